@@ -0,0 +1,166 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#include "include/alloc_stats.h"
+
+#ifdef ALLOC_STATS
+#include <stddef.h>
+#include <stdlib.h>
+
+#include <new>
+
+namespace {
+
+// Counters of one thread, plain data so they are usable in operator new
+// before and after the thread-local constructors and destructors
+struct ThreadAllocations {
+  uint64_t count;
+  uint64_t bytes;
+  int64_t  live;
+  int64_t  peak;
+};
+
+thread_local ThreadAllocations thread_allocations = { 0, 0, 0, 0 };
+
+// The size is kept before the block, keeping the alignment of malloc
+const size_t kHeader = 16;
+
+void *counted_alloc(size_t size)
+{
+  char *block = static_cast<char*> (malloc(size + kHeader));
+  if (block == NULL) return NULL;
+  *reinterpret_cast<size_t*> (block) = size;
+
+  ThreadAllocations &counters = thread_allocations;
+  ++counters.count;
+  counters.bytes += size;
+  counters.live += size;
+  if (counters.live > counters.peak) counters.peak = counters.live;
+
+  return block + kHeader;
+}
+
+void counted_free(void *p)
+{
+  if (p == NULL) return;
+
+  char *block = static_cast<char*> (p) - kHeader;
+  thread_allocations.live -= *reinterpret_cast<size_t*> (block);
+  free(block);
+}
+
+void *counted_new(size_t size)
+{
+  for (;;) {
+    void *p = counted_alloc(size);
+    if (p != NULL) return p;
+
+    std::new_handler handler = std::get_new_handler();
+    if (handler == NULL) throw std::bad_alloc();
+    handler();
+  }
+}
+
+}  // namespace
+
+void *operator new(size_t size)
+{
+  return counted_new(size);
+}
+
+void *operator new[](size_t size)
+{
+  return counted_new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t&) noexcept
+{
+  return counted_alloc(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+  return counted_alloc(size);
+}
+
+void operator delete(void *p) noexcept
+{
+  counted_free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+  counted_free(p);
+}
+
+void operator delete(void *p, const std::nothrow_t&) noexcept
+{
+  counted_free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t&) noexcept
+{
+  counted_free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+  counted_free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+  counted_free(p);
+}
+
+bool allocation_tracking()
+{
+  return true;
+}
+
+// -- AllocationScope
+void AllocationScope::start()
+{
+  ThreadAllocations &counters = thread_allocations;
+  start_count_ = counters.count;
+  start_bytes_ = counters.bytes;
+  start_live_ = counters.live;
+  outer_peak_ = counters.peak;
+  counters.peak = counters.live;
+}
+
+void AllocationScope::end()
+{
+  ThreadAllocations &counters = thread_allocations;
+  if (outer_peak_ > counters.peak) counters.peak = outer_peak_;
+}
+
+AllocationStats AllocationScope::stats() const
+{
+  const ThreadAllocations &counters = thread_allocations;
+  AllocationStats stats;
+  stats.count = counters.count - start_count_;
+  stats.bytes = counters.bytes - start_bytes_;
+  stats.peak = (counters.peak > start_live_) ? counters.peak - start_live_
+                                             : 0;
+  return stats;
+}
+#else
+bool allocation_tracking()
+{
+  return false;
+}
+#endif  // ALLOC_STATS
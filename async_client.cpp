@@ -0,0 +1,568 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#include "include/async_client.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "include/protocol.h"
+
+namespace {
+
+#ifdef _WIN32
+typedef SOCKET SocketHandle;
+const SocketHandle kNoSocket = INVALID_SOCKET;
+const int kSendFlags = 0;
+const int kShutdownBoth = SD_BOTH;
+
+void close_socket(SocketHandle sock) { closesocket(sock); }
+
+int poll_socket(SocketHandle sock, short events, int timeout)
+{
+  WSAPOLLFD fd;
+  fd.fd = sock;
+  fd.events = events;
+  fd.revents = 0;
+  return WSAPoll(&fd, 1, timeout);
+}
+
+void set_blocking(SocketHandle sock, bool blocking)
+{
+  u_long mode = blocking ? 0 : 1;
+  ioctlsocket(sock, FIONBIO, &mode);
+}
+
+bool connect_pending() { return WSAGetLastError() == WSAEWOULDBLOCK; }
+bool interrupted() { return false; }
+
+void set_send_timeout(SocketHandle sock, int milliseconds)
+{
+  DWORD timeout = milliseconds;
+  setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO,
+             reinterpret_cast<const char*> (&timeout), sizeof(timeout));
+}
+#else
+typedef int SocketHandle;
+const SocketHandle kNoSocket = -1;
+const int kSendFlags = MSG_NOSIGNAL;
+const int kShutdownBoth = SHUT_RDWR;
+
+void close_socket(SocketHandle sock) { close(sock); }
+
+int poll_socket(SocketHandle sock, short events, int timeout)
+{
+  struct pollfd fd;
+  fd.fd = sock;
+  fd.events = events;
+  fd.revents = 0;
+  return poll(&fd, 1, timeout);
+}
+
+void set_blocking(SocketHandle sock, bool blocking)
+{
+  int flags = fcntl(sock, F_GETFL, 0);
+  fcntl(sock, F_SETFL, blocking ? (flags & ~O_NONBLOCK)
+                                : (flags | O_NONBLOCK));
+}
+
+bool connect_pending() { return errno == EINPROGRESS; }
+bool interrupted() { return errno == EINTR; }
+
+void set_send_timeout(SocketHandle sock, int milliseconds)
+{
+  struct timeval timeout;
+  timeout.tv_sec = milliseconds / 1000;
+  timeout.tv_usec = (milliseconds % 1000) * 1000;
+  setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+#endif
+
+// Longest wait of the receiver, so it notices the client stopping
+const int kReceivePollInterval = 100;
+
+// Connect to one address within timeout (socket or kNoSocket)
+SocketHandle connect_address(const addrinfo *address, int timeout)
+{
+  SocketHandle sock = socket(address->ai_family, address->ai_socktype,
+                             address->ai_protocol);
+  if (sock == kNoSocket) return kNoSocket;
+
+  set_blocking(sock, false);
+  bool connected = (connect(sock, address->ai_addr,
+                            static_cast<int>(address->ai_addrlen)) == 0);
+
+  if (!connected && connect_pending() &&
+      (poll_socket(sock, POLLOUT, timeout) > 0)) {
+    int error = 0;
+    socklen_t size = sizeof(error);
+    getsockopt(sock, SOL_SOCKET, SO_ERROR,
+               reinterpret_cast<char*> (&error), &size);
+    connected = (error == 0);
+  }
+
+  if (!connected) {
+    close_socket(sock);
+    return kNoSocket;
+  }
+
+  set_blocking(sock, true);
+  return sock;
+}
+
+// Send all bytes of data (partial sends are continued)
+bool send_data(SocketHandle sock, const std::string &data)
+{
+  size_t sent = 0;
+  while (sent < data.size()) {
+    int bytes = send(sock, data.data() + sent,
+                     static_cast<int>(data.size() - sent), kSendFlags);
+    if ((bytes < 0) && interrupted()) continue;
+    if (bytes <= 0) return false;
+    sent += bytes;
+  }
+  return true;
+}
+
+int milliseconds_until(std::chrono::steady_clock::time_point deadline)
+{
+  return static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+      deadline - std::chrono::steady_clock::now()).count());
+}
+
+}  // namespace
+
+//
+// Class for one connection of the pool
+// The sending thread takes requests from the client queue while the
+// pipeline has room, the receiving thread (one per opened socket) completes
+// them in the order of verdicts. A request without verdict in time breaks
+// the connection, as later verdicts can't be matched past it.
+//
+class AsyncClient::Connection {
+ public:
+  Connection(AsyncClient *client, const ServerAddress &server)
+      : client_(client),
+        server_(server),
+        sock_(kNoSocket),
+        started_(false),
+        sent_(0),
+        broken_(false) {}
+
+  ~Connection()
+  {
+    if (thread_.joinable()) thread_.join();
+  }
+
+  void start() { thread_ = std::thread(&Connection::run, this); }
+
+ private:
+  // Sending thread
+  void run();
+  // Receiving thread of the opened socket
+  void receive();
+
+  bool open();
+  // Connect sock_ to the host and port of the server
+  bool connect_tcp(int timeout);
+  // Documents per connection were sent
+  bool used_up() const
+  {
+    size_t limit = client_->options_.documents_per_connection;
+    return (limit > 0) && (sent_ >= limit);
+  }
+  // Close the socket after the receiving thread (in flight are completed)
+  void close();
+
+  AsyncClient             *client_;
+  ServerAddress           server_;
+  SocketHandle            sock_;
+  bool                    started_;  // protocol magic was sent
+  size_t                  sent_;     // documents sent over the socket
+  std::thread             thread_;
+  std::thread             receiver_;
+
+  std::mutex              lock_;
+  std::condition_variable changed_;
+  std::deque<RequestPtr>  in_flight_;
+  bool                    broken_;   // the receiving thread has finished
+};
+
+void AsyncClient::Connection::run()
+{
+  const AsyncClientOptions &options = client_->options_;
+
+  for ( ; ; ) {
+    // Room in the pipeline, a used up connection is closed after
+    // the verdicts of its documents
+    bool reopen;
+    {
+      std::unique_lock<std::mutex> guard(lock_);
+      changed_.wait(guard, [this, &options]() {
+        if (broken_) return true;
+        return used_up() ? in_flight_.empty()
+                         : (in_flight_.size() < options.depth);
+      });
+      reopen = broken_ || used_up();
+    }
+    if (reopen) close();
+
+    RequestPtr request = client_->next_request();
+    if (!request) break;
+
+    if ((sock_ == kNoSocket) && !open()) {
+      client_->requeue(std::move(request));
+      if (!client_->pause(options.retry_interval)) break;
+      continue;
+    }
+
+    std::string out;
+    if (!started_) out.assign(kProtocolMagic, sizeof(kProtocolMagic));
+    started_ = true;
+    out += encode_message(mtDocument, request->document);
+
+    // In flight before sending, the verdict may come at once
+    {
+      std::lock_guard<std::mutex> guard(lock_);
+      if (broken_) {
+        client_->requeue(std::move(request));
+        continue;
+      }
+      in_flight_.push_back(std::move(request));
+    }
+    ++sent_;
+
+    // The receiving thread sees the broken connection and completes
+    // the requests in flight
+    if (!send_data(sock_, out)) shutdown(sock_, kShutdownBoth);
+  }
+
+  close();
+}
+
+void AsyncClient::Connection::receive()
+{
+  MessageReader reader;
+  Message message;
+  char buff[16384];
+
+  kAsyncStatus status = asConnectionLost;
+  std::string error = "Connection closed";
+
+  for ( ; ; ) {
+    if (client_->stopping_) {
+      status = asStopped;
+      error = "Client stopped";
+      break;
+    }
+
+    int timeout = kReceivePollInterval;
+    {
+      std::lock_guard<std::mutex> guard(lock_);
+      if (!in_flight_.empty()) {
+        timeout = std::min(timeout,
+                           milliseconds_until(in_flight_.front()->deadline));
+      }
+    }
+    if (timeout <= 0) {
+      status = asTimeout;
+      error = "No verdict in time";
+      break;
+    }
+
+    int ready = poll_socket(sock_, POLLIN, timeout);
+    if ((ready < 0) && interrupted()) continue;
+    if (ready < 0) break;
+    if (ready == 0) continue;
+
+    int bytes = recv(sock_, buff, sizeof(buff), 0);
+    if ((bytes < 0) && interrupted()) continue;
+    if (bytes <= 0) break;
+    reader.feed(buff, bytes);
+
+    bool unexpected = false;
+    while (reader.next(&message)) {
+      RequestPtr request;
+      {
+        std::lock_guard<std::mutex> guard(lock_);
+        if (!in_flight_.empty()) {
+          request = std::move(in_flight_.front());
+          in_flight_.pop_front();
+        }
+      }
+      if (!request) {
+        unexpected = true;
+        break;
+      }
+      changed_.notify_one();
+
+      AsyncResult result;
+      if ((message.type == mtVerdict) &&
+          decode_verdict(message.payload, &result.verdict)) {
+        complete(request.get(), &result);
+      } else {
+        fail(request.get(), asServerError,
+             (message.type == mtError) ? message.payload
+                                       : "Unexpected message");
+      }
+    }
+
+    if (unexpected || reader.error()) {
+      error = "Unexpected message";
+      break;
+    }
+  }
+
+  // The pipeline is lost with the connection
+  std::deque<RequestPtr> lost;
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    lost.swap(in_flight_);
+    broken_ = true;
+  }
+  changed_.notify_all();
+
+  for (size_t i = 0; i < lost.size(); ++i) {
+    if ((i == 0) || (status == asStopped)) {
+      fail(lost[i].get(), status, error);
+    } else {
+      fail(lost[i].get(), asConnectionLost, "Connection closed");
+    }
+  }
+}
+
+bool AsyncClient::Connection::open()
+{
+  const AsyncClientOptions &options = client_->options_;
+
+  std::string path;
+  if (unix_socket_path(server_.host, &path)) {
+#ifdef _WIN32
+    return false;
+#else
+    // Server of this host, without TCP
+    sockaddr_un local;
+    memset(&local, 0, sizeof(local));
+    local.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(local.sun_path)) return false;
+    memcpy(local.sun_path, path.c_str(), path.size() + 1);
+
+    addrinfo address;
+    memset(&address, 0, sizeof(address));
+    address.ai_family = AF_UNIX;
+    address.ai_socktype = SOCK_STREAM;
+    address.ai_addr = reinterpret_cast<sockaddr*> (&local);
+    address.ai_addrlen = sizeof(local);
+
+    sock_ = connect_address(&address, options.connect_timeout);
+    if (sock_ == kNoSocket) return false;
+#endif
+  } else if (!connect_tcp(options.connect_timeout)) {
+    return false;
+  }
+
+  // A stuck server can't hold the sending thread past the request timeout
+  set_send_timeout(sock_, options.request_timeout);
+
+  started_ = false;
+  sent_ = 0;
+  broken_ = false;
+  receiver_ = std::thread(&Connection::receive, this);
+  return true;
+}
+
+bool AsyncClient::Connection::connect_tcp(int timeout)
+{
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  char port[16];
+  snprintf(port, sizeof(port), "%d", server_.port);
+
+  addrinfo *addresses = NULL;
+  if (getaddrinfo(server_.host.c_str(), port, &hints, &addresses) != 0) {
+    return false;
+  }
+
+  for (addrinfo *address = addresses; address != NULL;
+       address = address->ai_next) {
+    sock_ = connect_address(address, timeout);
+    if (sock_ != kNoSocket) break;
+  }
+  freeaddrinfo(addresses);
+
+  if (sock_ == kNoSocket) return false;
+
+  // Documents of the pipeline go out at once
+  int nodelay = 1;
+  setsockopt(sock_, IPPROTO_TCP, TCP_NODELAY,
+             reinterpret_cast<const char*> (&nodelay), sizeof(nodelay));
+  return true;
+}
+
+void AsyncClient::Connection::close()
+{
+  if (sock_ == kNoSocket) return;
+
+  shutdown(sock_, kShutdownBoth);
+  receiver_.join();
+  close_socket(sock_);
+  sock_ = kNoSocket;
+
+  std::lock_guard<std::mutex> guard(lock_);
+  broken_ = false;
+}
+
+// -- AsyncClient
+AsyncClient::AsyncClient(const std::vector<ServerAddress> &servers,
+                         const AsyncClientOptions &options)
+    : options_(options),
+      stopping_(false)
+{
+#ifdef _WIN32
+  WSADATA data;
+  WSAStartup(0x202, &data);
+#endif
+
+  if (options_.connections == 0) options_.connections = 1;
+  if (options_.depth == 0) options_.depth = 1;
+
+  for (size_t i = 0; i < servers.size(); ++i) {
+    for (size_t j = 0; j < options_.connections; ++j) {
+      connections_.push_back(std::unique_ptr<Connection>(
+          new Connection(this, servers[i])));
+    }
+  }
+  for (size_t i = 0; i < connections_.size(); ++i) connections_[i]->start();
+}
+
+AsyncClient::~AsyncClient()
+{
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    stopping_ = true;
+  }
+  changed_.notify_all();
+
+  // Joins the threads, the requests in flight are completed
+  connections_.clear();
+
+  for (size_t i = 0; i < queue_.size(); ++i) {
+    fail(queue_[i].get(), asStopped, "Client stopped");
+  }
+
+#ifdef _WIN32
+  WSACleanup();
+#endif
+}
+
+std::future<AsyncResult> AsyncClient::validate_async(std::string document)
+{
+  RequestPtr request(new Request());
+  request->document.swap(document);
+  request->submitted = Clock::now();
+  request->deadline = request->submitted +
+                      std::chrono::milliseconds(options_.request_timeout);
+
+  std::future<AsyncResult> future = request->promise.get_future();
+
+  // Without servers nothing would take it
+  if (connections_.empty()) {
+    fail(request.get(), asConnectionLost, "No servers");
+    return future;
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    queue_.push_back(std::move(request));
+  }
+  changed_.notify_one();
+
+  return future;
+}
+
+void AsyncClient::complete(Request *request, AsyncResult *result)
+{
+  result->latency = std::chrono::duration<double, std::milli>(
+      Clock::now() - request->submitted).count();
+  request->promise.set_value(*result);
+}
+
+void AsyncClient::fail(Request *request, kAsyncStatus status,
+                       const std::string &error)
+{
+  AsyncResult result;
+  result.status = status;
+  result.error = error;
+  complete(request, &result);
+}
+
+AsyncClient::RequestPtr AsyncClient::next_request()
+{
+  std::unique_lock<std::mutex> guard(lock_);
+
+  for ( ; ; ) {
+    changed_.wait(guard, [this]() { return stopping_ || !queue_.empty(); });
+    if (stopping_) return RequestPtr();
+
+    RequestPtr request = std::move(queue_.front());
+    queue_.pop_front();
+    if (Clock::now() < request->deadline) return request;
+
+    guard.unlock();
+    fail(request.get(), asTimeout, "Not sent in time");
+    guard.lock();
+  }
+}
+
+void AsyncClient::requeue(RequestPtr request)
+{
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    queue_.push_front(std::move(request));
+  }
+  changed_.notify_one();
+}
+
+bool AsyncClient::pause(int milliseconds)
+{
+  std::unique_lock<std::mutex> guard(lock_);
+  return !changed_.wait_for(guard, std::chrono::milliseconds(milliseconds),
+                            [this]() { return stopping_.load(); });
+}
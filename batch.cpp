@@ -0,0 +1,319 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#include "include/batch.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// Result of one file of batch
+struct FileResult {
+  bool done;             // verdict received
+  ValidationResult result;
+  std::string error;     // why there is no verdict
+  double latency;        // ms from sending to the verdict
+  size_t size;           // bytes of the file
+};
+
+// File sent and waiting for verdict
+struct InFlight {
+  size_t index;
+  Clock::time_point start;
+};
+
+double milliseconds(Clock::duration duration)
+{
+  return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+// Worker: own connection, files taken from the shared counter
+void batch_worker(const std::vector<std::string> *files,
+                  std::atomic<size_t> *next, size_t depth,
+                  BatchConnect connect, std::vector<FileResult> *results)
+{
+  std::unique_ptr<IBatchConnection> connection(connect());
+  std::deque<InFlight> pending;
+
+  for ( ; ; ) {
+    // Keep the pipeline full
+    while (pending.size() < depth) {
+      size_t index = (*next)++;
+      if (index >= files->size()) break;
+
+      FileResult &file_result = (*results)[index];
+      std::ifstream file((*files)[index].c_str(),
+                         std::ios::in | std::ios::binary);
+      if (!file) {
+        file_result.error = "File not found";
+        continue;
+      }
+
+      std::stringstream text;
+      text << file.rdbuf();
+      file_result.size = text.str().size();
+
+      if (!connection) connection.reset(connect());
+
+      InFlight in_flight;
+      in_flight.index = index;
+      in_flight.start = Clock::now();
+
+      if (!connection || !connection->send_document(text.str())) {
+        file_result.error = "Connection failed";
+        connection.reset();
+        continue;
+      }
+      pending.push_back(in_flight);
+    }
+
+    if (pending.empty()) break;
+
+    InFlight in_flight = pending.front();
+    pending.pop_front();
+    FileResult &file_result = (*results)[in_flight.index];
+
+    if (!connection->receive_verdict(&file_result.result)) {
+      // The files in flight are lost with the connection
+      file_result.error = "Connection failed";
+      for (size_t i = 0; i < pending.size(); ++i) {
+        (*results)[pending[i].index].error = "Connection failed";
+      }
+      pending.clear();
+      connection.reset();
+      continue;
+    }
+
+    file_result.done = true;
+    file_result.latency = milliseconds(Clock::now() - in_flight.start);
+  }
+}
+
+// Files have the .xml extension (any case)
+bool is_xml_file(const std::string &path)
+{
+  if (path.size() < 4) return false;
+
+  std::string extension = path.substr(path.size() - 4);
+  for (size_t i = 0; i < extension.size(); ++i) {
+    extension[i] = tolower(static_cast<unsigned char>(extension[i]));
+  }
+  return extension == ".xml";
+}
+
+bool is_directory(const char *path)
+{
+#ifdef _WIN32
+  DWORD attributes = GetFileAttributesA(path);
+  return (attributes != INVALID_FILE_ATTRIBUTES) &&
+         (attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+  struct stat info;
+  return (stat(path, &info) == 0) && S_ISDIR(info.st_mode);
+#endif
+}
+
+// Add XML files of directory and its subdirectories to files
+bool list_directory(const std::string &path, std::vector<std::string> *files)
+{
+  std::vector<std::string> names;
+  std::vector<std::string> directories;
+
+#ifdef _WIN32
+  const char kSeparator = '\\';
+
+  WIN32_FIND_DATAA data;
+  HANDLE find = FindFirstFileA((path + "\\*").c_str(), &data);
+  if (find == INVALID_HANDLE_VALUE) return false;
+
+  do {
+    std::string name = data.cFileName;
+    if ((name == ".") || (name == "..")) continue;
+
+    if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+      directories.push_back(name);
+    } else if (is_xml_file(name)) {
+      names.push_back(name);
+    }
+  } while (FindNextFileA(find, &data));
+  FindClose(find);
+#else
+  const char kSeparator = '/';
+
+  DIR *dir = opendir(path.c_str());
+  if (dir == NULL) return false;
+
+  while (struct dirent *entry = readdir(dir)) {
+    std::string name = entry->d_name;
+    if ((name == ".") || (name == "..")) continue;
+
+    struct stat info;
+    if (stat((path + kSeparator + name).c_str(), &info) != 0) continue;
+
+    if (S_ISDIR(info.st_mode)) {
+      directories.push_back(name);
+    } else if (S_ISREG(info.st_mode) && is_xml_file(name)) {
+      names.push_back(name);
+    }
+  }
+  closedir(dir);
+#endif
+
+  // Same order on every run
+  std::sort(names.begin(), names.end());
+  std::sort(directories.begin(), directories.end());
+
+  for (size_t i = 0; i < names.size(); ++i) {
+    files->push_back(path + kSeparator + names[i]);
+  }
+  for (size_t i = 0; i < directories.size(); ++i) {
+    list_directory(path + kSeparator + directories[i], files);
+  }
+
+  return true;
+}
+
+// Add paths of list, one per line (empty lines and '#' comments skipped)
+void read_file_list(std::istream *list, std::vector<std::string> *files)
+{
+  std::string line;
+  while (std::getline(*list, line)) {
+    // Trailing CR of lists written on Windows
+    while (!line.empty() && isspace(static_cast<unsigned char>(
+                                *line.rbegin()))) {
+      line.erase(line.size() - 1);
+    }
+    if (line.empty() || (line[0] == '#')) continue;
+    files->push_back(line);
+  }
+}
+
+}  // namespace
+
+bool is_file_set(const char *path)
+{
+  return (path[0] == '@') || is_directory(path);
+}
+
+bool list_files(const char *path, std::vector<std::string> *files)
+{
+  if (path[0] != '@') return list_directory(path, files);
+
+  if (strcmp(path, "@-") == 0) {
+    read_file_list(&std::cin, files);
+    return true;
+  }
+
+  std::ifstream list(path + 1, std::ios::in);
+  if (!list) return false;
+
+  read_file_list(&list, files);
+  return true;
+}
+
+int run_batch(const std::vector<std::string> &files, size_t jobs,
+              size_t depth, BatchConnect connect)
+{
+  if (jobs == 0) jobs = 1;
+  if (depth == 0) depth = 1;
+  if (jobs > files.size()) jobs = (files.empty() ? 1 : files.size());
+
+  FileResult empty;
+  empty.done = false;
+  empty.latency = 0;
+  empty.size = 0;
+  std::vector<FileResult> results(files.size(), empty);
+  std::atomic<size_t> next(0);
+
+  Clock::time_point start = Clock::now();
+
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < jobs; ++i) {
+    workers.push_back(std::thread(batch_worker, &files, &next, depth,
+                                  connect, &results));
+  }
+  for (size_t i = 0; i < workers.size(); ++i) workers[i].join();
+
+  double elapsed = milliseconds(Clock::now() - start);
+
+  // Verdicts in the order of files
+  size_t valid = 0;
+  size_t invalid = 0;
+  size_t failed = 0;
+  size_t bytes = 0;
+  std::vector<double> latencies;
+
+  for (size_t i = 0; i < files.size(); ++i) {
+    const FileResult &file_result = results[i];
+    std::cout << files[i] << ": ";
+
+    if (!file_result.done) {
+      std::cout << "Error " << file_result.error << "\n";
+      ++failed;
+      continue;
+    }
+
+    std::cout << file_result.result.to_string() << " ("
+              << file_result.latency << " ms)\n";
+    latencies.push_back(file_result.latency);
+    bytes += file_result.size;
+    if (file_result.result.valid) {
+      ++valid;
+    } else {
+      ++invalid;
+    }
+  }
+
+  std::cout << "\nFiles: " << files.size() << " (valid " << valid
+            << ", invalid " << invalid << ", failed " << failed << ")\n";
+  double seconds = elapsed / 1000;
+  std::cout << "Time: " << seconds << " s, "
+            << ((seconds > 0) ? files.size() / seconds : 0) << " files/s, "
+            << ((seconds > 0) ? bytes / seconds / (1024 * 1024) : 0)
+            << " MB/s (" << jobs << " jobs)\n";
+
+  if (!latencies.empty()) {
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << "Latency: p50 " << latencies[latencies.size() / 2]
+              << " ms, p99 " << latencies[latencies.size() * 99 / 100]
+              << " ms, max " << latencies.back() << " ms\n";
+  }
+
+  return static_cast<int>(invalid + failed);
+}
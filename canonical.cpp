@@ -0,0 +1,354 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#include "include/canonical.h"
+
+#include <ctype.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Keeps canonical digests apart from the digests of raw bytes
+const uint64_t kCanonicalSeed = 0x63616e6f6e696361ULL;
+
+// Record marks of the canonical stream
+const char kStartMark = '<';
+const char kHeaderMark = '?';
+const char kEndMark = '>';
+const char kEmptyMark = '/';
+const char kNameMark = '=';
+const char kValueMark = '"';
+const char kTextMark = 't';
+
+// The parser reads the byte 0xFF as the end of data
+const char kParserEof = static_cast<char>(-1);
+
+// Classes of bytes
+const unsigned char kSpace = 1;  // whitespace collapsed in text (a subset
+                                 // of what the parser trims)
+const unsigned char kName = 2;   // byte of a tag or attribute name taken
+                                 // by the parser as it is
+
+//
+// Class of each byte value, built once
+//
+class ByteClasses {
+ public:
+  ByteClasses()
+  {
+    for (int c = 0; c < 256; ++c) {
+      char ch = static_cast<char>(c);
+      classes_[c] = 0;
+      if ((ch == ' ') || (ch == '\t') || (ch == '\r') || (ch == '\n')) {
+        classes_[c] |= kSpace;
+      }
+      if (!isspace(c) && (strchr("<>/?!=\"#", ch) == NULL) && (c != 0) &&
+          (ch != kParserEof)) {
+        classes_[c] |= kName;
+      }
+    }
+  }
+
+  bool is(char c, unsigned char mask) const
+  {
+    return (classes_[static_cast<unsigned char>(c)] & mask) != 0;
+  }
+
+ private:
+  unsigned char classes_[256];
+};
+
+const ByteClasses kClasses;
+
+inline bool is_space(char c) { return kClasses.is(c, kSpace); }
+inline bool is_name_char(char c) { return kClasses.is(c, kName); }
+
+struct Attribute {
+  StringView name;
+  StringView value;
+};
+
+// Orders attributes by name
+inline bool by_name(const Attribute &a, const Attribute &b)
+{
+  int order = memcmp(a.name.data(), b.name.data(),
+                     std::min(a.name.size(), b.name.size()));
+  return (order != 0) ? (order < 0) : (a.name.size() < b.name.size());
+}
+
+//
+// Class for one scan of a document into the canonical stream
+//
+class CanonicalScanner {
+ public:
+  explicit CanonicalScanner(StringView document)
+      : data_(document.data()),
+        size_(document.size()),
+        pos_(0),
+        hash_(kCanonicalSeed) {}
+
+  // false - markup the canonical form leaves out
+  bool scan(Digest128 *digest);
+
+ private:
+  // Text up to the next '<'
+  bool text();
+  // Start tag or header (<?name ...?>) after '<'
+  bool start_tag(bool header);
+  // End tag after "</"
+  bool end_tag();
+  // Comment after "<!--", the same end as the parser finds
+  bool comment();
+
+  bool at(char c) const { return (pos_ < size_) && (data_[pos_] == c); }
+  // Position of c from pos_ on or the end of data
+  size_t find(char c) const
+  {
+    const char *found = static_cast<const char*> (
+        memchr(data_ + pos_, c, size_ - pos_));
+    return (found == NULL) ? size_ : found - data_;
+  }
+  // The parser stops at 0xFF, what follows isn't modeled
+  bool has_eof(size_t end) const
+  {
+    return memchr(data_ + pos_, kParserEof, end - pos_) != NULL;
+  }
+  // Record of the canonical stream (hashed in batches of kBatch bytes)
+  void put(char mark, StringView field);
+  void flush();
+
+  static const size_t kBatch = 4096;
+
+  const char             *data_;
+  size_t                 size_;
+  size_t                 pos_;
+  Hash128                hash_;
+  std::string            stream_;      // records not hashed yet
+  std::string            buffer_;      // normalized text or end tag name
+  std::vector<Attribute> attributes_;  // of the current tag
+};
+
+void CanonicalScanner::put(char mark, StringView field)
+{
+  uint32_t size = static_cast<uint32_t>(field.size());
+  stream_ += mark;
+  stream_.append(reinterpret_cast<const char*> (&size), sizeof(size));
+  stream_.append(field.data(), field.size());
+  if (stream_.size() >= kBatch) flush();
+}
+
+void CanonicalScanner::flush()
+{
+  hash_.update(stream_.data(), stream_.size());
+  stream_.clear();
+}
+
+bool CanonicalScanner::scan(Digest128 *digest)
+{
+  while (pos_ < size_) {
+    if (data_[pos_] != '<') {
+      if (!text()) return false;
+      continue;
+    }
+
+    ++pos_;
+    bool done;
+    if (at('/')) {
+      ++pos_;
+      done = end_tag();
+    } else if (at('?')) {
+      ++pos_;
+      done = start_tag(true);
+    } else if (at('!')) {
+      // Only comments, DOCTYPE and CDATA aren't modeled
+      done = (size_ - pos_ >= 3) &&
+             (memcmp(data_ + pos_, "!--", 3) == 0);
+      if (done) {
+        pos_ += 3;
+        done = comment();
+      }
+    } else {
+      done = start_tag(false);
+    }
+    if (!done) return false;
+  }
+
+  flush();
+  *digest = hash_.digest();
+  return true;
+}
+
+bool CanonicalScanner::text()
+{
+  size_t end = find('<');
+  if (has_eof(end)) return false;
+
+  // Words joined by one space
+  buffer_.clear();
+  while (pos_ < end) {
+    while ((pos_ < end) && is_space(data_[pos_])) ++pos_;
+    size_t start = pos_;
+    while ((pos_ < end) && !is_space(data_[pos_])) ++pos_;
+    if (start == pos_) break;
+
+    if (!buffer_.empty()) buffer_ += ' ';
+    buffer_.append(data_ + start, pos_ - start);
+  }
+
+  // Whitespace-only text gives no content to the parser either
+  if (!buffer_.empty()) put(kTextMark, buffer_);
+  return true;
+}
+
+bool CanonicalScanner::start_tag(bool header)
+{
+  size_t start = pos_;
+  while ((pos_ < size_) && is_name_char(data_[pos_])) ++pos_;
+  if (pos_ == start) return false;
+  StringView name(data_ + start, pos_ - start);
+
+  // The parser ends a header name only at whitespace
+  if (header && !((pos_ < size_) && is_space(data_[pos_]))) {
+    return false;
+  }
+
+  attributes_.clear();
+  bool empty = false;
+  for (;;) {
+    bool space = false;
+    while ((pos_ < size_) && is_space(data_[pos_])) {
+      ++pos_;
+      space = true;
+    }
+    if (pos_ >= size_) return false;
+
+    char c = data_[pos_];
+    if (header) {
+      if ((c == '?') && (pos_ + 1 < size_) &&
+          (data_[pos_ + 1] == '>')) {
+        pos_ += 2;
+        break;
+      }
+    } else if (c == '>') {
+      ++pos_;
+      break;
+    } else if ((c == '/') && (pos_ + 1 < size_) &&
+               (data_[pos_ + 1] == '>')) {
+      pos_ += 2;
+      empty = true;
+      break;
+    }
+
+    // The first attribute is separated from the tag name
+    if (attributes_.empty() && !space) return false;
+
+    // name="value", nothing between them
+    Attribute attribute;
+    start = pos_;
+    while ((pos_ < size_) && is_name_char(data_[pos_])) ++pos_;
+    if ((pos_ == start) || (size_ - pos_ < 2) ||
+        (data_[pos_] != '=') || (data_[pos_ + 1] != '"')) {
+      return false;
+    }
+    attribute.name = StringView(data_ + start, pos_ - start);
+
+    pos_ += 2;
+    size_t end = find('"');
+    if ((end == size_) || has_eof(end)) return false;
+    attribute.value = StringView(data_ + pos_, end - pos_);
+    pos_ = end + 1;
+
+    attributes_.push_back(attribute);
+  }
+
+  // Insertion sort: tags have few attributes, stable_sort would allocate.
+  // Duplicated names keep their order, the first one wins on lookup.
+  for (size_t i = 1; i < attributes_.size(); ++i) {
+    Attribute attribute = attributes_[i];
+    size_t j = i;
+    for ( ; (j > 0) && by_name(attribute, attributes_[j - 1]); --j) {
+      attributes_[j] = attributes_[j - 1];
+    }
+    attributes_[j] = attribute;
+  }
+
+  put(header ? kHeaderMark : kStartMark, name);
+  uint32_t count = static_cast<uint32_t>(attributes_.size());
+  stream_.append(reinterpret_cast<const char*> (&count), sizeof(count));
+  for (size_t i = 0; i < attributes_.size(); ++i) {
+    put(kNameMark, attributes_[i].name);
+    put(kValueMark, attributes_[i].value);
+  }
+  if (empty) put(kEmptyMark, StringView());
+  return true;
+}
+
+bool CanonicalScanner::end_tag()
+{
+  size_t end = find('>');
+  if ((end == size_) || has_eof(end)) return false;
+
+  // The parser drops all whitespace of end tags
+  StringView name(data_ + pos_, end - pos_);
+  for (size_t i = 0; i < name.size(); ++i) {
+    if (isspace(static_cast<unsigned char>(name[i]))) {
+      buffer_.clear();
+      for ( ; pos_ < end; ++pos_) {
+        if (!isspace(static_cast<unsigned char>(data_[pos_]))) {
+          buffer_ += data_[pos_];
+        }
+      }
+      name = buffer_;
+      break;
+    }
+  }
+
+  pos_ = end + 1;
+  put(kEndMark, name);
+  return true;
+}
+
+bool CanonicalScanner::comment()
+{
+  // '-' then "->" ends it, as in the parser engines
+  bool dash = false;
+  for ( ; pos_ < size_; ++pos_) {
+    char c = data_[pos_];
+    if (c == kParserEof) return false;
+    if ((c == '-') && (pos_ + 1 < size_) && (data_[pos_ + 1] == '>')) {
+      if (dash) {
+        pos_ += 2;
+        return true;
+      }
+    } else if (c == '-') {
+      dash = true;
+    }
+  }
+
+  return false;
+}
+
+}  // namespace
+
+bool canonical_digest(StringView document, Digest128 *digest)
+{
+  CanonicalScanner scanner(document);
+  return scanner.scan(digest);
+}
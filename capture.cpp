@@ -0,0 +1,143 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#include "include/capture.h"
+
+#include <string.h>
+
+#include <string>
+
+#include "include/protocol.h"
+
+namespace {
+
+const char kCaptureMagic[4] = { 'X', 'V', 'T', '1' };
+
+// Longest record accepted when reading
+const uint32_t kMaxRecord = 1024 * 1024 * 1024;
+
+}  // namespace
+
+// -- CaptureWriter
+bool CaptureWriter::open(const std::string &file_name, std::string *error)
+{
+  std::lock_guard<std::mutex> guard(lock_);
+
+  // An existing capture is continued if it is one
+  std::ifstream existing(file_name.c_str(), std::ios::in | std::ios::binary);
+  char magic[sizeof(kCaptureMagic)];
+  bool empty = !existing.read(magic, sizeof(magic));
+  if (!empty && (memcmp(magic, kCaptureMagic, sizeof(magic)) != 0)) {
+    *error = "Not a capture file: " + file_name;
+    return false;
+  }
+  existing.close();
+
+  out_.open(file_name.c_str(),
+            std::ios::out | std::ios::binary | std::ios::app);
+  if (!out_) {
+    *error = "Can't write capture file " + file_name;
+    return false;
+  }
+
+  if (empty) out_.write(kCaptureMagic, sizeof(kCaptureMagic));
+  out_.flush();
+  return true;
+}
+
+void CaptureWriter::write(const CaptureRecord &record)
+{
+  std::string body;
+  body.reserve(record.document.size() + record.id.size() + 21);
+  put_u32(&body, static_cast<uint32_t>(record.time >> 32));
+  put_u32(&body, static_cast<uint32_t>(record.time));
+  put_u32(&body, record.connection);
+  body += record.valid ? '\1' : '\0';
+  put_string(&body, record.id);
+  put_string(&body, record.document);
+
+  std::string length;
+  put_u32(&length, static_cast<uint32_t>(body.size()));
+
+  std::lock_guard<std::mutex> guard(lock_);
+  out_.write(length.data(), length.size());
+  out_.write(body.data(), body.size());
+  out_.flush();
+}
+
+// -- CaptureReader
+bool CaptureReader::open(const std::string &file_name, std::string *error)
+{
+  in_.open(file_name.c_str(),
+           std::ios::in | std::ios::binary | std::ios::ate);
+  if (!in_) {
+    *error = "Capture file not found: " + file_name;
+    return false;
+  }
+  end_ = in_.tellg();
+  in_.seekg(0);
+
+  char magic[sizeof(kCaptureMagic)];
+  if (!in_.read(magic, sizeof(magic)) ||
+      (memcmp(magic, kCaptureMagic, sizeof(magic)) != 0)) {
+    *error = "Not a capture file: " + file_name;
+    return false;
+  }
+  return true;
+}
+
+bool CaptureReader::next(CaptureRecord *record)
+{
+  if (in_.tellg() >= end_) return false;
+
+  std::string head(4, '\0');
+  if (!in_.read(&head[0], head.size())) {
+    // A part of the length is a cut record
+    bad_ = (in_.gcount() > 0);
+    return false;
+  }
+
+  size_t pos = 0;
+  uint32_t length;
+  get_u32(head, &pos, &length);
+  if (length > kMaxRecord) {
+    bad_ = true;
+    return false;
+  }
+
+  std::string body(length, '\0');
+  if ((length > 0) && !in_.read(&body[0], length)) {
+    bad_ = true;
+    return false;
+  }
+
+  uint32_t high, low;
+  pos = 0;
+  if (!get_u32(body, &pos, &high) || !get_u32(body, &pos, &low) ||
+      !get_u32(body, &pos, &record->connection) || (pos >= body.size())) {
+    bad_ = true;
+    return false;
+  }
+  record->time = (static_cast<uint64_t>(high) << 32) | low;
+  record->valid = (body[pos++] != 0);
+
+  if (!get_string(body, &pos, &record->id) ||
+      !get_string(body, &pos, &record->document)) {
+    bad_ = true;
+    return false;
+  }
+  return true;
+}
@@ -17,17 +17,206 @@
 #ifdef __unix__
 #include "include/app_unix.h"
 
-#define SLEEP_TIME 5
+// Send named document as delta to the version stored on the server
+// (the message protocol, see include/protocol.h)
+static int upload_delta(int my_sock, const std::string &text,
+                        const std::string &id)
+{
+    MessageReader reader;
+    Message message;
+
+    // Signatures of the stored version
+    std::string out(kProtocolMagic, sizeof(kProtocolMagic));
+    std::string payload;
+    put_string(&payload, id);
+    out += encode_message(mtSignaturesRequest, payload);
+    send_all(my_sock, &out);
+
+    Signatures signatures;
+    if (!recv_message(my_sock, &reader, &message) ||
+        (message.type != mtSignatures) ||
+        !decode_signatures(message.payload, &signatures)) {
+        std::cerr << "Error signatures not received!\n";
+        return -1;
+    }
+
+    Digest128 target = Hash128::of(text.data(), text.size());
+
+    // The second attempt sends the whole document
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        std::string delta = make_delta(signatures, text);
+        std::cout << "Sending " << delta.size() << " of " << text.size()
+                  << " bytes\n";
+
+        payload.clear();
+        put_string(&payload, id);
+        put_digest(&payload, signatures.base);
+        put_digest(&payload, target);
+        payload += delta;
+        out = encode_message(mtDelta, payload);
+        send_all(my_sock, &out);
+
+        if (!recv_message(my_sock, &reader, &message)) break;
+
+        ValidationResult result;
+        if ((message.type == mtVerdict) &&
+            decode_verdict(message.payload, &result)) {
+            std::cout << "Validation of file: " << result.to_string()
+                      << std::endl;
+            return 0;
+        }
+
+        std::cerr << "Error " << message.payload << "\n";
+        if (message.type != mtError) break;
+        signatures = Signatures();
+    }
+
+    return -1;
+}
 
-int client(int connect_port, const char* server_address, const char* file_name)
+// Send bytes of file (partial sends are continued)
+static bool send_file(int my_sock, int fd, size_t size)
 {
-    // Buffer for sending and receiving data
-    char packet_buff[PACKET_BUFF_SIZE];
+#ifdef __linux__
+    // From the page cache to the socket without copies
+    off_t offset = 0;
+    while (static_cast<size_t>(offset) < size) {
+        ssize_t sent = sendfile(my_sock, fd, &offset, size - offset);
+        if ((sent < 0) && (errno == EINTR)) continue;
+        if (sent <= 0) return false;
+    }
+    return true;
+#else
+    if (size == 0) return true;
 
-    // Buffer for WSA and other metadata
-    char buff[1024];
+    void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) return false;
 
-    std::cout << "TCP CLIENT STARTED\n";
+    size_t sent = 0;
+    while (sent < size) {
+        ssize_t bytes = send(my_sock, static_cast<char*> (data) + sent,
+                             size - sent, 0);
+        if ((bytes < 0) && (errno == EINTR)) continue;
+        if (bytes <= 0) break;
+        sent += bytes;
+    }
+
+    munmap(data, size);
+    return sent == size;
+#endif
+}
+
+// Send the whole file deflated as one document message (false and
+// nothing sent if deflating isn't worth it, *sent - the send succeeded)
+static bool send_deflated(int my_sock, int fd, size_t size, std::string *out,
+                          bool *sent)
+{
+    if (size < kDeflateMinSize) return false;
+
+    // Deflated straight from the page cache
+    void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) return false;
+
+    std::string deflated;
+    bool smaller = deflate_if_smaller(
+        StringView(static_cast<char*> (data), size), &deflated);
+    munmap(data, size);
+    if (!smaller) return false;
+
+    std::cout << "Sending " << deflated.size() << " of " << size
+              << " bytes deflated\n";
+    *out += encode_message(mtDeflatedDocument, deflated);
+    *sent = send_all(my_sock, out);
+    return true;
+}
+
+// Send the whole file as one document message
+// (id names the document for incremental validation, may be empty;
+//  started - the protocol magic was sent, deflate - the server takes
+//  deflated documents)
+static int upload_file(int my_sock, const char *file_name,
+                       const std::string &id, bool started, bool deflate)
+{
+    int fd = open(file_name, O_RDONLY);
+    struct stat info;
+    if ((fd < 0) || (fstat(fd, &info) != 0)) {
+        std::cerr << "Error file not found!\n";
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+
+    size_t size = info.st_size;
+    if (size > kMaxPayload) {
+        std::cerr << "Error file is too big!\n";
+        close(fd);
+        return -1;
+    }
+
+    std::string out;
+    if (!started) out.assign(kProtocolMagic, sizeof(kProtocolMagic));
+    if (!id.empty()) {
+        std::string payload;
+        put_string(&payload, id);
+        out += encode_message(mtName, payload);
+    }
+
+    bool sent = false;
+    if (!deflate || !send_deflated(my_sock, fd, size, &out, &sent)) {
+        // Header of the document message, the file follows it
+        out.push_back(mtDocument);
+        put_u32(&out, static_cast<uint32_t>(size));
+
+        sent = send_all(my_sock, &out) && send_file(my_sock, fd, size);
+    }
+    close(fd);
+    if (!sent) {
+        std::cerr << "Error sending file!\n";
+        return -1;
+    }
+
+    MessageReader reader;
+    Message message;
+    ValidationResult result;
+    if (!recv_message(my_sock, &reader, &message) ||
+        (message.type != mtVerdict) ||
+        !decode_verdict(message.payload, &result)) {
+        std::cerr << "Error verdict not received!\n";
+        return -1;
+    }
+
+    std::cout << "Validation of file: " << result.to_string() << std::endl;
+    return 0;
+}
+
+// Connect to the server (socket or -1)
+static int connect_server(int connect_port, const char *server_address)
+{
+    // "unix:<path>" - Unix domain socket of the server on this host
+    std::string local_path;
+    if (unix_socket_path(server_address, &local_path)) {
+        sockaddr_un local_addr;
+        memset(&local_addr, 0, sizeof(local_addr));
+        local_addr.sun_family = AF_UNIX;
+        if (local_path.size() >= sizeof(local_addr.sun_path)) {
+            std::cout << "Socket path is too long!\n";
+            return -1;
+        }
+        memcpy(local_addr.sun_path, local_path.c_str(), local_path.size() + 1);
+
+        int my_sock = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (my_sock < 0) {
+            std::cout << "Socket() error!\n";
+            return -1;
+        }
+        if (connect(my_sock,
+            reinterpret_cast<sockaddr*> (&local_addr),
+            sizeof(local_addr))) {
+          std::cout << "Connect error!\n";
+          close(my_sock);
+          return -1;
+        }
+        return my_sock;
+    }
 
     int my_sock = socket(AF_INET, SOCK_STREAM, 0);
     if (my_sock < 0) {
@@ -37,6 +226,7 @@ int client(int connect_port, const char* server_address, const char* file_name)
 
     // Creating connection
     sockaddr_in dest_addr;
+    memset(&dest_addr, 0, sizeof(dest_addr));
     dest_addr.sin_family = AF_INET;
     dest_addr.sin_port = htons(connect_port);
 
@@ -49,37 +239,217 @@ int client(int connect_port, const char* server_address, const char* file_name)
         reinterpret_cast<sockaddr*> (&dest_addr),
         sizeof(dest_addr))) {
       std::cout << "Connect error!\n";
+      close(my_sock);
       return -1;
     }
 
-    std::cout << "Connection with " << server_address << " accepted\n\n";
+    return my_sock;
+}
 
-    // Creating the filestream and opening a file
-    std::ifstream file(file_name, std::ios::in);
-    if (!file) {
-        std::cerr << "Error file not found!\n";
+// Offer deflated uploads to the server, starting the connection with the
+// hello; true if it takes them. An old server answers the hello with an
+// error and closes the connection, *my_sock is then connected again (not
+// started, -1 on failure).
+static bool offer_compression(int *my_sock, int connect_port,
+                              const char *server_address, bool *started)
+{
+    std::string out(kProtocolMagic, sizeof(kProtocolMagic));
+    out += encode_message(mtHello, kDeflateEncoding);
+
+    MessageReader reader;
+    Message message;
+    if (send_all(*my_sock, &out) &&
+        recv_message(*my_sock, &reader, &message) &&
+        (message.type == mtEncodings)) {
+        *started = true;
+        return has_encoding(message.payload, kDeflateEncoding);
+    }
+
+    close(*my_sock);
+    *my_sock = connect_server(connect_port, server_address);
+    *started = false;
+    return false;
+}
+
+// Compression is offered on request, local sockets don't need it
+static bool wants_compression(const char *server_address,
+                              const ClientOptions &options)
+{
+    std::string local_path;
+    return options.compress && !unix_socket_path(server_address, &local_path);
+}
+
+//
+// Class for connection of directory mode: documents go one after another
+// without waiting for verdicts, which come back in the same order
+//
+class SocketConnection : public IBatchConnection {
+ public:
+    SocketConnection(int sock, bool started, bool deflate)
+        : sock_(sock), started_(started), deflate_(deflate) {}
+    virtual ~SocketConnection() { close(sock_); }
+
+    virtual bool send_document(const std::string &document)
+    {
+        std::string out;
+        if (!started_) out.assign(kProtocolMagic, sizeof(kProtocolMagic));
+        started_ = true;
+
+        std::string deflated;
+        if (deflate_ && deflate_if_smaller(document, &deflated)) {
+            out += encode_message(mtDeflatedDocument, deflated);
+        } else {
+            out += encode_message(mtDocument, document);
+        }
+        return send_all(sock_, &out);
+    }
+
+    virtual bool receive_verdict(ValidationResult *result)
+    {
+        Message message;
+        return recv_message(sock_, &reader_, &message) &&
+               (message.type == mtVerdict) &&
+               decode_verdict(message.payload, result);
+    }
+
+ private:
+    int             sock_;
+    bool            started_;
+    bool            deflate_;   // the server takes deflated documents
+    MessageReader   reader_;
+};
+
+#ifdef __linux__
+//
+// Class for connection over a shared memory ring: documents are written
+// into the ring of this process and parsed there by the server
+//
+class RingConnection : public IBatchConnection {
+ public:
+    RingConnection() {}
+
+    bool connect(const std::string &path, size_t depth)
+    {
+        // Slots for all documents in flight
+        uint32_t slots = kRingSlots;
+        while (slots < depth) slots *= 2;
+
+        std::string error;
+        if (!ring_.connect(path, slots, kRingDataSize, &error)) {
+            std::cout << error << "\n";
+            return false;
+        }
+        return true;
+    }
+
+    virtual bool send_document(const std::string &document)
+    {
+        return ring_.submit(document, kRingTimeout);
+    }
+
+    virtual bool receive_verdict(ValidationResult *result)
+    {
+        return ring_.next_verdict(result, kRingTimeout);
+    }
+
+ private:
+    static const uint32_t kRingSlots = 64;
+    static const uint64_t kRingDataSize = 16 * 1024 * 1024;
+    static const int kRingTimeout = 60000;  // ms
+
+    ShmProducer ring_;
+};
+#endif
+
+int client(int connect_port, const char* server_address, const char* file_name,
+           const ClientOptions &options)
+{
+    std::cout << "TCP CLIENT STARTED\n";
+
+    // sendfile() takes no MSG_NOSIGNAL: a server closing the connection
+    // fails the send instead of killing the client
+    signal(SIGPIPE, SIG_IGN);
+
+    // Documents go through shared memory rings, a single file is a set
+    // of one
+    std::string ring_path;
+    if (ring_socket_path(server_address, &ring_path)) {
+#ifdef __linux__
+        std::vector<std::string> files;
+        if (!is_file_set(file_name)) {
+            files.push_back(file_name);
+        } else if (!list_files(file_name, &files)) {
+            std::cerr << "Error file list not found!\n";
+            return -1;
+        }
+
+        size_t depth = options.depth;
+        BatchConnect connect = [=]() -> IBatchConnection* {
+            RingConnection *ring = new RingConnection();
+            if (ring->connect(ring_path, depth)) return ring;
+            delete ring;
+            return NULL;
+        };
+        return run_batch(files, is_file_set(file_name) ? options.jobs : 1,
+                         depth, connect);
+#else
+        std::cerr << "Error shared memory rings need Linux!\n";
         return -1;
+#endif
     }
 
-    // Sending the file
-    while (file.getline(packet_buff, PACKET_BUFF_SIZE)) {
-        send(my_sock, &packet_buff[0], PACKET_BUFF_SIZE, 0);
-        memset(packet_buff, '\0', PACKET_BUFF_SIZE);
+    // A directory or '@list' of files is validated over concurrent
+    // connections
+    if (is_file_set(file_name)) {
+        std::vector<std::string> files;
+        if (!list_files(file_name, &files)) {
+            std::cerr << "Error file list not found!\n";
+            return -1;
+        }
 
-        // Pause for more slow transferring,
-        // because the cycle causes the fall of the client
-        usleep(SLEEP_TIME);
+        bool compress = wants_compression(server_address, options);
+        BatchConnect connect = [=]() -> IBatchConnection* {
+            int my_sock = connect_server(connect_port, server_address);
+            bool started = false;
+            bool deflate = (my_sock >= 0) && compress &&
+                           offer_compression(&my_sock, connect_port,
+                                             server_address, &started);
+            return (my_sock < 0) ? NULL
+                                 : new SocketConnection(my_sock, started,
+                                                        deflate);
+        };
+        return run_batch(files, options.jobs, options.depth, connect);
     }
 
-    // Sending a command end of file (EOF)
-    send(my_sock, "~~", 2, 0);
+    int my_sock = connect_server(connect_port, server_address);
+    if (my_sock < 0) return -1;
 
-    // Closing the file
-    file.close();
+    std::cout << "Connection with " << server_address << " accepted\n\n";
+    int status;
+    if (!options.document_id.empty() && options.delta) {
+        // Named document goes as delta to its version on the server
+        std::ifstream file(file_name, std::ios::in | std::ios::binary);
+        if (!file) {
+            std::cerr << "Error file not found!\n";
+            close(my_sock);
+            return -1;
+        }
 
-    recv(my_sock, &packet_buff[0], sizeof(packet_buff)-1, 0);
-    std::cout << "Validation of file: " << packet_buff << std::endl;
+        std::stringstream text;
+        text << file.rdbuf();
+        status = upload_delta(my_sock, text.str(), options.document_id);
+    } else {
+        // Whole documents go deflated if the server takes them
+        bool started = false;
+        bool deflate = wants_compression(server_address, options) &&
+                       offer_compression(&my_sock, connect_port,
+                                         server_address, &started);
+        if (my_sock < 0) return -1;
+        status = upload_file(my_sock, file_name, options.document_id,
+                             started, deflate);
+    }
 
-    return 0;
+    close(my_sock);
+    return status;
 }
 #endif  // __unix__
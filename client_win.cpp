@@ -17,32 +17,164 @@
 #ifdef _WIN32
 #include "include/app_win.h"
 
-int client(int connect_port, const char* server_address, const char* file_name)
+// Send named document as delta to the version stored on the server
+// (the message protocol, see include/protocol.h)
+static int upload_delta(SOCKET my_sock, const std::string &text,
+                        const std::string &id)
 {
-    // Buffer for sending and receiving data
-    char packet_buff[PACKET_BUFF_SIZE];
+    MessageReader reader;
+    Message message;
 
-    // Buffer for WSA and other metadata
-    char buff[1024];
+    // Signatures of the stored version
+    std::string out(kProtocolMagic, sizeof(kProtocolMagic));
+    std::string payload;
+    put_string(&payload, id);
+    out += encode_message(mtSignaturesRequest, payload);
+    send_all(my_sock, &out);
 
-    std::cout << "TCP CLIENT STARTED\n";
+    Signatures signatures;
+    if (!recv_message(my_sock, &reader, &message) ||
+        (message.type != mtSignatures) ||
+        !decode_signatures(message.payload, &signatures)) {
+        std::cerr << "Error signatures not received!\n";
+        return -1;
+    }
 
-    // Sockets library initialisation
-    if (WSAStartup(0x202, reinterpret_cast<WSADATA*> (&buff[0]))) {
-        std::cout << "WSAStart error!\n";
+    Digest128 target = Hash128::of(text.data(), text.size());
+
+    // The second attempt sends the whole document
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        std::string delta = make_delta(signatures, text);
+        std::cout << "Sending " << delta.size() << " of " << text.size()
+                  << " bytes\n";
+
+        payload.clear();
+        put_string(&payload, id);
+        put_digest(&payload, signatures.base);
+        put_digest(&payload, target);
+        payload += delta;
+        out = encode_message(mtDelta, payload);
+        send_all(my_sock, &out);
+
+        if (!recv_message(my_sock, &reader, &message)) break;
+
+        ValidationResult result;
+        if ((message.type == mtVerdict) &&
+            decode_verdict(message.payload, &result)) {
+            std::cout << "Validation of file: " << result.to_string()
+                      << std::endl;
+            return 0;
+        }
+
+        std::cerr << "Error " << message.payload << "\n";
+        if (message.type != mtError) break;
+        signatures = Signatures();
+    }
+
+    return -1;
+}
+
+// Send the whole file as one document message
+// (id names the document for incremental validation, may be empty)
+// (started - the protocol magic was sent, deflate - the server takes
+//  deflated documents)
+static int upload_file(SOCKET my_sock, const char *file_name,
+                       const std::string &id, bool started, bool deflate)
+{
+    std::ifstream file(file_name, std::ios::in | std::ios::binary);
+    if (!file) {
+        std::cerr << "Error file not found!\n";
+        return -1;
+    }
+
+    file.seekg(0, std::ios::end);
+    size_t size = static_cast<size_t>(file.tellg());
+    file.seekg(0, std::ios::beg);
+    if (size > kMaxPayload) {
+        std::cerr << "Error file is too big!\n";
+        return -1;
+    }
+
+    std::string out;
+    if (!started) out.assign(kProtocolMagic, sizeof(kProtocolMagic));
+    if (!id.empty()) {
+        std::string payload;
+        put_string(&payload, id);
+        out += encode_message(mtName, payload);
+    }
+
+    bool sent;
+    if (deflate && (size >= kDeflateMinSize)) {
+        std::stringstream text;
+        text << file.rdbuf();
+        std::string document = text.str();
+        std::string deflated;
+        if (deflate_if_smaller(document, &deflated)) {
+            std::cout << "Sending " << deflated.size() << " of " << size
+                      << " bytes deflated\n";
+            out += encode_message(mtDeflatedDocument, deflated);
+        } else {
+            out += encode_message(mtDocument, document);
+        }
+        sent = send_all(my_sock, &out);
+    } else {
+        // Header of the document message, the file follows it
+        out.push_back(mtDocument);
+        put_u32(&out, static_cast<uint32_t>(size));
+        sent = send_all(my_sock, &out);
+
+        // The file goes in large chunks
+        std::vector<char> chunk(1024 * 1024);
+        while (sent && !file.eof()) {
+            file.read(&chunk[0], chunk.size());
+            if (file.gcount() == 0) break;
+
+            out.assign(&chunk[0], static_cast<size_t>(file.gcount()));
+            sent = send_all(my_sock, &out);
+        }
+    }
+
+    if (!sent) {
+        std::cerr << "Error sending file!\n";
         return -1;
     }
 
+    MessageReader reader;
+    Message message;
+    ValidationResult result;
+    if (!recv_message(my_sock, &reader, &message) ||
+        (message.type != mtVerdict) ||
+        !decode_verdict(message.payload, &result)) {
+        std::cerr << "Error verdict not received!\n";
+        return -1;
+    }
+
+    std::cout << "Validation of file: " << result.to_string() << std::endl;
+    return 0;
+}
+
+// Connect to the server (socket or INVALID_SOCKET)
+static SOCKET connect_server(int connect_port, const char *server_address)
+{
+    // Unix domain sockets and shared memory rings are served only on Unix
+    std::string local_path;
+    if (unix_socket_path(server_address, &local_path) ||
+        ring_socket_path(server_address, &local_path)) {
+        std::cout << "Unix domain sockets are not supported!\n";
+        return INVALID_SOCKET;
+    }
+
     // Creating socket
     SOCKET my_sock = socket(AF_INET, SOCK_STREAM, 0);
 
-    if (my_sock < 0) {
+    if (my_sock == INVALID_SOCKET) {
         std::cout << "Socket() error!\n";
-        return -1;
+        return INVALID_SOCKET;
     }
 
     // Creating connection
     sockaddr_in dest_addr;
+    memset(&dest_addr, 0, sizeof(dest_addr));
     dest_addr.sin_family = AF_INET;
     dest_addr.sin_port = htons(connect_port);
 
@@ -55,36 +187,156 @@ int client(int connect_port, const char* server_address, const char* file_name)
         reinterpret_cast<sockaddr*> (&dest_addr),
         sizeof(dest_addr))) {
       std::cout << "Connect error!\n";
-      return -1;
+      closesocket(my_sock);
+      return INVALID_SOCKET;
     }
 
-    std::cout << "Connection with " << server_address << " accepted\n\n";
+    return my_sock;
+}
 
-    // Creating the filestream and opening a file
-    std::ifstream file(file_name, std::ios::in);
-    if (!file) {
-        std::cerr << "Error file not found!\n";
+// Offer deflated uploads to the server, starting the connection with the
+// hello; true if it takes them. An old server answers the hello with an
+// error and closes the connection, *my_sock is then connected again (not
+// started, INVALID_SOCKET on failure).
+static bool offer_compression(SOCKET *my_sock, int connect_port,
+                              const char *server_address, bool *started)
+{
+    std::string out(kProtocolMagic, sizeof(kProtocolMagic));
+    out += encode_message(mtHello, kDeflateEncoding);
+
+    MessageReader reader;
+    Message message;
+    if (send_all(*my_sock, &out) &&
+        recv_message(*my_sock, &reader, &message) &&
+        (message.type == mtEncodings)) {
+        *started = true;
+        return has_encoding(message.payload, kDeflateEncoding);
+    }
+
+    closesocket(*my_sock);
+    *my_sock = connect_server(connect_port, server_address);
+    *started = false;
+    return false;
+}
+
+//
+// Class for connection of directory mode: documents go one after another
+// without waiting for verdicts, which come back in the same order
+//
+class SocketConnection : public IBatchConnection {
+ public:
+    SocketConnection(SOCKET sock, bool started, bool deflate)
+        : sock_(sock), started_(started), deflate_(deflate) {}
+    virtual ~SocketConnection() { closesocket(sock_); }
+
+    virtual bool send_document(const std::string &document)
+    {
+        std::string out;
+        if (!started_) out.assign(kProtocolMagic, sizeof(kProtocolMagic));
+        started_ = true;
+
+        std::string deflated;
+        if (deflate_ && deflate_if_smaller(document, &deflated)) {
+            out += encode_message(mtDeflatedDocument, deflated);
+        } else {
+            out += encode_message(mtDocument, document);
+        }
+        return send_all(sock_, &out);
+    }
+
+    virtual bool receive_verdict(ValidationResult *result)
+    {
+        Message message;
+        return recv_message(sock_, &reader_, &message) &&
+               (message.type == mtVerdict) &&
+               decode_verdict(message.payload, result);
+    }
+
+ private:
+    SOCKET          sock_;
+    bool            started_;
+    bool            deflate_;   // the server takes deflated documents
+    MessageReader   reader_;
+};
+
+int client(int connect_port, const char* server_address, const char* file_name,
+           const ClientOptions &options)
+{
+    // Buffer for WSA and other metadata
+    char buff[1024];
+
+    std::cout << "TCP CLIENT STARTED\n";
+
+    // Sockets library initialisation
+    if (WSAStartup(0x202, reinterpret_cast<WSADATA*> (&buff[0]))) {
+        std::cout << "WSAStart error!\n";
         return -1;
     }
 
-    // Sending the file
-    while (file.getline(packet_buff, PACKET_BUFF_SIZE)) {
-        send(my_sock, &packet_buff[0], PACKET_BUFF_SIZE, 0);
-        memset(packet_buff, '\0', PACKET_BUFF_SIZE);
+    // A directory or '@list' of files is validated over concurrent
+    // connections
+    if (is_file_set(file_name)) {
+        std::vector<std::string> files;
+        if (!list_files(file_name, &files)) {
+            std::cerr << "Error file list not found!\n";
+            WSACleanup();
+            return -1;
+        }
+
+        bool compress = options.compress;
+        BatchConnect connect = [=]() -> IBatchConnection* {
+            SOCKET my_sock = connect_server(connect_port, server_address);
+            bool started = false;
+            bool deflate = (my_sock != INVALID_SOCKET) && compress &&
+                           offer_compression(&my_sock, connect_port,
+                                             server_address, &started);
+            return (my_sock == INVALID_SOCKET)
+                       ? NULL
+                       : new SocketConnection(my_sock, started, deflate);
+        };
+        int status = run_batch(files, options.jobs, options.depth, connect);
+        WSACleanup();
+        return status;
     }
 
-    // Sending a command end of file (EOF)
-    send(my_sock, "~~", 2, 0);
+    SOCKET my_sock = connect_server(connect_port, server_address);
+    if (my_sock == INVALID_SOCKET) {
+        WSACleanup();
+        return -1;
+    }
 
-    // Closing the file
-    file.close();
+    std::cout << "Connection with " << server_address << " accepted\n\n";
+    int status;
+    if (!options.document_id.empty() && options.delta) {
+        // Named document goes as delta to its version on the server
+        std::ifstream file(file_name, std::ios::in | std::ios::binary);
+        if (!file) {
+            std::cerr << "Error file not found!\n";
+            closesocket(my_sock);
+            WSACleanup();
+            return -1;
+        }
 
-    recv(my_sock, &packet_buff[0], sizeof(packet_buff)-1, 0);
-    std::cout << "Validation of file: " << packet_buff << std::endl;
+        std::stringstream text;
+        text << file.rdbuf();
+        status = upload_delta(my_sock, text.str(), options.document_id);
+    } else {
+        // Whole documents go deflated if the server takes them
+        bool started = false;
+        bool deflate = options.compress &&
+                       offer_compression(&my_sock, connect_port,
+                                         server_address, &started);
+        if (my_sock == INVALID_SOCKET) {
+            WSACleanup();
+            return -1;
+        }
+        status = upload_file(my_sock, file_name, options.document_id,
+                             started, deflate);
+    }
 
     closesocket(my_sock);
     WSACleanup();
 
-    return 0;
+    return status;
 }
 #endif  // _WIN32
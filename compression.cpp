@@ -0,0 +1,119 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#include "include/compression.h"
+
+#include <string.h>
+
+#include <string>
+
+namespace {
+
+// Output of one inflate call
+const size_t kInflateChunk = 64 * 1024;
+
+}  // namespace
+
+const char kDeflateEncoding[] = "deflate";
+
+bool has_encoding(const std::string &list, const std::string &encoding)
+{
+  size_t start = 0;
+  while (start <= list.size()) {
+    size_t comma = list.find(',', start);
+    if (comma == std::string::npos) comma = list.size();
+    if (list.compare(start, comma - start, encoding) == 0) return true;
+    start = comma + 1;
+  }
+  return false;
+}
+
+std::string deflate_document(StringView document, int level)
+{
+  std::string out;
+  uLongf size = compressBound(document.size());
+  out.resize(size);
+  if (compress2(reinterpret_cast<Bytef*> (&out[0]), &size,
+                reinterpret_cast<const Bytef*> (document.data()),
+                document.size(), level) != Z_OK) {
+    return std::string();
+  }
+  out.resize(size);
+  return out;
+}
+
+bool deflate_if_smaller(StringView document, std::string *deflated)
+{
+  if (document.size() < kDeflateMinSize) return false;
+
+  *deflated = deflate_document(document);
+  return !deflated->empty() && (deflated->size() < document.size());
+}
+
+// -- Inflater
+Inflater::Inflater(size_t max_size)
+    : done_(false),
+      max_size_(max_size),
+      produced_(0)
+{
+  memset(&stream_, 0, sizeof(stream_));
+  inflateInit(&stream_);
+}
+
+Inflater::~Inflater()
+{
+  inflateEnd(&stream_);
+}
+
+void Inflater::reset()
+{
+  inflateReset(&stream_);
+  done_ = false;
+  produced_ = 0;
+}
+
+bool Inflater::feed(const char *data, size_t size, std::string *out)
+{
+  if (size == 0) return true;
+  if (done_) return false;
+
+  stream_.next_in = reinterpret_cast<Bytef*> (const_cast<char*> (data));
+  stream_.avail_in = static_cast<uInt>(size);
+
+  // Until the input is taken and no output is pending in the stream
+  do {
+    size_t used = out->size();
+    out->resize(used + kInflateChunk);
+    stream_.next_out = reinterpret_cast<Bytef*> (&(*out)[used]);
+    stream_.avail_out = kInflateChunk;
+
+    int status = inflate(&stream_, Z_NO_FLUSH);
+    size_t produced = kInflateChunk - stream_.avail_out;
+    out->resize(used + produced);
+    produced_ += produced;
+
+    if (produced_ > max_size_) return false;
+    if (status == Z_STREAM_END) {
+      done_ = true;
+      // Nothing may follow the stream in the document
+      return stream_.avail_in == 0;
+    }
+    if ((status != Z_OK) && (status != Z_BUF_ERROR)) return false;
+    if ((status == Z_BUF_ERROR) && (produced == 0)) break;
+  } while ((stream_.avail_in > 0) || (stream_.avail_out == 0));
+
+  return true;
+}
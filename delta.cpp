@@ -0,0 +1,257 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#include "include/delta.h"
+#include "include/protocol.h"
+
+#include <math.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+const char kCopyOp = 'C';
+const char kLiteralOp = 'L';
+
+// Delta being built: literal bytes wait until the next copy
+class DeltaWriter {
+ public:
+  explicit DeltaWriter(std::string *out)
+      : out_(out), first_(0), count_(0) {}
+
+  void copy(uint32_t block)
+  {
+    if ((count_ > 0) && (first_ + count_ == block)) {
+      ++count_;
+      return;
+    }
+    flush_copy();
+    first_ = block;
+    count_ = 1;
+  }
+
+  void literal(const char *data, size_t size)
+  {
+    if (size == 0) return;
+    flush_copy();
+    out_->push_back(kLiteralOp);
+    put_u32(out_, static_cast<uint32_t>(size));
+    out_->append(data, size);
+  }
+
+  void flush_copy()
+  {
+    if (count_ == 0) return;
+    out_->push_back(kCopyOp);
+    put_u32(out_, first_);
+    put_u32(out_, count_);
+    count_ = 0;
+  }
+
+ private:
+  std::string *out_;
+  uint32_t    first_;
+  uint32_t    count_;
+};
+
+}  // namespace
+
+void RollingChecksum::reset(const char *data, size_t size)
+{
+  a_ = 0;
+  b_ = 0;
+  size_ = static_cast<uint32_t>(size);
+
+  for (size_t i = 0; i < size; ++i) {
+    unsigned char c = static_cast<unsigned char>(data[i]);
+    a_ = static_cast<uint16_t>(a_ + c);
+    b_ = static_cast<uint16_t>(b_ + (size - i) * c);
+  }
+}
+
+uint32_t choose_block_size(size_t size)
+{
+  uint32_t block = static_cast<uint32_t>(sqrt(static_cast<double>(size)));
+  block &= ~7u;
+  if (block < 512) block = 512;
+  if (block > 64 * 1024) block = 64 * 1024;
+  return block;
+}
+
+Signatures make_signatures(const std::string &base, uint32_t block_size)
+{
+  Signatures signatures;
+  signatures.block_size = block_size;
+  signatures.base = Hash128::of(base.data(), base.size());
+
+  RollingChecksum checksum;
+  for (size_t pos = 0; pos + block_size <= base.size(); pos += block_size) {
+    BlockSignature block;
+    checksum.reset(base.data() + pos, block_size);
+    block.weak = checksum.value();
+    block.strong = Hash128::of(base.data() + pos, block_size);
+    signatures.blocks.push_back(block);
+  }
+
+  return signatures;
+}
+
+std::string encode_signatures(const Signatures &signatures)
+{
+  std::string payload;
+  put_u32(&payload, signatures.block_size);
+  put_digest(&payload, signatures.base);
+  put_u32(&payload, static_cast<uint32_t>(signatures.blocks.size()));
+
+  for (size_t i = 0; i < signatures.blocks.size(); ++i) {
+    put_u32(&payload, signatures.blocks[i].weak);
+    put_digest(&payload, signatures.blocks[i].strong);
+  }
+
+  return payload;
+}
+
+bool decode_signatures(const std::string &payload, Signatures *signatures)
+{
+  size_t pos = 0;
+  uint32_t count;
+
+  // No blocks and no block size if there is no stored version
+  if (!get_u32(payload, &pos, &signatures->block_size) ||
+      !get_digest(payload, &pos, &signatures->base) ||
+      !get_u32(payload, &pos, &count) ||
+      ((signatures->block_size == 0) && (count > 0))) {
+    return false;
+  }
+
+  signatures->blocks.clear();
+  for (uint32_t i = 0; i < count; ++i) {
+    BlockSignature block;
+    if (!get_u32(payload, &pos, &block.weak) ||
+        !get_digest(payload, &pos, &block.strong)) {
+      return false;
+    }
+    signatures->blocks.push_back(block);
+  }
+
+  return true;
+}
+
+std::string make_delta(const Signatures &signatures, const std::string &target)
+{
+  std::string delta;
+  DeltaWriter writer(&delta);
+
+  const size_t block_size = signatures.block_size;
+  const char *data = target.data();
+  const size_t size = target.size();
+
+  // Blocks by weak checksum
+  std::unordered_multimap<uint32_t, uint32_t> blocks;
+  for (size_t i = 0; i < signatures.blocks.size(); ++i) {
+    blocks.insert(std::make_pair(signatures.blocks[i].weak,
+                                 static_cast<uint32_t>(i)));
+  }
+
+  size_t literal = 0;
+  size_t pos = 0;
+  RollingChecksum checksum;
+  if (!blocks.empty() && (size >= block_size)) {
+    checksum.reset(data, block_size);
+  }
+
+  while (!blocks.empty() && (pos + block_size <= size)) {
+    typedef std::unordered_multimap<uint32_t, uint32_t>::const_iterator Iter;
+    std::pair<Iter, Iter> range = blocks.equal_range(checksum.value());
+
+    // Strong hash only for the weak matches
+    int found = -1;
+    if (range.first != range.second) {
+      Digest128 strong = Hash128::of(data + pos, block_size);
+      for (Iter it = range.first; it != range.second; ++it) {
+        if (signatures.blocks[it->second].strong == strong) {
+          found = it->second;
+          break;
+        }
+      }
+    }
+
+    if (found >= 0) {
+      writer.literal(data + literal, pos - literal);
+      writer.copy(found);
+      pos += block_size;
+      literal = pos;
+      if (pos + block_size <= size) checksum.reset(data + pos, block_size);
+      continue;
+    }
+
+    if (pos + block_size >= size) break;
+    checksum.roll(data[pos], data[pos + block_size]);
+    ++pos;
+  }
+
+  writer.literal(data + literal, size - literal);
+  writer.flush_copy();
+  return delta;
+}
+
+bool apply_delta(const std::string &base, uint32_t block_size,
+                 const std::string &delta, size_t pos, std::string *target,
+                 std::string *error)
+{
+  const size_t blocks = (block_size == 0) ? 0 : base.size() / block_size;
+  target->clear();
+
+  while (pos < delta.size()) {
+    char op = delta[pos++];
+    uint32_t first;
+    uint32_t count;
+
+    if (op == kCopyOp) {
+      if (!get_u32(delta, &pos, &first) || !get_u32(delta, &pos, &count) ||
+          (first > blocks) || (count > blocks - first)) {
+        *error = "Bad block in delta";
+        return false;
+      }
+      // Copies may repeat the base: the rebuilt document is bounded
+      // like an uploaded one
+      size_t size = static_cast<size_t>(count) * block_size;
+      if (size > kMaxPayload - target->size()) {
+        *error = "Rebuilt document is too long";
+        return false;
+      }
+      target->append(base, static_cast<size_t>(first) * block_size, size);
+    } else if (op == kLiteralOp) {
+      if (!get_u32(delta, &pos, &count) || (delta.size() - pos < count)) {
+        *error = "Bad literal in delta";
+        return false;
+      }
+      if (count > kMaxPayload - target->size()) {
+        *error = "Rebuilt document is too long";
+        return false;
+      }
+      target->append(delta, pos, count);
+      pos += count;
+    } else {
+      *error = "Bad delta";
+      return false;
+    }
+  }
+
+  return true;
+}
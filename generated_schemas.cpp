@@ -0,0 +1,41 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+// Validators generated by tools/schemagen (see GENERATED in Makefile)
+
+#include "include/validator.h"
+#include "include/testrunner_schema.h"
+
+namespace {
+
+template <class Events>
+ValidationResult validate_generated(StringView data,
+                                    const ParseEventsList &extra)
+{
+  Events events;
+  return validate_with(&events, data, extra);
+}
+
+}  // namespace
+
+GeneratedValidate find_generated_validator(uint64_t fingerprint)
+{
+  if (fingerprint == testrunner_schema::kFingerprint) {
+    return validate_generated<testrunner_schema::Validator>;
+  }
+
+  return NULL;
+}
@@ -0,0 +1,141 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#include "include/hash128.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+
+namespace {
+
+const uint64_t kC1 = 0x87c37b91114253d5ULL;
+const uint64_t kC2 = 0x4cf5ad432745937fULL;
+
+inline uint64_t rotl(uint64_t x, int r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t fmix(uint64_t k)
+{
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ULL;
+  k ^= k >> 33;
+  return k;
+}
+
+// Little-endian load
+inline uint64_t load(const unsigned char *p)
+{
+  uint64_t v = 0;
+  for (int i = 7; i >= 0; --i) v = (v << 8) | p[i];
+  return v;
+}
+
+}  // namespace
+
+std::string Digest128::to_string() const
+{
+  char buff[33];
+  snprintf(buff, sizeof(buff), "%016llx%016llx",
+           static_cast<unsigned long long>(high),
+           static_cast<unsigned long long>(low));
+  return buff;
+}
+
+Hash128::Hash128(uint64_t seed)
+    : h1_(seed),
+      h2_(seed),
+      length_(0),
+      tail_size_(0)
+{
+}
+
+void Hash128::block(const unsigned char *data)
+{
+  uint64_t k1 = load(data);
+  uint64_t k2 = load(data + 8);
+
+  k1 *= kC1; k1 = rotl(k1, 31); k1 *= kC2; h1_ ^= k1;
+  h1_ = rotl(h1_, 27); h1_ += h2_; h1_ = h1_ * 5 + 0x52dce729;
+
+  k2 *= kC2; k2 = rotl(k2, 33); k2 *= kC1; h2_ ^= k2;
+  h2_ = rotl(h2_, 31); h2_ += h1_; h2_ = h2_ * 5 + 0x38495ab5;
+}
+
+void Hash128::update(const char *data, size_t size)
+{
+  const unsigned char *p = reinterpret_cast<const unsigned char*> (data);
+  length_ += size;
+
+  // Complete the pending block
+  if (tail_size_ > 0) {
+    size_t take = 16 - tail_size_;
+    if (take > size) take = size;
+    memcpy(tail_ + tail_size_, p, take);
+    tail_size_ += take;
+    p += take;
+    size -= take;
+
+    if (tail_size_ < 16) return;
+    block(tail_);
+    tail_size_ = 0;
+  }
+
+  for ( ; size >= 16; p += 16, size -= 16) {
+    block(p);
+  }
+
+  memcpy(tail_, p, size);
+  tail_size_ = size;
+}
+
+Digest128 Hash128::digest() const
+{
+  uint64_t h1 = h1_;
+  uint64_t h2 = h2_;
+  uint64_t k1 = 0;
+  uint64_t k2 = 0;
+
+  for (size_t i = tail_size_; i > 8; --i) {
+    k2 = (k2 << 8) | tail_[i - 1];
+  }
+  for (size_t i = (tail_size_ < 8) ? tail_size_ : 8; i > 0; --i) {
+    k1 = (k1 << 8) | tail_[i - 1];
+  }
+
+  if (tail_size_ > 8) {
+    k2 *= kC2; k2 = rotl(k2, 33); k2 *= kC1; h2 ^= k2;
+  }
+  if (tail_size_ > 0) {
+    k1 *= kC1; k1 = rotl(k1, 31); k1 *= kC2; h1 ^= k1;
+  }
+
+  h1 ^= length_;
+  h2 ^= length_;
+  h1 += h2;
+  h2 += h1;
+  h1 = fmix(h1);
+  h2 = fmix(h2);
+  h1 += h2;
+  h2 += h1;
+
+  return Digest128(h1, h2);
+}
@@ -0,0 +1,455 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#include "include/http.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+
+#include "include/rules.h"
+#include "include/trace.h"
+
+namespace {
+
+const char kContinue[] = "HTTP/1.1 100 Continue\r\n\r\n";
+// Longest chunk size line
+const size_t kMaxChunkLine = 1024;
+
+const char *reason_phrase(int status)
+{
+  switch (status) {
+    case 200: return "OK";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 413: return "Payload Too Large";
+    case 415: return "Unsupported Media Type";
+    case 431: return "Request Header Fields Too Large";
+    case 501: return "Not Implemented";
+    case 505: return "HTTP Version Not Supported";
+    default: return "Error";
+  }
+}
+
+std::string lowercase(const std::string &text)
+{
+  std::string result(text);
+  for (size_t i = 0; i < result.size(); ++i) {
+    result[i] = tolower(static_cast<unsigned char>(result[i]));
+  }
+  return result;
+}
+
+std::string trimmed(const std::string &text)
+{
+  size_t start = text.find_first_not_of(" \t");
+  if (start == std::string::npos) return std::string();
+  size_t end = text.find_last_not_of(" \t");
+  return text.substr(start, end - start + 1);
+}
+
+// JSON string with quotes
+std::string json_string(const std::string &text)
+{
+  std::string result = "\"";
+  for (size_t i = 0; i < text.size(); ++i) {
+    unsigned char c = text[i];
+    if ((c == '"') || (c == '\\')) {
+      result += '\\';
+      result += c;
+    } else if (c < 0x20) {
+      char buff[8];
+      snprintf(buff, sizeof(buff), "\\u%04x", c);
+      result += buff;
+    } else {
+      result += c;
+    }
+  }
+  return result + "\"";
+}
+
+}  // namespace
+
+HttpSession::HttpSession(DocumentService *service)
+    : service_(service),
+      state_(hsHead),
+      done_(false),
+      taken_(0),
+      connection_(0),
+      keep_alive_(true),
+      http10_(false),
+      plain_text_(false),
+      body_left_(0),
+      receive_start_(0),
+      deflated_(false)
+{
+}
+
+void HttpSession::feed(const char *data, size_t size, std::string *reply)
+{
+  if (done_ || (size == 0)) return;
+  buffer_.append(data, size);
+
+  for (;;) {
+    if ((state_ == hsHead) && (receive_start_ == 0) &&
+        (taken_ < buffer_.size())) {
+      receive_start_ = monotonic_ns();
+      allocations_.restart();
+    }
+    if (done_) break;
+    if (!((state_ == hsHead) ? parse_head(reply) : parse_body(reply))) break;
+  }
+
+  // Taken bytes are dropped once per received piece
+  buffer_.erase(0, taken_);
+  taken_ = 0;
+}
+
+bool HttpSession::parse_head(std::string *reply)
+{
+  // Empty lines before a request are ignored
+  while ((buffer_.size() - taken_ >= 2) &&
+         (buffer_.compare(taken_, 2, "\r\n") == 0)) {
+    taken_ += 2;
+  }
+
+  size_t end = buffer_.find("\r\n\r\n", taken_);
+  if (end == std::string::npos) {
+    if (buffer_.size() - taken_ > kMaxHttpHead) {
+      fail(431, "Request head is too long", reply);
+    }
+    return false;
+  }
+
+  std::string head = buffer_.substr(taken_, end + 2 - taken_);
+  taken_ = end + 4;
+
+  // Request line
+  size_t line_end = head.find("\r\n");
+  std::string line = head.substr(0, line_end);
+  size_t space1 = line.find(' ');
+  size_t space2 = line.find(' ', space1 + 1);
+  if ((space1 == std::string::npos) || (space2 == std::string::npos)) {
+    fail(400, "Bad request line", reply);
+    return false;
+  }
+  std::string method = line.substr(0, space1);
+  std::string target = line.substr(space1 + 1, space2 - space1 - 1);
+  std::string version = line.substr(space2 + 1);
+  if ((version != "HTTP/1.1") && (version != "HTTP/1.0")) {
+    fail(505, "Expected HTTP/1.1", reply);
+    return false;
+  }
+
+  http10_ = (version == "HTTP/1.0");
+  keep_alive_ = !http10_;
+  plain_text_ = false;
+  deflated_ = false;
+  id_.clear();
+  bool chunked = false;
+  bool expect_continue = false;
+  bool has_length = false;
+  int64_t content_length = 0;
+
+  // Headers
+  for (size_t start = line_end + 2; start < head.size(); ) {
+    size_t stop = head.find("\r\n", start);
+    std::string header = head.substr(start, stop - start);
+    start = stop + 2;
+
+    size_t colon = header.find(':');
+    if ((colon == std::string::npos) || (colon == 0)) {
+      fail(400, "Bad header", reply);
+      return false;
+    }
+    std::string name = lowercase(header.substr(0, colon));
+    std::string value = trimmed(header.substr(colon + 1));
+    std::string lower = lowercase(value);
+
+    if (name == "content-length") {
+      int64_t length;
+      if (!parse_integer(value, &length) || (length < 0)) {
+        fail(400, "Bad Content-Length", reply);
+        return false;
+      }
+      // Proxies could take another length than ours (RFC 7230, 3.3.3)
+      if (has_length && (length != content_length)) {
+        fail(400, "Differing Content-Length headers", reply);
+        return false;
+      }
+      has_length = true;
+      content_length = length;
+    } else if (name == "transfer-encoding") {
+      if (lower != "chunked") {
+        fail(501, "Only chunked transfer encoding is supported", reply);
+        return false;
+      }
+      chunked = true;
+    } else if (name == "content-encoding") {
+      if (lower == kDeflateEncoding) {
+        deflated_ = true;
+      } else if (lower != "identity") {
+        fail(415, "Only deflate content encoding is supported", reply);
+        return false;
+      }
+    } else if (name == "connection") {
+      if (lower.find("close") != std::string::npos) keep_alive_ = false;
+      if (lower.find("keep-alive") != std::string::npos) keep_alive_ = true;
+    } else if (name == "expect") {
+      expect_continue = (lower == "100-continue");
+    } else if (name == "accept") {
+      plain_text_ = (lower.find("text/plain") != std::string::npos);
+    } else if (name == "x-document-id") {
+      id_ = value;
+    }
+  }
+
+  // Either framing could be taken by a proxy in front of the server
+  if (chunked && has_length) {
+    fail(400, "Both Transfer-Encoding and Content-Length", reply);
+    return false;
+  }
+
+  // Requests other than validation: their body isn't read, so the
+  // connection ends after the answer if there is one
+  bool has_body = chunked || (content_length > 0);
+  std::string path = target.substr(0, target.find('?'));
+  if (path == "/health") {
+    respond(200, "text/plain", "ok\n", !keep_alive_ || has_body, reply);
+    return true;
+  }
+  if (path != "/validate") {
+    respond(404, "text/plain", "Not found\n", !keep_alive_ || has_body,
+            reply);
+    return true;
+  }
+  if (method != "POST") {
+    respond(405, "text/plain", "Use POST\n", !keep_alive_ || has_body,
+            reply);
+    return true;
+  }
+  if (static_cast<uint64_t>(content_length) > kMaxPayload) {
+    fail(413, "Document is too long", reply);
+    return false;
+  }
+
+  document_.clear();
+  hash_ = Hash128();
+  if (deflated_) {
+    if (!inflater_) inflater_.reset(new Inflater(kMaxPayload));
+    inflater_->reset();
+  }
+
+  if (chunked) {
+    state_ = hsChunkSize;
+  } else {
+    body_left_ = static_cast<size_t>(content_length);
+    if (!deflated_) document_.reserve(body_left_);
+    state_ = hsBody;
+  }
+  if (expect_continue) *reply += kContinue;
+  return true;
+}
+
+bool HttpSession::take_body(std::string *reply)
+{
+  size_t size = buffer_.size() - taken_;
+  if (size > body_left_) size = body_left_;
+  if (size == 0) return true;
+
+  const char *data = buffer_.data() + taken_;
+  size_t received = document_.size();
+  if (deflated_) {
+    if (!inflater_->feed(data, size, &document_)) {
+      fail(400, "Bad deflated body", reply);
+      return false;
+    }
+    service_->metrics().add(ctDeflatedBytes, size);
+    service_->metrics().add(ctInflatedBytes, document_.size() - received);
+  } else {
+    if (received + size > kMaxPayload) {
+      fail(413, "Document is too long", reply);
+      return false;
+    }
+    document_.append(data, size);
+  }
+  hash_.update(document_.data() + received, document_.size() - received);
+
+  taken_ += size;
+  body_left_ -= size;
+  return true;
+}
+
+bool HttpSession::parse_body(std::string *reply)
+{
+  switch (state_) {
+    case hsBody: {
+      if (!take_body(reply) || (body_left_ > 0)) return false;
+      complete(reply);
+      return true;
+    }
+    case hsChunkSize: {
+      size_t eol = buffer_.find("\r\n", taken_);
+      if (eol == std::string::npos) {
+        if (buffer_.size() - taken_ > kMaxChunkLine) {
+          fail(400, "Bad chunk size", reply);
+        }
+        return false;
+      }
+
+      // Hex size, chunk extensions after ';' are ignored
+      std::string line = buffer_.substr(taken_, eol - taken_);
+      line = trimmed(line.substr(0, line.find(';')));
+      char *end = NULL;
+      unsigned long long size = strtoull(line.c_str(), &end, 16);
+      if (line.empty() || (*end != '\0') || (size > kMaxPayload)) {
+        fail(400, "Bad chunk size", reply);
+        return false;
+      }
+
+      taken_ = eol + 2;
+      body_left_ = static_cast<size_t>(size);
+      state_ = (size == 0) ? hsTrailer : hsChunkData;
+      return true;
+    }
+    case hsChunkData: {
+      if (!take_body(reply) || (body_left_ > 0)) return false;
+      state_ = hsChunkEnd;
+      return true;
+    }
+    case hsChunkEnd: {
+      if (buffer_.size() - taken_ < 2) return false;
+      if (buffer_.compare(taken_, 2, "\r\n") != 0) {
+        fail(400, "Bad chunk end", reply);
+        return false;
+      }
+      taken_ += 2;
+      state_ = hsChunkSize;
+      return true;
+    }
+    case hsTrailer: {
+      size_t eol = buffer_.find("\r\n", taken_);
+      if (eol == std::string::npos) {
+        if (buffer_.size() - taken_ > kMaxHttpHead) {
+          fail(431, "Trailer is too long", reply);
+        }
+        return false;
+      }
+
+      bool last = (eol == taken_);
+      taken_ = eol + 2;
+      if (last) complete(reply);
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+void HttpSession::complete(std::string *reply)
+{
+  if (deflated_ && !inflater_->done()) {
+    fail(400, "Deflated body is cut", reply);
+    return;
+  }
+
+  if (receive_start_ != 0) {
+    service_->latency().record_since(phReceive, receive_start_);
+    trace_span("receive document", receive_start_, monotonic_ns());
+  }
+  uint64_t arrived = arrival_time();
+
+  Digest128 digest = hash_.digest();
+  Verdict verdict;
+  verdict.result = service_->validate(id_, document_, digest, &verdict.source);
+  verdicts_.push_back(verdict);
+  capture(arrived, verdict);
+
+  // The base of the next delta upload of the native protocol
+  if (!id_.empty()) service_->keep_version(id_, document_, digest);
+
+  const ValidationResult &result = verdict.result;
+  if (plain_text_) {
+    respond(200, "text/plain",
+            result.valid ? std::string("valid\n")
+                         : "invalid: " + result.message + "\n",
+            !keep_alive_, reply);
+  } else {
+    respond(200, "application/json",
+            std::string("{\"valid\":") + (result.valid ? "true" : "false") +
+                ",\"message\":" + json_string(result.message) + "}\n",
+            !keep_alive_, reply);
+  }
+  service_->metrics().add_request_allocations(allocations_.stats());
+
+  document_.clear();
+  id_.clear();
+}
+
+uint64_t HttpSession::arrival_time() const
+{
+  uint64_t now = wall_us();
+  if (receive_start_ == 0) return now;
+  return now - (monotonic_ns() - receive_start_) / 1000;
+}
+
+void HttpSession::capture(uint64_t arrived, const Verdict &verdict)
+{
+  CaptureWriter *writer = service_->capture();
+  if (writer == NULL) return;
+
+  if (connection_ == 0) connection_ = writer->next_connection();
+
+  CaptureRecord record;
+  record.time = arrived;
+  record.connection = connection_;
+  record.valid = verdict.result.valid;
+  record.id = id_;
+  record.document = document_;
+  writer->write(record);
+}
+
+void HttpSession::respond(int status, const std::string &content_type,
+                          const std::string &body, bool close,
+                          std::string *reply)
+{
+  char status_line[64];
+  snprintf(status_line, sizeof(status_line), "HTTP/1.1 %d %s\r\n", status,
+           reason_phrase(status));
+  *reply += status_line;
+  *reply += "Content-Type: " + content_type + "\r\n";
+  *reply += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+  if (close) {
+    *reply += "Connection: close\r\n";
+  } else if (http10_) {
+    *reply += "Connection: keep-alive\r\n";
+  }
+  *reply += "\r\n";
+  *reply += body;
+
+  if (close) done_ = true;
+  state_ = hsHead;
+  receive_start_ = 0;
+}
+
+void HttpSession::fail(int status, const std::string &message,
+                       std::string *reply)
+{
+  respond(status, "text/plain", message + "\n", true, reply);
+}
@@ -0,0 +1,79 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#ifndef TRLWO_1286_INCLUDE_ALLOC_STATS_H_
+#define TRLWO_1286_INCLUDE_ALLOC_STATS_H_
+
+#include <stdint.h>
+
+// Accounting of allocations, built with "make ALLOC_STATS=1": the global
+// operator new and delete of the application count the calls and bytes
+// of each thread. Without it the scopes cost nothing and count zero.
+
+//
+// Allocations of a scope of the calling thread
+//
+struct AllocationStats {
+  AllocationStats() : count(0), bytes(0), peak(0) {}
+
+  uint64_t count;  // operator new calls
+  uint64_t bytes;  // bytes requested by them
+  uint64_t peak;   // most bytes live at once above the start of the scope
+                   // (freeing in another thread isn't seen)
+};
+
+// Built with the counting operator new?
+bool allocation_tracking();
+
+//
+// Allocations of the calling thread since the start of the scope
+// Scopes of one thread nest (as the calls), restart() only when no inner
+// scope is open.
+//
+class AllocationScope {
+ public:
+#ifdef ALLOC_STATS
+  AllocationScope() { start(); }
+  ~AllocationScope() { end(); }
+
+  void restart()
+  {
+    end();
+    start();
+  }
+
+  AllocationStats stats() const;
+
+ private:
+  void start();
+  void end();
+
+  uint64_t start_count_;
+  uint64_t start_bytes_;
+  int64_t  start_live_;
+  int64_t  outer_peak_;  // peak of the enclosing scope
+#else
+  AllocationScope() {}
+  void restart() {}
+  AllocationStats stats() const { return AllocationStats(); }
+#endif  // ALLOC_STATS
+
+ private:
+  AllocationScope(const AllocationScope&);
+  AllocationScope &operator=(const AllocationScope&);
+};
+
+#endif  // TRLWO_1286_INCLUDE_ALLOC_STATS_H_
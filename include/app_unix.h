@@ -18,39 +18,131 @@
 #define TRLWO_1286_INCLUDE_APP_UNIX_H_
 
 #ifdef __unix__
+#include <errno.h>
 #include <stdio.h>
 #include <memory.h>
 #include <time.h>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <poll.h>
 #include <pthread.h>
+#include <signal.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 
+#include <atomic>
+#include <condition_variable>
 #include <iostream>
 #include <fstream>
+#include <mutex>
+#include <set>
+#include <sstream>
 #include "xmlparser.h"
+#include "validator.h"
+#include "options.h"
+#include "service.h"
+#include "trace.h"
+#include "batch.h"
+#include "shm_ring.h"
+#include "compression.h"
+#include "http.h"
 
 #define PACKET_BUFF_SIZE 5120
 
+//
+// Class for tracking the sockets of the servicing threads
+// The server stops only after every thread is done with the shared
+// DocumentService and cache.
+//
+class ConnectionSet {
+ public:
+    ConnectionSet() : stopping_(false) {}
+
+    // Socket served by a new thread
+    void add(int sock);
+    // The thread of sock doesn't touch the shared state any more
+    // (called before closing sock, so its number isn't reused yet)
+    void remove(int sock);
+    // Shut down the sockets and wait until all the threads are done
+    void stop();
+
+    // Threads should finish the current document and end
+    bool stopping() const { return stopping_.load(); }
+
+ private:
+    std::mutex              lock_;
+    std::condition_variable drained_;
+    std::set<int>           sockets_;
+    std::atomic<bool>       stopping_;
+};
+
+// Data of one connection for the servicing thread
+struct ServiceContext {
+    std::string client;  // client info starting its lines in the log
+    int socket;
+    DocumentService *service;
+    ConnectionSet *connections;
+    uint64_t accepted;  // monotonic_ns() of accepting
+    bool http;          // accepted on the HTTP port
+};
+
 // Server function
-int server(int connect_port);
+// (schema_file is a DTD to validate against or "n" for well-formedness only,
+//  rules_file is a file of semantic rules or "n")
+int server(int connect_port, const char *rules_file, const char *schema_file,
+           const ServerOptions &options);
 
 // Client function
-int client(int connect_port, const char *server_address, const char *file_name);
+int client(int connect_port, const char *server_address, const char *file_name,
+           const ClientOptions &options);
 
 // Function for service the connected users
-void* client_service(void *client_socket);
+// (takes ownership of ServiceContext)
+void* client_service(void *context);
+// Function serving the shared memory ring attached over the socket of
+// context (takes ownership of ServiceContext)
+void* ring_service(void *context);
 
-// Function for getting handling time
-inline uint64_t tick()
+// Send all bytes of data (partial sends are continued), clears data
+inline bool send_all(int sock, std::string *data)
 {
-    uint64_t time;
-    __asm__ __volatile__("rdtsc" : "=A" (time));
-    return time;
+    size_t sent = 0;
+    while (sent < data->size()) {
+        ssize_t bytes = send(sock, data->data() + sent, data->size() - sent,
+                             MSG_NOSIGNAL);
+        if ((bytes < 0) && (errno == EINTR)) continue;
+        if (bytes <= 0) break;
+        sent += bytes;
+    }
+
+    bool complete = (sent == data->size());
+    data->clear();
+    return complete;
+}
+
+// Receive the next message of the message protocol
+inline bool recv_message(int sock, MessageReader *reader, Message *message)
+{
+    char buff[PACKET_BUFF_SIZE];
+    while (!reader->next(message)) {
+        if (reader->error()) return false;
+
+        ssize_t bytes = recv(sock, buff, sizeof(buff), 0);
+        if ((bytes < 0) && (errno == EINTR)) continue;
+        if (bytes <= 0) return false;
+        reader->feed(buff, bytes);
+    }
+    return true;
 }
 
 #endif  // __unix__
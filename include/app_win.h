@@ -26,27 +26,69 @@
 
 #include <iostream>
 #include <fstream>
+#include <mutex>
+#include <sstream>
 
 #include "xmlparser.h"
+#include "validator.h"
+#include "options.h"
+#include "service.h"
+#include "trace.h"
+#include "batch.h"
 
 #pragma comment(lib, "WS2_32.Lib")
 #define PACKET_BUFF_SIZE 5120
 
+// Data of one connection for the servicing thread
+struct ServiceContext {
+    std::string client;  // client info starting its lines in the log
+    SOCKET socket;
+    DocumentService *service;
+    uint64_t accepted;  // monotonic_ns() of accepting
+};
+
 // Server function
-int server(int connect_port);
+// (schema_file is a DTD to validate against or "n" for well-formedness only,
+//  rules_file is a file of semantic rules or "n")
+int server(int connect_port, const char *rules_file, const char *schema_file,
+           const ServerOptions &options);
 
 // Client function
-int client(int connect_port, const char *server_address, const char *file_name);
+int client(int connect_port, const char *server_address, const char *file_name,
+           const ClientOptions &options);
 
 // Function for service the connected users
-DWORD WINAPI client_service(LPVOID client_socket);
+// (takes ownership of ServiceContext)
+DWORD WINAPI client_service(LPVOID context);
+
+// Send all bytes of data (partial sends are continued), clears data
+inline bool send_all(SOCKET sock, std::string *data)
+{
+    size_t sent = 0;
+    while (sent < data->size()) {
+        int bytes = send(sock, data->data() + sent,
+                         static_cast<int>(data->size() - sent), 0);
+        if (bytes <= 0) break;
+        sent += bytes;
+    }
 
-// Function for getting handling time
-inline uint64_t tick()
+    bool complete = (sent == data->size());
+    data->clear();
+    return complete;
+}
+
+// Receive the next message of the message protocol
+inline bool recv_message(SOCKET sock, MessageReader *reader, Message *message)
 {
-    uint64_t time;
-    __asm__ __volatile__("rdtsc" : "=A" (time));
-    return time;
+    char buff[PACKET_BUFF_SIZE];
+    while (!reader->next(message)) {
+        if (reader->error()) return false;
+
+        int bytes = recv(sock, buff, sizeof(buff), 0);
+        if (bytes <= 0) return false;
+        reader->feed(buff, bytes);
+    }
+    return true;
 }
 
 #endif  // _WIN32
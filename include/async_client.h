@@ -0,0 +1,146 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#ifndef TRLWO_1286_INCLUDE_ASYNC_CLIENT_H_
+#define TRLWO_1286_INCLUDE_ASYNC_CLIENT_H_
+
+#include <stddef.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "validator.h"
+
+// Outcome of asynchronous validation
+enum kAsyncStatus {
+  asOk,              // verdict received
+  asTimeout,         // no verdict within the request timeout
+  asConnectionLost,  // connection broke with the request in flight
+  asServerError,     // server replied with an error message
+  asStopped,         // client was destroyed first
+};
+
+//
+// Result of asynchronous validation
+//
+struct AsyncResult {
+  kAsyncStatus status;
+  ValidationResult verdict;  // valid for asOk
+  std::string error;         // what went wrong otherwise
+  double latency;            // ms from validate_async to the result
+
+  AsyncResult() : status(asOk), latency(0) {}
+};
+
+//
+// Server of the pool
+//
+struct ServerAddress {
+  std::string host;  // name or IP
+  int port;
+
+  ServerAddress(const std::string &host, int port) : host(host), port(port) {}
+};
+
+//
+// Settings of the client pool
+//
+struct AsyncClientOptions {
+  AsyncClientOptions()
+      : connections(2),
+        depth(8),
+        connect_timeout(3000),
+        request_timeout(10000),
+        retry_interval(500),
+        documents_per_connection(0) {}
+
+  size_t connections;     // connections to each server
+  size_t depth;           // documents in flight on one connection
+  int connect_timeout;    // ms
+  int request_timeout;    // ms from validate_async to the verdict
+  int retry_interval;     // ms between attempts to connect a failed server
+  size_t documents_per_connection;  // connection is closed after so many
+                                    // documents, 0 - kept open
+};
+
+//
+// Asynchronous validation client
+// Keeps a pool of message protocol connections to the servers. Documents
+// wait in one queue, the connections take them as their pipelines have
+// room, so any number of validations may be pending from any threads.
+// Connections are opened on demand and reopened after failures.
+//
+class AsyncClient {
+ public:
+  explicit AsyncClient(const std::vector<ServerAddress> &servers,
+                       const AsyncClientOptions &options =
+                           AsyncClientOptions());
+  // Pending validations complete with asStopped
+  ~AsyncClient();
+
+  // Queue document for validation (thread-safe)
+  std::future<AsyncResult> validate_async(std::string document);
+  // Validate and wait for the result
+  AsyncResult validate(std::string document)
+  {
+    return validate_async(document).get();
+  }
+
+  const AsyncClientOptions &options() const { return options_; }
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Request {
+    std::string document;
+    std::promise<AsyncResult> promise;
+    Clock::time_point submitted;
+    Clock::time_point deadline;
+  };
+  typedef std::unique_ptr<Request> RequestPtr;
+
+  class Connection;
+  friend class Connection;
+
+  // Complete request with result
+  static void complete(Request *request, AsyncResult *result);
+  static void fail(Request *request, kAsyncStatus status,
+                   const std::string &error);
+
+  // Next request for a connection, NULL once stopping (expired requests
+  // are completed on the way)
+  RequestPtr next_request();
+  // Return request a connection could not send to the front of the queue
+  void requeue(RequestPtr request);
+  // Wait for stopping up to milliseconds (false if stopping)
+  bool pause(int milliseconds);
+
+  AsyncClientOptions                         options_;
+  std::mutex                                 lock_;
+  std::condition_variable                    changed_;
+  std::deque<RequestPtr>                     queue_;
+  std::atomic<bool>                          stopping_;
+  std::vector<std::unique_ptr<Connection> >  connections_;
+};
+
+#endif  // TRLWO_1286_INCLUDE_ASYNC_CLIENT_H_
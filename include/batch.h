@@ -0,0 +1,57 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#ifndef TRLWO_1286_INCLUDE_BATCH_H_
+#define TRLWO_1286_INCLUDE_BATCH_H_
+
+#include <stddef.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "validator.h"
+
+//
+// Connection of one batch worker to the server
+//
+class IBatchConnection {
+ public:
+  virtual ~IBatchConnection() {}
+
+  // Send document (false if the connection failed)
+  virtual bool send_document(const std::string &document) = 0;
+  // Receive verdict of the oldest sent document
+  virtual bool receive_verdict(ValidationResult *result) = 0;
+};
+
+// Opens connection of worker (NULL on failure)
+typedef std::function<IBatchConnection*()> BatchConnect;
+
+// Path names several files: a directory or '@list' file
+bool is_file_set(const char *path);
+// Files of directory (*.xml of it and its subdirectories, sorted) or of
+// '@list' file, one path per line ('@-' - list of the standard input)
+bool list_files(const char *path, std::vector<std::string> *files);
+
+// Validate files over jobs connections with up to depth documents in
+// flight on each, print verdicts and latencies of files and the summary
+// (files/s, MB/s and latency percentiles).
+// Returns the number of invalid and failed files.
+int run_batch(const std::vector<std::string> &files, size_t jobs,
+              size_t depth, BatchConnect connect);
+
+#endif  // TRLWO_1286_INCLUDE_BATCH_H_
@@ -0,0 +1,37 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#ifndef TRLWO_1286_INCLUDE_CANONICAL_H_
+#define TRLWO_1286_INCLUDE_CANONICAL_H_
+
+#include "xmlparser.h"
+#include "hash128.h"
+
+//
+// Digest of the canonical form of document, found by one scan of the
+// bytes before parsing
+// Whitespace-only text is dropped and runs of whitespace in text are
+// collapsed to one space. Whitespace between attributes is dropped and
+// attributes are sorted by name (duplicates keep their order). Comments are
+// dropped. Attribute values are kept as they are. So documents differing
+// only in indentation or attribute order get the same digest, and the
+// parser gives them the same tags, attributes and non-empty texts.
+// Markup the scan doesn't model the same way as the parser (DOCTYPE,
+// CDATA, unquoted or spaced-out attributes, ...) gives no digest (false).
+//
+bool canonical_digest(StringView document, Digest128 *digest);
+
+#endif  // TRLWO_1286_INCLUDE_CANONICAL_H_
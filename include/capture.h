@@ -0,0 +1,95 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#ifndef TRLWO_1286_INCLUDE_CAPTURE_H_
+#define TRLWO_1286_INCLUDE_CAPTURE_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <string>
+
+// Capture file of the received documents for replaying the traffic:
+// magic, then records of u32 length and the body
+//   u32 time high, u32 time low (microseconds since the epoch of the
+//   first byte), u32 connection, verdict (1 byte), id, document
+// in the message protocol encoding. Records are only appended.
+
+// Wall clock in microseconds since the epoch
+inline uint64_t wall_us()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+//
+// Captured document
+//
+struct CaptureRecord {
+  CaptureRecord() : time(0), connection(0), valid(false) {}
+
+  uint64_t time;         // wall_us() of the first byte
+  uint32_t connection;   // number of the connection in the capture
+  bool valid;            // verdict of the server
+  std::string id;        // name of the document or empty
+  std::string document;
+};
+
+//
+// Appending records to capture file, shared by the connections
+//
+class CaptureWriter {
+ public:
+  CaptureWriter() : connections_(0) {}
+
+  // Open file for appending (false and error message on failure)
+  bool open(const std::string &file_name, std::string *error);
+  // Number for the next connection
+  uint32_t next_connection() { return ++connections_; }
+  // Append record, flushed so the file is complete if the server dies
+  void write(const CaptureRecord &record);
+
+ private:
+  std::mutex             lock_;
+  std::ofstream          out_;
+  std::atomic<uint32_t>  connections_;
+};
+
+//
+// Reading capture file record by record
+//
+class CaptureReader {
+ public:
+  CaptureReader() : bad_(false), end_(0) {}
+
+  bool open(const std::string &file_name, std::string *error);
+  // Next record, false at the end or on a broken record (bad()). Records
+  // appended after opening aren't read, so replaying to the capturing
+  // server ends.
+  bool next(CaptureRecord *record);
+  // The file ended in a broken record
+  bool bad() const { return bad_; }
+
+ private:
+  std::ifstream   in_;
+  bool            bad_;
+  std::streamoff  end_;  // size of the file when opened
+};
+
+#endif  // TRLWO_1286_INCLUDE_CAPTURE_H_
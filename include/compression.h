@@ -0,0 +1,74 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#ifndef TRLWO_1286_INCLUDE_COMPRESSION_H_
+#define TRLWO_1286_INCLUDE_COMPRESSION_H_
+
+#include <stddef.h>
+#include <zlib.h>
+
+#include <string>
+
+#include "xmlparser.h"
+
+// Content encodings of uploads, named in the hello messages
+// (see mtHello in include/protocol.h)
+extern const char kDeflateEncoding[];
+
+// Encoding is in the comma separated list
+bool has_encoding(const std::string &list, const std::string &encoding);
+
+// Document compressed in the zlib format
+std::string deflate_document(StringView document,
+                             int level = Z_DEFAULT_COMPRESSION);
+
+// Shorter documents are sent as they are: little is saved, and the client
+// can send the file without copying it
+const size_t kDeflateMinSize = 64 * 1024;
+
+// Deflate document if it is worth it (false for documents shorter than
+// kDeflateMinSize or not made smaller)
+bool deflate_if_smaller(StringView document, std::string *deflated);
+
+//
+// Class for inflating a zlib stream piece by piece as it is received,
+// the compressed bytes aren't kept
+//
+class Inflater {
+ public:
+  // max_size - longest output accepted (against decompression bombs)
+  explicit Inflater(size_t max_size);
+  ~Inflater();
+
+  // Start the next stream
+  void reset();
+  // Inflate the next compressed bytes, appending the output to out
+  // (false on a broken stream, bytes after its end or too long output)
+  bool feed(const char *data, size_t size, std::string *out);
+  // The end of the stream was inflated
+  bool done() const { return done_; }
+
+ private:
+  Inflater(const Inflater&);
+  Inflater &operator=(const Inflater&);
+
+  z_stream  stream_;
+  bool      done_;
+  size_t    max_size_;
+  size_t    produced_;
+};
+
+#endif  // TRLWO_1286_INCLUDE_COMPRESSION_H_
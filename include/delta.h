@@ -0,0 +1,90 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#ifndef TRLWO_1286_INCLUDE_DELTA_H_
+#define TRLWO_1286_INCLUDE_DELTA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "hash128.h"
+
+//
+// Rolling checksum of rsync: the window slides by one byte in O(1)
+//
+class RollingChecksum {
+ public:
+  RollingChecksum() : a_(0), b_(0), size_(0) {}
+
+  // Checksum of window
+  void reset(const char *data, size_t size);
+  // Slide the window: drop byte out, add byte in
+  void roll(unsigned char out, unsigned char in)
+  {
+    a_ = static_cast<uint16_t>(a_ - out + in);
+    b_ = static_cast<uint16_t>(b_ - size_ * out + a_);
+  }
+
+  uint32_t value() const { return a_ | (static_cast<uint32_t>(b_) << 16); }
+
+ private:
+  uint16_t a_;
+  uint16_t b_;
+  uint32_t size_;
+};
+
+//
+// Signature of block of the stored version
+//
+struct BlockSignature {
+  uint32_t  weak;    // rolling checksum
+  Digest128 strong;  // Hash128 of block
+};
+
+//
+// Signatures of the full blocks of the stored version
+//
+struct Signatures {
+  uint32_t block_size;
+  Digest128 base;  // digest of the whole stored version
+  std::vector<BlockSignature> blocks;
+
+  Signatures() : block_size(0) {}
+};
+
+// Block size for document size (about square root, like rsync)
+uint32_t choose_block_size(size_t size);
+
+// Signatures of stored version
+Signatures make_signatures(const std::string &base, uint32_t block_size);
+
+std::string encode_signatures(const Signatures &signatures);
+bool decode_signatures(const std::string &payload, Signatures *signatures);
+
+// Delta of target to the version with signatures: runs of copied blocks
+// ('C' <first> <count>) and literal bytes ('L' <length> <bytes>)
+std::string make_delta(const Signatures &signatures, const std::string &target);
+
+// Rebuild target from base and delta (false and error message on failure,
+// also when target would grow past kMaxPayload)
+bool apply_delta(const std::string &base, uint32_t block_size,
+                 const std::string &delta, size_t pos, std::string *target,
+                 std::string *error);
+
+#endif  // TRLWO_1286_INCLUDE_DELTA_H_
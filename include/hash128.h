@@ -0,0 +1,84 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#ifndef TRLWO_1286_INCLUDE_HASH128_H_
+#define TRLWO_1286_INCLUDE_HASH128_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+//
+// 128-bit digest
+//
+struct Digest128 {
+  uint64_t high;
+  uint64_t low;
+
+  Digest128() : high(0), low(0) {}
+  Digest128(uint64_t _high, uint64_t _low) : high(_high), low(_low) {}
+
+  bool operator==(const Digest128 &other) const
+  {
+    return (high == other.high) && (low == other.low);
+  }
+  bool operator!=(const Digest128 &other) const { return !(*this == other); }
+
+  // 32 hex digits
+  std::string to_string() const;
+};
+
+// Hasher of Digest128 for unordered containers
+struct Digest128Hash {
+  size_t operator()(const Digest128 &digest) const
+  {
+    return static_cast<size_t>(digest.low ^ (digest.high * 31));
+  }
+};
+
+//
+// Streaming MurmurHash3 x64 128 (fast non-cryptographic hash)
+// Data may come in pieces of any size, the digest is the same as of the
+// whole buffer.
+//
+class Hash128 {
+ public:
+  explicit Hash128(uint64_t seed = 0);
+
+  // Add data
+  void update(const char *data, size_t size);
+  // Digest of all data added so far
+  Digest128 digest() const;
+
+  // Digest of buffer
+  static Digest128 of(const char *data, size_t size, uint64_t seed = 0)
+  {
+    Hash128 hash(seed);
+    hash.update(data, size);
+    return hash.digest();
+  }
+
+ private:
+  void block(const unsigned char *data);
+
+  uint64_t      h1_;
+  uint64_t      h2_;
+  uint64_t      length_;
+  unsigned char tail_[16];
+  size_t        tail_size_;
+};
+
+#endif  // TRLWO_1286_INCLUDE_HASH128_H_
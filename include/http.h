@@ -0,0 +1,114 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#ifndef TRLWO_1286_INCLUDE_HTTP_H_
+#define TRLWO_1286_INCLUDE_HTTP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "alloc_stats.h"
+#include "compression.h"
+#include "hash128.h"
+#include "service.h"
+
+// Longest request head (request line and headers)
+const size_t kMaxHttpHead = 64 * 1024;
+
+//
+// Protocol state of one connection of the HTTP/1.1 listener
+//   POST /validate  - the body is the document (Content-Length or chunked,
+//                     Content-Encoding: deflate is inflated), answered with
+//                     {"valid":...,"message":...} or with a text line if
+//                     the Accept header asks for text/plain.
+//                     X-Document-Id names it for incremental validation.
+//   GET /health     - "ok" for load balancers
+// Connections are kept alive (unless "Connection: close" or HTTP/1.0
+// without keep-alive) and pipelined requests are answered in order. The
+// body goes to the same DocumentService as the native protocol, decoded
+// and hashed as it comes.
+//
+class HttpSession : public IConnectionSession {
+ public:
+  explicit HttpSession(DocumentService *service);
+
+  virtual void feed(const char *data, size_t size, std::string *reply);
+  virtual void finish(std::string *reply) { done_ = true; }
+  virtual bool done() const { return done_; }
+
+  virtual void take_verdicts(std::vector<Verdict> *verdicts)
+  {
+    verdicts->swap(verdicts_);
+    verdicts_.clear();
+  }
+
+ private:
+  enum kState {
+    hsHead,        // request line and headers
+    hsBody,        // Content-Length bytes of body
+    hsChunkSize,   // size line of the next chunk
+    hsChunkData,   // bytes of chunk
+    hsChunkEnd,    // CRLF after the chunk bytes
+    hsTrailer,     // trailer lines after the last chunk
+  };
+
+  // Parse the head of the next request (false if not received yet)
+  bool parse_head(std::string *reply);
+  // Step of the body states (false if more bytes are needed)
+  bool parse_body(std::string *reply);
+  // Take up to body_left_ received bytes of the body: the document is
+  // inflated and hashed (false and answered if the body is bad)
+  bool take_body(std::string *reply);
+  // Validate the received document and answer
+  void complete(std::string *reply);
+  // wall_us() of the first byte of the request
+  uint64_t arrival_time() const;
+  // Append the received document to the capture if there is one
+  void capture(uint64_t arrived, const Verdict &verdict);
+  // Answer with status and body; close - the connection ends after it
+  void respond(int status, const std::string &content_type,
+               const std::string &body, bool close, std::string *reply);
+  // Bad request: answered and the connection closed
+  void fail(int status, const std::string &message, std::string *reply);
+
+  DocumentService  *service_;
+  kState           state_;
+  bool             done_;
+  std::string      buffer_;     // received bytes not taken yet
+  size_t           taken_;      // taken bytes at the start of buffer_
+  uint32_t         connection_;  // number in the capture, 0 - none
+
+  // Current request
+  bool             keep_alive_;
+  bool             http10_;      // HTTP/1.0 client (keep-alive is told)
+  bool             plain_text_;  // answer with a text line
+  size_t           body_left_;   // of the body or the current chunk
+  std::string      id_;
+  std::string      document_;
+  Hash128          hash_;
+  uint64_t         receive_start_;  // first byte of the request, 0 - none
+  AllocationScope  allocations_;    // of the current request
+  std::unique_ptr<Inflater> inflater_;  // created by the first one
+  bool             deflated_;
+
+  std::vector<Verdict> verdicts_;
+};
+
+#endif  // TRLWO_1286_INCLUDE_HTTP_H_
@@ -0,0 +1,122 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#ifndef TRLWO_1286_INCLUDE_LATENCY_H_
+#define TRLWO_1286_INCLUDE_LATENCY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+
+// Phases of handling the documents of a connection
+enum kPhase {
+  phAccept,      // accepted to the first byte received
+  phReceive,     // first byte to the whole document received
+  phValidate,    // cache lookups and the parse pass with the validation
+  phSend,        // sending the reply
+  phConnection,  // accepted to closed
+  phCount,
+};
+
+const char *phase_name(kPhase phase);
+
+// Stripe of the calling thread, for counters split between threads
+size_t thread_stripe(size_t stripes);
+
+// Monotonic time in nanoseconds
+inline uint64_t monotonic_ns()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//
+// Histogram of latencies in nanoseconds with log-linear buckets (as HDR
+// histograms): 16 buckets per power of two, so percentiles are within
+// 1/16 of the true value. Counters are atomic, recording doesn't lock.
+//
+class LatencyHistogram {
+ public:
+  static const size_t kSubBuckets = 16;
+  static const size_t kBuckets = 61 * kSubBuckets;
+
+  LatencyHistogram();
+
+  void record(uint64_t ns);
+
+  uint64_t count(size_t bucket) const
+  {
+    return counts_[bucket].load(std::memory_order_relaxed);
+  }
+  uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+  uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+
+  static size_t bucket_of(uint64_t ns);
+  // Highest value of bucket
+  static uint64_t bucket_value(size_t bucket);
+
+ private:
+  std::atomic<uint64_t> counts_[kBuckets];
+  std::atomic<uint64_t> max_;
+  std::atomic<uint64_t> sum_;
+};
+
+//
+// Latencies of the phases
+// Each thread records into its own stripe of histograms, so the threads
+// don't contend for the counters. Percentiles merge the stripes.
+//
+class LatencyStats {
+ public:
+  struct Summary {
+    uint64_t count;
+    double p50;   // ms
+    double p90;
+    double p99;
+    double p999;
+    double max;
+    double sum;   // s
+  };
+
+  LatencyStats();
+
+  void record(kPhase phase, uint64_t ns);
+  // Record time from start to now
+  void record_since(kPhase phase, uint64_t start)
+  {
+    record(phase, monotonic_ns() - start);
+  }
+
+  Summary summary(kPhase phase) const;
+  // Table of the phases for printing
+  std::string report() const;
+
+ private:
+  static const size_t kStripes = 16;
+
+  LatencyHistogram &histogram(size_t stripe, kPhase phase)
+  {
+    return histograms_[stripe * phCount + phase];
+  }
+
+  std::unique_ptr<LatencyHistogram[]> histograms_;
+};
+
+#endif  // TRLWO_1286_INCLUDE_LATENCY_H_
@@ -0,0 +1,101 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#ifndef TRLWO_1286_INCLUDE_METRICS_H_
+#define TRLWO_1286_INCLUDE_METRICS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include "alloc_stats.h"
+
+// Counters of the server
+enum kCounter {
+  ctConnections,     // accepted connections
+  ctDocuments,       // documents answered (with cached verdicts)
+  ctValid,           // valid verdicts
+  ctInvalid,         // invalid verdicts
+  ctBytesIn,         // received bytes
+  ctBytesOut,        // sent bytes
+  ctParsedBytes,     // bytes of documents parsed (not cached)
+  ctParseNs,         // time of parsing them
+  ctParses,          // documents parsed
+  ctParseAllocations,      // allocations of parsing them (ALLOC_STATS)
+  ctParseAllocatedBytes,
+  ctRequestAllocations,    // allocations of receiving, validating and
+  ctRequestAllocatedBytes, // answering documents (ALLOC_STATS)
+  ctDeflatedBytes,   // received payload bytes of deflated documents
+  ctInflatedBytes,   // bytes inflated from them
+  ctCount,
+};
+
+//
+// Counters and gauges of the server for the metrics listener
+// Counters are split into stripes of threads, the request path only adds
+// to its own stripe without locks. Reading sums the stripes.
+//
+class ServerMetrics {
+ public:
+  ServerMetrics();
+
+  void add(kCounter counter, uint64_t value);
+  uint64_t value(kCounter counter) const;
+
+  // Gauges
+  void connection_opened() { ++active_connections_; }
+  void connection_closed() { --active_connections_; }
+  int64_t active_connections() const { return active_connections_.load(); }
+  void validation_started() { ++in_progress_; }
+  void validation_finished() { --in_progress_; }
+  int64_t in_progress() const { return in_progress_.load(); }
+
+  // Allocations of one parse or one request (document)
+  void add_parse_allocations(const AllocationStats &stats);
+  void add_request_allocations(const AllocationStats &stats);
+  // Highest peak of live bytes of one parse or request
+  uint64_t parse_peak() const { return parse_peak_.load(); }
+  uint64_t request_peak() const { return request_peak_.load(); }
+
+ private:
+  static const size_t kStripes = 16;
+
+  // Counters of one stripe, padded to own cache lines
+  struct Stripe {
+    std::atomic<uint64_t> values[ctCount];
+    char pad[64];
+  };
+
+  std::unique_ptr<Stripe[]> stripes_;
+  std::atomic<int64_t>      active_connections_;
+  std::atomic<int64_t>      in_progress_;
+  std::atomic<uint64_t>     parse_peak_;
+  std::atomic<uint64_t>     request_peak_;
+};
+
+class DocumentService;
+
+// Metrics in the Prometheus text format
+std::string metrics_text(DocumentService *service);
+// HTTP response to the request of the metrics listener
+// ("GET /metrics" - the metrics, anything else - 404)
+std::string metrics_response(const std::string &request,
+                             DocumentService *service);
+
+#endif  // TRLWO_1286_INCLUDE_METRICS_H_
@@ -0,0 +1,30 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#ifndef TRLWO_1286_INCLUDE_OFFLINE_H_
+#define TRLWO_1286_INCLUDE_OFFLINE_H_
+
+#include "options.h"
+
+// Validate without the server: path is a file, a directory, an '@list' file
+// or "-" for one document of the standard input. The files are validated
+// by a pool of threads sharing one validator, like the server threads do.
+// (schema_file and rules_file are as of the server, "n" - none)
+// Returns the number of invalid and failed files.
+int validate_offline(const char *rules_file, const char *schema_file,
+                     const char *path, const OfflineOptions &options);
+
+#endif  // TRLWO_1286_INCLUDE_OFFLINE_H_
@@ -0,0 +1,95 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#ifndef TRLWO_1286_INCLUDE_OPTIONS_H_
+#define TRLWO_1286_INCLUDE_OPTIONS_H_
+
+#include <stddef.h>
+#include <string>
+
+//
+// Optional settings of the server, given as 'key=value' words
+// after the server command
+//
+struct ServerOptions {
+  ServerOptions()
+      : cache_size(4096),
+        canonical(true),
+        documents(64),
+        metrics_port(0),
+        trace_sample(1),
+        http_port(0) {}
+
+  // Apply one 'key=value' word (false and error message on failure)
+  bool parse(const std::string &option, std::string *error);
+
+  size_t cache_size;            // cache=<entries>, 0 - no cache
+  std::string cache_snapshot;   // snapshot=<file>, empty - no snapshot
+  bool canonical;               // canonical=<0|1>, cache misses are looked
+                                // up by canonical form before parsing
+  size_t documents;             // documents=<count> kept for incremental
+                                // validation by id, 0 - none
+  int metrics_port;             // metrics=<port> of the metrics listener,
+                                // 0 - none
+  std::string trace_file;       // trace=<file> of Chrome trace events,
+                                // empty - no tracing
+  size_t trace_sample;          // trace_sample=<n>, one of n connections
+                                // is traced
+  std::string capture_file;     // capture=<file> the received documents
+                                // are appended to, empty - none
+  std::string unix_socket;      // unix=<path> of a Unix domain socket to
+                                // listen on as well, empty - none
+  std::string ring_socket;      // shm=<path> of the socket attaching
+                                // shared memory rings (Linux), empty - none
+  int http_port;                // http=<port> of the HTTP/1.1 listener
+                                // (POST /validate), 0 - none
+};
+
+//
+// Optional settings of the client, 'key=value' words after the command
+//
+struct ClientOptions {
+  ClientOptions() : delta(true), jobs(4), depth(8), compress(true) {}
+
+  // Apply one 'key=value' word (false and error message on failure)
+  bool parse(const std::string &option, std::string *error);
+
+  std::string document_id;      // id=<name>, for incremental validation
+  bool delta;                   // delta=<0|1>, named documents are sent
+                                // as delta to the version on the server
+  size_t jobs;                  // jobs=<n>, connections of directory mode
+  size_t depth;                 // depth=<n>, documents in flight on each
+                                // connection of directory mode
+  bool compress;                // compress=<0|1>, documents are deflated
+                                // if the server accepts it (not over
+                                // local sockets)
+};
+
+//
+// Optional settings of the offline validation, 'key=value' words after
+// the command
+//
+struct OfflineOptions {
+  OfflineOptions() : jobs(0) {}
+
+  // Apply one 'key=value' word (false and error message on failure)
+  bool parse(const std::string &option, std::string *error);
+
+  size_t jobs;                  // jobs=<n> validating threads, 0 - one per
+                                // core
+};
+
+#endif  // TRLWO_1286_INCLUDE_OPTIONS_H_
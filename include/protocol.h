@@ -0,0 +1,142 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#ifndef TRLWO_1286_INCLUDE_PROTOCOL_H_
+#define TRLWO_1286_INCLUDE_PROTOCOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include "hash128.h"
+#include "validator.h"
+
+//
+// Class for decoding the document sent by the client:
+// one line per frame of fixed size padded with '\0',
+// the end is "~~" at the start of a frame.
+// Optional frame "~#<id>" names the document (see SubtreeCache).
+//
+class LegacyFrameDecoder {
+ public:
+  explicit LegacyFrameDecoder(size_t frame_size);
+
+  // Append decoded text of received data to document
+  // (bytes after the end mark are ignored)
+  void feed(const char *data, size_t size, std::string *document);
+  // The end mark was received, or the document got too long
+  bool done() const { return done_; }
+  // The document or its id grew past kMaxPayload
+  bool too_long() const { return too_long_; }
+  // Id of document, empty if the client sent none
+  const std::string &document_id() const { return document_id_; }
+
+ private:
+  size_t  frame_size_;
+  size_t  offset_;    // position in the current frame
+  bool    in_line_;   // no padding seen in the current frame yet
+  bool    tilde_;     // '~' at the frame start is pending
+  bool    in_id_;     // the current frame is the id frame
+  bool    done_;
+  bool    too_long_;
+  std::string document_id_;
+};
+
+// Start of connection of the message protocol
+// (text documents never start with it)
+extern const char kProtocolMagic[4];
+
+// Largest payload of message
+const uint32_t kMaxPayload = 256 * 1024 * 1024;
+
+// Types of messages
+enum kMessageType {
+  mtName = 'N',               // client: id of the next document
+  mtDocument = 'F',           // client: the whole document
+  mtSignaturesRequest = 'S',  // client: id
+  mtSignatures = 's',         // server: signatures of the stored version
+  mtDelta = 'D',              // client: id, delta to the stored version
+  mtVerdict = 'V',            // server: valid flag and message
+  mtError = 'E',              // server: message, the client may retry
+  mtHello = 'H',              // client: encodings it can send, comma
+                              // separated (old servers answer mtError and
+                              // close the connection)
+  mtEncodings = 'h',          // server: encodings of the hello it accepts
+  mtDeflatedDocument = 'Z',   // client: the whole document, zlib format
+};
+
+//
+// Message: type (1 byte), payload length (4 bytes, big-endian), payload
+//
+struct Message {
+  char type;
+  std::string payload;
+};
+
+// Encoded message
+std::string encode_message(char type, const std::string &payload);
+
+//
+// Class for splitting the received bytes into messages
+//
+class MessageReader {
+ public:
+  static const size_t kHeaderSize = 5;
+
+  MessageReader() : error_(false) {}
+
+  // Add received data
+  void feed(const char *data, size_t size) { buffer_.append(data, size); }
+  // Take the next complete message
+  bool next(Message *message);
+
+  // Header of the next message is received
+  // (for taking long payloads in pieces, see take())
+  bool header(char *type, uint32_t *length);
+  // Drop the header of the next message
+  void skip_header() { buffer_.erase(0, kHeaderSize); }
+  // Move up to max received bytes to out, returns the number of them
+  size_t take(size_t max, std::string *out);
+  // Payload was too long
+  bool error() const { return error_; }
+
+ private:
+  std::string buffer_;
+  bool        error_;
+};
+
+// Payload fields, integers are big-endian
+void put_u32(std::string *out, uint32_t value);
+void put_digest(std::string *out, const Digest128 &digest);
+void put_string(std::string *out, const std::string &value);
+
+// Read fields at *pos (false if the payload is too short)
+bool get_u32(const std::string &in, size_t *pos, uint32_t *value);
+bool get_digest(const std::string &in, size_t *pos, Digest128 *digest);
+bool get_string(const std::string &in, size_t *pos, std::string *value);
+
+// Payload of verdict message: '1' or '0' and the message
+std::string encode_verdict(const ValidationResult &result);
+bool decode_verdict(const std::string &payload, ValidationResult *result);
+
+// Server address "unix:<path>" of a Unix domain socket: the path
+// (false for host names and IPs)
+bool unix_socket_path(const std::string &address, std::string *path);
+// Server address "shm:<path>" of the socket attaching shared memory rings
+// (see include/shm_ring.h): the path
+bool ring_socket_path(const std::string &address, std::string *path);
+
+#endif  // TRLWO_1286_INCLUDE_PROTOCOL_H_
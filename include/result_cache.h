@@ -0,0 +1,92 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#ifndef TRLWO_1286_INCLUDE_RESULT_CACHE_H_
+#define TRLWO_1286_INCLUDE_RESULT_CACHE_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "hash128.h"
+#include "validator.h"
+
+//
+// Bounded cache of verdicts by document digest
+// Split into shards with own lock and LRU list, so concurrent clients
+// rarely wait for each other.
+//
+class ResultCache {
+ public:
+  // capacity - total number of verdicts (split evenly between shards)
+  explicit ResultCache(size_t capacity, size_t shards = 16);
+
+  // Find verdict (counts hit or miss)
+  bool lookup(const Digest128 &key, ValidationResult *result);
+  // Store verdict, evicting the least recently used of the shard
+  void store(const Digest128 &key, const ValidationResult &result);
+  // Find verdict shared by the documents of one canonical form (counts
+  // shared on success, misses are already counted by lookup)
+  bool lookup_shared(const Digest128 &canonical, ValidationResult *result);
+
+  uint64_t hits() const { return hits_.load(); }
+  uint64_t misses() const { return misses_.load(); }
+  // Misses answered by the verdict of the same canonical form
+  uint64_t shared() const { return shared_.load(); }
+  // Hits / lookups
+  double hit_rate() const;
+  size_t size() const;
+
+  // Snapshot of the cache, verdicts are only valid for the same
+  // schema and rules (config is the fingerprint of them)
+  bool save(const char *file_name, uint64_t config) const;
+  bool load(const char *file_name, uint64_t config);
+
+ private:
+  typedef std::pair<Digest128, ValidationResult> Entry;
+  typedef std::list<Entry> EntryList;
+
+  struct Shard {
+    std::mutex lock;
+    // Most recently used first
+    EntryList lru;
+    std::unordered_map<Digest128, EntryList::iterator, Digest128Hash> index;
+  };
+
+  // New entry of shard (the shard is locked)
+  void insert(Shard *shard, const Digest128 &key,
+              const ValidationResult &result);
+
+  Shard &shard_of(const Digest128 &key)
+  {
+    return *shards_[key.low % shards_.size()];
+  }
+
+  std::vector<std::unique_ptr<Shard> > shards_;
+  size_t                               shard_capacity_;
+  std::atomic<uint64_t>                hits_;
+  std::atomic<uint64_t>                misses_;
+  std::atomic<uint64_t>                shared_;
+};
+
+#endif  // TRLWO_1286_INCLUDE_RESULT_CACHE_H_
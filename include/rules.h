@@ -0,0 +1,121 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#ifndef TRLWO_1286_INCLUDE_RULES_H_
+#define TRLWO_1286_INCLUDE_RULES_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "xmlparser.h"
+
+// Kind of rule
+enum kRuleKind {
+  rkUnique,   // unique  element@attribute
+  rkRange,    // range   element@attribute <min> <max>
+  rkPattern,  // pattern element@attribute "<pattern>"
+};
+
+// Parse decimal integer, digits are converted 8 at a time (SWAR)
+bool parse_integer(StringView text, int64_t *value);
+
+// Match pattern: '%d' - one or more digits, '%a' - one or more letters,
+// '[abc]' - one of the characters, anything else matches itself
+bool match_pattern(StringView pattern, StringView text);
+
+//
+// Semantic rule on attribute values
+//
+struct Rule {
+  kRuleKind kind;
+  std::string element;
+  const std::string *attribute;  // interned
+  // Optional condition 'if <attribute>=<value>'
+  const std::string *when_attribute;
+  std::string when_value;
+
+  int64_t min;
+  int64_t max;
+  std::string pattern;
+
+  std::string source;  // text of rule for messages
+};
+
+//
+// Compiled rules file
+// One rule per line, '#' starts a comment:
+//   unique  uut@name
+//   range   interface@port 1 65535 if type=socket
+//   pattern interface@params "%d,%d,[NOEMS],%d"
+//
+class RuleSet {
+ public:
+  RuleSet() : fingerprint_(0) {}
+
+  // Compile rules text (false and error message on failure)
+  bool compile(const std::string &text, std::string *error);
+  // Load and compile rules file
+  bool load(const char *file_name, std::string *error);
+
+  const std::vector<Rule> &rules() const { return rules_; }
+  // FNV-1a 64 of the rules text
+  uint64_t fingerprint() const { return fingerprint_; }
+
+  // Indices of rules of element or NULL
+  const std::vector<size_t> *rules_of(const std::string &element) const
+  {
+    std::unordered_map<std::string, std::vector<size_t> >::const_iterator it =
+        by_element_.find(element);
+    return (it == by_element_.end()) ? NULL : &it->second;
+  }
+
+ private:
+  std::vector<Rule>                                      rules_;
+  std::unordered_map<std::string, std::vector<size_t> >  by_element_;
+  uint64_t                                               fingerprint_;
+};
+
+//
+// Checker of rules in the parse events stream (one per document)
+//
+class RuleChecker : public IParseEvents {
+ public:
+  explicit RuleChecker(const RuleSet *rules);
+  virtual ~RuleChecker() {}
+
+  virtual void start_tag(ITag *pTag);
+  virtual void end_tag(ITag *pTag) {}
+  virtual void content_tag(ITag *pTag, const std::string &content) {}
+
+  // No rule was broken
+  bool result() const { return valid_; }
+  // First broken rule
+  const std::string &error() const { return error_; }
+
+ private:
+  void fail(const Rule &rule, StringView value, const char *reason);
+
+  const RuleSet *rules_;
+  // Seen values of unique rules, by rule index
+  std::vector<std::unordered_set<std::string> > seen_;
+  bool          valid_;
+  std::string   error_;
+};
+
+#endif  // TRLWO_1286_INCLUDE_RULES_H_
@@ -0,0 +1,159 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#ifndef TRLWO_1286_INCLUDE_SCHEMA_H_
+#define TRLWO_1286_INCLUDE_SCHEMA_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "xmlparser.h"
+
+// Kind of element content
+enum kContentKind {
+  ckEmpty,     // EMPTY
+  ckAny,       // ANY
+  ckMixed,     // (#PCDATA|a|b)*
+  ckChildren,  // (a, (b|c)+, d?)
+};
+
+// Usage of attribute
+enum kAttributeUse {
+  auImplied,
+  auRequired,
+  auFixed,
+};
+
+//
+// Deterministic automaton of one content model
+// Symbols are the element ids of the schema, state 0 is the start state.
+//
+struct ContentAutomaton {
+  int symbols;
+  // states x symbols, -1 - element is not allowed here
+  std::vector<int32_t> next;
+  std::vector<uint8_t> accepting;
+
+  ContentAutomaton() : symbols(0) {}
+
+  int32_t step(int32_t state, int symbol) const
+  {
+    return next[state * symbols + symbol];
+  }
+
+  size_t states() const { return accepting.size(); }
+};
+
+//
+// Declaration of attribute
+//
+struct AttributeDecl {
+  const std::string *name;          // interned
+  kAttributeUse use;
+  std::vector<std::string> values;  // enumeration, empty - any value
+  std::string fixed;
+};
+
+//
+// Declaration of element
+//
+struct ElementDecl {
+  std::string name;
+  kContentKind kind;
+  ContentAutomaton automaton;
+  std::vector<AttributeDecl> attributes;
+};
+
+//
+// Compiled schema
+// Built from a DTD subset: <!ELEMENT> with EMPTY, ANY, mixed and children
+// content models, <!ATTLIST> with CDATA-like types, enumerations and
+// #REQUIRED, #IMPLIED, #FIXED defaults. The first declared element is root.
+//
+class Schema {
+ public:
+  Schema() : root_(-1), fingerprint_(0) {}
+
+  // Compile DTD text (false and error message on failure)
+  bool compile(const std::string &dtd, std::string *error);
+  // Load and compile DTD file
+  bool load(const char *file_name, std::string *error);
+
+  // Id of element or -1 if it isn't declared
+  int element_id(const std::string &name) const
+  {
+    std::unordered_map<std::string, int>::const_iterator it = ids_.find(name);
+    return (it == ids_.end()) ? -1 : it->second;
+  }
+
+  const ElementDecl &element(int id) const { return elements_[id]; }
+  size_t element_count() const { return elements_.size(); }
+  int root() const { return root_; }
+  // FNV-1a 64 of the DTD text, identifies generated validators
+  uint64_t fingerprint() const { return fingerprint_; }
+
+  // FNV-1a 64 of text
+  static uint64_t fingerprint_of(const std::string &text);
+
+ private:
+  std::vector<ElementDecl>             elements_;
+  std::unordered_map<std::string, int> ids_;
+  int                                  root_;
+  uint64_t                             fingerprint_;
+};
+
+//
+// Validator of the parse events stream against schema
+// Without schema only checks that the document is well-formed.
+//
+class SchemaValidator : public IParseEvents {
+ public:
+  // root - id of the expected root element (-1 - root of the schema),
+  // other elements are validated as fragments of the document
+  explicit SchemaValidator(const Schema *schema = NULL, int root = -1);
+  virtual ~SchemaValidator() {}
+
+  virtual void start_tag(ITag *pTag);
+  virtual void end_tag(ITag *pTag);
+  virtual void content_tag(ITag *pTag, const std::string &content);
+
+  // Whole document was valid (call after the parsing)
+  bool result() const;
+  // First error
+  const std::string &error() const { return error_; }
+
+  void reset();
+
+ private:
+  struct Frame {
+    int     element;
+    int32_t state;
+  };
+
+  void fail(const std::string &message);
+  void check_attributes(const ElementDecl &decl, ITag *pTag);
+
+  const Schema       *schema_;
+  int                root_;
+  std::vector<Frame> stack_;
+  bool               valid_;
+  bool               root_closed_;
+  std::string        error_;
+};
+
+#endif  // TRLWO_1286_INCLUDE_SCHEMA_H_
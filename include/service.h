@@ -0,0 +1,218 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#ifndef TRLWO_1286_INCLUDE_SERVICE_H_
+#define TRLWO_1286_INCLUDE_SERVICE_H_
+
+#include <stddef.h>
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "alloc_stats.h"
+#include "canonical.h"
+#include "capture.h"
+#include "compression.h"
+#include "delta.h"
+#include "hash128.h"
+#include "latency.h"
+#include "metrics.h"
+#include "options.h"
+#include "protocol.h"
+#include "result_cache.h"
+#include "subtree_cache.h"
+#include "validator.h"
+
+// How the verdict was obtained
+enum kVerdictSource {
+  vsValidated,  // whole document was validated
+  vsCached,     // the same bytes were validated before
+  vsCanonical,  // the same canonical form was validated before
+  vsSubtrees,   // only the changed subtrees were validated
+};
+
+// Note of verdict source for the log ("" for validated documents)
+const char *verdict_source_note(kVerdictSource source);
+
+//
+// Verdict of one received document
+//
+struct Verdict {
+  ValidationResult result;
+  kVerdictSource source;
+};
+
+//
+// Validation service shared by all connections: the validator, the caches
+// and the stored versions of named documents (bases of delta uploads)
+//
+class DocumentService {
+ public:
+  DocumentService(const Validator *validator, const ServerOptions &options);
+
+  // Validate document (id is empty for unnamed documents), parsed in
+  // place: the bytes may be in a receive buffer or shared memory
+  // (keep - the verdict may be kept in the caches; false for bytes the
+  //  sender can change while they are read, the caches are only looked up)
+  ValidationResult validate(const std::string &id, StringView document,
+                            const Digest128 &digest, kVerdictSource *source,
+                            bool keep = true);
+
+  // Signatures of the stored version of named document
+  Signatures signatures(const std::string &id);
+  // Rebuild document from delta to the stored version with digest base
+  // (zero digest - delta to the empty document)
+  bool apply_delta(const std::string &id, const Digest128 &base,
+                   const std::string &delta, size_t pos,
+                   std::string *document, std::string *error);
+  // Store version of named document as the base of the next delta
+  void keep_version(const std::string &id, const std::string &document,
+                    const Digest128 &digest);
+
+  const Validator &validator() const { return *validator_; }
+  // Cache of verdicts or NULL
+  ResultCache *cache() { return cache_.get(); }
+  // Latencies of the phases of all connections
+  LatencyStats &latency() { return latency_; }
+  // Counters of the metrics listener
+  ServerMetrics &metrics() { return metrics_; }
+
+  // Append the received documents to capture file (false and error
+  // message on failure)
+  bool start_capture(const std::string &file_name, std::string *error);
+  // Capture of the received documents or NULL
+  CaptureWriter *capture() { return capture_.get(); }
+
+ private:
+  struct Version {
+    std::string text;
+    Digest128 digest;
+  };
+  typedef std::shared_ptr<const Version> VersionPtr;
+  typedef std::list<std::pair<std::string, VersionPtr> > VersionList;
+
+  VersionPtr find_version(const std::string &id);
+  // Verdict from the caches or by validating
+  ValidationResult lookup_or_validate(const std::string &id,
+                                      StringView document,
+                                      const Digest128 &digest,
+                                      kVerdictSource *source, bool keep);
+
+  const Validator                *validator_;
+  std::unique_ptr<ResultCache>   cache_;
+  bool                           canonical_;  // look up by canonical form
+  std::unique_ptr<SubtreeCache>  subtrees_;
+  LatencyStats                   latency_;
+  ServerMetrics                  metrics_;
+  std::unique_ptr<CaptureWriter> capture_;
+
+  size_t                                                versions_capacity_;
+  std::mutex                                            versions_lock_;
+  // Most recently used first
+  VersionList                                           versions_;
+  std::unordered_map<std::string, VersionList::iterator> version_index_;
+};
+
+//
+// Interface of the protocol state of one connection
+// The received bytes are fed in as they come, the bytes to send back are
+// appended to reply.
+//
+class IConnectionSession {
+ public:
+  virtual ~IConnectionSession() {}
+
+  // Process received data
+  virtual void feed(const char *data, size_t size, std::string *reply) = 0;
+  // The client closed the connection
+  virtual void finish(std::string *reply) = 0;
+  // Nothing more to receive
+  virtual bool done() const = 0;
+  // Move out verdicts of the documents validated so far
+  virtual void take_verdicts(std::vector<Verdict> *verdicts) = 0;
+};
+
+//
+// Protocol state of one connection of the native protocol
+// The received bytes are fed in as they come, the bytes to send back are
+// appended to reply. Connections starting with kProtocolMagic speak the
+// message protocol and may send any number of documents (verdicts come
+// back in the same order), others send one document in legacy frames.
+// Documents may come deflated if the client said hello first.
+//
+class Session : public IConnectionSession {
+ public:
+  Session(DocumentService *service, size_t frame_size);
+
+  virtual void feed(const char *data, size_t size, std::string *reply);
+  // (legacy clients may skip "~~")
+  virtual void finish(std::string *reply);
+  virtual bool done() const { return done_; }
+
+  virtual void take_verdicts(std::vector<Verdict> *verdicts)
+  {
+    verdicts->swap(verdicts_);
+    verdicts_.clear();
+  }
+
+ private:
+  enum kMode { smDetect, smLegacy, smMessages };
+
+  // First bytes of the next document
+  void begin_document();
+  // wall_us() of the first bytes of the document
+  uint64_t arrival_time() const;
+  // Append the received document to the capture if there is one
+  void capture(uint64_t arrived, const std::string &id,
+               const Verdict &verdict);
+  void feed_legacy(const char *data, size_t size, std::string *reply);
+  void feed_messages(const char *data, size_t size, std::string *reply);
+  void handle(const Message &message, std::string *reply);
+  // Validate the legacy document and reply with one frame
+  void complete_legacy(std::string *reply);
+  // Validate the received document and reply with verdict message
+  void complete_document(std::string *reply);
+
+  DocumentService     *service_;
+  size_t              frame_size_;
+  kMode               mode_;
+  bool                done_;
+  std::string         prefix_;     // first bytes until the mode is known
+
+  LegacyFrameDecoder  decoder_;
+  std::string         document_;
+  Hash128             hash_;
+  MessageReader       reader_;
+  std::string         id_;         // name of the document
+  bool                in_document_;  // taking the document payload
+  size_t              document_left_;
+  // Deflated documents are inflated as their bytes come
+  std::unique_ptr<Inflater> inflater_;  // created by the first one
+  bool                deflated_;     // the payload is deflated
+  std::string         compressed_;   // received piece of the payload
+  uint64_t            receive_start_;  // first bytes of the document, 0 -
+                                       // none yet
+  AllocationScope     allocations_;    // of the current document
+  uint32_t            connection_;     // number in the capture, 0 - none
+
+  std::vector<Verdict> verdicts_;
+};
+
+#endif  // TRLWO_1286_INCLUDE_SERVICE_H_
@@ -0,0 +1,206 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#ifndef TRLWO_1286_INCLUDE_SHM_RING_H_
+#define TRLWO_1286_INCLUDE_SHM_RING_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+
+#include "validator.h"
+#include "xmlparser.h"
+
+// Shared memory ring of one local producer (Linux): a sealed memfd of
+//   ShmRingHeader, slots ShmRequest, slots ShmCompletion, data_size bytes
+// The producer writes each document contiguously into the data area
+// (skipping to its start when the document doesn't fit before the end)
+// and publishes a request with its position. The server parses it in
+// place, writes the verdict to the completion of the same index and
+// releases the bytes. Positions count bytes since the start and don't
+// wrap, the offset in the area is position % data_size.
+// Each side sleeps on its eventfd only after announcing it in the header,
+// so a busy ring takes no system call per document.
+// The memfd and both eventfds are passed over a Unix domain socket, which
+// stays open while the ring is attached.
+
+const char kShmRingMagic[4] = { 'X', 'V', 'S', '1' };
+
+// Verdict messages longer than that are truncated
+const size_t kShmMessageSize = 1016;
+
+// Document published by the producer
+struct ShmRequest {
+  uint64_t position;  // of the first byte
+  uint32_t size;
+  uint32_t reserved;
+};
+
+// Verdict of the request of the same index
+struct ShmCompletion {
+  uint32_t valid;
+  uint32_t message_size;
+  char message[kShmMessageSize];
+};
+
+// Layout of the ring, written once by the producer
+struct ShmRingLayout {
+  char magic[4];
+  uint32_t slots;       // requests and completions, power of two
+  uint64_t data_size;
+};
+
+struct ShmRingHeader {
+  ShmRingLayout layout;
+
+  // Written by the producer
+  alignas(64) std::atomic<uint64_t> requests;     // published
+  std::atomic<uint32_t>             producer_sleeping;
+
+  // Written by the server
+  alignas(64) std::atomic<uint64_t> completions;  // verdicts written
+  std::atomic<uint64_t>             released;     // position of the data
+                                                  // not needed any more
+  std::atomic<uint32_t>             server_sleeping;
+};
+
+//
+// Mapping of the ring memfd
+//
+class ShmRing {
+ public:
+  ShmRing();
+  ~ShmRing();
+
+  // New ring in a sealed memfd (false and error message on failure)
+  bool create(uint32_t slots, uint64_t data_size, std::string *error);
+  // Ring created by another process (takes ownership of fd, checks the
+  // seals and the layout)
+  bool map(int fd, std::string *error);
+
+  int fd() const { return fd_; }
+  ShmRingHeader *header() { return header_; }
+  ShmRequest *request(uint64_t index) { return &requests_[index & mask_]; }
+  ShmCompletion *completion(uint64_t index)
+  {
+    return &completions_[index & mask_];
+  }
+  char *data() { return data_; }
+
+  // Layout as mapped (not read again from the shared header)
+  uint32_t slots() const { return mask_ + 1; }
+  uint64_t data_size() const { return data_size_; }
+
+ private:
+  ShmRing(const ShmRing&);
+  ShmRing &operator=(const ShmRing&);
+
+  // Pointers into the mapping of size bytes
+  bool layout(uint32_t slots, uint64_t data_size, uint64_t size);
+
+  int            fd_;
+  void           *base_;
+  size_t         size_;
+  ShmRingHeader  *header_;
+  ShmRequest     *requests_;
+  ShmCompletion  *completions_;
+  char           *data_;
+  uint32_t       mask_;
+  uint64_t       data_size_;
+};
+
+//
+// Client side of the ring: documents in, verdicts out, in the same order
+// Used by one thread.
+//
+class ShmProducer {
+ public:
+  ShmProducer();
+  ~ShmProducer();
+
+  // Create ring and attach it to the server listening on the socket path
+  // (false and error message on failure)
+  bool connect(const std::string &path, uint32_t slots, uint64_t data_size,
+               std::string *error);
+
+  // Space for a document of size bytes written in place, NULL if it can't
+  // fit the ring, all slots wait for their verdicts to be taken or the
+  // server didn't release enough bytes within timeout
+  char *reserve(size_t size, int timeout_ms);
+  // Publish the document of size bytes written to the reserved space
+  void publish(size_t size);
+  // Copy document into the ring and publish it
+  bool submit(StringView document, int timeout_ms);
+
+  // Verdict of the oldest published document (false on timeout or when
+  // the server is gone)
+  bool next_verdict(ValidationResult *result, int timeout_ms);
+  // Documents published without the verdict taken
+  uint64_t in_flight() const { return published_ - taken_; }
+  // The server closed the ring
+  bool closed() const { return closed_; }
+
+ private:
+  // Sleep on the producer event until ready() or timeout
+  template <class Ready>
+  bool wait(Ready ready, int timeout_ms);
+
+  ShmRing   ring_;
+  int       socket_;
+  int       server_event_;
+  int       producer_event_;
+  uint64_t  head_;       // position after the last reserved document
+  uint64_t  reserved_;   // position of the reserved document
+  uint64_t  published_;
+  uint64_t  taken_;
+  bool      closed_;
+};
+
+//
+// Server side of the ring
+//
+class ShmConsumer {
+ public:
+  ShmConsumer();
+  ~ShmConsumer();
+
+  // Take the ring sent over the accepted socket (false and error message
+  // on failure), the socket stays owned by the caller
+  bool attach(int sock, std::string *error);
+
+  // Next document, to be parsed in place until complete(); false when the
+  // producer detached or broke the ring (error() tells)
+  bool next(StringView *document);
+  // Verdict of the document of next(), its bytes are released
+  void complete(const ValidationResult &result);
+
+  const std::string &error() const { return error_; }
+
+ private:
+  template <class Ready>
+  bool wait(Ready ready);
+
+  ShmRing      ring_;
+  int          socket_;
+  int          server_event_;
+  int          producer_event_;
+  uint64_t     index_;     // of the current request
+  uint64_t     end_;       // position after the current document
+  std::string  error_;
+};
+
+#endif  // TRLWO_1286_INCLUDE_SHM_RING_H_
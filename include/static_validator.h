@@ -0,0 +1,180 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#ifndef TRLWO_1286_INCLUDE_STATIC_VALIDATOR_H_
+#define TRLWO_1286_INCLUDE_STATIC_VALIDATOR_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "schema.h"
+
+// FNV-1a of C string, same value as StringView::hash()
+constexpr uint32_t static_name_hash(const char *s, uint32_t h = 2166136261u)
+{
+  return (*s == 0) ? h
+                   : static_name_hash(s + 1,
+                         (h ^ static_cast<unsigned char>(*s)) * 16777619u);
+}
+
+//
+// Validator of the parse events stream against a schema compiled into C++
+// by tools/schemagen. Model is the generated struct with static functions:
+//   int element_id(const std::string &name);
+//   int root();
+//   const char *name(int element);
+//   kContentKind kind(int element);
+//   int32_t step(int element, int32_t state, int child);
+//   bool accepting(int element, int32_t state);
+//   bool check_attributes(int element, const AttributeSet &attributes,
+//                         std::string *error);
+// Behaves exactly like SchemaValidator with the same schema.
+//
+template <class Model>
+class StaticValidator : public IParseEvents {
+ public:
+  StaticValidator() { reset(); }
+  virtual ~StaticValidator() {}
+
+  virtual void start_tag(ITag *pTag)
+  {
+    const std::string &name = pTag->get_name();
+
+    // Header tags (<?xml ?>) are not a part of the document tree
+    if (!name.empty() && name[0] == '?') return;
+    if (!valid_) return;
+
+    if (stack_.empty() && root_closed_) {
+      fail("Element '" + name + "' after the root element");
+      return;
+    }
+
+    Frame frame;
+    frame.element = Model::element_id(name);
+    frame.state = 0;
+
+    if (frame.element < 0) {
+      fail("Element '" + name + "' is not declared");
+      return;
+    }
+
+    if (stack_.empty()) {
+      if (frame.element != Model::root()) {
+        fail(std::string("Root element must be '") +
+             Model::name(Model::root()) + "'");
+        return;
+      }
+    } else {
+      Frame &parent = stack_.back();
+      kContentKind kind = Model::kind(parent.element);
+
+      if (kind == ckEmpty) {
+        fail(std::string("Element '") + Model::name(parent.element) +
+             "' must be empty");
+        return;
+      }
+      if (kind != ckAny) {
+        parent.state = Model::step(parent.element, parent.state,
+                                   frame.element);
+        if (parent.state < 0) {
+          fail("Element '" + name + "' is not allowed in '" +
+               Model::name(parent.element) + "'");
+          return;
+        }
+      }
+    }
+
+    std::string error;
+    if (!Model::check_attributes(frame.element, pTag->get_attributes(),
+                                 &error)) {
+      fail(error);
+      return;
+    }
+
+    stack_.push_back(frame);
+  }
+
+  virtual void end_tag(ITag *pTag)
+  {
+    if (pTag == NULL) {
+      fail("End tag doesn't match the start tag");
+      return;
+    }
+
+    const std::string &name = pTag->get_name();
+    if (!name.empty() && name[0] == '?') return;
+    if (!valid_ || stack_.empty()) return;
+
+    Frame frame = stack_.back();
+    stack_.pop_back();
+    if (stack_.empty()) root_closed_ = true;
+
+    if ((Model::kind(frame.element) == ckChildren) &&
+        !Model::accepting(frame.element, frame.state)) {
+      fail("Element '" + name + "' is incomplete");
+    }
+  }
+
+  virtual void content_tag(ITag *pTag, const std::string &content)
+  {
+    if (!valid_) return;
+
+    if (stack_.empty()) {
+      fail("Text outside of the root element");
+      return;
+    }
+
+    int element = stack_.back().element;
+    kContentKind kind = Model::kind(element);
+    if ((kind == ckEmpty) || (kind == ckChildren)) {
+      fail(std::string("Text is not allowed in '") + Model::name(element) +
+           "'");
+    }
+  }
+
+  // Whole document was valid (call after the parsing)
+  bool result() const { return valid_ && stack_.empty() && root_closed_; }
+  // First error
+  const std::string &error() const { return error_; }
+
+  void reset()
+  {
+    stack_.clear();
+    valid_ = true;
+    root_closed_ = false;
+    error_.clear();
+  }
+
+ private:
+  struct Frame {
+    int     element;
+    int32_t state;
+  };
+
+  void fail(const std::string &message)
+  {
+    if (valid_) error_ = message;
+    valid_ = false;
+  }
+
+  std::vector<Frame> stack_;
+  bool               valid_;
+  bool               root_closed_;
+  std::string        error_;
+};
+
+#endif  // TRLWO_1286_INCLUDE_STATIC_VALIDATOR_H_
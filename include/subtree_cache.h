@@ -0,0 +1,105 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#ifndef TRLWO_1286_INCLUDE_SUBTREE_CACHE_H_
+#define TRLWO_1286_INCLUDE_SUBTREE_CACHE_H_
+
+#include <stddef.h>
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "hash128.h"
+#include "validator.h"
+
+//
+// Element of document outline
+//
+struct OutlineNode {
+  std::string name;
+  size_t start;        // '<' of the start tag
+  size_t start_end;    // after '>' of the start tag
+  size_t end;          // after '>' of the end tag
+  Digest128 own;       // bytes of the span outside of the children
+  Digest128 hash;      // Merkle hash: own bytes and hashes of the children
+  std::vector<size_t> children;
+};
+
+//
+// Element spans of document found by a light scan (no tag objects,
+// no attribute parsing) with the Merkle hashes of subtrees
+//
+class DocumentOutline {
+ public:
+  // Scan document, false if it is not well-formed or has constructs
+  // left to the parser (<!DOCTYPE>, CDATA, processing instructions
+  // inside the root)
+  bool scan(const std::string &data);
+
+  // Elements in document order, the first is the root
+  const std::vector<OutlineNode> &nodes() const { return nodes_; }
+  // Bytes outside of the root element
+  const Digest128 &outside() const { return outside_; }
+
+ private:
+  std::vector<OutlineNode> nodes_;
+  Digest128                outside_;
+};
+
+//
+// Outlines of recently validated documents by the client document id
+// A resubmitted document is compared with the last valid version of it,
+// only the subtrees with changed hashes are validated again, as fragments.
+// Unique rules need all values, they are checked over the start tags of
+// the whole document.
+//
+class SubtreeCache {
+ public:
+  explicit SubtreeCache(size_t capacity);
+
+  // Validate document, reusing the verdicts of unchanged subtrees
+  // (partial is set when not the whole document was validated)
+  ValidationResult validate(const Validator &validator, const std::string &id,
+                            StringView data, bool *partial);
+
+ private:
+  struct Entry {
+    std::string document;
+    DocumentOutline outline;
+  };
+  typedef std::shared_ptr<const Entry> EntryPtr;
+  typedef std::list<std::pair<std::string, EntryPtr> > EntryList;
+
+  EntryPtr find(const std::string &id);
+  void store(const std::string &id, EntryPtr entry);
+
+  // Validation of the changed subtrees, false if the whole document
+  // has to be validated
+  bool validate_changes(const Validator &validator, const Entry &previous,
+                        const Entry &current, ValidationResult *result);
+
+  size_t                                              capacity_;
+  std::mutex                                          lock_;
+  // Most recently used first
+  EntryList                                           lru_;
+  std::unordered_map<std::string, EntryList::iterator> index_;
+};
+
+#endif  // TRLWO_1286_INCLUDE_SUBTREE_CACHE_H_
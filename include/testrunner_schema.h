@@ -0,0 +1,383 @@
+// Generated by tools/schemagen from config_test.dtd, don't edit.
+
+#ifndef TRLWO_1286_INCLUDE_TESTRUNNER_SCHEMA_H_
+#define TRLWO_1286_INCLUDE_TESTRUNNER_SCHEMA_H_
+
+#include <stdint.h>
+#include <string>
+
+#include "static_validator.h"
+
+namespace testrunner_schema {
+
+// Fingerprint of the source DTD text
+const uint64_t kFingerprint = 0x232b842c29701128ULL;
+
+enum kElement {
+  eTestrunner = 0,
+  eUut = 1,
+  ePatient = 2,
+  eDevice = 3,
+  eType = 4,
+  eInstrument = 5,
+  eInterface = 6,
+};
+
+struct Model {
+  static int root() { return eTestrunner; }
+
+  static const char *name(int element)
+  {
+    static const char *const names[] = {
+      "testrunner",
+      "uut",
+      "Patient",
+      "Device",
+      "type",
+      "instrument",
+      "interface",
+    };
+    return names[element];
+  }
+
+  static kContentKind kind(int element)
+  {
+    static const kContentKind kinds[] = {
+      ckChildren,
+      ckChildren,
+      ckChildren,
+      ckChildren,
+      ckChildren,
+      ckChildren,
+      ckEmpty,
+    };
+    return kinds[element];
+  }
+
+  static int element_id(const std::string &name)
+  {
+    switch (StringView(name).hash()) {
+      case static_name_hash("Patient"):
+        if (name == "Patient") return ePatient;
+        break;
+      case static_name_hash("testrunner"):
+        if (name == "testrunner") return eTestrunner;
+        break;
+      case static_name_hash("uut"):
+        if (name == "uut") return eUut;
+        break;
+      case static_name_hash("type"):
+        if (name == "type") return eType;
+        break;
+      case static_name_hash("interface"):
+        if (name == "interface") return eInterface;
+        break;
+      case static_name_hash("instrument"):
+        if (name == "instrument") return eInstrument;
+        break;
+      case static_name_hash("Device"):
+        if (name == "Device") return eDevice;
+        break;
+    }
+    return -1;
+  }
+
+  static int32_t step(int element, int32_t state, int child)
+  {
+    switch (element) {
+      case eTestrunner:
+        switch (state) {
+          case 0:
+            switch (child) {
+              case eUut: return 1;
+              default: return -1;
+            }
+          case 1:
+            switch (child) {
+              case eUut: return 1;
+              default: return -1;
+            }
+        }
+        return -1;
+      case eUut:
+        switch (state) {
+          case 0:
+            switch (child) {
+              case ePatient: return 1;
+              case eDevice: return 2;
+              default: return -1;
+            }
+          case 1:
+            switch (child) {
+              case eDevice: return 2;
+              default: return -1;
+            }
+          case 2:
+            switch (child) {
+              default: return -1;
+            }
+        }
+        return -1;
+      case ePatient:
+        switch (state) {
+          case 0:
+            switch (child) {
+              case eType: return 1;
+              default: return -1;
+            }
+          case 1:
+            switch (child) {
+              case eType: return 1;
+              default: return -1;
+            }
+        }
+        return -1;
+      case eDevice:
+        switch (state) {
+          case 0:
+            switch (child) {
+              case eType: return 1;
+              default: return -1;
+            }
+          case 1:
+            switch (child) {
+              case eType: return 1;
+              default: return -1;
+            }
+        }
+        return -1;
+      case eType:
+        switch (state) {
+          case 0:
+            switch (child) {
+              case eInstrument: return 1;
+              default: return -1;
+            }
+          case 1:
+            switch (child) {
+              case eInstrument: return 1;
+              default: return -1;
+            }
+        }
+        return -1;
+      case eInstrument:
+        switch (state) {
+          case 0:
+            switch (child) {
+              case eInterface: return 1;
+              default: return -1;
+            }
+          case 1:
+            switch (child) {
+              case eInterface: return 1;
+              default: return -1;
+            }
+        }
+        return -1;
+    }
+    return -1;
+  }
+
+  static bool accepting(int element, int32_t state)
+  {
+    switch (element) {
+      case eTestrunner:
+        return false || state == 1;
+      case eUut:
+        return false || state == 0 || state == 1 || state == 2;
+      case ePatient:
+        return false || state == 1;
+      case eDevice:
+        return false || state == 1;
+      case eType:
+        return false || state == 1;
+      case eInstrument:
+        return false || state == 1;
+    }
+    return true;
+  }
+
+  static bool check_eTestrunner(const AttributeSet &attributes, std::string *error)
+  {
+    if (attributes.empty()) return true;
+    *error = "Attribute '" + attributes.name_at(0).str() +
+             "' of '" "testrunner" "' is not declared";
+    return false;
+  }
+
+  static bool check_eUut(const AttributeSet &attributes, std::string *error)
+  {
+    for (size_t i = 0; i < attributes.size(); ++i) {
+      StringView name = attributes.name_at(i);
+
+      switch (name.hash()) {
+        case static_name_hash("name"):
+          if (name == StringView("name")) {
+            continue;
+          }
+          break;
+      }
+
+      *error = "Attribute '" + name.str() + "' of '" "uut" "' is not declared";
+      return false;
+    }
+
+    return true;
+  }
+
+  static bool check_ePatient(const AttributeSet &attributes, std::string *error)
+  {
+    if (attributes.empty()) return true;
+    *error = "Attribute '" + attributes.name_at(0).str() +
+             "' of '" "Patient" "' is not declared";
+    return false;
+  }
+
+  static bool check_eDevice(const AttributeSet &attributes, std::string *error)
+  {
+    if (attributes.empty()) return true;
+    *error = "Attribute '" + attributes.name_at(0).str() +
+             "' of '" "Device" "' is not declared";
+    return false;
+  }
+
+  static bool check_eType(const AttributeSet &attributes, std::string *error)
+  {
+    uint64_t present = 0;
+
+    for (size_t i = 0; i < attributes.size(); ++i) {
+      StringView name = attributes.name_at(i);
+
+      switch (name.hash()) {
+        case static_name_hash("name"):
+          if (name == StringView("name")) {
+            present |= 1ULL << 0;
+            continue;
+          }
+          break;
+      }
+
+      *error = "Attribute '" + name.str() + "' of '" "type" "' is not declared";
+      return false;
+    }
+
+    if ((present & (1ULL << 0)) == 0) {
+      *error = "Attribute '" "name" "' of '" "type" "' is required";
+      return false;
+    }
+    return true;
+  }
+
+  static bool check_eInstrument(const AttributeSet &attributes, std::string *error)
+  {
+    uint64_t present = 0;
+
+    for (size_t i = 0; i < attributes.size(); ++i) {
+      StringView name = attributes.name_at(i);
+
+      switch (name.hash()) {
+        case static_name_hash("name"):
+          if (name == StringView("name")) {
+            present |= 1ULL << 0;
+            continue;
+          }
+          break;
+        case static_name_hash("driver"):
+          if (name == StringView("driver")) {
+            present |= 1ULL << 1;
+            continue;
+          }
+          break;
+      }
+
+      *error = "Attribute '" + name.str() + "' of '" "instrument" "' is not declared";
+      return false;
+    }
+
+    if ((present & (1ULL << 0)) == 0) {
+      *error = "Attribute '" "name" "' of '" "instrument" "' is required";
+      return false;
+    }
+    if ((present & (1ULL << 1)) == 0) {
+      *error = "Attribute '" "driver" "' of '" "instrument" "' is required";
+      return false;
+    }
+    return true;
+  }
+
+  static bool check_eInterface(const AttributeSet &attributes, std::string *error)
+  {
+    uint64_t present = 0;
+
+    for (size_t i = 0; i < attributes.size(); ++i) {
+      StringView name = attributes.name_at(i);
+
+      switch (name.hash()) {
+        case static_name_hash("params"):
+          if (name == StringView("params")) {
+            continue;
+          }
+          break;
+        case static_name_hash("type"):
+          if (name == StringView("type")) {
+            StringView value = attributes.value_at(i);
+            if (value != StringView("serial") &&
+                value != StringView("socket")) {
+              *error = "Attribute '" "type" "' of '" "interface"
+                       "' has invalid value '" + value.str() + "'";
+              return false;
+            }
+            present |= 1ULL << 0;
+            continue;
+          }
+          break;
+        case static_name_hash("port"):
+          if (name == StringView("port")) {
+            present |= 1ULL << 1;
+            continue;
+          }
+          break;
+        case static_name_hash("host"):
+          if (name == StringView("host")) {
+            continue;
+          }
+          break;
+      }
+
+      *error = "Attribute '" + name.str() + "' of '" "interface" "' is not declared";
+      return false;
+    }
+
+    if ((present & (1ULL << 0)) == 0) {
+      *error = "Attribute '" "type" "' of '" "interface" "' is required";
+      return false;
+    }
+    if ((present & (1ULL << 1)) == 0) {
+      *error = "Attribute '" "port" "' of '" "interface" "' is required";
+      return false;
+    }
+    return true;
+  }
+
+  static bool check_attributes(int element,
+                               const AttributeSet &attributes,
+                               std::string *error)
+  {
+    switch (element) {
+      case eTestrunner: return check_eTestrunner(attributes, error);
+      case eUut: return check_eUut(attributes, error);
+      case ePatient: return check_ePatient(attributes, error);
+      case eDevice: return check_eDevice(attributes, error);
+      case eType: return check_eType(attributes, error);
+      case eInstrument: return check_eInstrument(attributes, error);
+      case eInterface: return check_eInterface(attributes, error);
+    }
+    return false;
+  }
+};
+
+typedef StaticValidator<Model> Validator;
+
+}  // namespace testrunner_schema
+
+#endif  // TRLWO_1286_INCLUDE_TESTRUNNER_SCHEMA_H_
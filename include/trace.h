@@ -0,0 +1,118 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#ifndef TRLWO_1286_INCLUDE_TRACE_H_
+#define TRLWO_1286_INCLUDE_TRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "latency.h"
+
+// Tracing of the stages of sampled requests into a Chrome trace-event
+// JSON file (chrome://tracing, ui.perfetto.dev). Spans are complete
+// events ("ph":"X") on the thread of the connection, nested by time.
+
+// Start writing the trace file, one of sample connections is traced
+// (false and error message on failure)
+bool trace_open(const std::string &file_name, size_t sample,
+                std::string *error);
+// Finish the trace file
+void trace_close();
+
+// The request handled by the calling thread begins: decides by sampling
+// whether its spans are recorded, name labels the thread
+bool trace_begin(const std::string &name);
+// The request ends: its spans are written to the file (a long request,
+// as a connection of many documents, writes them as they pile up)
+void trace_end();
+
+// The spans of the calling thread are recorded?
+bool trace_active();
+
+// Record span from start to end (monotonic_ns), args is the JSON object
+// body of the arguments or empty
+void trace_span(const char *name, uint64_t start, uint64_t end,
+                const std::string &args = std::string());
+
+//
+// Span of the enclosing scope, nothing is done if the thread isn't traced
+//
+class TraceSpan {
+ public:
+  explicit TraceSpan(const char *name)
+      : name_(name),
+        start_(trace_active() ? monotonic_ns() : 0)
+  {
+  }
+
+  ~TraceSpan()
+  {
+    if (start_ != 0) trace_span(name_, start_, monotonic_ns());
+  }
+
+ private:
+  TraceSpan(const TraceSpan&);
+  TraceSpan &operator=(const TraceSpan&);
+
+  const char *name_;
+  uint64_t    start_;
+};
+
+//
+// Spans of batches of parser state transitions: step() is called with
+// the state before each character, every batch transitions close a span
+// with the number of transitions and bytes. Untraced threads pay one
+// branch per character.
+//
+class TraceBatches {
+ public:
+  TraceBatches(const char *name, size_t batch);
+  ~TraceBatches() { flush(); }
+
+  void step(int state, size_t position)
+  {
+    if (!active_) return;
+    if (state != state_) {
+      state_ = state;
+      if (++transitions_ >= batch_) {
+        position_ = position;
+        flush();
+      }
+    }
+    position_ = position;
+  }
+
+ private:
+  TraceBatches(const TraceBatches&);
+  TraceBatches &operator=(const TraceBatches&);
+
+  // Close the current span and start the next one
+  void flush();
+
+  const char *name_;
+  bool        active_;
+  size_t      batch_;
+  int         state_;
+  size_t      transitions_;
+  size_t      start_position_;
+  size_t      position_;
+  uint64_t    start_;
+};
+
+#endif  // TRLWO_1286_INCLUDE_TRACE_H_
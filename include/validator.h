@@ -0,0 +1,149 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#ifndef TRLWO_1286_INCLUDE_VALIDATOR_H_
+#define TRLWO_1286_INCLUDE_VALIDATOR_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "schema.h"
+#include "rules.h"
+
+//
+// Result of validating one document
+//
+struct ValidationResult {
+  bool valid;
+  std::string message;  // first error, empty for the valid document
+
+  ValidationResult() : valid(false) {}
+
+  // Text of response to the client
+  std::string to_string() const
+  {
+    return valid ? "File is valid!" : "File is invalid! " + message;
+  }
+};
+
+// Handlers receiving the parse events next to the validating one
+typedef std::vector<IParseEvents*> ParseEventsList;
+
+//
+// Fans the parse events out to the validating handler and the extra ones
+// (the validating handler is called directly, without a virtual call)
+//
+template <class Events>
+class ParseEventsFanout : public IParseEvents {
+ public:
+  ParseEventsFanout(Events *events, const ParseEventsList &extra)
+      : events_(events), extra_(extra) {}
+
+  virtual void start_tag(ITag *pTag)
+  {
+    events_->Events::start_tag(pTag);
+    for (size_t i = 0; i < extra_.size(); ++i) extra_[i]->start_tag(pTag);
+  }
+
+  virtual void end_tag(ITag *pTag)
+  {
+    events_->Events::end_tag(pTag);
+    for (size_t i = 0; i < extra_.size(); ++i) extra_[i]->end_tag(pTag);
+  }
+
+  virtual void content_tag(ITag *pTag, const std::string &content)
+  {
+    events_->Events::content_tag(pTag, content);
+    for (size_t i = 0; i < extra_.size(); ++i) {
+      extra_[i]->content_tag(pTag, content);
+    }
+  }
+
+ private:
+  Events                *events_;
+  const ParseEventsList &extra_;
+};
+
+// Parse document in the streamed mode with the validating events handler
+// (SchemaValidator or StaticValidator) and the extra handlers
+template <class Events>
+ValidationResult validate_with(Events *events, StringView data,
+                               const ParseEventsList &extra)
+{
+  ValidationResult result;
+
+  if (extra.empty()) {
+    Parser parser(data, events, pmStream);
+  } else {
+    ParseEventsFanout<Events> fanout(events, extra);
+    Parser parser(data, &fanout, pmStream);
+  }
+
+  result.valid = events->result();
+  if (!result.valid) {
+    result.message = events->error().empty() ? "Unexpected end of document"
+                                             : events->error();
+  }
+
+  return result;
+}
+
+// Validation by a validator generated with tools/schemagen
+typedef ValidationResult (*GeneratedValidate)(StringView data,
+                                              const ParseEventsList &extra);
+
+// Generated validator of the schema or NULL (see generated_schemas.cpp)
+GeneratedValidate find_generated_validator(uint64_t fingerprint);
+
+//
+// Validation of whole documents
+// Parses in the streamed mode, the schema and the rules are checked in the
+// parse event callbacks of that single pass. Schemas with a generated
+// validator linked in take that fast path.
+// One validator is shared by all server threads.
+//
+class Validator {
+ public:
+  Validator() : generated_(NULL) {}
+  explicit Validator(std::shared_ptr<const Schema> schema,
+                     std::shared_ptr<const RuleSet> rules = nullptr);
+
+  // Validate document in place
+  // (extra handlers get the events of the same parse pass)
+  ValidationResult validate(StringView data,
+                            const ParseEventsList &extra =
+                                ParseEventsList()) const;
+
+  // Validate subtree of document rooted at element
+  // (always interpreted, the generated validators only take whole documents)
+  ValidationResult validate_fragment(const std::string &data,
+                                     const std::string &element) const;
+
+  const Schema *schema() const { return schema_.get(); }
+  const RuleSet *rules() const { return rules_.get(); }
+  // Identifies the schema and rules (verdicts of other configs differ)
+  uint64_t fingerprint() const;
+  // Generated validator is used?
+  bool is_generated() const { return generated_ != NULL; }
+
+ private:
+  std::shared_ptr<const Schema>  schema_;
+  std::shared_ptr<const RuleSet> rules_;
+  GeneratedValidate              generated_;
+};
+
+#endif  // TRLWO_1286_INCLUDE_VALIDATOR_H_
@@ -18,9 +18,12 @@
 #define TRLWO_1286_INCLUDE_XMLPARSER_H_
 
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
 #include <string>
 #include <list>
 #include <stack>
+#include <vector>
 #include <memory>
 
     // -- start config
@@ -114,15 +117,123 @@
     };
 
     //
-    // Class for work with attributes
-    // (Here are the public interfaces)
+    // Non-owning reference to a string
+    // (std::string_view stand-in, the project is built as C++11)
     //
-    class IAttribute {
+    class StringView {
      public:
-      // Get name of attribute
-      virtual std::string& get_name() = 0;
-      // Get value of attribute
-      virtual std::string& get_value() = 0;
+      StringView() : data_(""), size_(0) {}
+      StringView(const char *s) : data_(s), size_(strlen(s)) {}
+      StringView(const char *s, size_t n) : data_(s), size_(n) {}
+      StringView(const std::string &s) : data_(s.data()), size_(s.size()) {}
+
+      const char *data() const { return data_; }
+      size_t size() const { return size_; }
+      bool empty() const { return size_ == 0; }
+      char operator[](size_t i) const { return data_[i]; }
+
+      // Copy to owning string
+      std::string str() const { return std::string(data_, size_); }
+
+      bool operator==(StringView other) const
+      {
+        return (size_ == other.size_) &&
+               (memcmp(data_, other.data_, size_) == 0);
+      }
+      bool operator!=(StringView other) const { return !(*this == other); }
+
+      // FNV-1a hash of the referenced bytes
+      uint32_t hash() const
+      {
+        uint32_t h = 2166136261u;
+        for (size_t i = 0; i < size_; ++i) {
+          h ^= static_cast<unsigned char>(data_[i]);
+          h *= 16777619u;
+        }
+        return h;
+      }
+
+     private:
+      const char *data_;
+      size_t size_;
+    };
+
+    //
+    // Process-wide table of interned names of the schema and rules
+    // Only trusted configuration goes in: parsed documents don't touch it.
+    //
+    class NameTable {
+     public:
+      // Get the unique stored copy of name (never freed)
+      static const std::string *intern(StringView name);
+    };
+
+    //
+    // Compact attribute storage of one tag
+    // Names and values are packed back to back in per-tag buffers (names
+    // are NUL-terminated). Lookups are linear up to kIndexThreshold
+    // entries, hashed above it, and never allocate.
+    //
+    class AttributeSet {
+     public:
+      static const size_t kIndexThreshold = 8;
+
+      AttributeSet() {}
+
+      // Add attribute (the first of duplicated names wins on lookup)
+      void add(StringView name, StringView value);
+      // Attribute is present?
+      bool has(StringView name) const { return find(name) >= 0; }
+      // Attribute is present? (by interned name of the schema or rules)
+      bool has(const std::string *interned) const
+      {
+        return find(StringView(*interned)) >= 0;
+      }
+      // Get value of attribute or defValue
+      StringView get(StringView name, StringView defValue) const;
+      // Get value of attribute by interned name of the schema or rules
+      StringView get(const std::string *interned, StringView defValue) const
+      {
+        return get(StringView(*interned), defValue);
+      }
+
+      size_t size() const { return entries_.size(); }
+      bool empty() const { return entries_.empty(); }
+      // Name of attribute i (data() is NUL-terminated)
+      StringView name_at(size_t i) const
+      {
+        return StringView(names_.data() + entries_[i].name_offset,
+                          entries_[i].name_length);
+      }
+      StringView value_at(size_t i) const
+      {
+        return StringView(values_.data() + entries_[i].value_offset,
+                          entries_[i].value_length);
+      }
+
+      void clear();
+
+     private:
+      struct Entry {
+        uint32_t name_offset;
+        uint32_t name_length;
+        uint32_t name_hash;
+        uint32_t value_offset;
+        uint32_t value_length;
+      };
+
+      // Index of attribute or -1
+      int find(StringView name) const;
+      // Insert entry idx into the hashed index
+      void index_entry(size_t idx);
+      // Rebuild hashed index with the new number of slots
+      void rebuild_index(size_t slots);
+
+      std::vector<Entry>    entries_;
+      std::string           names_;
+      std::string           values_;
+      // Open addressing slots holding entry index + 1 (0 - empty slot)
+      std::vector<uint32_t> index_;
     };
 
     //
@@ -139,12 +250,13 @@
       // Put name and content to one string
       virtual std::string to_string() = 0;
       // Tag has attribute?
-      virtual bool has_attribute(std::string name) = 0;
+      virtual bool has_attribute(StringView name) = 0;
       // Get value of attribute
-      virtual std::string get_attribute_value(std::string name,
-                                              std::string defValue) = 0;
-      // List of attributes
-      virtual std::list <IAttribute*> &get_attributes() = 0;
+      // (the view stays valid while the tag is alive and unchanged)
+      virtual StringView get_attribute_value(StringView name,
+                                             StringView defValue) = 0;
+      // Attributes of tag
+      virtual const AttributeSet &get_attributes() = 0;
       // List of child tags
       virtual std::list <ITag*> &get_children() = 0;
     };
@@ -163,34 +275,15 @@
     //
     class IParseEvents{
      public:
-      // Start tags
+      // Start tags (header tags like <?xml ?> are named '?xml')
       virtual void start_tag(ITag *pTag) = 0;
-      // End tags
+      // End tags (NULL if the end tag doesn't match the open one)
       virtual void end_tag(ITag *pTag) = 0;
-      // Content tags
+      // Trimmed text content of the open tag
       virtual void content_tag(ITag *pTag,
                                const std::string &content) = 0;
     };
 
-    //
-    // Class for work with attributes
-    // (Internal parser classes and default implementations)
-    //
-    class Attribute : public IAttribute {
-     private:
-      std::string name;
-      std::string value;
-
-     public:
-      Attribute() {}
-
-      virtual std::string &get_name() { return name; }
-      void set_name(std::string &_name) { name = _name; }
-
-      virtual std::string& get_value() { return value; }
-      void set_value(std::string &_value) {value = _value; }
-    };
-
     //
     // Class for work with tags
     //
@@ -199,7 +292,7 @@
       std::string name;
       std::string content;
 
-      std::list<IAttribute*> attributes;
+      AttributeSet attributes;
       std::list<ITag*> children;
 
      public:
@@ -209,8 +302,8 @@
       virtual bool has_content();
       virtual std::string to_string();
 
-      void add_attribute(std::string _name,
-                         std::string _value);
+      void add_attribute(StringView _name,
+                         StringView _value);
       void add_child(Tag *tag);
 
       virtual std::string &get_name() { return name; }
@@ -219,12 +312,12 @@
       virtual std::string &get_content() { return content; }
       void set_content(std::string &_content) { content = _content; }
 
-      bool has_attribute(std::string name);
-      std::string get_attribute_value(std::string name,
-                                      std::string defValue);
+      bool has_attribute(StringView name);
+      StringView get_attribute_value(StringView name,
+                                     StringView defValue);
 
 
-      virtual std::list<IAttribute*> &get_attributes() { return attributes; }
+      virtual const AttributeSet &get_attributes() { return attributes; }
       virtual std::list<ITag*> &get_children() { return children; }
     };
 
@@ -278,6 +371,8 @@
       virtual void end_tag(std::string tok) = 0;
       // Commit tag
       virtual void commit_tag(Tag *pTag) = 0;
+      // Text content of the open tag
+      virtual void add_content(std::string &tok) = 0;
       // Rewinding
       virtual void rewind() = 0;
       // Next char
@@ -296,13 +391,14 @@
     //
     class Parser : public IParseContext {
      public:
-      explicit Parser(std::string _data);
-      Parser(std::string _data,
-             IParseEvents *pEventHandler);
+      explicit Parser(StringView _data);
+      Parser(StringView _data,
+             IParseEvents *pEventHandler,
+             kParseMode mode = pmDOMBuild);
       virtual ~Parser();
 
       // Load XML document
-      static Document *loadXML(std::string _data,
+      static Document *loadXML(StringView _data,
                                IParseEvents *pEventHandler = NULL);
 
       Document* getDocument() { return &(*pDocument); }
@@ -310,8 +406,9 @@
      protected:
       Parser() {}
       // Initialize parser
-      virtual void initialize(std::string _data,
-                              IParseEvents *pEventHandler);
+      virtual void initialize(StringView _data,
+                              IParseEvents *pEventHandler,
+                              kParseMode mode = pmDOMBuild);
 
       // Parse data
       virtual void parse_data();
@@ -324,6 +421,8 @@
       void end_tag(std::string tok);
       // Commit tag
       void commit_tag(Tag *pTag);
+      // Text content of the open tag
+      void add_content(std::string &tok);
 
       // Rewinding
       void rewind();
@@ -347,7 +446,8 @@
 
       std::stack<Tag*> tagStack;
       int              idxCurrent;
-      std::string      data;
+      // Document being parsed (not copied, valid while the parse runs)
+      StringView       data;
       IParseEvents     *pEventHandler;
       // Parser variables
       std::string token;
@@ -361,7 +461,7 @@
     //
     class ParseStateFunc : public Parser {
      public:
-      ParseStateFunc(std::string _data,
+      ParseStateFunc(StringView _data,
                      IParseEvents *pEventHandler);
 
       virtual void parse_data();
@@ -401,6 +501,7 @@
       Tag *create_tag(std::string name);
       void end_tag(std::string tok);
       void commit_tag(Tag *pTag);
+      void add_content(std::string &tok);
 
       void rewind();
       int next_char();
@@ -479,13 +580,14 @@
       StateTagContent       state_tag_content;
 
      public:
-      ParseStateClasses(std::string _data,
+      ParseStateClasses(StringView _data,
                         IParseEvents *pEventHandler);
 
       virtual void change_state(kParseState newState);
 
-      virtual void initialize(std::string _data,
-                              IParseEvents *pEventHandler);
+      virtual void initialize(StringView _data,
+                              IParseEvents *pEventHandler,
+                              kParseMode mode = pmDOMBuild);
 
       virtual void parse_data();
     };
@@ -497,12 +599,14 @@
         int end_tags_;
         int content_tags_;
         bool valid_;
+        bool mismatched_;
 
       ParseEventTracker():
           start_tags_(0),
           end_tags_(0),
           content_tags_(0),
-          valid_(false){}
+          valid_(false),
+          mismatched_(false){}
       ~ParseEventTracker() = default;
 
       virtual void start_tag(ITag *pTag)
@@ -514,6 +618,10 @@
       {
         ++end_tags_;
 
+        if (pTag == NULL) {
+            mismatched_ = true;
+        }
+
         if (start_tags_ == end_tags_) {
             valid_ = true;
         } else {
@@ -528,7 +636,7 @@
 
       bool result()
       {
-          return valid_;
+          return valid_ && !mismatched_;
       }
     };
 #endif  // TRLWO_1286_INCLUDE_XMLPARSER_H_
@@ -0,0 +1,112 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#ifndef TRLWO_1286_INCLUDE_XMLVALIDATOR_H_
+#define TRLWO_1286_INCLUDE_XMLVALIDATOR_H_
+
+/*
+ * C API of libxmlvalidator.so: the parser and the validator of the server
+ * for validation in process.
+ *
+ * A validator (compiled schema and rules) is immutable and may be shared
+ * by any number of threads. A context belongs to one thread at a time and
+ * is reused for any number of documents, keeping its buffers.
+ *
+ *   xv_validator *validator = xv_validator_new("config.dtd", NULL, err, n);
+ *   xv_context *context = xv_context_new(validator);
+ *   if (xv_validate_buffer(context, data, size) != XV_VALID)
+ *     puts(xv_error(context));
+ */
+
+#include <stddef.h>
+
+#if defined(_WIN32)
+#define XV_API __declspec(dllexport)
+#elif defined(__GNUC__)
+#define XV_API __attribute__((visibility("default")))
+#else
+#define XV_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Version of this API, changes only when existing calls change */
+#define XV_API_VERSION 1
+
+/* Results of validation */
+#define XV_VALID    0   /* document is valid */
+#define XV_INVALID  1   /* document is invalid, see xv_error */
+#define XV_ERROR   -1   /* wrong arguments */
+
+typedef struct xv_validator xv_validator;
+typedef struct xv_context xv_context;
+
+/* Attribute of start tag (value is not NUL-terminated) */
+typedef struct xv_attribute {
+  const char *name;
+  const char *value;
+  size_t value_size;
+} xv_attribute;
+
+/* Parse events of xv_parse, any of them may be NULL */
+typedef struct xv_callbacks {
+  void (*start_tag)(void *user, const char *name,
+                    const xv_attribute *attributes, size_t count);
+  void (*end_tag)(void *user, const char *name);
+  void (*content)(void *user, const char *name, const char *text,
+                  size_t size);
+} xv_callbacks;
+
+XV_API int xv_api_version(void);
+
+/* Validator of DTD and rules files (NULL - check only well-formedness or
+   no rules). On failure returns NULL and the message in error. */
+XV_API xv_validator *xv_validator_new(const char *schema_file,
+                                      const char *rules_file,
+                                      char *error, size_t error_size);
+/* Validator of DTD and rules texts */
+XV_API xv_validator *xv_validator_compile(const char *schema_text,
+                                          const char *rules_text,
+                                          char *error, size_t error_size);
+/* Contexts of validator must be freed first */
+XV_API void xv_validator_free(xv_validator *validator);
+
+XV_API xv_context *xv_context_new(const xv_validator *validator);
+XV_API void xv_context_free(xv_context *context);
+
+/* Validate document */
+XV_API int xv_validate_buffer(xv_context *context, const char *data,
+                              size_t size);
+/* Validate document, passing its parse events to callbacks */
+XV_API int xv_parse(xv_context *context, const char *data, size_t size,
+                    const xv_callbacks *callbacks, void *user);
+
+/* Streaming: feed the document in chunks, xv_finish validates it and
+   makes the context ready for the next one, xv_reset drops it */
+XV_API int xv_feed(xv_context *context, const char *data, size_t size);
+XV_API int xv_finish(xv_context *context);
+XV_API void xv_reset(xv_context *context);
+
+/* First error of the last invalid document ("" if valid) */
+XV_API const char *xv_error(const xv_context *context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* TRLWO_1286_INCLUDE_XMLVALIDATOR_H_ */
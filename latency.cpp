@@ -0,0 +1,182 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#include "include/latency.h"
+
+#include <stdio.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+const size_t LatencyHistogram::kSubBuckets;
+const size_t LatencyHistogram::kBuckets;
+const size_t LatencyStats::kStripes;
+
+namespace {
+
+// Index of the highest set bit
+inline int highest_bit(uint64_t value)
+{
+  int bit = 0;
+  while (value >>= 1) ++bit;
+  return bit;
+}
+
+}  // namespace
+
+size_t thread_stripe(size_t stripes)
+{
+  static std::atomic<size_t> next(0);
+  static thread_local size_t stripe = next++;
+  return stripe % stripes;
+}
+
+const char *phase_name(kPhase phase)
+{
+  switch (phase) {
+    case phAccept:
+      return "accept";
+    case phReceive:
+      return "receive";
+    case phValidate:
+      return "validate";
+    case phSend:
+      return "send";
+    case phConnection:
+      return "connection";
+    default:
+      return "";
+  }
+}
+
+// -- LatencyHistogram
+LatencyHistogram::LatencyHistogram()
+    : max_(0),
+      sum_(0)
+{
+  for (size_t i = 0; i < kBuckets; ++i) counts_[i] = 0;
+}
+
+size_t LatencyHistogram::bucket_of(uint64_t ns)
+{
+  // Below 16 ns exactly, above it 16 buckets per power of two
+  if (ns < kSubBuckets) return static_cast<size_t>(ns);
+
+  int exponent = highest_bit(ns);
+  size_t sub = (ns >> (exponent - 4)) & (kSubBuckets - 1);
+  size_t bucket = (exponent - 3) * kSubBuckets + sub;
+  return (bucket < kBuckets) ? bucket : kBuckets - 1;
+}
+
+uint64_t LatencyHistogram::bucket_value(size_t bucket)
+{
+  if (bucket < kSubBuckets) return bucket;
+
+  int exponent = static_cast<int>(bucket / kSubBuckets) + 3;
+  uint64_t sub = bucket % kSubBuckets;
+  uint64_t lowest = (kSubBuckets + sub) << (exponent - 4);
+  return lowest + (1ULL << (exponent - 4)) - 1;
+}
+
+void LatencyHistogram::record(uint64_t ns)
+{
+  counts_[bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(ns, std::memory_order_relaxed);
+
+  uint64_t max = max_.load(std::memory_order_relaxed);
+  while ((ns > max) &&
+         !max_.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {
+  }
+}
+
+// -- LatencyStats
+LatencyStats::LatencyStats()
+    : histograms_(new LatencyHistogram[kStripes * phCount])
+{
+}
+
+void LatencyStats::record(kPhase phase, uint64_t ns)
+{
+  histogram(thread_stripe(kStripes), phase).record(ns);
+}
+
+LatencyStats::Summary LatencyStats::summary(kPhase phase) const
+{
+  std::vector<uint64_t> counts(LatencyHistogram::kBuckets, 0);
+  uint64_t max = 0;
+  uint64_t sum = 0;
+
+  for (size_t s = 0; s < kStripes; ++s) {
+    const LatencyHistogram &stripe = histograms_[s * phCount + phase];
+    for (size_t b = 0; b < counts.size(); ++b) counts[b] += stripe.count(b);
+    if (stripe.max() > max) max = stripe.max();
+    sum += stripe.sum();
+  }
+
+  Summary summary;
+  summary.count = 0;
+  summary.sum = sum / 1e9;
+  for (size_t b = 0; b < counts.size(); ++b) summary.count += counts[b];
+  summary.max = max / 1e6;
+
+  // Value of the bucket reaching fraction p of the records
+  auto percentile = [&](double p) -> double {
+    uint64_t rank = static_cast<uint64_t>(p * summary.count);
+    if (rank >= summary.count) rank = summary.count - 1;
+
+    uint64_t seen = 0;
+    for (size_t b = 0; b < counts.size(); ++b) {
+      seen += counts[b];
+      if (seen > rank) {
+        uint64_t value = LatencyHistogram::bucket_value(b);
+        return ((value < max) ? value : max) / 1e6;
+      }
+    }
+    return max / 1e6;
+  };
+
+  if (summary.count == 0) {
+    summary.p50 = summary.p90 = summary.p99 = summary.p999 = 0;
+  } else {
+    summary.p50 = percentile(0.5);
+    summary.p90 = percentile(0.9);
+    summary.p99 = percentile(0.99);
+    summary.p999 = percentile(0.999);
+  }
+
+  return summary;
+}
+
+std::string LatencyStats::report() const
+{
+  std::string text = "Latency ms         count      p50      p90      p99"
+                     "    p99.9      max\n";
+
+  for (int phase = 0; phase < phCount; ++phase) {
+    Summary s = summary(static_cast<kPhase>(phase));
+
+    char line[160];
+    snprintf(line, sizeof(line),
+             "%-12s %11llu %8.3f %8.3f %8.3f %8.3f %8.3f\n",
+             phase_name(static_cast<kPhase>(phase)),
+             static_cast<unsigned long long>(s.count), s.p50, s.p90, s.p99,
+             s.p999, s.max);
+    text += line;
+  }
+
+  return text;
+}
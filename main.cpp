@@ -15,6 +15,7 @@
  ********************************************************************/
 
 #include <iostream>
+#include <sstream>
 #include <string>
 
 #ifdef __unix__
@@ -24,6 +25,7 @@
 #else
 #error "unknown OS"
 #endif
+#include "include/offline.h"
 
 int main()
 {
@@ -32,15 +34,58 @@ int main()
     std::string ip;
     std::string file_name;
 
-    std::cin >> change >> port >> ip >> file_name;
+    std::cin >> change;
 
-    if (change == 's') {
-        server(port);
+    // Offline validation names the rules and the schema instead of
+    // the port and the IP
+    std::string rules_file;
+    if (change == 'v') {
+        std::cin >> rules_file >> ip >> file_name;
+    } else {
+        std::cin >> port >> ip >> file_name;
+    }
+
+    // The rest of the line is 'key=value' options
+    std::string rest;
+    std::getline(std::cin, rest);
+    std::istringstream words(rest);
+    std::string option;
+    std::string error;
+
+    if (change == 'v') {
+        OfflineOptions options;
+        while (words >> option) {
+            if (!options.parse(option, &error)) {
+                std::cerr << "Error! " << error << "\n";
+                return -1;
+            }
+        }
+
+        validate_offline(rules_file.c_str(), ip.c_str(), file_name.c_str(),
+                         options);
+    } else if (change == 's') {
+        ServerOptions options;
+        while (words >> option) {
+            if (!options.parse(option, &error)) {
+                std::cerr << "Error! " << error << "\n";
+                return -1;
+            }
+        }
+
+        server(port, ip.c_str(), file_name.c_str(), options);
     } else if (change == 'c') {
+        ClientOptions options;
+        while (words >> option) {
+            if (!options.parse(option, &error)) {
+                std::cerr << "Error! " << error << "\n";
+                return -1;
+            }
+        }
+
         if (ip == "localhost") {
-            client(port, "127.0.0.1", file_name.c_str());
+            client(port, "127.0.0.1", file_name.c_str(), options);
         } else {
-            client(port, ip.c_str(), file_name.c_str());
+            client(port, ip.c_str(), file_name.c_str(), options);
         }
     } else {
         std::cerr << "Error! Missing change!\n";
@@ -0,0 +1,255 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#include "include/metrics.h"
+
+#include <stdio.h>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include <string>
+
+#include "include/latency.h"
+#include "include/service.h"
+
+const size_t ServerMetrics::kStripes;
+
+namespace {
+
+//
+// Class for writing metrics in the Prometheus text exposition format
+//
+class MetricsWriter {
+ public:
+  // Header of metric family
+  void family(const char *name, const char *type, const char *help)
+  {
+    text_ += std::string("# HELP ") + name + " " + help + "\n";
+    text_ += std::string("# TYPE ") + name + " " + type + "\n";
+  }
+
+  void sample(const char *name, const std::string &labels, double value)
+  {
+    char buff[64];
+    snprintf(buff, sizeof(buff), "%.10g", value);
+
+    text_ += name;
+    if (!labels.empty()) text_ += "{" + labels + "}";
+    text_ += std::string(" ") + buff + "\n";
+  }
+
+  void sample(const char *name, double value) { sample(name, "", value); }
+
+  const std::string &text() const { return text_; }
+
+ private:
+  std::string text_;
+};
+
+// Raise maximum to value
+void raise_to(std::atomic<uint64_t> *maximum, uint64_t value)
+{
+  uint64_t current = maximum->load(std::memory_order_relaxed);
+  while ((value > current) &&
+         !maximum->compare_exchange_weak(current, value)) {
+  }
+}
+
+}  // namespace
+
+ServerMetrics::ServerMetrics()
+    : stripes_(new Stripe[kStripes]),
+      active_connections_(0),
+      in_progress_(0),
+      parse_peak_(0),
+      request_peak_(0)
+{
+  for (size_t s = 0; s < kStripes; ++s) {
+    for (int c = 0; c < ctCount; ++c) stripes_[s].values[c] = 0;
+  }
+}
+
+void ServerMetrics::add(kCounter counter, uint64_t value)
+{
+  stripes_[thread_stripe(kStripes)].values[counter].fetch_add(
+      value, std::memory_order_relaxed);
+}
+
+uint64_t ServerMetrics::value(kCounter counter) const
+{
+  uint64_t total = 0;
+  for (size_t s = 0; s < kStripes; ++s) {
+    total += stripes_[s].values[counter].load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+void ServerMetrics::add_parse_allocations(const AllocationStats &stats)
+{
+  add(ctParseAllocations, stats.count);
+  add(ctParseAllocatedBytes, stats.bytes);
+  raise_to(&parse_peak_, stats.peak);
+}
+
+void ServerMetrics::add_request_allocations(const AllocationStats &stats)
+{
+  add(ctRequestAllocations, stats.count);
+  add(ctRequestAllocatedBytes, stats.bytes);
+  raise_to(&request_peak_, stats.peak);
+}
+
+std::string metrics_text(DocumentService *service)
+{
+  const ServerMetrics &metrics = service->metrics();
+  MetricsWriter out;
+
+  out.family("xv_connections_total", "counter", "Accepted connections.");
+  out.sample("xv_connections_total", metrics.value(ctConnections));
+  out.family("xv_active_connections", "gauge", "Open connections.");
+  out.sample("xv_active_connections", metrics.active_connections());
+
+  out.family("xv_documents_total", "counter",
+             "Documents answered, including cached verdicts.");
+  out.sample("xv_documents_total", metrics.value(ctDocuments));
+  out.family("xv_verdicts_total", "counter", "Verdicts by result.");
+  out.sample("xv_verdicts_total", "verdict=\"valid\"",
+             metrics.value(ctValid));
+  out.sample("xv_verdicts_total", "verdict=\"invalid\"",
+             metrics.value(ctInvalid));
+  out.family("xv_documents_in_progress", "gauge",
+             "Documents being validated now.");
+  out.sample("xv_documents_in_progress", metrics.in_progress());
+
+  out.family("xv_received_bytes_total", "counter", "Bytes received.");
+  out.sample("xv_received_bytes_total", metrics.value(ctBytesIn));
+  out.family("xv_sent_bytes_total", "counter", "Bytes sent.");
+  out.sample("xv_sent_bytes_total", metrics.value(ctBytesOut));
+  out.family("xv_deflated_bytes_total", "counter",
+             "Received bytes of deflated documents.");
+  out.sample("xv_deflated_bytes_total", metrics.value(ctDeflatedBytes));
+  out.family("xv_inflated_bytes_total", "counter",
+             "Bytes of documents inflated from them.");
+  out.sample("xv_inflated_bytes_total", metrics.value(ctInflatedBytes));
+
+  // Parse speed of the documents without cached verdicts
+  double parsed = static_cast<double>(metrics.value(ctParsedBytes));
+  double parse_seconds = metrics.value(ctParseNs) / 1e9;
+  out.family("xv_parsed_bytes_total", "counter",
+             "Bytes of documents parsed and validated.");
+  out.sample("xv_parsed_bytes_total", parsed);
+  out.family("xv_parse_seconds_total", "counter",
+             "Time of parsing and validating them.");
+  out.sample("xv_parse_seconds_total", parse_seconds);
+  out.family("xv_parse_mbytes_per_second", "gauge",
+             "Average parse speed since the start.");
+  out.sample("xv_parse_mbytes_per_second",
+             (parse_seconds > 0) ? parsed / parse_seconds / (1024 * 1024) : 0);
+
+  if (allocation_tracking()) {
+    out.family("xv_parses_total", "counter", "Documents parsed.");
+    out.sample("xv_parses_total", metrics.value(ctParses));
+    out.family("xv_allocations_total", "counter",
+               "Allocations of parses and of whole requests.");
+    out.sample("xv_allocations_total", "scope=\"parse\"",
+               metrics.value(ctParseAllocations));
+    out.sample("xv_allocations_total", "scope=\"request\"",
+               metrics.value(ctRequestAllocations));
+    out.family("xv_allocated_bytes_total", "counter",
+               "Bytes allocated by parses and by whole requests.");
+    out.sample("xv_allocated_bytes_total", "scope=\"parse\"",
+               metrics.value(ctParseAllocatedBytes));
+    out.sample("xv_allocated_bytes_total", "scope=\"request\"",
+               metrics.value(ctRequestAllocatedBytes));
+    out.family("xv_peak_live_bytes", "gauge",
+               "Highest live bytes of one parse or request.");
+    out.sample("xv_peak_live_bytes", "scope=\"parse\"",
+               static_cast<double>(metrics.parse_peak()));
+    out.sample("xv_peak_live_bytes", "scope=\"request\"",
+               static_cast<double>(metrics.request_peak()));
+  }
+
+  ResultCache *cache = service->cache();
+  if (cache != NULL) {
+    out.family("xv_cache_lookups_total", "counter",
+               "Lookups of the verdict cache.");
+    out.sample("xv_cache_lookups_total", "result=\"hit\"",
+               static_cast<double>(cache->hits()));
+    out.sample("xv_cache_lookups_total", "result=\"miss\"",
+               static_cast<double>(cache->misses()));
+    out.family("xv_cache_shared_total", "counter",
+               "Misses answered by the verdict of the canonical form.");
+    out.sample("xv_cache_shared_total", static_cast<double>(cache->shared()));
+    out.family("xv_cache_entries", "gauge", "Cached verdicts.");
+    out.sample("xv_cache_entries", static_cast<double>(cache->size()));
+  }
+
+  out.family("xv_phase_latency_seconds", "summary",
+             "Latency of the phases of handling documents.");
+  for (int p = 0; p < phCount; ++p) {
+    kPhase phase = static_cast<kPhase>(p);
+    LatencyStats::Summary s = service->latency().summary(phase);
+    std::string label = std::string("phase=\"") + phase_name(phase) + "\"";
+
+    out.sample("xv_phase_latency_seconds", label + ",quantile=\"0.5\"",
+               s.p50 / 1000);
+    out.sample("xv_phase_latency_seconds", label + ",quantile=\"0.9\"",
+               s.p90 / 1000);
+    out.sample("xv_phase_latency_seconds", label + ",quantile=\"0.99\"",
+               s.p99 / 1000);
+    out.sample("xv_phase_latency_seconds", label + ",quantile=\"0.999\"",
+               s.p999 / 1000);
+    out.sample("xv_phase_latency_seconds_sum", label, s.sum);
+    out.sample("xv_phase_latency_seconds_count", label,
+               static_cast<double>(s.count));
+  }
+
+#if defined(__GLIBC__) && \
+    ((__GLIBC__ > 2) || ((__GLIBC__ == 2) && (__GLIBC_MINOR__ >= 33)))
+  struct mallinfo2 heap = mallinfo2();
+  out.family("xv_heap_bytes", "gauge", "Heap of the allocator by state.");
+  out.sample("xv_heap_bytes", "state=\"in_use\"",
+             static_cast<double>(heap.uordblks));
+  out.sample("xv_heap_bytes", "state=\"free\"",
+             static_cast<double>(heap.fordblks));
+  out.sample("xv_heap_bytes", "state=\"mmap\"",
+             static_cast<double>(heap.hblkhd));
+#endif
+
+  return out.text();
+}
+
+std::string metrics_response(const std::string &request,
+                             DocumentService *service)
+{
+  bool metrics = (request.compare(0, 13, "GET /metrics ") == 0) ||
+                 (request.compare(0, 14, "GET /metrics\r\n") == 0) ||
+                 (request.compare(0, 6, "GET / ") == 0);
+
+  std::string body = metrics ? metrics_text(service) : "Not found\n";
+
+  char header[160];
+  snprintf(header, sizeof(header),
+           "HTTP/1.0 %s\r\n"
+           "Content-Type: text/plain; version=0.0.4\r\n"
+           "Content-Length: %lu\r\n"
+           "Connection: close\r\n\r\n",
+           metrics ? "200 OK" : "404 Not Found",
+           static_cast<unsigned long>(body.size()));
+
+  return header + body;
+}
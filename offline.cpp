@@ -0,0 +1,133 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#include "include/offline.h"
+
+#include <string.h>
+
+#include <chrono>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "include/batch.h"
+#include "include/validator.h"
+
+namespace {
+
+//
+// Class for validation in the calling thread, in place of a connection
+// to the server
+//
+class LocalConnection : public IBatchConnection {
+ public:
+  explicit LocalConnection(const Validator *validator)
+      : validator_(validator) {}
+
+  virtual bool send_document(const std::string &document)
+  {
+    result_ = validator_->validate(document);
+    return true;
+  }
+
+  virtual bool receive_verdict(ValidationResult *result)
+  {
+    *result = result_;
+    return true;
+  }
+
+ private:
+  const Validator   *validator_;
+  ValidationResult  result_;
+};
+
+// Compile the schema and the rules as the server does
+bool load_validator(const char *rules_file, const char *schema_file,
+                    std::unique_ptr<Validator> *validator)
+{
+  std::string error;
+
+  std::shared_ptr<Schema> schema;
+  if (strcmp(schema_file, "n") != 0) {
+    schema.reset(new Schema());
+    if (!schema->load(schema_file, &error)) {
+      std::cerr << " Error schema! " << error << "\n";
+      return false;
+    }
+  }
+
+  std::shared_ptr<RuleSet> rules;
+  if (strcmp(rules_file, "n") != 0) {
+    rules.reset(new RuleSet());
+    if (!rules->load(rules_file, &error)) {
+      std::cerr << " Error rules! " << error << "\n";
+      return false;
+    }
+  }
+
+  validator->reset(new Validator(schema, rules));
+  return true;
+}
+
+}  // namespace
+
+int validate_offline(const char *rules_file, const char *schema_file,
+                     const char *path, const OfflineOptions &options)
+{
+  std::unique_ptr<Validator> validator;
+  if (!load_validator(rules_file, schema_file, &validator)) return -1;
+
+  if (strcmp(path, "-") == 0) {
+    // One document of the rest of the standard input
+    std::string document((std::istreambuf_iterator<char>(std::cin)),
+                         std::istreambuf_iterator<char>());
+
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    ValidationResult result = validator->validate(document);
+    double seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "-: " << result.to_string() << " (" << seconds * 1000
+              << " ms, "
+              << ((seconds > 0) ? document.size() / seconds / (1024 * 1024)
+                                : 0)
+              << " MB/s)\n";
+    return result.valid ? 0 : 1;
+  }
+
+  std::vector<std::string> files;
+  if (!is_file_set(path)) {
+    files.push_back(path);
+  } else if (!list_files(path, &files)) {
+    std::cerr << "Error file list not found!\n";
+    return -1;
+  }
+
+  size_t jobs = options.jobs;
+  if (jobs == 0) jobs = std::thread::hardware_concurrency();
+
+  const Validator *shared = validator.get();
+  BatchConnect connect = [shared]() -> IBatchConnection* {
+    return new LocalConnection(shared);
+  };
+
+  // Validation is synchronous, nothing to keep in flight
+  return run_batch(files, jobs, 1, connect);
+}
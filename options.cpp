@@ -0,0 +1,169 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#include "include/options.h"
+
+#include <stdlib.h>
+
+#include <string>
+
+namespace {
+
+// Non-negative decimal number
+bool parse_size(const std::string &text, size_t *value)
+{
+  if (text.empty()) return false;
+
+  char *end;
+  unsigned long long number = strtoull(text.c_str(), &end, 10);
+  if ((*end != '\0') || (text[0] == '-')) return false;
+
+  *value = static_cast<size_t>(number);
+  return true;
+}
+
+}  // namespace
+
+bool ServerOptions::parse(const std::string &option, std::string *error)
+{
+  std::string::size_type eq = option.find('=');
+  if ((eq == std::string::npos) || (eq == 0)) {
+    *error = "Expected key=value: " + option;
+    return false;
+  }
+
+  std::string key = option.substr(0, eq);
+  std::string value = option.substr(eq + 1);
+
+  if (key == "cache") {
+    if (!parse_size(value, &cache_size)) {
+      *error = "Bad cache size: " + value;
+      return false;
+    }
+  } else if (key == "snapshot") {
+    cache_snapshot = value;
+  } else if (key == "canonical") {
+    if ((value != "0") && (value != "1")) {
+      *error = "Expected canonical=0 or canonical=1";
+      return false;
+    }
+    canonical = (value == "1");
+  } else if (key == "documents") {
+    if (!parse_size(value, &documents)) {
+      *error = "Bad number of documents: " + value;
+      return false;
+    }
+  } else if (key == "metrics") {
+    size_t port;
+    if (!parse_size(value, &port) || (port == 0) || (port > 65535)) {
+      *error = "Bad metrics port: " + value;
+      return false;
+    }
+    metrics_port = static_cast<int>(port);
+  } else if (key == "http") {
+    size_t port;
+    if (!parse_size(value, &port) || (port == 0) || (port > 65535)) {
+      *error = "Bad HTTP port: " + value;
+      return false;
+    }
+    http_port = static_cast<int>(port);
+  } else if (key == "trace") {
+    trace_file = value;
+  } else if (key == "unix") {
+    unix_socket = value;
+  } else if (key == "shm") {
+    ring_socket = value;
+  } else if (key == "capture") {
+    capture_file = value;
+  } else if (key == "trace_sample") {
+    if (!parse_size(value, &trace_sample) || (trace_sample == 0)) {
+      *error = "Bad trace sample: " + value;
+      return false;
+    }
+  } else {
+    *error = "Unknown option: " + key;
+    return false;
+  }
+
+  return true;
+}
+
+bool ClientOptions::parse(const std::string &option, std::string *error)
+{
+  std::string::size_type eq = option.find('=');
+  if ((eq == std::string::npos) || (eq == 0)) {
+    *error = "Expected key=value: " + option;
+    return false;
+  }
+
+  std::string key = option.substr(0, eq);
+  std::string value = option.substr(eq + 1);
+
+  if (key == "id") {
+    document_id = value;
+  } else if (key == "delta") {
+    if ((value != "0") && (value != "1")) {
+      *error = "Expected delta=0 or delta=1";
+      return false;
+    }
+    delta = (value == "1");
+  } else if (key == "compress") {
+    if ((value != "0") && (value != "1")) {
+      *error = "Expected compress=0 or compress=1";
+      return false;
+    }
+    compress = (value == "1");
+  } else if (key == "jobs") {
+    if (!parse_size(value, &jobs) || (jobs == 0)) {
+      *error = "Bad number of jobs: " + value;
+      return false;
+    }
+  } else if (key == "depth") {
+    if (!parse_size(value, &depth) || (depth == 0)) {
+      *error = "Bad pipeline depth: " + value;
+      return false;
+    }
+  } else {
+    *error = "Unknown option: " + key;
+    return false;
+  }
+
+  return true;
+}
+
+bool OfflineOptions::parse(const std::string &option, std::string *error)
+{
+  std::string::size_type eq = option.find('=');
+  if ((eq == std::string::npos) || (eq == 0)) {
+    *error = "Expected key=value: " + option;
+    return false;
+  }
+
+  std::string key = option.substr(0, eq);
+  std::string value = option.substr(eq + 1);
+
+  if (key == "jobs") {
+    if (!parse_size(value, &jobs)) {
+      *error = "Bad number of jobs: " + value;
+      return false;
+    }
+  } else {
+    *error = "Unknown option: " + key;
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,220 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#include "include/protocol.h"
+
+#include <string>
+
+const size_t MessageReader::kHeaderSize;
+
+LegacyFrameDecoder::LegacyFrameDecoder(size_t frame_size)
+    : frame_size_(frame_size),
+      offset_(0),
+      in_line_(true),
+      tilde_(false),
+      in_id_(false),
+      done_(false),
+      too_long_(false)
+{
+}
+
+void LegacyFrameDecoder::feed(const char *data, size_t size,
+                              std::string *document)
+{
+  for (size_t i = 0; (i < size) && !done_; ++i) {
+    char c = data[i];
+
+    // "~~" and "~#" are only marks at the start of a frame
+    if (tilde_) {
+      tilde_ = false;
+      if (c == '~') {
+        done_ = true;
+        break;
+      }
+      if (c == '#') {
+        in_id_ = true;
+        ++offset_;
+        continue;
+      }
+      document->push_back('~');
+    }
+
+    if ((offset_ == 0) && (c == '~')) {
+      tilde_ = true;
+    } else if (c == '\0') {
+      in_line_ = false;
+    } else if (in_line_) {
+      if (in_id_) {
+        document_id_.push_back(c);
+      } else {
+        document->push_back(c);
+      }
+    }
+
+    // Every frame is one line
+    if (++offset_ == frame_size_) {
+      if (!in_id_) document->push_back('\n');
+      offset_ = 0;
+      in_line_ = true;
+      in_id_ = false;
+    }
+
+    // Frames carry no length: the end mark may never come
+    if ((document->size() > kMaxPayload) ||
+        (document_id_.size() > kMaxPayload)) {
+      too_long_ = true;
+      done_ = true;
+    }
+  }
+}
+
+// -- Message protocol
+const char kProtocolMagic[4] = { '\x02', 'X', 'V', '1' };
+
+std::string encode_message(char type, const std::string &payload)
+{
+  std::string message(1, type);
+  put_u32(&message, static_cast<uint32_t>(payload.size()));
+  message += payload;
+  return message;
+}
+
+bool MessageReader::header(char *type, uint32_t *length)
+{
+  size_t pos = 1;
+  if (error_ || !get_u32(buffer_, &pos, length)) return false;
+
+  if (*length > kMaxPayload) {
+    error_ = true;
+    return false;
+  }
+
+  *type = buffer_[0];
+  return true;
+}
+
+bool MessageReader::next(Message *message)
+{
+  uint32_t length;
+  if (!header(&message->type, &length)) return false;
+  if (buffer_.size() < kHeaderSize + length) return false;
+
+  message->payload.assign(buffer_, kHeaderSize, length);
+  buffer_.erase(0, kHeaderSize + length);
+  return true;
+}
+
+size_t MessageReader::take(size_t max, std::string *out)
+{
+  size_t size = (buffer_.size() < max) ? buffer_.size() : max;
+  out->append(buffer_, 0, size);
+  buffer_.erase(0, size);
+  return size;
+}
+
+void put_u32(std::string *out, uint32_t value)
+{
+  char bytes[4] = {
+    static_cast<char>(value >> 24), static_cast<char>(value >> 16),
+    static_cast<char>(value >> 8), static_cast<char>(value)
+  };
+  out->append(bytes, sizeof(bytes));
+}
+
+void put_digest(std::string *out, const Digest128 &digest)
+{
+  put_u32(out, static_cast<uint32_t>(digest.high >> 32));
+  put_u32(out, static_cast<uint32_t>(digest.high));
+  put_u32(out, static_cast<uint32_t>(digest.low >> 32));
+  put_u32(out, static_cast<uint32_t>(digest.low));
+}
+
+void put_string(std::string *out, const std::string &value)
+{
+  put_u32(out, static_cast<uint32_t>(value.size()));
+  *out += value;
+}
+
+bool get_u32(const std::string &in, size_t *pos, uint32_t *value)
+{
+  if (in.size() < *pos + 4) return false;
+
+  const unsigned char *p =
+      reinterpret_cast<const unsigned char*> (in.data() + *pos);
+  *value = (static_cast<uint32_t>(p[0]) << 24) |
+           (static_cast<uint32_t>(p[1]) << 16) |
+           (static_cast<uint32_t>(p[2]) << 8) | p[3];
+  *pos += 4;
+  return true;
+}
+
+bool get_digest(const std::string &in, size_t *pos, Digest128 *digest)
+{
+  uint32_t words[4];
+  for (int i = 0; i < 4; ++i) {
+    if (!get_u32(in, pos, &words[i])) return false;
+  }
+
+  digest->high = (static_cast<uint64_t>(words[0]) << 32) | words[1];
+  digest->low = (static_cast<uint64_t>(words[2]) << 32) | words[3];
+  return true;
+}
+
+bool get_string(const std::string &in, size_t *pos, std::string *value)
+{
+  uint32_t length;
+  if (!get_u32(in, pos, &length) || (in.size() - *pos < length)) return false;
+
+  value->assign(in, *pos, length);
+  *pos += length;
+  return true;
+}
+
+std::string encode_verdict(const ValidationResult &result)
+{
+  std::string payload(1, result.valid ? '1' : '0');
+  payload += result.message;
+  return payload;
+}
+
+bool decode_verdict(const std::string &payload, ValidationResult *result)
+{
+  if (payload.empty()) return false;
+
+  result->valid = (payload[0] == '1');
+  result->message = payload.substr(1);
+  return true;
+}
+
+bool unix_socket_path(const std::string &address, std::string *path)
+{
+  if ((address.compare(0, 5, "unix:") != 0) || (address.size() == 5)) {
+    return false;
+  }
+
+  *path = address.substr(5);
+  return true;
+}
+
+bool ring_socket_path(const std::string &address, std::string *path)
+{
+  if ((address.compare(0, 4, "shm:") != 0) || (address.size() == 4)) {
+    return false;
+  }
+
+  *path = address.substr(4);
+  return true;
+}
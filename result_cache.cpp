@@ -0,0 +1,229 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#include "include/result_cache.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <fstream>
+#include <string>
+
+#include "include/protocol.h"
+
+namespace {
+
+// Snapshot: magic, config, count, then entries of
+// high, low, valid (1 byte), message length (4 bytes), message
+const char kSnapshotMagic[4] = { 'X', 'V', 'C', '1' };
+
+template <class T>
+void write_value(std::ofstream *out, const T &value)
+{
+  out->write(reinterpret_cast<const char*> (&value), sizeof(value));
+}
+
+template <class T>
+bool read_value(std::ifstream *in, T *value)
+{
+  in->read(reinterpret_cast<char*> (value), sizeof(*value));
+  return in->good();
+}
+
+}  // namespace
+
+ResultCache::ResultCache(size_t capacity, size_t shards)
+    : hits_(0),
+      misses_(0),
+      shared_(0)
+{
+  if (shards == 0) shards = 1;
+  if (capacity < shards) shards = (capacity == 0) ? 1 : capacity;
+
+  shard_capacity_ = capacity / shards;
+  for (size_t i = 0; i < shards; ++i) {
+    shards_.push_back(std::unique_ptr<Shard>(new Shard()));
+  }
+}
+
+void ResultCache::insert(Shard *shard, const Digest128 &key,
+                         const ValidationResult &result)
+{
+  shard->lru.push_front(Entry(key, result));
+  shard->index[key] = shard->lru.begin();
+
+  if (shard->lru.size() > shard_capacity_) {
+    shard->index.erase(shard->lru.back().first);
+    shard->lru.pop_back();
+  }
+}
+
+bool ResultCache::lookup(const Digest128 &key, ValidationResult *result)
+{
+  Shard &shard = shard_of(key);
+  std::lock_guard<std::mutex> guard(shard.lock);
+
+  auto it = shard.index.find(key);
+  if (it == shard.index.end()) {
+    ++misses_;
+    return false;
+  }
+
+  // Move to the front of LRU
+  shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+  *result = it->second->second;
+  ++hits_;
+  return true;
+}
+
+void ResultCache::store(const Digest128 &key, const ValidationResult &result)
+{
+  if (shard_capacity_ == 0) return;
+
+  Shard &shard = shard_of(key);
+  std::lock_guard<std::mutex> guard(shard.lock);
+
+  auto it = shard.index.find(key);
+  if (it != shard.index.end()) {
+    it->second->second = result;
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    return;
+  }
+
+  insert(&shard, key, result);
+}
+
+bool ResultCache::lookup_shared(const Digest128 &canonical,
+                                ValidationResult *result)
+{
+  Shard &shard = shard_of(canonical);
+  std::lock_guard<std::mutex> guard(shard.lock);
+
+  auto it = shard.index.find(canonical);
+  if (it == shard.index.end()) return false;
+
+  shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+  *result = it->second->second;
+  ++shared_;
+  return true;
+}
+
+double ResultCache::hit_rate() const
+{
+  uint64_t hits = hits_.load();
+  uint64_t total = hits + misses_.load();
+  return (total == 0) ? 0.0 : static_cast<double>(hits) / total;
+}
+
+size_t ResultCache::size() const
+{
+  size_t total = 0;
+  for (size_t i = 0; i < shards_.size(); ++i) {
+    std::lock_guard<std::mutex> guard(shards_[i]->lock);
+    total += shards_[i]->lru.size();
+  }
+  return total;
+}
+
+bool ResultCache::save(const char *file_name, uint64_t config) const
+{
+  // Copy under the locks, write without them
+  std::vector<Entry> entries;
+  for (size_t i = 0; i < shards_.size(); ++i) {
+    std::lock_guard<std::mutex> guard(shards_[i]->lock);
+
+    // Oldest first, so loading restores the LRU order
+    entries.insert(entries.end(), shards_[i]->lru.rbegin(),
+                   shards_[i]->lru.rend());
+  }
+
+  std::string tmp_name = std::string(file_name) + ".tmp";
+  std::ofstream out(tmp_name.c_str(), std::ios::out | std::ios::binary);
+  if (!out) return false;
+
+  out.write(kSnapshotMagic, sizeof(kSnapshotMagic));
+  write_value(&out, config);
+  write_value(&out, static_cast<uint64_t>(entries.size()));
+
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const ValidationResult &result = entries[i].second;
+    uint8_t valid = result.valid ? 1 : 0;
+    uint32_t length = static_cast<uint32_t>(result.message.size());
+
+    write_value(&out, entries[i].first.high);
+    write_value(&out, entries[i].first.low);
+    write_value(&out, valid);
+    write_value(&out, length);
+    out.write(result.message.data(), length);
+  }
+
+  out.close();
+  if (!out) return false;
+
+  return rename(tmp_name.c_str(), file_name) == 0;
+}
+
+bool ResultCache::load(const char *file_name, uint64_t config)
+{
+  std::ifstream in(file_name, std::ios::in | std::ios::binary);
+  if (!in) return false;
+
+  // Lengths are checked against the bytes left, so a damaged snapshot
+  // can't make a huge allocation
+  in.seekg(0, std::ios::end);
+  uint64_t file_size = static_cast<uint64_t>(in.tellg());
+  in.seekg(0, std::ios::beg);
+
+  char magic[4];
+  uint64_t saved_config;
+  uint64_t count;
+
+  in.read(magic, sizeof(magic));
+  if (!in || (memcmp(magic, kSnapshotMagic, sizeof(magic)) != 0)) return false;
+  if (!read_value(&in, &saved_config) || (saved_config != config)) return false;
+  if (!read_value(&in, &count)) return false;
+
+  // Nothing is stored unless the whole snapshot is read
+  std::vector<Entry> entries;
+  for (uint64_t i = 0; i < count; ++i) {
+    Digest128 key;
+    uint8_t valid;
+    uint32_t length;
+    ValidationResult result;
+
+    if (!read_value(&in, &key.high) || !read_value(&in, &key.low) ||
+        !read_value(&in, &valid) || !read_value(&in, &length)) {
+      return false;
+    }
+
+    uint64_t left = file_size - static_cast<uint64_t>(in.tellg());
+    if ((length > kMaxPayload) || (length > left)) return false;
+
+    result.valid = (valid != 0);
+    result.message.resize(length);
+    if (length > 0) {
+      in.read(&result.message[0], length);
+      if (!in) return false;
+    }
+
+    entries.push_back(Entry(key, result));
+  }
+
+  for (size_t i = 0; i < entries.size(); ++i) {
+    store(entries[i].first, entries[i].second);
+  }
+  return true;
+}
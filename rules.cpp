@@ -0,0 +1,312 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#include "include/rules.h"
+#include "include/schema.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+namespace {
+
+// All 8 bytes are ASCII digits?
+inline bool all_digits(uint64_t chunk)
+{
+  return ((chunk & 0xF0F0F0F0F0F0F0F0ULL) == 0x3030303030303030ULL) &&
+         (((chunk + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) ==
+          0x3030303030303030ULL);
+}
+
+// Value of up to 8 digits, false if there is a non-digit
+inline bool parse_eight(const char *digits, size_t n, uint64_t *value)
+{
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+  // Left-pad with '0' so the first digit lands in the highest position
+  char buff[8] = { '0', '0', '0', '0', '0', '0', '0', '0' };
+  memcpy(buff + 8 - n, digits, n);
+
+  uint64_t chunk;
+  memcpy(&chunk, buff, sizeof(chunk));
+  if (!all_digits(chunk)) return false;
+
+  // Pairs, quads and then the whole 8 digits
+  chunk = (chunk & 0x0F0F0F0F0F0F0F0FULL) * 2561 >> 8;
+  chunk = (chunk & 0x00FF00FF00FF00FFULL) * 6553601 >> 16;
+  chunk = (chunk & 0x0000FFFF0000FFFFULL) * 42949672960001ULL >> 32;
+  *value = chunk;
+  return true;
+#else
+  uint64_t result = 0;
+  for (size_t i = 0; i < n; ++i) {
+    if (!isdigit(digits[i])) return false;
+    result = result * 10 + (digits[i] - '0');
+  }
+  *value = result;
+  return true;
+#endif
+}
+
+std::string trimmed(const std::string &s)
+{
+  std::string result(s);
+  return StringUtilStatic::trim(result);
+}
+
+}  // namespace
+
+bool parse_integer(StringView text, int64_t *value)
+{
+  const char *p = text.data();
+  size_t n = text.size();
+  bool negative = false;
+
+  if ((n > 0) && (p[0] == '-' || p[0] == '+')) {
+    negative = (p[0] == '-');
+    ++p;
+    --n;
+  }
+  // Up to 18 digits always fit int64_t
+  if ((n == 0) || (n > 18)) return false;
+
+  uint64_t result = 0;
+  size_t head = n % 8;
+  if (head == 0) head = 8;
+
+  uint64_t chunk;
+  if (!parse_eight(p, head, &chunk)) return false;
+  result = chunk;
+
+  for (size_t i = head; i < n; i += 8) {
+    if (!parse_eight(p + i, 8, &chunk)) return false;
+    result = result * 100000000ULL + chunk;
+  }
+
+  *value = negative ? -static_cast<int64_t>(result)
+                    : static_cast<int64_t>(result);
+  return true;
+}
+
+bool match_pattern(StringView pattern, StringView text)
+{
+  size_t p = 0;
+  size_t t = 0;
+
+  while (p < pattern.size()) {
+    if ((pattern[p] == '%') && (p + 1 < pattern.size()) &&
+        (pattern[p + 1] == 'd' || pattern[p + 1] == 'a')) {
+      bool digits = (pattern[p + 1] == 'd');
+      size_t start = t;
+      while ((t < text.size()) &&
+             (digits ? isdigit(text[t]) : isalpha(text[t]))) {
+        ++t;
+      }
+      if (t == start) return false;
+      p += 2;
+    } else if (pattern[p] == '[') {
+      size_t end = p + 1;
+      while ((end < pattern.size()) && (pattern[end] != ']')) ++end;
+
+      if (t >= text.size()) return false;
+      bool found = false;
+      for (size_t i = p + 1; i < end; ++i) {
+        if (pattern[i] == text[t]) found = true;
+      }
+      if (!found) return false;
+      ++t;
+      p = end + 1;
+    } else {
+      if ((t >= text.size()) || (pattern[p] != text[t])) return false;
+      ++p;
+      ++t;
+    }
+  }
+
+  return t == text.size();
+}
+
+bool RuleSet::compile(const std::string &text, std::string *error)
+{
+  std::istringstream lines(text);
+  std::string line;
+  int number = 0;
+
+  rules_.clear();
+  by_element_.clear();
+
+  while (std::getline(lines, line)) {
+    ++number;
+    std::string::size_type comment = line.find('#');
+    if (comment != std::string::npos) line.erase(comment);
+    line = trimmed(line);
+    if (line.empty()) continue;
+
+    std::ostringstream where;
+    where << " at line " << number;
+
+    std::istringstream words(line);
+    std::string kind;
+    std::string target;
+    words >> kind >> target;
+
+    Rule rule;
+    rule.source = line;
+    rule.min = rule.max = 0;
+    rule.when_attribute = NULL;
+
+    std::string::size_type at = target.find('@');
+    if ((at == std::string::npos) || (at == 0) || (at + 1 == target.size())) {
+      *error = "Expected element@attribute" + where.str();
+      return false;
+    }
+    rule.element = target.substr(0, at);
+    rule.attribute = NameTable::intern(target.substr(at + 1));
+
+    if (kind == "unique") {
+      rule.kind = rkUnique;
+    } else if (kind == "range") {
+      rule.kind = rkRange;
+      std::string min, max;
+      words >> min >> max;
+      if (!parse_integer(min, &rule.min) || !parse_integer(max, &rule.max) ||
+          (rule.min > rule.max)) {
+        *error = "Bad range" + where.str();
+        return false;
+      }
+    } else if (kind == "pattern") {
+      rule.kind = rkPattern;
+      std::string rest;
+      std::getline(words, rest);
+      rest = trimmed(rest);
+      std::string::size_type close = rest.find('"', 1);
+      if (rest.empty() || (rest[0] != '"') || (close == std::string::npos)) {
+        *error = "Expected quoted pattern" + where.str();
+        return false;
+      }
+      rule.pattern = rest.substr(1, close - 1);
+      words.clear();
+      words.str(rest.substr(close + 1));
+    } else {
+      *error = "Unknown rule '" + kind + "'" + where.str();
+      return false;
+    }
+
+    std::string when;
+    if (words >> when) {
+      std::string condition;
+      words >> condition;
+      std::string::size_type eq = condition.find('=');
+      if ((when != "if") || (eq == std::string::npos) || (eq == 0)) {
+        *error = "Expected 'if attribute=value'" + where.str();
+        return false;
+      }
+      rule.when_attribute = NameTable::intern(condition.substr(0, eq));
+      rule.when_value = condition.substr(eq + 1);
+    }
+
+    by_element_[rule.element].push_back(rules_.size());
+    rules_.push_back(rule);
+  }
+
+  fingerprint_ = Schema::fingerprint_of(text);
+  return true;
+}
+
+bool RuleSet::load(const char *file_name, std::string *error)
+{
+  std::ifstream file(file_name, std::ios::in);
+  if (!file) {
+    *error = std::string("Rules file not found: ") + file_name;
+    return false;
+  }
+
+  std::stringstream text;
+  text << file.rdbuf();
+  return compile(text.str(), error);
+}
+
+// -- RuleChecker
+RuleChecker::RuleChecker(const RuleSet *rules)
+    : rules_(rules),
+      seen_(rules->rules().size()),
+      valid_(true)
+{
+}
+
+void RuleChecker::fail(const Rule &rule, StringView value, const char *reason)
+{
+  if (valid_) {
+    error_ = "Value '" + value.str() + "' of '" + rule.element + "@" +
+             *rule.attribute + "' " + reason + " (" + rule.source + ")";
+  }
+  valid_ = false;
+}
+
+void RuleChecker::start_tag(ITag *pTag)
+{
+  if (!valid_) return;
+
+  const std::vector<size_t> *indices = rules_->rules_of(pTag->get_name());
+  if (indices == NULL) return;
+
+  const AttributeSet &attributes = pTag->get_attributes();
+
+  for (size_t i = 0; i < indices->size(); ++i) {
+    const Rule &rule = rules_->rules()[(*indices)[i]];
+
+    if (!attributes.has(rule.attribute)) continue;
+    if ((rule.when_attribute != NULL) &&
+        (attributes.get(rule.when_attribute, StringView()) !=
+         StringView(rule.when_value))) {
+      continue;
+    }
+
+    StringView value = attributes.get(rule.attribute, StringView());
+
+    switch (rule.kind) {
+      case rkUnique: {
+        std::unordered_set<std::string> &seen = seen_[(*indices)[i]];
+        if (!seen.insert(value.str()).second) {
+          fail(rule, value, "is not unique");
+          return;
+        }
+        break;
+      }
+      case rkRange: {
+        int64_t number;
+        if (!parse_integer(value, &number)) {
+          fail(rule, value, "is not a number");
+          return;
+        }
+        if ((number < rule.min) || (number > rule.max)) {
+          fail(rule, value, "is out of range");
+          return;
+        }
+        break;
+      }
+      case rkPattern: {
+        if (!match_pattern(rule.pattern, value)) {
+          fail(rule, value, "doesn't match the pattern");
+          return;
+        }
+        break;
+      }
+    }
+  }
+}
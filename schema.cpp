@@ -0,0 +1,707 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#include "include/schema.h"
+
+#include <ctype.h>
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+//
+// Node of content model
+//
+struct Particle {
+  enum kKind { pkName, pkSeq, pkChoice };
+
+  kKind kind;
+  std::string name;
+  std::vector<Particle> children;
+  char occurs;  // '?', '*', '+' or 0
+};
+
+//
+// Element declaration before the compilation
+//
+struct RawElement {
+  std::string name;
+  kContentKind kind;
+  Particle model;
+  std::vector<std::string> mixed;  // elements allowed in mixed content
+};
+
+//
+// Tokenizer of DTD text
+//
+class DtdReader {
+ public:
+  explicit DtdReader(const std::string &text) : text_(text), pos_(0) {}
+
+  void skip_spaces()
+  {
+    for ( ; ; ) {
+      while ((pos_ < text_.size()) && isspace(text_[pos_])) ++pos_;
+
+      if (text_.compare(pos_, 4, "<!--") != 0) return;
+
+      std::string::size_type end = text_.find("-->", pos_ + 4);
+      pos_ = (end == std::string::npos) ? text_.size() : end + 3;
+    }
+  }
+
+  bool eof()
+  {
+    skip_spaces();
+    return pos_ >= text_.size();
+  }
+
+  // Consume literal if it's next
+  bool accept(const char *literal)
+  {
+    skip_spaces();
+    size_t len = strlen(literal);
+    if (text_.compare(pos_, len, literal) != 0) return false;
+    pos_ += len;
+    return true;
+  }
+
+  // Name or keyword (#PCDATA, #REQUIRED ...)
+  std::string name()
+  {
+    skip_spaces();
+    size_t start = pos_;
+    if ((pos_ < text_.size()) && (text_[pos_] == '#')) ++pos_;
+    while ((pos_ < text_.size()) &&
+           (isalnum(text_[pos_]) || strchr("_-.:", text_[pos_]) != NULL)) {
+      ++pos_;
+    }
+    return text_.substr(start, pos_ - start);
+  }
+
+  // Quoted string
+  bool quoted(std::string *value)
+  {
+    skip_spaces();
+    if ((pos_ >= text_.size()) || (text_[pos_] != '"' && text_[pos_] != '\''))
+      return false;
+
+    std::string::size_type end = text_.find(text_[pos_], pos_ + 1);
+    if (end == std::string::npos) return false;
+
+    *value = text_.substr(pos_ + 1, end - pos_ - 1);
+    pos_ = end + 1;
+    return true;
+  }
+
+  // Occurrence indicator right after a particle
+  char occurs()
+  {
+    if ((pos_ < text_.size()) && strchr("?*+", text_[pos_]) != NULL)
+      return text_[pos_++];
+    return 0;
+  }
+
+  std::string where()
+  {
+    std::ostringstream out;
+    out << " at offset " << pos_;
+    return out.str();
+  }
+
+ private:
+  const std::string &text_;
+  size_t pos_;
+};
+
+bool parse_particle(DtdReader *reader, Particle *particle, std::string *error);
+
+// Group after '(': (a, b) or (a | b)
+bool parse_group(DtdReader *reader, Particle *group, std::string *error)
+{
+  Particle first;
+  if (!parse_particle(reader, &first, error)) return false;
+
+  group->kind = Particle::pkSeq;
+  group->children.push_back(first);
+
+  char separator = 0;
+  for ( ; ; ) {
+    char next = 0;
+    if (reader->accept(")")) break;
+    if (reader->accept(",")) next = ',';
+    else if (reader->accept("|")) next = '|';
+
+    if ((next == 0) || ((separator != 0) && (next != separator))) {
+      *error = "Bad content model" + reader->where();
+      return false;
+    }
+    separator = next;
+
+    Particle item;
+    if (!parse_particle(reader, &item, error)) return false;
+    group->children.push_back(item);
+  }
+
+  if (separator == '|') group->kind = Particle::pkChoice;
+  group->occurs = reader->occurs();
+  return true;
+}
+
+bool parse_particle(DtdReader *reader, Particle *particle, std::string *error)
+{
+  particle->occurs = 0;
+
+  if (reader->accept("(")) return parse_group(reader, particle, error);
+
+  particle->kind = Particle::pkName;
+  particle->name = reader->name();
+  if (particle->name.empty() || particle->name[0] == '#') {
+    *error = "Expected element name" + reader->where();
+    return false;
+  }
+  particle->occurs = reader->occurs();
+  return true;
+}
+
+// <!ELEMENT name content>
+bool parse_element(DtdReader *reader, RawElement *element, std::string *error)
+{
+  element->name = reader->name();
+  if (element->name.empty()) {
+    *error = "Expected element name" + reader->where();
+    return false;
+  }
+
+  if (reader->accept("EMPTY")) {
+    element->kind = ckEmpty;
+  } else if (reader->accept("ANY")) {
+    element->kind = ckAny;
+  } else if (reader->accept("(")) {
+    if (reader->accept("#PCDATA")) {
+      element->kind = ckMixed;
+      while (reader->accept("|")) {
+        element->mixed.push_back(reader->name());
+      }
+      if (!reader->accept(")")) {
+        *error = "Bad mixed content" + reader->where();
+        return false;
+      }
+      // '(#PCDATA)' or '(#PCDATA|a)*'
+      reader->occurs();
+    } else {
+      element->kind = ckChildren;
+      if (!parse_group(reader, &element->model, error)) return false;
+    }
+  } else {
+    *error = "Bad content of '" + element->name + "'" + reader->where();
+    return false;
+  }
+
+  if (!reader->accept(">")) {
+    *error = "Expected '>'" + reader->where();
+    return false;
+  }
+  return true;
+}
+
+// <!ATTLIST element name type default ...>
+bool parse_attlist(DtdReader *reader,
+                   std::map<std::string, std::vector<AttributeDecl> > *lists,
+                   std::string *error)
+{
+  std::string element = reader->name();
+  std::vector<AttributeDecl> &list = (*lists)[element];
+
+  while (!reader->accept(">")) {
+    AttributeDecl decl;
+    std::string name = reader->name();
+    if (name.empty() || reader->eof()) {
+      *error = "Bad attribute list of '" + element + "'" + reader->where();
+      return false;
+    }
+    decl.name = NameTable::intern(name);
+    decl.use = auImplied;
+
+    // Type: enumeration or CDATA, ID, NMTOKEN ... (not checked)
+    if (reader->accept("(")) {
+      do {
+        decl.values.push_back(reader->name());
+      } while (reader->accept("|"));
+
+      if (!reader->accept(")")) {
+        *error = "Bad enumeration of '" + name + "'" + reader->where();
+        return false;
+      }
+    } else if (reader->name().empty()) {
+      *error = "Expected type of '" + name + "'" + reader->where();
+      return false;
+    }
+
+    std::string value;
+    if (reader->accept("#REQUIRED")) {
+      decl.use = auRequired;
+    } else if (reader->accept("#IMPLIED")) {
+      decl.use = auImplied;
+    } else if (reader->accept("#FIXED")) {
+      decl.use = auFixed;
+      if (!reader->quoted(&decl.fixed)) {
+        *error = "Expected value of '" + name + "'" + reader->where();
+        return false;
+      }
+    } else if (!reader->quoted(&value)) {
+      *error = "Expected default of '" + name + "'" + reader->where();
+      return false;
+    }
+
+    list.push_back(decl);
+  }
+
+  return true;
+}
+
+//
+// Nondeterministic automaton built by Thompson's construction
+//
+class Nfa {
+ public:
+  struct Edge {
+    int symbol;  // -1 - epsilon
+    int target;
+  };
+
+  struct Fragment {
+    int start;
+    int end;
+  };
+
+  int add_state()
+  {
+    edges_.push_back(std::vector<Edge>());
+    return static_cast<int>(edges_.size()) - 1;
+  }
+
+  void add_edge(int from, int symbol, int to)
+  {
+    Edge edge = { symbol, to };
+    edges_[from].push_back(edge);
+  }
+
+  // Build fragment of particle
+  Fragment build(const Particle &particle, const Schema &schema)
+  {
+    Fragment body;
+
+    if (particle.kind == Particle::pkName) {
+      body.start = add_state();
+      body.end = add_state();
+      add_edge(body.start, schema.element_id(particle.name), body.end);
+    } else if (particle.kind == Particle::pkSeq) {
+      body = build(particle.children[0], schema);
+      for (size_t i = 1; i < particle.children.size(); ++i) {
+        Fragment next = build(particle.children[i], schema);
+        add_edge(body.end, -1, next.start);
+        body.end = next.end;
+      }
+    } else {
+      body.start = add_state();
+      body.end = add_state();
+      for (size_t i = 0; i < particle.children.size(); ++i) {
+        Fragment alt = build(particle.children[i], schema);
+        add_edge(body.start, -1, alt.start);
+        add_edge(alt.end, -1, body.end);
+      }
+    }
+
+    if (particle.occurs == 0) return body;
+
+    Fragment result;
+    result.start = add_state();
+    result.end = add_state();
+    add_edge(result.start, -1, body.start);
+    add_edge(body.end, -1, result.end);
+    if (particle.occurs != '+') add_edge(result.start, -1, result.end);
+    if (particle.occurs != '?') add_edge(body.end, -1, body.start);
+
+    return result;
+  }
+
+  // Subset construction of the deterministic automaton
+  void determinize(const Fragment &fragment, int symbols,
+                   ContentAutomaton *dfa) const
+  {
+    std::map<std::vector<int>, int> known;
+    std::vector<std::vector<int> > pending;
+
+    std::vector<int> start(1, fragment.start);
+    closure(&start);
+    known[start] = 0;
+    pending.push_back(start);
+
+    dfa->symbols = symbols;
+    dfa->next.clear();
+    dfa->accepting.clear();
+
+    for (size_t current = 0; current < pending.size(); ++current) {
+      std::vector<int> set = pending[current];
+      dfa->next.resize((current + 1) * symbols, -1);
+      dfa->accepting.push_back(
+          std::binary_search(set.begin(), set.end(), fragment.end) ? 1 : 0);
+
+      for (int symbol = 0; symbol < symbols; ++symbol) {
+        std::vector<int> moved;
+        for (size_t i = 0; i < set.size(); ++i) {
+          const std::vector<Edge> &edges = edges_[set[i]];
+          for (size_t e = 0; e < edges.size(); ++e) {
+            if (edges[e].symbol == symbol) moved.push_back(edges[e].target);
+          }
+        }
+        if (moved.empty()) continue;
+
+        closure(&moved);
+        std::map<std::vector<int>, int>::iterator it = known.find(moved);
+        int target;
+        if (it == known.end()) {
+          target = static_cast<int>(pending.size());
+          known[moved] = target;
+          pending.push_back(moved);
+        } else {
+          target = it->second;
+        }
+        dfa->next[current * symbols + symbol] = target;
+      }
+    }
+  }
+
+ private:
+  // Epsilon closure, result is sorted
+  void closure(std::vector<int> *set) const
+  {
+    std::vector<uint8_t> seen(edges_.size(), 0);
+    std::vector<int> work(*set);
+    set->clear();
+
+    while (!work.empty()) {
+      int state = work.back();
+      work.pop_back();
+      if (seen[state]) continue;
+      seen[state] = 1;
+      set->push_back(state);
+
+      const std::vector<Edge> &edges = edges_[state];
+      for (size_t e = 0; e < edges.size(); ++e) {
+        if (edges[e].symbol == -1) work.push_back(edges[e].target);
+      }
+    }
+
+    std::sort(set->begin(), set->end());
+  }
+
+  std::vector<std::vector<Edge> > edges_;
+};
+
+// Names used in model which are not declared
+bool check_names(const Particle &particle, const Schema &schema,
+                 std::string *error)
+{
+  if (particle.kind == Particle::pkName) {
+    if (schema.element_id(particle.name) >= 0) return true;
+    *error = "Element '" + particle.name + "' is not declared";
+    return false;
+  }
+
+  for (size_t i = 0; i < particle.children.size(); ++i) {
+    if (!check_names(particle.children[i], schema, error)) return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+bool Schema::compile(const std::string &dtd, std::string *error)
+{
+  std::vector<RawElement> raw;
+  std::map<std::string, std::vector<AttributeDecl> > lists;
+  DtdReader reader(dtd);
+
+  while (!reader.eof()) {
+    if (reader.accept("<!ELEMENT")) {
+      raw.push_back(RawElement());
+      if (!parse_element(&reader, &raw.back(), error)) return false;
+    } else if (reader.accept("<!ATTLIST")) {
+      if (!parse_attlist(&reader, &lists, error)) return false;
+    } else {
+      *error = "Unsupported declaration" + reader.where();
+      return false;
+    }
+  }
+
+  if (raw.empty()) {
+    *error = "Schema has no elements";
+    return false;
+  }
+
+  elements_.clear();
+  ids_.clear();
+  for (size_t i = 0; i < raw.size(); ++i) {
+    if (ids_.count(raw[i].name) != 0) {
+      *error = "Element '" + raw[i].name + "' is declared twice";
+      return false;
+    }
+    ids_[raw[i].name] = static_cast<int>(i);
+  }
+
+  std::map<std::string, std::vector<AttributeDecl> >::iterator list;
+  for (list = lists.begin(); list != lists.end(); ++list) {
+    if (ids_.count(list->first) == 0) {
+      *error = "Attributes of undeclared element '" + list->first + "'";
+      return false;
+    }
+  }
+
+  int symbols = static_cast<int>(raw.size());
+  elements_.resize(raw.size());
+
+  for (size_t i = 0; i < raw.size(); ++i) {
+    ElementDecl &decl = elements_[i];
+    decl.name = raw[i].name;
+    decl.kind = raw[i].kind;
+    decl.attributes = lists[decl.name];
+
+    if (decl.kind == ckChildren) {
+      if (!check_names(raw[i].model, *this, error)) return false;
+
+      Nfa nfa;
+      Nfa::Fragment fragment = nfa.build(raw[i].model, *this);
+      nfa.determinize(fragment, symbols, &decl.automaton);
+    } else if (decl.kind == ckMixed) {
+      // One accepting state looping on the allowed elements
+      decl.automaton.symbols = symbols;
+      decl.automaton.next.assign(symbols, -1);
+      decl.automaton.accepting.assign(1, 1);
+      for (size_t m = 0; m < raw[i].mixed.size(); ++m) {
+        int id = element_id(raw[i].mixed[m]);
+        if (id < 0) {
+          *error = "Element '" + raw[i].mixed[m] + "' is not declared";
+          return false;
+        }
+        decl.automaton.next[id] = 0;
+      }
+    }
+  }
+
+  root_ = 0;
+  fingerprint_ = fingerprint_of(dtd);
+  return true;
+}
+
+uint64_t Schema::fingerprint_of(const std::string &text)
+{
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < text.size(); ++i) {
+    h ^= static_cast<unsigned char>(text[i]);
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+bool Schema::load(const char *file_name, std::string *error)
+{
+  std::ifstream file(file_name, std::ios::in);
+  if (!file) {
+    *error = std::string("Schema file not found: ") + file_name;
+    return false;
+  }
+
+  std::stringstream text;
+  text << file.rdbuf();
+  return compile(text.str(), error);
+}
+
+// -- SchemaValidator
+SchemaValidator::SchemaValidator(const Schema *schema, int root)
+    : schema_(schema),
+      root_(root)
+{
+  if ((root_ < 0) && (schema_ != NULL)) root_ = schema_->root();
+  reset();
+}
+
+void SchemaValidator::reset()
+{
+  stack_.clear();
+  valid_ = true;
+  root_closed_ = false;
+  error_.clear();
+}
+
+void SchemaValidator::fail(const std::string &message)
+{
+  if (valid_) error_ = message;
+  valid_ = false;
+}
+
+void SchemaValidator::start_tag(ITag *pTag)
+{
+  const std::string &name = pTag->get_name();
+
+  // Header tags (<?xml ?>) are not a part of the document tree
+  if (!name.empty() && name[0] == '?') return;
+  if (!valid_) return;
+
+  if (stack_.empty() && root_closed_) {
+    fail("Element '" + name + "' after the root element");
+    return;
+  }
+
+  Frame frame;
+  frame.element = -1;
+  frame.state = 0;
+
+  if (schema_ != NULL) {
+    frame.element = schema_->element_id(name);
+    if (frame.element < 0) {
+      fail("Element '" + name + "' is not declared");
+      return;
+    }
+
+    if (stack_.empty()) {
+      if (frame.element != root_) {
+        fail("Root element must be '" + schema_->element(root_).name + "'");
+        return;
+      }
+    } else {
+      Frame &parent = stack_.back();
+      const ElementDecl &decl = schema_->element(parent.element);
+
+      if (decl.kind == ckEmpty) {
+        fail("Element '" + decl.name + "' must be empty");
+        return;
+      }
+      if (decl.kind != ckAny) {
+        parent.state = decl.automaton.step(parent.state, frame.element);
+        if (parent.state < 0) {
+          fail("Element '" + name + "' is not allowed in '" +
+               decl.name + "'");
+          return;
+        }
+      }
+    }
+
+    check_attributes(schema_->element(frame.element), pTag);
+  }
+
+  stack_.push_back(frame);
+}
+
+void SchemaValidator::end_tag(ITag *pTag)
+{
+  if (pTag == NULL) {
+    fail("End tag doesn't match the start tag");
+    return;
+  }
+
+  const std::string &name = pTag->get_name();
+  if (!name.empty() && name[0] == '?') return;
+  if (!valid_ || stack_.empty()) return;
+
+  Frame frame = stack_.back();
+  stack_.pop_back();
+  if (stack_.empty()) root_closed_ = true;
+
+  if (schema_ == NULL) return;
+
+  const ElementDecl &decl = schema_->element(frame.element);
+  if ((decl.kind == ckChildren) && !decl.automaton.accepting[frame.state]) {
+    fail("Element '" + name + "' is incomplete");
+  }
+}
+
+void SchemaValidator::content_tag(ITag *pTag, const std::string &content)
+{
+  if (!valid_) return;
+
+  if (stack_.empty()) {
+    fail("Text outside of the root element");
+    return;
+  }
+
+  if (schema_ == NULL) return;
+
+  const ElementDecl &decl = schema_->element(stack_.back().element);
+  if ((decl.kind == ckEmpty) || (decl.kind == ckChildren)) {
+    fail("Text is not allowed in '" + decl.name + "'");
+  }
+}
+
+void SchemaValidator::check_attributes(const ElementDecl &decl, ITag *pTag)
+{
+  const AttributeSet &attributes = pTag->get_attributes();
+
+  // Every present attribute is declared and has allowed value
+  for (size_t i = 0; i < attributes.size(); ++i) {
+    StringView name = attributes.name_at(i);
+    const AttributeDecl *found = NULL;
+
+    for (size_t d = 0; d < decl.attributes.size(); ++d) {
+      if (StringView(*decl.attributes[d].name) == name) {
+        found = &decl.attributes[d];
+        break;
+      }
+    }
+
+    if (found == NULL) {
+      fail("Attribute '" + name.str() + "' of '" + decl.name +
+           "' is not declared");
+      return;
+    }
+
+    StringView value = attributes.value_at(i);
+    bool allowed = found->values.empty();
+    for (size_t v = 0; !allowed && v < found->values.size(); ++v) {
+      allowed = (value == StringView(found->values[v]));
+    }
+    if ((found->use == auFixed) && (value != StringView(found->fixed))) {
+      allowed = false;
+    }
+
+    if (!allowed) {
+      fail("Attribute '" + name.str() + "' of '" + decl.name +
+           "' has invalid value '" + value.str() + "'");
+      return;
+    }
+  }
+
+  // Required attributes are present
+  for (size_t d = 0; d < decl.attributes.size(); ++d) {
+    const AttributeDecl &attr = decl.attributes[d];
+    if ((attr.use == auRequired) && !attributes.has(attr.name)) {
+      fail("Attribute '" + *attr.name + "' of '" + decl.name +
+           "' is required");
+      return;
+    }
+  }
+}
+
+bool SchemaValidator::result() const
+{
+  return valid_ && stack_.empty() && root_closed_;
+}
@@ -19,152 +19,693 @@
 
 std::ofstream log;
 
-int server(int connect_port)
+namespace {
+
+// The console and the log are written by all connection threads
+std::mutex output_lock;
+
+// Write text to the console and the log in one piece
+void write_output(const std::string &text)
 {
-    // Opening file for logging
-    log.open("log.txt", std::ios::app);
+    std::lock_guard<std::mutex> guard(output_lock);
+    std::cout << text;
+    log << text;
+    log.flush();
+}
 
-    std::cout << "\nTCP SERVER STARTED\n";
+// Set by SIGINT/SIGTERM, the accept cycle stops
+volatile sig_atomic_t stopping = 0;
 
-    // Creating socket for Unix
-    int mysocket;
+void stop_server(int)
+{
+    stopping = 1;
+}
 
-    // AF_INET - internet socket
-    // SOCK_STREAM - stream socket (with creating a connection)
-    // 0 - default TCP protocol
-    if ((mysocket = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-        // Error
-        std::cerr << " Error socket! ";
-        log << " Error socket! ";
+// Set by SIGUSR1, the accept cycle prints the latencies
+volatile sig_atomic_t reporting = 0;
 
-        return -1;
+void report_latency(int)
+{
+    reporting = 1;
+}
+
+// Listening socket of the metrics listener
+struct MetricsContext {
+    int socket;
+    DocumentService *service;
+};
+
+// Answering the scrapes of the metrics port one by one
+// until the listening socket is shut down
+void* metrics_service(void *context)
+{
+    MetricsContext *metrics = reinterpret_cast<MetricsContext*> (context);
+
+    for (;;) {
+        int scraper = accept(metrics->socket, NULL, NULL);
+        if (scraper < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            break;
+        }
+
+        // A stuck scraper doesn't block the next ones for long
+        timeval timeout;
+        timeout.tv_sec = 2;
+        timeout.tv_usec = 0;
+        setsockopt(scraper, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                   sizeof(timeout));
+
+        // Reading the request head
+        std::string request;
+        char buff[1024];
+        while ((request.find("\r\n\r\n") == std::string::npos) &&
+               (request.size() < 8192)) {
+            ssize_t bytes = recv(scraper, buff, sizeof(buff), 0);
+            if ((bytes < 0) && (errno == EINTR)) continue;
+            if (bytes <= 0) break;
+            request.append(buff, bytes);
+        }
+
+        std::string response = metrics_response(request, metrics->service);
+        send_all(scraper, &response);
+        close(scraper);
     }
 
-    // Binding the socket with local address
+    return 0;
+}
+
+// Listening socket on all interfaces or -1
+int listen_on(int port, int backlog)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) return -1;
+
+    int reuse = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
     sockaddr_in local_addr;
+    memset(&local_addr, 0, sizeof(local_addr));
     local_addr.sin_family = AF_INET;
-    local_addr.sin_port = htons(connect_port);
+    local_addr.sin_port = htons(port);
     local_addr.sin_addr.s_addr = 0;
 
-    // Binding for accepting connections
-    if (bind(mysocket,
-             reinterpret_cast<sockaddr*> (&local_addr),
-             sizeof(local_addr))) {
-        // Error
-        std::cerr << " Error bind! ";
-        log << " Error bind! ";
+    if (bind(sock, reinterpret_cast<sockaddr*> (&local_addr),
+             sizeof(local_addr)) || listen(sock, backlog)) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// Listening Unix domain socket at path or -1
+// (a socket left by a previous run is replaced, other files are not)
+int listen_local(const std::string &path)
+{
+    sockaddr_un local_addr;
+    memset(&local_addr, 0, sizeof(local_addr));
+    local_addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(local_addr.sun_path)) return -1;
+    memcpy(local_addr.sun_path, path.c_str(), path.size() + 1);
+
+    struct stat existing;
+    if ((lstat(path.c_str(), &existing) == 0) && S_ISSOCK(existing.st_mode)) {
+        unlink(path.c_str());
+    }
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) return -1;
 
+    if (bind(sock, reinterpret_cast<sockaddr*> (&local_addr),
+             sizeof(local_addr)) || listen(sock, 0x100)) {
+        close(sock);
         return -1;
     }
+    return sock;
+}
+
+}  // namespace
+
+// -- ConnectionSet
+void ConnectionSet::add(int sock)
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    sockets_.insert(sock);
+}
+
+void ConnectionSet::remove(int sock)
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    sockets_.erase(sock);
+    if (sockets_.empty()) drained_.notify_all();
+}
+
+void ConnectionSet::stop()
+{
+    std::unique_lock<std::mutex> guard(lock_);
+    stopping_.store(true);
+
+    // Blocked receives return 0, rings see the hangup
+    for (std::set<int>::iterator it = sockets_.begin(); it != sockets_.end();
+         ++it) {
+        shutdown(*it, SHUT_RDWR);
+    }
+    while (!sockets_.empty()) drained_.wait(guard);
+}
+
+int server(int connect_port, const char *rules_file, const char *schema_file,
+           const ServerOptions &options)
+{
+    // Opening file for logging
+    log.open("log.txt", std::ios::app);
+
+    std::cout << "\nTCP SERVER STARTED\n";
 
-    // Waiting for connections
-    // Size of queue 0x100
-    if (listen(mysocket, 0x100)) {
-        // Error
-        std::cerr << " Error listen! ";
-        log << " Error listen! ";
+    // Compiling the schema once for all clients
+    std::shared_ptr<Schema> schema;
+    if (strcmp(schema_file, "n") != 0) {
+        std::string error;
+        schema.reset(new Schema());
+
+        if (!schema->load(schema_file, &error)) {
+            std::cerr << " Error schema! " << error << "\n";
+            log << " Error schema! " << error << "\n";
+
+            return -1;
+        }
+        std::cout << "Validating against " << schema_file << "\n";
+    }
+
+    // Compiling the rules
+    std::shared_ptr<RuleSet> rules;
+    if (strcmp(rules_file, "n") != 0) {
+        std::string error;
+        rules.reset(new RuleSet());
+
+        if (!rules->load(rules_file, &error)) {
+            std::cerr << " Error rules! " << error << "\n";
+            log << " Error rules! " << error << "\n";
+
+            return -1;
+        }
+        std::cout << "Checking rules of " << rules_file << "\n";
+    }
+
+    Validator validator(schema, rules);
+    if (validator.is_generated()) {
+        std::cout << "Using the generated validator of the schema\n";
+    }
+
+    // Caches and stored documents shared by the connections
+    DocumentService service(&validator, options);
+    ResultCache *cache = service.cache();
+    if ((cache != NULL) && !options.cache_snapshot.empty() &&
+        cache->load(options.cache_snapshot.c_str(), validator.fingerprint())) {
+        std::cout << "Loaded " << cache->size() << " cached verdicts\n";
+    }
+
+    // Spans of the sampled connections
+    if (!options.trace_file.empty()) {
+        std::string error;
+        if (!trace_open(options.trace_file, options.trace_sample, &error)) {
+            std::cerr << " Error trace! " << error << "\n";
+            log << " Error trace! " << error << "\n";
+
+            return -1;
+        }
+        std::cout << "Tracing 1 of " << options.trace_sample
+                  << " connections to " << options.trace_file << "\n";
+    }
+
+    // Received documents for replaying
+    if (!options.capture_file.empty()) {
+        std::string error;
+        if (!service.start_capture(options.capture_file, &error)) {
+            std::cerr << " Error capture! " << error << "\n";
+            log << " Error capture! " << error << "\n";
+
+            return -1;
+        }
+        std::cout << "Capturing documents to " << options.capture_file
+                  << "\n";
+    }
+
+    // Stopping by Ctrl+C or kill, without SA_RESTART accept is interrupted
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop_server;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    // Latencies of the phases on demand by kill -USR1
+    action.sa_handler = report_latency;
+    sigaction(SIGUSR1, &action, NULL);
+
+    // Only the accepting thread takes the signals
+    sigset_t stop_signals;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    sigaddset(&stop_signals, SIGUSR1);
+
+    if ((connect_port == 0) && options.unix_socket.empty() &&
+        options.ring_socket.empty() && (options.http_port == 0)) {
+        std::cerr << " Error! Neither port nor unix socket to listen on\n";
+        log << " Error! Neither port nor unix socket to listen on\n";
 
         return -1;
     }
 
+    // Creating socket for Unix (port 0 - only the Unix domain socket)
+    int mysocket = -1;
+
+    if (connect_port != 0) {
+        // AF_INET - internet socket
+        // SOCK_STREAM - stream socket (with creating a connection)
+        // 0 - default TCP protocol
+        if ((mysocket = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+            // Error
+            std::cerr << " Error socket! ";
+            log << " Error socket! ";
+
+            return -1;
+        }
+
+        // Binding the socket with local address
+        sockaddr_in local_addr;
+        local_addr.sin_family = AF_INET;
+        local_addr.sin_port = htons(connect_port);
+        local_addr.sin_addr.s_addr = 0;
+
+        // Binding for accepting connections
+        if (bind(mysocket,
+                 reinterpret_cast<sockaddr*> (&local_addr),
+                 sizeof(local_addr))) {
+            // Error
+            std::cerr << " Error bind! ";
+            log << " Error bind! ";
+
+            return -1;
+        }
+
+        // Waiting for connections
+        // Size of queue 0x100
+        if (listen(mysocket, 0x100)) {
+            // Error
+            std::cerr << " Error listen! ";
+            log << " Error listen! ";
+
+            return -1;
+        }
+    }
+
+    // Unix domain socket for the clients of this host
+    int local_socket = -1;
+    // Socket attaching the shared memory rings of local producers
+    int ring_socket = -1;
+    if (!options.unix_socket.empty()) {
+        local_socket = listen_local(options.unix_socket);
+        if (local_socket < 0) {
+            std::cerr << " Error unix socket! ";
+            log << " Error unix socket! ";
+
+            if (mysocket >= 0) close(mysocket);
+            return -1;
+        }
+        std::cout << "Listening on " << options.unix_socket << "\n";
+    }
+    if (!options.ring_socket.empty()) {
+#ifdef __linux__
+        ring_socket = listen_local(options.ring_socket);
+#endif
+        if (ring_socket < 0) {
+            std::cerr << " Error shared memory socket! ";
+            log << " Error shared memory socket! ";
+
+            if (mysocket >= 0) close(mysocket);
+            if (local_socket >= 0) close(local_socket);
+            return -1;
+        }
+        std::cout << "Attaching shared memory rings on "
+                  << options.ring_socket << "\n";
+    }
+
+    // HTTP/1.1 front end, served by the same threads and DocumentService
+    int http_socket = -1;
+    if (options.http_port != 0) {
+        http_socket = listen_on(options.http_port, 0x100);
+        if (http_socket < 0) {
+            std::cerr << " Error HTTP port! ";
+            log << " Error HTTP port! ";
+
+            if (mysocket >= 0) close(mysocket);
+            if (local_socket >= 0) close(local_socket);
+            if (ring_socket >= 0) close(ring_socket);
+            return -1;
+        }
+        std::cout << "HTTP on port " << options.http_port << "\n";
+    }
+
+    // Metrics for Prometheus on the side port
+    MetricsContext metrics = { -1, &service };
+    pthread_t metrics_thread;
+    if (options.metrics_port != 0) {
+        metrics.socket = listen_on(options.metrics_port, 16);
+        if (metrics.socket < 0) {
+            std::cerr << " Error metrics port! ";
+            log << " Error metrics port! ";
+
+            if (mysocket >= 0) close(mysocket);
+            if (local_socket >= 0) close(local_socket);
+            if (ring_socket >= 0) close(ring_socket);
+            if (http_socket >= 0) close(http_socket);
+            return -1;
+        }
+
+        sigset_t old_signals;
+        pthread_sigmask(SIG_BLOCK, &stop_signals, &old_signals);
+        pthread_create(&metrics_thread, NULL, metrics_service, &metrics);
+        pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+        std::cout << "Metrics on port " << options.metrics_port << "\n";
+    }
+
     std::cout << "Waiting for connections\n";
 
+    // Listening sockets: TCP, the Unix domain one, the rings one and HTTP
+    pollfd listeners[4];
+    nfds_t listener_count = 0;
+    if (mysocket >= 0) {
+        listeners[listener_count].fd = mysocket;
+        listeners[listener_count++].events = POLLIN;
+    }
+    if (local_socket >= 0) {
+        listeners[listener_count].fd = local_socket;
+        listeners[listener_count++].events = POLLIN;
+    }
+    if (ring_socket >= 0) {
+        listeners[listener_count].fd = ring_socket;
+        listeners[listener_count++].events = POLLIN;
+    }
+    if (http_socket >= 0) {
+        listeners[listener_count].fd = http_socket;
+        listeners[listener_count++].events = POLLIN;
+    }
+
+    // Sockets of the servicing threads, drained before the teardown
+    ConnectionSet connections;
+
     // Socket for client
     int client_socket;
     // Address of client
-    sockaddr_in client_addr;
+    sockaddr_storage client_addr;
     // Size of client address
-    unsigned int client_addr_size = sizeof(client_addr);
+    socklen_t client_addr_size;
 
     // Cycle for accepting connections
-    for ( ; ; ) {
-        client_socket = accept(mysocket,
-                               reinterpret_cast<sockaddr*> (&client_addr),
-                               &client_addr_size);
+    while (!stopping) {
+        if (reporting) {
+            reporting = 0;
+            std::lock_guard<std::mutex> guard(output_lock);
+            std::cout << "\n" << service.latency().report();
+        }
+
+        // Waiting for connections, signals interrupt it
+        if (poll(listeners, listener_count, -1) <= 0) continue;
+
+        for (nfds_t i = 0; i < listener_count; ++i) {
+            if ((listeners[i].revents & POLLIN) == 0) continue;
+
+            client_addr_size = sizeof(client_addr);
+            client_socket = accept(listeners[i].fd,
+                                   reinterpret_cast<sockaddr*> (&client_addr),
+                                   &client_addr_size);
+            if (client_socket < 0) continue;
+            uint64_t accepted = monotonic_ns();
+
+            // The client info starts the lines of the connection
+            bool ring = (listeners[i].fd == ring_socket);
+            std::string client_name = ring ? "ring" : "local";
+            if (client_addr.ss_family == AF_INET) {
+                client_name = inet_ntoa(
+                    reinterpret_cast<sockaddr_in*> (&client_addr)->sin_addr);
+            }
+
+            ServiceContext *context = new ServiceContext;
+            context->client = " " __TIME__ "  [" + client_name + "] ";
+            context->socket = client_socket;
+            context->service = &service;
+            context->connections = &connections;
+            context->accepted = accepted;
+            context->http = (listeners[i].fd == http_socket);
+
+            // The new thread inherits the blocked signals
+            sigset_t old_signals;
+            pthread_sigmask(SIG_BLOCK, &stop_signals, &old_signals);
+
+            connections.add(client_socket);
+            pthread_t thread;
+            if (pthread_create(&thread, NULL,
+                               ring ? ring_service : client_service,
+                               context) == 0) {
+                pthread_detach(thread);
+            } else {
+                write_output(context->client + "Error thread!\n");
+                connections.remove(client_socket);
+                close(client_socket);
+                delete context;
+            }
+
+            pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+        }
+    }
 
-        // Printing the client info
-        std::cout << " " << __TIME__ << " ";
-        std::cout << " [" << inet_ntoa(client_addr.sin_addr) << "] ";
-        log << " " << __TIME__ << " ";
-        log << " [" << inet_ntoa(client_addr.sin_addr) << "] ";
+    if (mysocket >= 0) close(mysocket);
+    if (local_socket >= 0) {
+        close(local_socket);
+        unlink(options.unix_socket.c_str());
+    }
+    if (ring_socket >= 0) {
+        close(ring_socket);
+        unlink(options.ring_socket.c_str());
+    }
+    if (http_socket >= 0) close(http_socket);
 
-        pthread_t thread;
-        pthread_create(&thread, NULL, client_service, &client_socket);
+    // The connections end before the service, the validator and the cache
+    // they use go away (and before the cache is saved)
+    connections.stop();
+
+    if (metrics.socket >= 0) {
+        // Waking up the accept of the metrics thread
+        shutdown(metrics.socket, SHUT_RDWR);
+        pthread_join(metrics_thread, NULL);
+        close(metrics.socket);
+    }
+    std::cout << "\nTCP SERVER STOPPED\n";
+    std::cout << service.latency().report();
+    trace_close();
+
+    if (cache != NULL) {
+        std::cout << "Cache hit rate " << cache->hit_rate() * 100 << "% ("
+                  << cache->hits() << " of "
+                  << cache->hits() + cache->misses() << "), "
+                  << cache->shared() << " by canonical form\n";
+        log << " Cache hit rate " << cache->hit_rate() * 100 << "%\n";
+
+        if (!options.cache_snapshot.empty() &&
+            !cache->save(options.cache_snapshot.c_str(),
+                         validator.fingerprint())) {
+            std::cerr << " Error saving cache snapshot! ";
+            log << " Error saving cache snapshot! ";
+        }
     }
 
     return 0;
 }
 
+// Printing the verdicts of session, one line after the client info
+static void log_verdicts(IConnectionSession *session,
+                         std::vector<Verdict> *verdicts,
+                         const std::string &client)
+{
+    session->take_verdicts(verdicts);
+    if (verdicts->empty()) return;
+
+    std::string line = client;
+    for (size_t i = 0; i < verdicts->size(); ++i) {
+        const Verdict &verdict = (*verdicts)[i];
+        line += " " + verdict.result.to_string() + " " +
+                verdict_source_note(verdict.source);
+    }
+    write_output(line + "\n");
+}
+
+// Sending the reply, timed as the send phase and counted
+static void send_reply(int my_sock, std::string *reply,
+                       DocumentService *service)
+{
+    if (reply->empty()) return;
+
+    uint64_t start = monotonic_ns();
+    service->metrics().add(ctBytesOut, reply->size());
+    send_all(my_sock, reply);
+    service->latency().record_since(phSend, start);
+    trace_span("send", start, monotonic_ns());
+}
+
 // This function is being created in new thread
 // and is servicing the client (regardless of other)
-void* client_service(void* client_socket)
+void* client_service(void* context)
 {
-    uint64_t start = tick();
     // Buffer for sending and receiving data
     char packet_buff[PACKET_BUFF_SIZE];
 
-    int my_sock = (reinterpret_cast<int*> (client_socket))[0];
+    std::unique_ptr<ServiceContext> service(
+        reinterpret_cast<ServiceContext*> (context));
+    int my_sock = service->socket;
     int bytes_recv;
+    LatencyStats &latency = service->service->latency();
+    ServerMetrics &metrics = service->service->metrics();
+    bool first_bytes = true;
+
+    metrics.add(ctConnections, 1);
+    metrics.connection_opened();
+
+    // Stages of the sampled connections for the trace
+    trace_begin("connection");
+    trace_span("spawn", service->accepted, monotonic_ns());
+    uint64_t wait_start = monotonic_ns();
+
+    // Receiving documents, replies are sent as they are ready
+    // (HTTP requests and the native protocol share everything past this)
+    std::unique_ptr<IConnectionSession> session;
+    if (service->http) {
+        session.reset(new HttpSession(service->service));
+    } else {
+        session.reset(new Session(service->service, PACKET_BUFF_SIZE));
+    }
+    std::string reply;
+    std::vector<Verdict> verdicts;
 
-    // Creating the filestream and file
-    std::fstream tmpfile("tmp.xml", std::ios::out);
-
-    // Receiving the file from client
-    while ((bytes_recv = recv(my_sock,
+    while (!session->done() &&
+           (bytes_recv = recv(my_sock,
                               &packet_buff[0],
                               sizeof(packet_buff),
-                              0))) {
-        if (packet_buff[0] == '~' && packet_buff[1] == '~') break;
-
-        tmpfile << packet_buff << std::endl;
-        memset(packet_buff, '\0', PACKET_BUFF_SIZE);
-    }
-
-    tmpfile.close();
-
-    // Using to sending the validation result
-    tmpfile.open("tmp.xml", std::ios::in);
-    if (tmpfile.is_open() != 1) {
-        std::cerr << "File not found!!!\n";
+                              0)) > 0) {
+        trace_span("recv", wait_start, monotonic_ns());
+        if (first_bytes) {
+            latency.record_since(phAccept, service->accepted);
+            first_bytes = false;
+        }
+
+        metrics.add(ctBytesIn, bytes_recv);
+        {
+            TraceSpan span("feed");
+            session->feed(packet_buff, bytes_recv, &reply);
+        }
+        send_reply(my_sock, &reply, service->service);
+        log_verdicts(session.get(), &verdicts, service->client);
+        wait_start = monotonic_ns();
     }
 
-    ParseEventTracker events;
-    Document *pDoc;
-    bool is_eof = false;
-    bool validating;
-
-    while (is_eof != 1) {
-        tmpfile.read(packet_buff, PACKET_BUFF_SIZE);
+    session->finish(&reply);
+    send_reply(my_sock, &reply, service->service);
+    log_verdicts(session.get(), &verdicts, service->client);
+    session.reset();
 
-        is_eof = tmpfile.eof();
+    // Handling time of the connection
+    uint64_t handling = monotonic_ns() - service->accepted;
+    latency.record(phConnection, handling);
+    trace_span("connection", service->accepted, service->accepted + handling);
+    trace_end();
+    std::ostringstream line;
+    line << service->client << handling / 1e6 << " ms\n";
+    write_output(line.str());
 
-        pDoc = Parser::loadXML(packet_buff, &events);
-        // pDoc -> dump_tag_tree( pDoc -> get_root(), 0 );
+    metrics.connection_closed();
+    service->connections->remove(my_sock);
 
-        memset(packet_buff, '\0', PACKET_BUFF_SIZE);
-    }
+    // Closing the socket
+    close(my_sock);
 
-    validating = events.result();
+    return 0;
+}
 
-    if (validating == true) {
-        send(my_sock, "File is valid!", PACKET_BUFF_SIZE, 0);
-        std::cout << " File is valid! ";
-        log << " File is valid! ";
-    } else if (validating == false) {
-        send(my_sock, "File is invalid!", PACKET_BUFF_SIZE, 0);
-        std::cout << " File is invalid! ";
-        log << " File is invalid! ";
+void* ring_service(void* context)
+{
+    std::unique_ptr<ServiceContext> service(
+        reinterpret_cast<ServiceContext*> (context));
+    int my_sock = service->socket;
+    DocumentService &documents = *service->service;
+    ServerMetrics &metrics = documents.metrics();
+
+    metrics.add(ctConnections, 1);
+    metrics.connection_opened();
+    trace_begin("ring");
+
+#ifdef __linux__
+    // Documents are parsed in place in the shared memory of the producer
+    // (they aren't received: no receive phase)
+    ShmConsumer ring;
+    std::string error;
+    size_t count = 0;
+    CaptureWriter *writer = documents.capture();
+    uint32_t connection = 0;  // number in the capture
+    if (ring.attach(my_sock, &error)) {
+        StringView document;
+        while (!service->connections->stopping() && ring.next(&document)) {
+            uint64_t arrived = wall_us();
+            metrics.add(ctBytesIn, document.size());
+
+            // The producer can rewrite the bytes between the hash, the
+            // scan and the parse: its verdicts aren't cached for others
+            Hash128 hash;
+            hash.update(document.data(), document.size());
+            kVerdictSource source;
+            ValidationResult result = documents.validate("", document,
+                                                         hash.digest(),
+                                                         &source, false);
+
+            // The capture copies the bytes as they are after the parse
+            if (writer != NULL) {
+                if (connection == 0) connection = writer->next_connection();
+                CaptureRecord record;
+                record.time = arrived;
+                record.connection = connection;
+                record.valid = result.valid;
+                record.document = document.str();
+                writer->write(record);
+            }
+
+            // Writing the verdict back, timed as the send phase
+            uint64_t start = monotonic_ns();
+            ring.complete(result);
+            documents.latency().record_since(phSend, start);
+            trace_span("send", start, monotonic_ns());
+            ++count;
+        }
+        error = ring.error();
     }
 
-    uint64_t end = tick();
-    std::cout << end  -start << "\n";
-    log << end  -start << "\n";
-
-    // Closing the file
-    tmpfile.close();
-    remove("tmp.xml");
-    log.close();
-    log.open("log.txt", std::ios::app);
+#endif
+
+    // Handling time of the ring
+    uint64_t handling = monotonic_ns() - service->accepted;
+    documents.latency().record(phConnection, handling);
+    trace_span("ring", service->accepted, service->accepted + handling);
+    trace_end();
+    std::ostringstream line;
+    line << service->client;
+#ifdef __linux__
+    line << count << " documents ";
+    if (!error.empty()) line << "(" << error << ") ";
+#endif
+    line << handling / 1e6 << " ms\n";
+    write_output(line.str());
+
+    metrics.connection_closed();
+    service->connections->remove(my_sock);
+    close(my_sock);
 
     return 0;
 }
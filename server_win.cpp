@@ -19,7 +19,87 @@
 
 std::ofstream log;
 
-int server(int connect_port)
+namespace {
+
+// The console and the log are written by all connection threads
+std::mutex output_lock;
+
+// Write text to the console and the log in one piece
+void write_output(const std::string &text)
+{
+    std::lock_guard<std::mutex> guard(output_lock);
+    std::cout << text;
+    log << text;
+    log.flush();
+}
+
+// Cache to save on Ctrl+C or closing the console
+ResultCache *stop_cache = NULL;
+std::string stop_snapshot;
+uint64_t stop_config = 0;
+// Latencies to print then
+LatencyStats *stop_latency = NULL;
+
+BOOL WINAPI stop_server(DWORD)
+{
+    if (stop_latency != NULL) std::cout << "\n" << stop_latency->report();
+    trace_close();
+
+    if (stop_cache != NULL) {
+        std::cout << "\nCache hit rate " << stop_cache->hit_rate() * 100
+                  << "%\n";
+        if (!stop_snapshot.empty()) {
+            stop_cache->save(stop_snapshot.c_str(), stop_config);
+        }
+    }
+
+    // The default handler terminates the process
+    return FALSE;
+}
+
+// Listening socket of the metrics listener
+struct MetricsContext {
+    SOCKET socket;
+    DocumentService *service;
+};
+
+// Answering the scrapes of the metrics port one by one
+DWORD WINAPI metrics_service(LPVOID context)
+{
+    MetricsContext *metrics = reinterpret_cast<MetricsContext*> (context);
+
+    for ( ; ; ) {
+        SOCKET scraper = accept(metrics->socket, NULL, NULL);
+        if (scraper == INVALID_SOCKET) break;
+
+        // A stuck scraper doesn't block the next ones for long
+        DWORD timeout = 2000;
+        setsockopt(scraper, SOL_SOCKET, SO_RCVTIMEO,
+                   reinterpret_cast<const char*> (&timeout),
+                   sizeof(timeout));
+
+        // Reading the request head
+        std::string request;
+        char buff[1024];
+        while ((request.find("\r\n\r\n") == std::string::npos) &&
+               (request.size() < 8192)) {
+            int bytes = recv(scraper, buff, sizeof(buff), 0);
+            if (bytes <= 0) break;
+            request.append(buff, bytes);
+        }
+
+        std::string response = metrics_response(request, metrics->service);
+        send_all(scraper, &response);
+        closesocket(scraper);
+    }
+
+    return 0;
+}
+
+}  // namespace
+
+int server(int connect_port, const char *rules_file, const char *schema_file,
+           const ServerOptions &options)
 {
     // Buffer for WSA and other metadata
     char buff[1024];
@@ -29,6 +109,100 @@ int server(int connect_port)
 
     std::cout << "\nTCP SERVER STARTED\n";
 
+    // Compiling the schema once for all clients
+    std::shared_ptr<Schema> schema;
+    if (strcmp(schema_file, "n") != 0) {
+        std::string error;
+        schema.reset(new Schema());
+
+        if (!schema->load(schema_file, &error)) {
+            std::cerr << " Error schema! " << error << "\n";
+            log << " Error schema! " << error << "\n";
+
+            return -1;
+        }
+        std::cout << "Validating against " << schema_file << "\n";
+    }
+
+    // Compiling the rules
+    std::shared_ptr<RuleSet> rules;
+    if (strcmp(rules_file, "n") != 0) {
+        std::string error;
+        rules.reset(new RuleSet());
+
+        if (!rules->load(rules_file, &error)) {
+            std::cerr << " Error rules! " << error << "\n";
+            log << " Error rules! " << error << "\n";
+
+            return -1;
+        }
+        std::cout << "Checking rules of " << rules_file << "\n";
+    }
+
+    Validator validator(schema, rules);
+    if (validator.is_generated()) {
+        std::cout << "Using the generated validator of the schema\n";
+    }
+
+    // Caches and stored documents shared by the connections
+    DocumentService service(&validator, options);
+    ResultCache *cache = service.cache();
+    if (cache != NULL) {
+        if (!options.cache_snapshot.empty() &&
+            cache->load(options.cache_snapshot.c_str(),
+                        validator.fingerprint())) {
+            std::cout << "Loaded " << cache->size() << " cached verdicts\n";
+        }
+
+        stop_cache = cache;
+        stop_snapshot = options.cache_snapshot;
+        stop_config = validator.fingerprint();
+    }
+    stop_latency = &service.latency();
+    SetConsoleCtrlHandler(stop_server, TRUE);
+
+    // Spans of the sampled connections
+    if (!options.trace_file.empty()) {
+        std::string error;
+        if (!trace_open(options.trace_file, options.trace_sample, &error)) {
+            std::cerr << " Error trace! " << error << "\n";
+            log << " Error trace! " << error << "\n";
+
+            return -1;
+        }
+        std::cout << "Tracing 1 of " << options.trace_sample
+                  << " connections to " << options.trace_file << "\n";
+    }
+
+    // Unix domain sockets and shared memory rings are served only on Unix
+    if (!options.unix_socket.empty() || !options.ring_socket.empty()) {
+        std::cerr << " Error! Unix domain sockets are not supported\n";
+        log << " Error! Unix domain sockets are not supported\n";
+
+        return -1;
+    }
+
+    // The HTTP front end is served only on Unix
+    if (options.http_port != 0) {
+        std::cerr << " Error! HTTP listener is not supported\n";
+        log << " Error! HTTP listener is not supported\n";
+
+        return -1;
+    }
+
+    // Received documents for replaying
+    if (!options.capture_file.empty()) {
+        std::string error;
+        if (!service.start_capture(options.capture_file, &error)) {
+            std::cerr << " Error capture! " << error << "\n";
+            log << " Error capture! " << error << "\n";
+
+            return -1;
+        }
+        std::cout << "Capturing documents to " << options.capture_file
+                  << "\n";
+    }
+
     // Sockets library initialisation
     if (WSAStartup(0x0202, reinterpret_cast<WSADATA*> (&buff[0]))) {
         // Error
@@ -88,6 +262,36 @@ int server(int connect_port)
         return -1;
     }
 
+    // Metrics for Prometheus on the side port
+    MetricsContext metrics = { INVALID_SOCKET, &service };
+    if (options.metrics_port != 0) {
+        sockaddr_in metrics_addr;
+        metrics_addr.sin_family = AF_INET;
+        metrics_addr.sin_port = htons(options.metrics_port);
+        metrics_addr.sin_addr.s_addr = 0;
+
+        metrics.socket = socket(AF_INET, SOCK_STREAM, 0);
+        if ((metrics.socket == INVALID_SOCKET) ||
+            bind(metrics.socket,
+                 reinterpret_cast<sockaddr*> (&metrics_addr),
+                 sizeof(metrics_addr)) ||
+            listen(metrics.socket, 16)) {
+            std::cerr << " Error metrics port! ";
+            log << " Error metrics port! ";
+
+            // Closing the sockets
+            if (metrics.socket != INVALID_SOCKET) closesocket(metrics.socket);
+            closesocket(mysocket);
+            WSACleanup();
+
+            return -1;
+        }
+
+        DWORD thID;
+        CreateThread(NULL, NULL, metrics_service, &metrics, NULL, &thID);
+        std::cout << "Metrics on port " << options.metrics_port << "\n";
+    }
+
     std::cout << "Waiting for connections\n";
 
     // Socket for client
@@ -102,95 +306,118 @@ int server(int connect_port)
         client_socket = accept(mysocket,
                                reinterpret_cast<sockaddr*> (&client_addr),
                                &client_addr_size);
+        uint64_t accepted = monotonic_ns();
 
-        // Printing the client info
-        std::cout << " " << __TIME__ << " ";
-        std::cout << " [" << inet_ntoa(client_addr.sin_addr) << "] ";
-        log << " " << __TIME__ << " ";
-        log << " [" << inet_ntoa(client_addr.sin_addr) << "] ";
+        // Creating new thread for client service, the client info starts
+        // the lines of the connection
+        ServiceContext *context = new ServiceContext;
+        context->client = std::string(" " __TIME__ "  [") +
+                          inet_ntoa(client_addr.sin_addr) + "] ";
+        context->socket = client_socket;
+        context->service = &service;
+        context->accepted = accepted;
 
-        // Creating new thread for client service
         DWORD thID;
-        CreateThread(NULL, NULL, client_service, &client_socket, NULL, &thID);
+        CreateThread(NULL, NULL, client_service, context, NULL, &thID);
     }
 
     return 0;
 }
 
+// Printing the verdicts of session, one line after the client info
+static void log_verdicts(Session *session, std::vector<Verdict> *verdicts,
+                         const std::string &client)
+{
+    session->take_verdicts(verdicts);
+    if (verdicts->empty()) return;
+
+    std::string line = client;
+    for (size_t i = 0; i < verdicts->size(); ++i) {
+        const Verdict &verdict = (*verdicts)[i];
+        line += " " + verdict.result.to_string() + " " +
+                verdict_source_note(verdict.source);
+    }
+    write_output(line + "\n");
+}
+
+// Sending the reply, timed as the send phase and counted
+static void send_reply(SOCKET my_sock, std::string *reply,
+                       DocumentService *service)
+{
+    if (reply->empty()) return;
+
+    uint64_t start = monotonic_ns();
+    service->metrics().add(ctBytesOut, reply->size());
+    send_all(my_sock, reply);
+    service->latency().record_since(phSend, start);
+    trace_span("send", start, monotonic_ns());
+}
+
 // This function is being created in new thread
 // and is servicing the client (regardless of other)
-DWORD WINAPI client_service(LPVOID client_socket)
+DWORD WINAPI client_service(LPVOID context)
 {
-    uint64_t start = tick();
     // Buffer for sending and receiving data
     char packet_buff[PACKET_BUFF_SIZE];
 
-    // Creating socket
-    SOCKET my_sock = (reinterpret_cast<SOCKET*> (client_socket))[0];
+    std::unique_ptr<ServiceContext> service(
+        reinterpret_cast<ServiceContext*> (context));
+    SOCKET my_sock = service->socket;
     int bytes_recv;
+    LatencyStats &latency = service->service->latency();
+    ServerMetrics &metrics = service->service->metrics();
+    bool first_bytes = true;
 
-    // Creating the filestream and file
-    std::fstream tmpfile("tmp.xml", std::ios::out);
-
-    // Receiving the file from client
-    while ((bytes_recv = recv(my_sock,
-                              &packet_buff[0],
-                              sizeof(packet_buff),
-                              0))) {
-        if (packet_buff[0] == '~' && packet_buff[1] == '~') break;
-
-        tmpfile << packet_buff << std::endl;
-        memset(packet_buff, '\0', PACKET_BUFF_SIZE);
-    }
-
-    tmpfile.close();
-
-    // Using to sending the validation result
-    tmpfile.open("tmp.xml", std::ios::in);
-    if (tmpfile.is_open() != 1) {
-        std::cerr << "File not found!!!\n";
-    }
-
-    ParseEventTracker events;
-    Document *pDoc;
-    bool is_eof = false;
-    bool validating;
-
-    while (is_eof != 1) {
-        tmpfile.read(packet_buff, PACKET_BUFF_SIZE);
+    metrics.add(ctConnections, 1);
+    metrics.connection_opened();
 
-        is_eof = tmpfile.eof();
+    // Stages of the sampled connections for the trace
+    trace_begin("connection");
+    trace_span("spawn", service->accepted, monotonic_ns());
+    uint64_t wait_start = monotonic_ns();
 
-        pDoc = Parser::loadXML(packet_buff, &events);
-        // pDoc -> dump_tag_tree( pDoc -> get_root(), 0 );
-
-        memset(packet_buff, '\0', PACKET_BUFF_SIZE);
-    }
+    // Receiving documents, replies are sent as they are ready
+    Session session(service->service, PACKET_BUFF_SIZE);
+    std::string reply;
+    std::vector<Verdict> verdicts;
 
-    validating = events.result();
-
-    if (validating == true) {
-        send(my_sock, "File is valid!", PACKET_BUFF_SIZE, 0);
-        std::cout << " File is valid! ";
-        log << " File is valid! ";
-    } else if (validating == false) {
-        send(my_sock, "File is invalid!", PACKET_BUFF_SIZE, 0);
-        std::cout << " File is invalid! ";
-        log << " File is invalid! ";
+    while (!session.done() &&
+           (bytes_recv = recv(my_sock,
+                              &packet_buff[0],
+                              sizeof(packet_buff),
+                              0)) > 0) {
+        trace_span("recv", wait_start, monotonic_ns());
+        if (first_bytes) {
+            latency.record_since(phAccept, service->accepted);
+            first_bytes = false;
+        }
+
+        metrics.add(ctBytesIn, bytes_recv);
+        {
+            TraceSpan span("feed");
+            session.feed(packet_buff, bytes_recv, &reply);
+        }
+        send_reply(my_sock, &reply, service->service);
+        log_verdicts(&session, &verdicts, service->client);
+        wait_start = monotonic_ns();
     }
 
-    uint64_t end = tick();
-    std::cout << end - start << "\n";
-    log << end - start << "\n";
+    session.finish(&reply);
+    send_reply(my_sock, &reply, service->service);
+    log_verdicts(&session, &verdicts, service->client);
 
-    // Closing the file
-    tmpfile.close();
-    remove("tmp.xml");
-    log.close();
-    log.open("log.txt", std::ios::app);
+    // Handling time of the connection
+    uint64_t handling = monotonic_ns() - service->accepted;
+    latency.record(phConnection, handling);
+    trace_span("connection", service->accepted, service->accepted + handling);
+    trace_end();
+    std::ostringstream line;
+    line << service->client << handling / 1e6 << " ms\n";
+    write_output(line.str());
 
     // Closing the socket
     closesocket(my_sock);
+    metrics.connection_closed();
 
     return 0;
 }
@@ -0,0 +1,482 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#include "include/service.h"
+#include "include/trace.h"
+
+#include <string.h>
+
+#include <string>
+
+const char *verdict_source_note(kVerdictSource source)
+{
+  switch (source) {
+    case vsCached:
+      return "(cached) ";
+    case vsCanonical:
+      return "(cached canonical) ";
+    case vsSubtrees:
+      return "(changed subtrees) ";
+    default:
+      return "";
+  }
+}
+
+// -- DocumentService
+DocumentService::DocumentService(const Validator *validator,
+                                 const ServerOptions &options)
+    : validator_(validator),
+      canonical_(options.canonical),
+      versions_capacity_(options.documents)
+{
+  // Verdicts of repeated documents
+  if (options.cache_size > 0) {
+    cache_.reset(new ResultCache(options.cache_size));
+  }
+
+  // Outlines of documents named by clients
+  if (options.documents > 0) {
+    subtrees_.reset(new SubtreeCache(options.documents));
+  }
+}
+
+bool DocumentService::start_capture(const std::string &file_name,
+                                    std::string *error)
+{
+  std::unique_ptr<CaptureWriter> capture(new CaptureWriter());
+  if (!capture->open(file_name, error)) return false;
+
+  capture_.reset(capture.release());
+  return true;
+}
+
+ValidationResult DocumentService::validate(const std::string &id,
+                                           StringView document,
+                                           const Digest128 &digest,
+                                           kVerdictSource *source, bool keep)
+{
+  TraceSpan span("validate");
+  metrics_.validation_started();
+  AllocationScope allocations;
+  uint64_t start = monotonic_ns();
+  ValidationResult result = lookup_or_validate(id, document, digest, source,
+                                               keep);
+  uint64_t elapsed = monotonic_ns() - start;
+  latency_.record(phValidate, elapsed);
+  metrics_.validation_finished();
+
+  metrics_.add(ctDocuments, 1);
+  metrics_.add(result.valid ? ctValid : ctInvalid, 1);
+  if (*source != vsCached) {
+    metrics_.add(ctParses, 1);
+    metrics_.add(ctParsedBytes, document.size());
+    metrics_.add(ctParseNs, elapsed);
+    metrics_.add_parse_allocations(allocations.stats());
+  }
+  return result;
+}
+
+ValidationResult DocumentService::lookup_or_validate(
+    const std::string &id, StringView document,
+    const Digest128 &digest, kVerdictSource *source, bool keep)
+{
+  ValidationResult result;
+
+  // Repeated documents are answered without parsing
+  if (cache_ && cache_->lookup(digest, &result)) {
+    *source = vsCached;
+    return result;
+  }
+
+  *source = vsValidated;
+  if (!id.empty() && subtrees_ && keep) {
+    // Named document: only the subtrees changed since its last
+    // valid version are validated
+    bool partial = false;
+    result = subtrees_->validate(*validator_, id, document, &partial);
+    if (partial) *source = vsSubtrees;
+  } else {
+    // Differing only in whitespace or attribute order from a valid
+    // document, the document is valid too: one scan of the bytes
+    // saves the parse. Only valid verdicts are shared, the first error
+    // of an invalid document may differ between the forms.
+    Digest128 canonical;
+    bool has_canonical = cache_ && canonical_ &&
+                         canonical_digest(document, &canonical);
+    if (has_canonical && cache_->lookup_shared(canonical, &result)) {
+      *source = vsCanonical;
+    } else {
+      result = validator_->validate(document);
+      if (has_canonical && result.valid && keep) {
+        cache_->store(canonical, result);
+      }
+    }
+  }
+
+  if (cache_ && keep) cache_->store(digest, result);
+  return result;
+}
+
+DocumentService::VersionPtr DocumentService::find_version(
+    const std::string &id)
+{
+  std::lock_guard<std::mutex> guard(versions_lock_);
+
+  std::unordered_map<std::string, VersionList::iterator>::iterator it =
+      version_index_.find(id);
+  if (it == version_index_.end()) return VersionPtr();
+
+  versions_.splice(versions_.begin(), versions_, it->second);
+  return it->second->second;
+}
+
+Signatures DocumentService::signatures(const std::string &id)
+{
+  VersionPtr version = find_version(id);
+  if (!version) return Signatures();
+
+  return make_signatures(version->text,
+                         choose_block_size(version->text.size()));
+}
+
+bool DocumentService::apply_delta(const std::string &id, const Digest128 &base,
+                                  const std::string &delta, size_t pos,
+                                  std::string *document, std::string *error)
+{
+  if (base == Digest128()) {
+    return ::apply_delta(std::string(), 0, delta, pos, document, error);
+  }
+
+  // Another client may have stored a newer version meanwhile
+  VersionPtr version = find_version(id);
+  if (!version || (version->digest != base)) {
+    *error = "Stored version of document changed";
+    return false;
+  }
+
+  return ::apply_delta(version->text, choose_block_size(version->text.size()),
+                       delta, pos, document, error);
+}
+
+void DocumentService::keep_version(const std::string &id,
+                                   const std::string &document,
+                                   const Digest128 &digest)
+{
+  if (versions_capacity_ == 0) return;
+
+  std::shared_ptr<Version> version(new Version());
+  version->text = document;
+  version->digest = digest;
+
+  std::lock_guard<std::mutex> guard(versions_lock_);
+
+  std::unordered_map<std::string, VersionList::iterator>::iterator it =
+      version_index_.find(id);
+  if (it != version_index_.end()) {
+    it->second->second = version;
+    versions_.splice(versions_.begin(), versions_, it->second);
+    return;
+  }
+
+  versions_.push_front(std::make_pair(id, VersionPtr(version)));
+  version_index_[id] = versions_.begin();
+
+  if (versions_.size() > versions_capacity_) {
+    version_index_.erase(versions_.back().first);
+    versions_.pop_back();
+  }
+}
+
+// -- Session
+Session::Session(DocumentService *service, size_t frame_size)
+    : service_(service),
+      frame_size_(frame_size),
+      mode_(smDetect),
+      done_(false),
+      decoder_(frame_size),
+      in_document_(false),
+      document_left_(0),
+      deflated_(false),
+      receive_start_(0),
+      connection_(0)
+{
+}
+
+uint64_t Session::arrival_time() const
+{
+  uint64_t now = wall_us();
+  if (receive_start_ == 0) return now;
+  return now - (monotonic_ns() - receive_start_) / 1000;
+}
+
+void Session::capture(uint64_t arrived, const std::string &id,
+                      const Verdict &verdict)
+{
+  CaptureWriter *writer = service_->capture();
+  if (writer == NULL) return;
+
+  if (connection_ == 0) connection_ = writer->next_connection();
+
+  CaptureRecord record;
+  record.time = arrived;
+  record.connection = connection_;
+  record.valid = verdict.result.valid;
+  record.id = id;
+  record.document = document_;
+  writer->write(record);
+}
+
+void Session::begin_document()
+{
+  receive_start_ = monotonic_ns();
+  allocations_.restart();
+}
+
+void Session::feed(const char *data, size_t size, std::string *reply)
+{
+  if (done_ || (size == 0)) return;
+  if (receive_start_ == 0) begin_document();
+
+  if (mode_ == smDetect) {
+    // Enough bytes to tell the magic from a document
+    prefix_.append(data, size);
+    size_t known = (prefix_.size() < sizeof(kProtocolMagic))
+                       ? prefix_.size() : sizeof(kProtocolMagic);
+    if (memcmp(prefix_.data(), kProtocolMagic, known) != 0) {
+      mode_ = smLegacy;
+    } else if (known == sizeof(kProtocolMagic)) {
+      mode_ = smMessages;
+      prefix_.erase(0, sizeof(kProtocolMagic));
+    } else {
+      return;
+    }
+
+    std::string received;
+    received.swap(prefix_);
+    feed(received.data(), received.size(), reply);
+    return;
+  }
+
+  if (mode_ == smLegacy) {
+    feed_legacy(data, size, reply);
+  } else {
+    feed_messages(data, size, reply);
+  }
+}
+
+void Session::finish(std::string *reply)
+{
+  if (done_) return;
+
+  if (mode_ == smLegacy) complete_legacy(reply);
+  done_ = true;
+}
+
+void Session::feed_legacy(const char *data, size_t size, std::string *reply)
+{
+  size_t decoded = document_.size();
+  decoder_.feed(data, size, &document_);
+  hash_.update(document_.data() + decoded, document_.size() - decoded);
+
+  if (decoder_.done()) {
+    complete_legacy(reply);
+    done_ = true;
+  }
+}
+
+void Session::complete_legacy(std::string *reply)
+{
+  service_->latency().record_since(phReceive, receive_start_);
+  trace_span("receive document", receive_start_, monotonic_ns());
+  uint64_t arrived = arrival_time();
+
+  Verdict verdict;
+  if (decoder_.too_long()) {
+    // Not validated, nor kept
+    verdict.result.message = "Document is too long";
+    verdict.source = vsValidated;
+    document_.clear();
+  } else {
+    verdict.result = service_->validate(decoder_.document_id(), document_,
+                                        hash_.digest(), &verdict.source);
+    capture(arrived, decoder_.document_id(), verdict);
+  }
+  verdicts_.push_back(verdict);
+
+  // The response is always sent as one frame
+  std::string text = verdict.result.to_string();
+  if (text.size() > frame_size_ - 1) text.resize(frame_size_ - 1);
+  text.resize(frame_size_, '\0');
+  *reply += text;
+
+  service_->metrics().add_request_allocations(allocations_.stats());
+}
+
+void Session::feed_messages(const char *data, size_t size, std::string *reply)
+{
+  reader_.feed(data, size);
+
+  while (!done_) {
+    // The document is hashed as it comes, not kept whole in the reader
+    // (nor deflated: the received pieces are inflated right away)
+    if (in_document_) {
+      size_t received = document_.size();
+      if (deflated_) {
+        compressed_.clear();
+        document_left_ -= reader_.take(document_left_, &compressed_);
+        if (!inflater_->feed(compressed_.data(), compressed_.size(),
+                             &document_)) {
+          *reply += encode_message(mtError, "Bad deflated document");
+          done_ = true;
+          break;
+        }
+        service_->metrics().add(ctDeflatedBytes, compressed_.size());
+        service_->metrics().add(ctInflatedBytes, document_.size() - received);
+      } else {
+        document_left_ -= reader_.take(document_left_, &document_);
+      }
+      hash_.update(document_.data() + received, document_.size() - received);
+
+      if (document_left_ > 0) break;
+      in_document_ = false;
+      if (deflated_ && !inflater_->done()) {
+        *reply += encode_message(mtError, "Deflated document is cut");
+        done_ = true;
+        break;
+      }
+      complete_document(reply);
+      continue;
+    }
+
+    char type;
+    uint32_t length;
+    if (reader_.header(&type, &length) &&
+        ((type == mtDocument) || (type == mtDeflatedDocument))) {
+      reader_.skip_header();
+      // Pipelined documents may start in the bytes of the previous one
+      if (receive_start_ == 0) begin_document();
+      in_document_ = true;
+      document_left_ = length;
+      document_.clear();
+      deflated_ = (type == mtDeflatedDocument);
+      if (deflated_) {
+        if (!inflater_) inflater_.reset(new Inflater(kMaxPayload));
+        inflater_->reset();
+      } else {
+        document_.reserve(length);
+      }
+      continue;
+    }
+
+    Message message;
+    if (!reader_.next(&message)) break;
+    handle(message, reply);
+  }
+
+  if (reader_.error()) {
+    *reply += encode_message(mtError, "Message is too long");
+    done_ = true;
+  }
+}
+
+void Session::handle(const Message &message, std::string *reply)
+{
+  size_t pos = 0;
+  std::string id;
+
+  switch (message.type) {
+    case mtHello: {
+      // Encodings of the documents this server takes
+      std::string accepted;
+      if (has_encoding(message.payload, kDeflateEncoding)) {
+        accepted = kDeflateEncoding;
+      }
+      *reply += encode_message(mtEncodings, accepted);
+      return;
+    }
+    case mtName: {
+      if (!get_string(message.payload, &pos, &id_)) break;
+      return;
+    }
+    case mtSignaturesRequest: {
+      if (!get_string(message.payload, &pos, &id)) break;
+
+      *reply += encode_message(mtSignatures,
+                               encode_signatures(service_->signatures(id)));
+      return;
+    }
+    case mtDelta: {
+      Digest128 base;
+      Digest128 target;
+      if (!get_string(message.payload, &pos, &id) ||
+          !get_digest(message.payload, &pos, &base) ||
+          !get_digest(message.payload, &pos, &target)) {
+        break;
+      }
+
+      std::string error;
+      if (!service_->apply_delta(id, base, message.payload, pos,
+                                 &document_, &error)) {
+        // The client sends the whole document again
+        *reply += encode_message(mtError, error);
+        return;
+      }
+      hash_ = Hash128();
+      hash_.update(document_.data(), document_.size());
+      if (hash_.digest() != target) {
+        *reply += encode_message(mtError, "Rebuilt document differs");
+        return;
+      }
+
+      id_ = id;
+      complete_document(reply);
+      return;
+    }
+    default:
+      break;
+  }
+
+  *reply += encode_message(mtError, "Bad message");
+  done_ = true;
+}
+
+void Session::complete_document(std::string *reply)
+{
+  uint64_t arrived = arrival_time();
+  if (receive_start_ != 0) {
+    service_->latency().record_since(phReceive, receive_start_);
+    trace_span("receive document", receive_start_, monotonic_ns());
+  }
+  receive_start_ = 0;
+
+  Digest128 digest = hash_.digest();
+  Verdict verdict;
+  verdict.result = service_->validate(id_, document_, digest, &verdict.source);
+  verdicts_.push_back(verdict);
+  capture(arrived, id_, verdict);
+
+  // The base of the next delta upload
+  if (!id_.empty()) service_->keep_version(id_, document_, digest);
+
+  *reply += encode_message(mtVerdict, encode_verdict(verdict.result));
+  service_->metrics().add_request_allocations(allocations_.stats());
+
+  // Ready for the next document of the connection
+  id_.clear();
+  document_.clear();
+  hash_ = Hash128();
+  allocations_.restart();
+}
@@ -0,0 +1,578 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#include "include/shm_ring.h"
+
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <new>
+#include <string>
+#include <thread>
+
+namespace {
+
+const uint64_t kPage = 4096;
+// Largest ring accepted from a producer
+const uint32_t kMaxSlots = 1 << 16;
+const uint64_t kMaxDataSize = 1ULL << 32;
+// Checks of the other side before sleeping on the eventfd
+const int kSpins = 1000;
+// Handshake of attaching a ring
+const char kAttach = 'R';
+const char kAttached = 'A';
+const int kHandshakeTimeout = 5000;  // ms
+
+uint64_t page_round(uint64_t size)
+{
+  return (size + kPage - 1) & ~(kPage - 1);
+}
+
+// Offsets of the parts: header, requests and completions, data
+uint64_t slots_offset()
+{
+  return page_round(sizeof(ShmRingHeader));
+}
+
+uint64_t data_offset(uint32_t slots)
+{
+  return slots_offset() +
+         page_round(static_cast<uint64_t>(slots) *
+                    (sizeof(ShmRequest) + sizeof(ShmCompletion)));
+}
+
+uint64_t ring_size(uint32_t slots, uint64_t data_size)
+{
+  return data_offset(slots) + page_round(data_size);
+}
+
+// Spinning only helps when the other side runs on another core, on one
+// core it takes the time of the side it waits for
+int spin_count()
+{
+  static const int spins = (std::thread::hardware_concurrency() > 1) ? kSpins
+                                                                      : 0;
+  return spins;
+}
+
+inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+void notify(int event)
+{
+  uint64_t one = 1;
+  ssize_t written = write(event, &one, sizeof(one));
+  (void) written;
+}
+
+void drain(int event)
+{
+  uint64_t count;
+  ssize_t bytes = read(event, &count, sizeof(count));
+  (void) bytes;
+}
+
+void close_fd(int *fd)
+{
+  if (*fd >= 0) close(*fd);
+  *fd = -1;
+}
+
+// Socket became readable within timeout (ms)
+bool wait_readable(int sock, int timeout_ms)
+{
+  pollfd fds = { sock, POLLIN, 0 };
+  int ready;
+  do {
+    ready = poll(&fds, 1, timeout_ms);
+  } while ((ready < 0) && (errno == EINTR));
+  return ready > 0;
+}
+
+}  // namespace
+
+// -- ShmRing
+ShmRing::ShmRing()
+    : fd_(-1),
+      base_(MAP_FAILED),
+      size_(0),
+      header_(NULL),
+      requests_(NULL),
+      completions_(NULL),
+      data_(NULL),
+      mask_(0),
+      data_size_(0)
+{
+}
+
+ShmRing::~ShmRing()
+{
+  if (base_ != MAP_FAILED) munmap(base_, size_);
+  close_fd(&fd_);
+}
+
+bool ShmRing::layout(uint32_t slots, uint64_t data_size, uint64_t size)
+{
+  base_ = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  if (base_ == MAP_FAILED) return false;
+  size_ = size;
+
+  char *base = static_cast<char*> (base_);
+  header_ = reinterpret_cast<ShmRingHeader*> (base);
+  requests_ = reinterpret_cast<ShmRequest*> (base + slots_offset());
+  completions_ = reinterpret_cast<ShmCompletion*> (
+      base + slots_offset() + slots * sizeof(ShmRequest));
+  data_ = base + data_offset(slots);
+  mask_ = slots - 1;
+  data_size_ = data_size;
+  return true;
+}
+
+bool ShmRing::create(uint32_t slots, uint64_t data_size, std::string *error)
+{
+  if ((slots == 0) || (slots > kMaxSlots) || ((slots & (slots - 1)) != 0) ||
+      (data_size == 0) || (data_size > kMaxDataSize)) {
+    *error = "Bad ring size";
+    return false;
+  }
+
+  uint64_t size = ring_size(slots, data_size);
+  fd_ = memfd_create("xmlvalidator-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if ((fd_ < 0) || (ftruncate(fd_, size) != 0) ||
+      (fcntl(fd_, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) !=
+       0) ||
+      !layout(slots, data_size, size)) {
+    *error = std::string("Can't create shared memory: ") + strerror(errno);
+    return false;
+  }
+
+  new (header_) ShmRingHeader();
+  memcpy(header_->layout.magic, kShmRingMagic, sizeof(kShmRingMagic));
+  header_->layout.slots = slots;
+  header_->layout.data_size = data_size;
+  header_->requests.store(0);
+  header_->producer_sleeping.store(0);
+  header_->completions.store(0);
+  header_->released.store(0);
+  header_->server_sleeping.store(0);
+  return true;
+}
+
+bool ShmRing::map(int fd, std::string *error)
+{
+  fd_ = fd;
+
+  // The producer can't shrink the memory under the mapping
+  int seals = fcntl(fd_, F_GET_SEALS);
+  struct stat info;
+  if ((seals < 0) || ((seals & F_SEAL_SHRINK) == 0) ||
+      (fstat(fd_, &info) != 0) ||
+      (static_cast<uint64_t>(info.st_size) < slots_offset())) {
+    *error = "Ring is not a sealed memfd";
+    return false;
+  }
+
+  // The layout is read once, the shared header isn't trusted later
+  ShmRingLayout header;
+  if (pread(fd_, &header, sizeof(header), 0) !=
+      static_cast<ssize_t>(sizeof(header))) {
+    *error = "Can't read ring header";
+    return false;
+  }
+
+  uint32_t slots = header.slots;
+  uint64_t data_size = header.data_size;
+  if ((memcmp(header.magic, kShmRingMagic, sizeof(kShmRingMagic)) != 0) ||
+      (slots == 0) || (slots > kMaxSlots) || ((slots & (slots - 1)) != 0) ||
+      (data_size == 0) || (data_size > kMaxDataSize) ||
+      (ring_size(slots, data_size) != static_cast<uint64_t>(info.st_size))) {
+    *error = "Bad ring layout";
+    return false;
+  }
+
+  if (!layout(slots, data_size, info.st_size)) {
+    *error = std::string("Can't map ring: ") + strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+// -- ShmProducer
+ShmProducer::ShmProducer()
+    : socket_(-1),
+      server_event_(-1),
+      producer_event_(-1),
+      head_(0),
+      reserved_(0),
+      published_(0),
+      taken_(0),
+      closed_(false)
+{
+}
+
+ShmProducer::~ShmProducer()
+{
+  // Closing the socket detaches the ring
+  close_fd(&socket_);
+  close_fd(&server_event_);
+  close_fd(&producer_event_);
+}
+
+bool ShmProducer::connect(const std::string &path, uint32_t slots,
+                          uint64_t data_size, std::string *error)
+{
+  sockaddr_un server_addr;
+  memset(&server_addr, 0, sizeof(server_addr));
+  server_addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(server_addr.sun_path)) {
+    *error = "Socket path is too long";
+    return false;
+  }
+  memcpy(server_addr.sun_path, path.c_str(), path.size() + 1);
+
+  if (!ring_.create(slots, data_size, error)) return false;
+
+  server_event_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  producer_event_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  socket_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if ((server_event_ < 0) || (producer_event_ < 0) || (socket_ < 0)) {
+    *error = std::string("Can't create ring events: ") + strerror(errno);
+    return false;
+  }
+
+  if (::connect(socket_, reinterpret_cast<sockaddr*> (&server_addr),
+                sizeof(server_addr))) {
+    *error = "Can't connect " + path + ": " + strerror(errno);
+    return false;
+  }
+
+  // The ring and the events go as SCM_RIGHTS of one byte
+  int fds[3] = { ring_.fd(), server_event_, producer_event_ };
+  char control[CMSG_SPACE(sizeof(fds))];
+  memset(control, 0, sizeof(control));
+  char byte = kAttach;
+  iovec io = { &byte, 1 };
+
+  msghdr message;
+  memset(&message, 0, sizeof(message));
+  message.msg_iov = &io;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+
+  cmsghdr *rights = CMSG_FIRSTHDR(&message);
+  rights->cmsg_level = SOL_SOCKET;
+  rights->cmsg_type = SCM_RIGHTS;
+  rights->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(rights), fds, sizeof(fds));
+
+  if (sendmsg(socket_, &message, MSG_NOSIGNAL) != 1) {
+    *error = std::string("Can't send the ring: ") + strerror(errno);
+    return false;
+  }
+
+  char reply = 0;
+  if (!wait_readable(socket_, kHandshakeTimeout) ||
+      (recv(socket_, &reply, 1, 0) != 1) || (reply != kAttached)) {
+    *error = "The server didn't attach the ring";
+    return false;
+  }
+  return true;
+}
+
+template <class Ready>
+bool ShmProducer::wait(Ready ready, int timeout_ms)
+{
+  for (int i = spin_count(); i > 0; --i) {
+    if (ready()) return true;
+    cpu_relax();
+  }
+
+  typedef std::chrono::steady_clock Clock;
+  Clock::time_point deadline =
+      Clock::now() + std::chrono::milliseconds(timeout_ms);
+  ShmRingHeader *header = ring_.header();
+
+  for (;;) {
+    // Announced before the last check, so the server can't miss it
+    header->producer_sleeping.store(1);
+    if (ready()) {
+      header->producer_sleeping.store(0);
+      return true;
+    }
+
+    int left = static_cast<int>(
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - Clock::now()).count());
+    pollfd fds[2] = { { producer_event_, POLLIN, 0 },
+                      { socket_, POLLIN, 0 } };
+    int events = poll(fds, 2, std::max(left, 0));
+    header->producer_sleeping.store(0);
+
+    if ((events < 0) && (errno != EINTR)) return ready();
+    if ((events > 0) && (fds[0].revents & POLLIN)) drain(producer_event_);
+    if ((events > 0) && (fds[1].revents != 0)) {
+      // The server detached
+      closed_ = true;
+      return ready();
+    }
+    if (ready()) return true;
+    if (Clock::now() >= deadline) return false;
+  }
+}
+
+char *ShmProducer::reserve(size_t size, int timeout_ms)
+{
+  uint64_t data_size = ring_.data_size();
+  if (closed_ || (size > data_size) || (in_flight() >= ring_.slots())) {
+    return NULL;
+  }
+
+  // Documents don't wrap: the rest of the area is skipped
+  uint64_t start = head_;
+  uint64_t offset = start % data_size;
+  if (offset + size > data_size) start += data_size - offset;
+  uint64_t end = start + size;
+
+  ShmRingHeader *header = ring_.header();
+  if (!wait([&]() {
+        return end - header->released.load(std::memory_order_acquire) <=
+               data_size;
+      }, timeout_ms)) {
+    return NULL;
+  }
+
+  reserved_ = start;
+  return ring_.data() + start % data_size;
+}
+
+void ShmProducer::publish(size_t size)
+{
+  ShmRequest *request = ring_.request(published_);
+  request->position = reserved_;
+  request->size = static_cast<uint32_t>(size);
+  head_ = reserved_ + size;
+
+  ShmRingHeader *header = ring_.header();
+  header->requests.store(++published_);
+  if (header->server_sleeping.load()) notify(server_event_);
+}
+
+bool ShmProducer::submit(StringView document, int timeout_ms)
+{
+  char *space = reserve(document.size(), timeout_ms);
+  if (space == NULL) return false;
+
+  memcpy(space, document.data(), document.size());
+  publish(document.size());
+  return true;
+}
+
+bool ShmProducer::next_verdict(ValidationResult *result, int timeout_ms)
+{
+  if (taken_ == published_) return false;
+
+  ShmRingHeader *header = ring_.header();
+  uint64_t index = taken_;
+  if (!wait([&]() {
+        return header->completions.load(std::memory_order_acquire) > index;
+      }, timeout_ms)) {
+    return false;
+  }
+
+  const ShmCompletion *completion = ring_.completion(taken_++);
+  result->valid = (completion->valid != 0);
+  result->message.assign(completion->message,
+                         std::min<size_t>(completion->message_size,
+                                          kShmMessageSize));
+  return true;
+}
+
+// -- ShmConsumer
+ShmConsumer::ShmConsumer()
+    : socket_(-1),
+      server_event_(-1),
+      producer_event_(-1),
+      index_(0),
+      end_(0)
+{
+}
+
+ShmConsumer::~ShmConsumer()
+{
+  close_fd(&server_event_);
+  close_fd(&producer_event_);
+}
+
+bool ShmConsumer::attach(int sock, std::string *error)
+{
+  socket_ = sock;
+
+  int fds[3] = { -1, -1, -1 };
+  char control[CMSG_SPACE(sizeof(fds))];
+  char byte = 0;
+  iovec io = { &byte, 1 };
+
+  msghdr message;
+  memset(&message, 0, sizeof(message));
+  message.msg_iov = &io;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+
+  if (!wait_readable(sock, kHandshakeTimeout) ||
+      (recvmsg(sock, &message, MSG_CMSG_CLOEXEC) != 1)) {
+    *error = "No ring received";
+    return false;
+  }
+
+  // Any descriptors received are owned, even of a bad request
+  size_t received = 0;
+  for (cmsghdr *rights = CMSG_FIRSTHDR(&message); rights != NULL;
+       rights = CMSG_NXTHDR(&message, rights)) {
+    if ((rights->cmsg_level != SOL_SOCKET) ||
+        (rights->cmsg_type != SCM_RIGHTS)) {
+      continue;
+    }
+    size_t count = (rights->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    int *data = reinterpret_cast<int*> (CMSG_DATA(rights));
+    for (size_t i = 0; i < count; ++i) {
+      if (received < 3) {
+        fds[received++] = data[i];
+      } else {
+        close(data[i]);
+      }
+    }
+  }
+
+  server_event_ = fds[1];
+  producer_event_ = fds[2];
+  if ((byte != kAttach) || (received != 3) ||
+      (message.msg_flags & MSG_CTRUNC)) {
+    if (fds[0] >= 0) close(fds[0]);
+    *error = "Bad ring request";
+    return false;
+  }
+
+  if (!ring_.map(fds[0], error)) return false;
+
+  // Positions continue from the header, a fresh ring starts at zero
+  ShmRingHeader *header = ring_.header();
+  index_ = header->completions.load();
+  end_ = header->released.load();
+
+  char reply = kAttached;
+  if (send(sock, &reply, 1, MSG_NOSIGNAL) != 1) {
+    *error = "Producer is gone";
+    return false;
+  }
+  return true;
+}
+
+template <class Ready>
+bool ShmConsumer::wait(Ready ready)
+{
+  for (int i = spin_count(); i > 0; --i) {
+    if (ready()) return true;
+    cpu_relax();
+  }
+
+  ShmRingHeader *header = ring_.header();
+  for (;;) {
+    header->server_sleeping.store(1);
+    if (ready()) {
+      header->server_sleeping.store(0);
+      return true;
+    }
+
+    pollfd fds[2] = { { server_event_, POLLIN, 0 },
+                      { socket_, POLLIN, 0 } };
+    int events = poll(fds, 2, -1);
+    header->server_sleeping.store(0);
+
+    if ((events < 0) && (errno != EINTR)) {
+      error_ = strerror(errno);
+      return false;
+    }
+    if ((events > 0) && (fds[0].revents & POLLIN)) drain(server_event_);
+    // Documents published before detaching are still served
+    if (ready()) return true;
+    if ((events > 0) && (fds[1].revents != 0)) return false;
+  }
+}
+
+bool ShmConsumer::next(StringView *document)
+{
+  ShmRingHeader *header = ring_.header();
+  uint64_t index = index_;
+  if (!wait([&]() {
+        return header->requests.load(std::memory_order_acquire) != index;
+      })) {
+    return false;
+  }
+
+  uint64_t published = header->requests.load(std::memory_order_acquire);
+  if (published - index_ > ring_.slots()) {
+    error_ = "Ring overrun";
+    return false;
+  }
+
+  // Copied once, the producer may change the shared request meanwhile
+  ShmRequest request;
+  memcpy(&request, ring_.request(index_), sizeof(request));
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+
+  uint64_t data_size = ring_.data_size();
+  uint64_t offset = request.position % data_size;
+  if ((request.position < end_) || (request.size > data_size - offset)) {
+    error_ = "Bad document position";
+    return false;
+  }
+
+  end_ = request.position + request.size;
+  *document = StringView(ring_.data() + offset, request.size);
+  return true;
+}
+
+void ShmConsumer::complete(const ValidationResult &result)
+{
+  ShmCompletion *completion = ring_.completion(index_);
+  size_t size = std::min(result.message.size(), kShmMessageSize);
+  completion->valid = result.valid ? 1 : 0;
+  completion->message_size = static_cast<uint32_t>(size);
+  memcpy(completion->message, result.message.data(), size);
+
+  ShmRingHeader *header = ring_.header();
+  header->released.store(end_, std::memory_order_release);
+  header->completions.store(++index_);
+  if (header->producer_sleeping.load()) notify(producer_event_);
+}
+#endif  // __linux__
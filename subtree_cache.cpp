@@ -0,0 +1,310 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#include "include/subtree_cache.h"
+
+#include <string.h>
+
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace {
+
+inline bool is_space(char c)
+{
+  return (c == ' ') || (c == '\t') || (c == '\r') || (c == '\n');
+}
+
+// Changed subtrees of the current outline (in document order)
+void collect_changes(const DocumentOutline &previous, size_t p,
+                     const DocumentOutline &current, size_t c,
+                     std::vector<size_t> *changed)
+{
+  const OutlineNode &before = previous.nodes()[p];
+  const OutlineNode &after = current.nodes()[c];
+  if (before.hash == after.hash) return;
+
+  // The same start tag, text and child elements: only children changed
+  bool same_shape = (before.own == after.own) &&
+                    (before.children.size() == after.children.size());
+  for (size_t i = 0; same_shape && i < after.children.size(); ++i) {
+    same_shape = (previous.nodes()[before.children[i]].name ==
+                  current.nodes()[after.children[i]].name);
+  }
+
+  if (!same_shape) {
+    changed->push_back(c);
+    return;
+  }
+
+  for (size_t i = 0; i < after.children.size(); ++i) {
+    collect_changes(previous, before.children[i],
+                    current, after.children[i], changed);
+  }
+}
+
+}  // namespace
+
+bool DocumentOutline::scan(const std::string &data)
+{
+  const char *p = data.data();
+  size_t size = data.size();
+
+  nodes_.clear();
+  // Open elements and hashes of their own bytes
+  std::vector<size_t> open;
+  std::vector<Hash128> own;
+  Hash128 outside;
+  // Bytes before are hashed
+  size_t hashed = 0;
+  size_t pos = 0;
+
+  for ( ; ; ) {
+    const char *lt = static_cast<const char*> (
+        memchr(p + pos, '<', size - pos));
+    if (lt == NULL) break;
+
+    size_t i = lt - p;
+    if (i + 1 >= size) return false;
+    char next = p[i + 1];
+
+    // Comments stay in the own bytes, the header before the root
+    if (next == '!') {
+      if (data.compare(i, 4, "<!--") != 0) return false;
+      size_t close = data.find("-->", i + 4);
+      if (close == std::string::npos) return false;
+      pos = close + 3;
+      continue;
+    }
+    if (next == '?') {
+      size_t close = data.find("?>", i + 2);
+      if (!open.empty() || (close == std::string::npos)) return false;
+      pos = close + 2;
+      continue;
+    }
+
+    // End of tag, '>' in quoted values doesn't count
+    size_t j = i + 1;
+    char quote = 0;
+    for ( ; j < size; ++j) {
+      char c = p[j];
+      if (quote != 0) {
+        if (c == quote) quote = 0;
+      } else if ((c == '"') || (c == '\'')) {
+        quote = c;
+      } else if (c == '>') {
+        break;
+      }
+    }
+    if (j >= size) return false;
+    size_t tag_end = j + 1;
+    pos = tag_end;
+
+    bool closing = (next == '/');
+    if (!closing) {
+      // Start tag
+      if (open.empty() && !nodes_.empty()) return false;
+
+      size_t name_end = i + 1;
+      while ((name_end < j) && !is_space(p[name_end]) && (p[name_end] != '/')) {
+        ++name_end;
+      }
+      if (name_end == i + 1) return false;
+
+      if (open.empty()) {
+        outside.update(p + hashed, i - hashed);
+      } else {
+        own.back().update(p + hashed, i - hashed);
+        nodes_[open.back()].children.push_back(nodes_.size());
+      }
+
+      OutlineNode node;
+      node.name.assign(p + i + 1, name_end - i - 1);
+      node.start = i;
+      node.start_end = tag_end;
+      node.end = tag_end;
+
+      open.push_back(nodes_.size());
+      nodes_.push_back(node);
+      own.push_back(Hash128());
+      own.back().update(p + i, tag_end - i);
+      hashed = tag_end;
+
+      // Not <tag/>, wait for the end tag
+      if (p[j - 1] != '/') continue;
+    } else {
+      // End tag
+      size_t name_end = j;
+      while ((name_end > i + 2) && is_space(p[name_end - 1])) --name_end;
+
+      if (open.empty() ||
+          (data.compare(i + 2, name_end - i - 2,
+                        nodes_[open.back()].name) != 0)) {
+        return false;
+      }
+
+      own.back().update(p + hashed, tag_end - hashed);
+      hashed = tag_end;
+    }
+
+    // Closing the element: Merkle hash over the own bytes and children
+    OutlineNode &node = nodes_[open.back()];
+    node.end = tag_end;
+    node.own = own.back().digest();
+
+    Hash128 merkle;
+    merkle.update(reinterpret_cast<const char*> (&node.own), sizeof(node.own));
+    for (size_t c = 0; c < node.children.size(); ++c) {
+      const Digest128 &child = nodes_[node.children[c]].hash;
+      merkle.update(reinterpret_cast<const char*> (&child), sizeof(child));
+    }
+    node.hash = merkle.digest();
+
+    open.pop_back();
+    own.pop_back();
+  }
+
+  if (!open.empty() || nodes_.empty()) return false;
+
+  outside.update(p + hashed, size - hashed);
+  outside_ = outside.digest();
+  return true;
+}
+
+// -- SubtreeCache
+SubtreeCache::SubtreeCache(size_t capacity)
+    : capacity_(capacity)
+{
+}
+
+SubtreeCache::EntryPtr SubtreeCache::find(const std::string &id)
+{
+  std::lock_guard<std::mutex> guard(lock_);
+
+  std::unordered_map<std::string, EntryList::iterator>::iterator it =
+      index_.find(id);
+  if (it == index_.end()) return EntryPtr();
+
+  lru_.splice(lru_.begin(), lru_, it->second);
+  return it->second->second;
+}
+
+void SubtreeCache::store(const std::string &id, EntryPtr entry)
+{
+  std::lock_guard<std::mutex> guard(lock_);
+
+  std::unordered_map<std::string, EntryList::iterator>::iterator it =
+      index_.find(id);
+  if (it != index_.end()) {
+    it->second->second = entry;
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return;
+  }
+
+  lru_.push_front(std::make_pair(id, entry));
+  index_[id] = lru_.begin();
+
+  if (lru_.size() > capacity_) {
+    index_.erase(lru_.back().first);
+    lru_.pop_back();
+  }
+}
+
+bool SubtreeCache::validate_changes(const Validator &validator,
+                                    const Entry &previous,
+                                    const Entry &current,
+                                    ValidationResult *result)
+{
+  const DocumentOutline &before = previous.outline;
+  const DocumentOutline &after = current.outline;
+  if (!(before.outside() == after.outside())) return false;
+
+  std::vector<size_t> changed;
+  collect_changes(before, 0, after, 0, &changed);
+  // The root itself changed
+  if (!changed.empty() && (changed[0] == 0)) return false;
+
+  for (size_t i = 0; i < changed.size(); ++i) {
+    const OutlineNode &node = after.nodes()[changed[i]];
+    ValidationResult fragment = validator.validate_fragment(
+        current.document.substr(node.start, node.end - node.start),
+        node.name);
+
+    // The message of the first error comes from the whole document
+    if (!fragment.valid) return false;
+  }
+
+  // Values of unique rules are spread over the whole document,
+  // the start tags of their elements are checked together
+  const RuleSet *rules = validator.rules();
+  if ((rules != NULL) && !changed.empty()) {
+    std::unordered_set<std::string> unique_elements;
+    for (size_t i = 0; i < rules->rules().size(); ++i) {
+      if (rules->rules()[i].kind == rkUnique) {
+        unique_elements.insert(rules->rules()[i].element);
+      }
+    }
+
+    if (!unique_elements.empty()) {
+      std::string tags = "<unique>";
+      for (size_t i = 0; i < after.nodes().size(); ++i) {
+        const OutlineNode &node = after.nodes()[i];
+        if (unique_elements.count(node.name) == 0) continue;
+
+        size_t length = node.start_end - node.start;
+        if (current.document.compare(node.start_end - 2, 2, "/>") == 0) {
+          tags.append(current.document, node.start, length);
+        } else {
+          tags.append(current.document, node.start, length - 1);
+          tags += "/>";
+        }
+      }
+      tags += "</unique>";
+
+      RuleChecker checker(rules);
+      if (!validate_with(&checker, tags, ParseEventsList()).valid) {
+        return false;
+      }
+    }
+  }
+
+  result->valid = true;
+  result->message.clear();
+  return true;
+}
+
+ValidationResult SubtreeCache::validate(const Validator &validator,
+                                        const std::string &id,
+                                        StringView data,
+                                        bool *partial)
+{
+  std::shared_ptr<Entry> current(new Entry());
+  current->document.assign(data.data(), data.size());
+  bool outlined = current->outline.scan(current->document);
+
+  EntryPtr previous = find(id);
+  ValidationResult result;
+
+  *partial = outlined && previous &&
+             validate_changes(validator, *previous, *current, &result);
+  if (!*partial) result = validator.validate(data);
+
+  // The last valid version is kept for the next submission
+  if (outlined && result.valid) store(id, current);
+
+  return result;
+}
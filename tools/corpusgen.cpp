@@ -0,0 +1,495 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+// Generator of synthetic documents shaped like config_test.xml
+// (testrunner/uut/Patient|Device/type/instrument/interface) for
+// benchmarks. The output depends only on the options and the seed.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+//
+// Settings of generation, 'key=value' words of the command line
+//
+struct CorpusOptions {
+  CorpusOptions()
+      : seed(1),
+        uuts(4),
+        size(0),
+        fanout(1),
+        depth(0),
+        attributes(0),
+        content(0),
+        whitespace("tabs"),
+        comments(0),
+        errors(0),
+        count(1) {}
+
+  bool parse(const std::string &option, std::string *error);
+
+  uint64_t seed;           // seed=<n>
+  uint64_t uuts;           // uuts=<n> units under test
+  uint64_t size;           // size=<bytes>[K|M|G], units are added until
+                           // the document is that big (instead of uuts)
+  uint64_t fanout;         // fanout=<n> types, instruments and interfaces
+                           // at each level
+  uint64_t depth;          // depth=<n> levels of <setting> under interface
+  uint64_t attributes;     // attributes=<n> extra attributes of instrument
+  uint64_t content;        // content=<bytes> of <description> text of
+                           // instrument
+  std::string whitespace;  // whitespace=tabs|spaces|none|crlf
+  double comments;         // comments=<0..1> chance of comment before tag
+  double errors;           // errors=<0..1> chance of error in a unit
+  uint64_t count;          // count=<n> documents (written to dir)
+  std::string out;         // out=<file>, default - standard output
+  std::string dir;         // dir=<directory> for count documents
+  std::string schema;      // schema=<file> to write the DTD of the
+                           // generated shape
+};
+
+// Number with optional K, M or G suffix
+bool parse_number(const std::string &text, uint64_t *value)
+{
+  char *end;
+  unsigned long long number = strtoull(text.c_str(), &end, 10);
+  if ((end == text.c_str()) || (text[0] == '-')) return false;
+
+  std::string suffix = end;
+  if (suffix == "K") {
+    number <<= 10;
+  } else if (suffix == "M") {
+    number <<= 20;
+  } else if (suffix == "G") {
+    number <<= 30;
+  } else if (!suffix.empty()) {
+    return false;
+  }
+
+  *value = number;
+  return true;
+}
+
+bool parse_chance(const std::string &text, double *value)
+{
+  char *end;
+  *value = strtod(text.c_str(), &end);
+  return (end != text.c_str()) && (*end == '\0') && (*value >= 0) &&
+         (*value <= 1);
+}
+
+bool CorpusOptions::parse(const std::string &option, std::string *error)
+{
+  std::string::size_type eq = option.find('=');
+  if ((eq == std::string::npos) || (eq == 0)) {
+    *error = "Expected key=value: " + option;
+    return false;
+  }
+
+  std::string key = option.substr(0, eq);
+  std::string value = option.substr(eq + 1);
+  bool good = true;
+
+  if (key == "seed") {
+    good = parse_number(value, &seed);
+  } else if (key == "uuts") {
+    good = parse_number(value, &uuts) && (uuts > 0);
+  } else if (key == "size") {
+    good = parse_number(value, &size);
+  } else if (key == "fanout") {
+    good = parse_number(value, &fanout) && (fanout > 0);
+  } else if (key == "depth") {
+    good = parse_number(value, &depth);
+  } else if (key == "attributes") {
+    good = parse_number(value, &attributes);
+  } else if (key == "content") {
+    good = parse_number(value, &content);
+  } else if (key == "whitespace") {
+    whitespace = value;
+    good = (value == "tabs") || (value == "spaces") || (value == "none") ||
+           (value == "crlf");
+  } else if (key == "comments") {
+    good = parse_chance(value, &comments);
+  } else if (key == "errors") {
+    good = parse_chance(value, &errors);
+  } else if (key == "count") {
+    good = parse_number(value, &count) && (count > 0);
+  } else if (key == "out") {
+    out = value;
+  } else if (key == "dir") {
+    dir = value;
+  } else if (key == "schema") {
+    schema = value;
+  } else {
+    *error = "Unknown option: " + key;
+    return false;
+  }
+
+  if (!good) *error = "Bad value of " + key + ": " + value;
+  return good;
+}
+
+//
+// Pseudo-random numbers (SplitMix64), same sequence on every platform
+//
+class Random {
+ public:
+  explicit Random(uint64_t seed) : state_(seed) {}
+
+  uint64_t next()
+  {
+    uint64_t z = (state_ += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+  }
+
+  // 0 .. n - 1
+  uint64_t below(uint64_t n) { return next() % n; }
+  // True with probability p
+  bool chance(double p)
+  {
+    return (p > 0) && ((next() >> 11) * (1.0 / 9007199254740992.0) < p);
+  }
+
+ private:
+  uint64_t state_;
+};
+
+// Errors injected into units
+enum kInjectedError {
+  ieDuplicateName,     // rule: unique uut@name
+  iePortRange,         // rule: range of socket port
+  ieSerialPort,        // rule: pattern of serial port
+  ieInterfaceType,     // schema: value out of the enumeration
+  ieMissingAttribute,  // schema: instrument without driver
+  ieMismatchedTag,     // well-formedness: wrong end tag
+  ieCount,
+};
+
+const char *const kPatientTypes[] = { "ecg", "spo2", "nibp", "temp" };
+const char *const kDeviceTypes[] = { "gui", "usb", "power", "network" };
+const char *const kWords[] = {
+  "monitor", "channel", "signal", "lead", "calibration", "sample", "rate",
+  "alarm", "probe", "sensor", "waveform", "limit", "gain", "filter",
+};
+
+//
+// Class for writing one document
+//
+class DocumentWriter {
+ public:
+  DocumentWriter(const CorpusOptions &options, uint64_t seed,
+                 std::ostream *out)
+      : options_(options),
+        random_(seed),
+        out_(out),
+        bytes_(0),
+        errors_(0),
+        instruments_(0) {}
+
+  void write()
+  {
+    line(0, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>");
+    line(0, "<testrunner>");
+
+    for (uint64_t u = 0; ; ++u) {
+      if (options_.size > 0) {
+        if ((u > 0) && (bytes_ >= options_.size)) break;
+      } else if (u >= options_.uuts) {
+        break;
+      }
+      write_uut(u);
+    }
+
+    line(0, "</testrunner>");
+  }
+
+  uint64_t bytes() const { return bytes_; }
+  uint64_t errors() const { return errors_; }
+
+ private:
+  void line(int depth, const std::string &text)
+  {
+    std::string indent;
+    std::string end = "\n";
+
+    if (options_.whitespace == "spaces") {
+      indent.assign(depth * 2, ' ');
+    } else if (options_.whitespace == "none") {
+      end.clear();
+    } else {
+      indent.assign(depth, '\t');
+      if (options_.whitespace == "crlf") end = "\r\n";
+    }
+
+    *out_ << indent << text << end;
+    bytes_ += indent.size() + text.size() + end.size();
+  }
+
+  void comment(int depth)
+  {
+    if (!random_.chance(options_.comments)) return;
+    line(depth, "<!-- generated " + number(random_.next() % 100000) + " -->");
+  }
+
+  static std::string number(uint64_t value)
+  {
+    char buff[32];
+    snprintf(buff, sizeof(buff), "%llu",
+             static_cast<unsigned long long>(value));
+    return buff;
+  }
+
+  void write_uut(uint64_t u)
+  {
+    int error = -1;
+    if (random_.chance(options_.errors)) {
+      error = static_cast<int>(random_.below(ieCount));
+      if ((error == ieDuplicateName) && (u == 0)) error = iePortRange;
+      ++errors_;
+    }
+
+    comment(1);
+    uint64_t name = (error == ieDuplicateName) ? u - 1 : u;
+    line(1, "<uut name=\"UUT_" + number(name) + "\">");
+
+    write_group(2, "Patient", kPatientTypes, &error);
+    write_group(2, "Device", kDeviceTypes, &error);
+
+    line(1, "</uut>");
+  }
+
+  void write_group(int depth, const char *group, const char *const *types,
+                   int *error)
+  {
+    comment(depth);
+    line(depth, std::string("<") + group + ">");
+
+    for (uint64_t t = 0; t < options_.fanout; ++t) {
+      comment(depth + 1);
+      line(depth + 1, std::string("<type name=\"") + types[random_.below(4)] +
+                          "\">");
+      for (uint64_t i = 0; i < options_.fanout; ++i) {
+        write_instrument(depth + 2, group[0] == 'P', error);
+      }
+      line(depth + 1, "</type>");
+    }
+
+    line(depth, std::string("</") + group + ">");
+  }
+
+  // Writes the error of the unit into the first instrument it fits
+  void write_instrument(int depth, bool serial, int *unit_error)
+  {
+    int error = *unit_error;
+    if (((error == iePortRange) && serial) ||
+        ((error == ieSerialPort) && !serial)) {
+      error = -1;
+    }
+    if (error >= 0) *unit_error = -1;
+
+    std::string tag = "<instrument name=\"" +
+                      std::string(serial ? "prosim8_" : "gui_sim_") +
+                      number(instruments_++) + "\"";
+    if (error != ieMissingAttribute) {
+      tag += serial ? " driver=\"ecg_impl_prosim8\"" : " driver=\"simulator\"";
+    }
+    for (uint64_t a = 0; a < options_.attributes; ++a) {
+      tag += " attr" + number(a) + "=\"value_" + number(random_.below(1000)) +
+             "\"";
+    }
+
+    comment(depth);
+    line(depth, tag + ">");
+
+    if (options_.content > 0) {
+      std::string text;
+      while (text.size() < options_.content) {
+        if (!text.empty()) text += ' ';
+        text += kWords[random_.below(sizeof(kWords) / sizeof(kWords[0]))];
+      }
+      text.resize(options_.content);
+      line(depth + 1, "<description>" + text + "</description>");
+    }
+
+    for (uint64_t i = 0; i < options_.fanout; ++i) {
+      write_interface(depth + 1, serial, error);
+    }
+
+    line(depth, (error == ieMismatchedTag) ? "</instrumnt>" : "</instrument>");
+  }
+
+  void write_interface(int depth, bool serial, int error)
+  {
+    std::string tag;
+    if (error == ieInterfaceType) {
+      tag = "<interface type=\"usb\" port=\"USB1\"";
+    } else if (serial) {
+      std::string port = (error == ieSerialPort) ? "XX" : "COM";
+      static const char *const kParams[] = {
+        "115200,8,N,1", "9600,8,N,1", "57600,7,E,1", "38400,8,O,2",
+      };
+      tag = "<interface type=\"serial\" port=\"" + port +
+            number(1 + random_.below(16)) + "\" params=\"" +
+            kParams[random_.below(4)] + "\"";
+    } else {
+      uint64_t port = (error == iePortRange) ? 65536 + random_.below(1000)
+                                             : 1 + random_.below(65535);
+      tag = "<interface type=\"socket\" port=\"" + number(port) +
+            "\" host=\"192.168." + number(random_.below(256)) + "." +
+            number(1 + random_.below(254)) + "\"";
+    }
+
+    if (options_.depth == 0) {
+      line(depth, tag + " />");
+      return;
+    }
+
+    line(depth, tag + ">");
+    for (uint64_t d = 0; d + 1 < options_.depth; ++d) {
+      line(depth + 1 + d, "<setting name=\"level" + number(d) + "\">");
+    }
+    line(depth + options_.depth,
+         "<setting name=\"level" + number(options_.depth - 1) + "\" />");
+    for (uint64_t d = options_.depth - 1; d > 0; --d) {
+      line(depth + d, "</setting>");
+    }
+    line(depth, "</interface>");
+  }
+
+  const CorpusOptions &options_;
+  Random              random_;
+  std::ostream        *out_;
+  uint64_t            bytes_;
+  uint64_t            errors_;
+  uint64_t            instruments_;
+};
+
+// DTD of the generated shape (config_test.dtd with the extensions)
+void write_schema(const CorpusOptions &options, std::ostream *out)
+{
+  *out << "<!-- Schema of generated documents (see tools/corpusgen.cpp) -->\n"
+       << "<!ELEMENT testrunner (uut+)>\n\n"
+       << "<!ELEMENT uut (Patient?, Device?)>\n"
+       << "<!ATTLIST uut name CDATA #IMPLIED>\n\n"
+       << "<!ELEMENT Patient (type+)>\n"
+       << "<!ELEMENT Device (type+)>\n\n"
+       << "<!ELEMENT type (instrument+)>\n"
+       << "<!ATTLIST type name CDATA #REQUIRED>\n\n";
+
+  *out << "<!ELEMENT instrument ("
+       << ((options.content > 0) ? "description, " : "") << "interface+)>\n"
+       << "<!ATTLIST instrument name   CDATA #REQUIRED\n"
+       << "                     driver CDATA #REQUIRED";
+  for (uint64_t a = 0; a < options.attributes; ++a) {
+    *out << "\n                     attr" << a << " CDATA #IMPLIED";
+  }
+  *out << ">\n\n";
+
+  if (options.content > 0) *out << "<!ELEMENT description (#PCDATA)>\n\n";
+
+  *out << "<!ELEMENT interface " << ((options.depth > 0) ? "(setting)" : "EMPTY")
+       << ">\n"
+       << "<!ATTLIST interface type   (serial|socket) #REQUIRED\n"
+       << "                    port   CDATA #REQUIRED\n"
+       << "                    host   CDATA #IMPLIED\n"
+       << "                    params CDATA #IMPLIED>\n";
+
+  if (options.depth > 0) {
+    *out << "\n<!ELEMENT setting "
+         << ((options.depth > 1) ? "(setting?)" : "EMPTY") << ">\n"
+         << "<!ATTLIST setting name CDATA #REQUIRED>\n";
+  }
+}
+
+}  // namespace
+
+int main(int argc, char *argv[])
+{
+  CorpusOptions options;
+  for (int i = 1; i < argc; ++i) {
+    std::string error;
+    if (!options.parse(argv[i], &error)) {
+      std::cerr << "Error! " << error << "\n"
+                << "Usage: corpusgen [seed=<n>] [uuts=<n> | size=<bytes>] "
+                   "[fanout=<n>] [depth=<n>] [attributes=<n>] "
+                   "[content=<bytes>] [whitespace=tabs|spaces|none|crlf] "
+                   "[comments=<0..1>] [errors=<0..1>] [out=<file>] "
+                   "[count=<n> dir=<directory>] [schema=<file>]\n";
+      return 1;
+    }
+  }
+
+  if ((options.count > 1) && options.dir.empty()) {
+    std::cerr << "Error! count needs dir\n";
+    return 1;
+  }
+
+  if (!options.schema.empty()) {
+    std::ofstream schema(options.schema.c_str(), std::ios::out);
+    write_schema(options, &schema);
+    if (!schema) {
+      std::cerr << "Error writing " << options.schema << "\n";
+      return 1;
+    }
+  }
+
+  // Big buffer, documents may be gigabytes
+  std::vector<char> buffer(1 << 20);
+  uint64_t bytes = 0;
+  uint64_t errors = 0;
+
+  for (uint64_t d = 0; d < options.count; ++d) {
+    std::string file_name = options.out;
+    if (!options.dir.empty()) {
+      char name[32];
+      snprintf(name, sizeof(name), "/doc_%06llu.xml",
+               static_cast<unsigned long long>(d));
+      file_name = options.dir + name;
+    }
+
+    std::ofstream file;
+    std::ostream *out = &std::cout;
+    if (!file_name.empty()) {
+      file.rdbuf()->pubsetbuf(&buffer[0], buffer.size());
+      file.open(file_name.c_str(), std::ios::out | std::ios::binary);
+      out = &file;
+    }
+
+    DocumentWriter writer(options, options.seed + d, out);
+    writer.write();
+    out->flush();
+    if (!*out) {
+      std::cerr << "Error writing " << file_name << "\n";
+      return 1;
+    }
+
+    bytes += writer.bytes();
+    errors += writer.errors();
+  }
+
+  std::cerr << options.count << " documents, " << bytes << " bytes, "
+            << errors << " injected errors\n";
+  return 0;
+}
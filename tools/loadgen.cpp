@@ -0,0 +1,325 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+// Load generator for the server
+// Closed loop: concurrency clients each send the next document as soon as
+// the verdict of the previous one comes. Open loop (rate=<n>): documents
+// are sent on a fixed schedule however slow the server is, and latency is
+// counted from the scheduled time, so a stalled server isn't hidden by
+// the requests it held back (coordinated omission).
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "../include/async_client.h"
+#include "../include/batch.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+//
+// Settings of the run, 'key=value' words after the server and the corpus
+//
+struct LoadOptions {
+  LoadOptions()
+      : connections(4),
+        depth(1),
+        concurrency(0),
+        rate(0),
+        duration(10),
+        reuse(0),
+        timeout(10000) {}
+
+  bool parse(const std::string &option, std::string *error);
+
+  size_t connections;  // connections=<n>
+  size_t depth;        // depth=<n> documents in flight per connection
+  size_t concurrency;  // concurrency=<n> closed loop clients,
+                       // 0 - connections * depth
+  double rate;         // rate=<documents/s> open loop, 0 - closed loop
+  double duration;     // duration=<s>
+  size_t reuse;        // reuse=<n> documents per connection, 0 - unlimited
+  int timeout;         // timeout=<ms> of one request
+};
+
+bool LoadOptions::parse(const std::string &option, std::string *error)
+{
+  std::string::size_type eq = option.find('=');
+  if ((eq == std::string::npos) || (eq == 0)) {
+    *error = "Expected key=value: " + option;
+    return false;
+  }
+
+  std::string key = option.substr(0, eq);
+  char *end;
+  double value = strtod(option.c_str() + eq + 1, &end);
+  if ((*end != '\0') || (end == option.c_str() + eq + 1) || (value < 0)) {
+    *error = "Bad value of " + key;
+    return false;
+  }
+
+  if (key == "connections") {
+    connections = static_cast<size_t>(value);
+  } else if (key == "depth") {
+    depth = static_cast<size_t>(value);
+  } else if (key == "concurrency") {
+    concurrency = static_cast<size_t>(value);
+  } else if (key == "rate") {
+    rate = value;
+  } else if (key == "duration") {
+    duration = value;
+  } else if (key == "reuse") {
+    reuse = static_cast<size_t>(value);
+  } else if (key == "timeout") {
+    timeout = static_cast<int>(value);
+  } else {
+    *error = "Unknown option: " + key;
+    return false;
+  }
+
+  return true;
+}
+
+//
+// Results of the run, shared by the threads
+//
+class LoadStats {
+ public:
+  LoadStats() : valid_(0), invalid_(0), errors_(asStopped + 1, 0) {}
+
+  void add(const AsyncResult &result, double latency)
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (result.status != asOk) {
+      ++errors_[result.status];
+      return;
+    }
+
+    latencies_.push_back(latency);
+    if (result.verdict.valid) {
+      ++valid_;
+    } else {
+      ++invalid_;
+    }
+  }
+
+  void print(double seconds)
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    size_t done = latencies_.size();
+
+    std::cout << "Verdicts: " << done << " (valid " << valid_
+              << ", invalid " << invalid_ << ")\n";
+    std::cout << "Errors: timeout " << errors_[asTimeout]
+              << ", connection lost " << errors_[asConnectionLost]
+              << ", server " << errors_[asServerError] << ", stopped "
+              << errors_[asStopped] << "\n";
+    std::cout << "Throughput: " << done / seconds << " verdicts/s\n";
+
+    if (done == 0) return;
+
+    std::sort(latencies_.begin(), latencies_.end());
+    std::cout << "Latency ms: p50 " << percentile(0.5) << ", p90 "
+              << percentile(0.9) << ", p99 " << percentile(0.99)
+              << ", p99.9 " << percentile(0.999) << ", max "
+              << latencies_.back() << "\n";
+  }
+
+ private:
+  double percentile(double p) const
+  {
+    size_t index = static_cast<size_t>(p * latencies_.size());
+    return latencies_[std::min(index, latencies_.size() - 1)];
+  }
+
+  std::mutex           lock_;
+  size_t               valid_;
+  size_t               invalid_;
+  std::vector<size_t>  errors_;  // by kAsyncStatus
+  std::vector<double>  latencies_;
+};
+
+// Each client sends the next document after the verdict of its previous one
+void closed_loop(AsyncClient *client, const std::vector<std::string> *corpus,
+                 std::atomic<size_t> *next, Clock::time_point stop,
+                 LoadStats *stats)
+{
+  while (Clock::now() < stop) {
+    const std::string &document = (*corpus)[(*next)++ % corpus->size()];
+    AsyncResult result = client->validate(document);
+    stats->add(result, result.latency);
+  }
+}
+
+// Send on schedule, a collecting thread waits for the verdicts
+void open_loop(AsyncClient *client, const std::vector<std::string> &corpus,
+               double rate, Clock::time_point start, Clock::time_point stop,
+               LoadStats *stats)
+{
+  typedef std::pair<Clock::time_point, std::future<AsyncResult> > Pending;
+
+  std::mutex lock;
+  std::condition_variable changed;
+  std::deque<Pending> pending;
+  bool sending = true;
+
+  std::thread collector([&]() {
+    for ( ; ; ) {
+      Pending request;
+      {
+        std::unique_lock<std::mutex> guard(lock);
+        changed.wait(guard, [&]() { return !sending || !pending.empty(); });
+        if (pending.empty()) return;
+        request = std::move(pending.front());
+        pending.pop_front();
+      }
+
+      AsyncResult result = request.second.get();
+
+      // From the scheduled time: waiting to be sent counts too
+      Clock::time_point done = Clock::now();
+      stats->add(result, std::chrono::duration<double, std::milli>(
+          done - request.first).count());
+    }
+  });
+
+  std::chrono::duration<double> interval(1.0 / rate);
+  for (size_t i = 0; ; ++i) {
+    Clock::time_point scheduled =
+        start + std::chrono::duration_cast<Clock::duration>(interval * i);
+    if (scheduled >= stop) break;
+    std::this_thread::sleep_until(scheduled);
+
+    std::future<AsyncResult> future =
+        client->validate_async(corpus[i % corpus.size()]);
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      pending.push_back(Pending(scheduled, std::move(future)));
+    }
+    changed.notify_one();
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    sending = false;
+  }
+  changed.notify_one();
+  collector.join();
+}
+
+}  // namespace
+
+int main(int argc, char *argv[])
+{
+  if (argc < 4) {
+    std::cerr << "Usage: loadgen <host> <port> <File | Directory | @list> "
+                 "[connections=<n>] [depth=<n>] [concurrency=<n>] "
+                 "[rate=<n>] [duration=<s>] [reuse=<n>] [timeout=<ms>]\n";
+    return 1;
+  }
+
+  LoadOptions options;
+  for (int i = 4; i < argc; ++i) {
+    std::string error;
+    if (!options.parse(argv[i], &error)) {
+      std::cerr << "Error! " << error << "\n";
+      return 1;
+    }
+  }
+
+  // The corpus is kept in memory, reading files isn't measured
+  std::vector<std::string> files;
+  if (!is_file_set(argv[3])) {
+    files.push_back(argv[3]);
+  } else if (!list_files(argv[3], &files)) {
+    std::cerr << "Error file list not found!\n";
+    return 1;
+  }
+
+  std::vector<std::string> corpus;
+  size_t bytes = 0;
+  for (size_t i = 0; i < files.size(); ++i) {
+    std::ifstream file(files[i].c_str(), std::ios::in | std::ios::binary);
+    if (!file) {
+      std::cerr << "Error file not found: " << files[i] << "\n";
+      return 1;
+    }
+    std::stringstream text;
+    text << file.rdbuf();
+    corpus.push_back(text.str());
+    bytes += corpus.back().size();
+  }
+  if (corpus.empty()) {
+    std::cerr << "Error! Empty corpus\n";
+    return 1;
+  }
+
+  AsyncClientOptions client_options;
+  client_options.connections = options.connections;
+  client_options.depth = options.depth;
+  client_options.request_timeout = options.timeout;
+  client_options.documents_per_connection = options.reuse;
+
+  std::vector<ServerAddress> servers;
+  servers.push_back(ServerAddress(argv[1], atoi(argv[2])));
+  AsyncClient client(servers, client_options);
+
+  std::cout << "Corpus: " << corpus.size() << " documents, " << bytes
+            << " bytes\n";
+
+  LoadStats stats;
+  Clock::time_point start = Clock::now();
+  Clock::time_point stop = start + std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(options.duration));
+
+  if (options.rate > 0) {
+    std::cout << "Open loop at " << options.rate << " documents/s\n";
+    open_loop(&client, corpus, options.rate, start, stop, &stats);
+  } else {
+    size_t concurrency = options.concurrency;
+    if (concurrency == 0) concurrency = options.connections * options.depth;
+    std::cout << "Closed loop with " << concurrency << " clients\n";
+
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> clients;
+    for (size_t i = 0; i < concurrency; ++i) {
+      clients.push_back(std::thread(closed_loop, &client, &corpus, &next,
+                                    stop, &stats));
+    }
+    for (size_t i = 0; i < clients.size(); ++i) clients[i].join();
+  }
+
+  double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  std::cout << "Time: " << seconds << " s\n";
+  stats.print(seconds);
+
+  return 0;
+}
@@ -0,0 +1,483 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+// Benchmark of the parser engines: Parser (DOM building and streamed),
+// ParseStateFunc and ParseStateClasses on each document set given. Besides
+// MB/s the hardware counters of the runs are read by perf_event_open, for
+// IPC, the branch miss rate and the cache misses per KB of input. Built
+// with "make ALLOC_STATS=1" it also counts the allocations of a parse.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../include/alloc_stats.h"
+#include "../include/batch.h"
+#include "../include/xmlparser.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// Engines compared
+enum kEngine {
+  enParser,         // Parser building the DOM
+  enStream,         // Parser in the streamed mode (as the validator)
+  enStateFunc,      // ParseStateFunc, a function per state
+  enStateClasses,   // ParseStateClasses, a class per state
+  enCount,
+};
+
+const char *engine_name(kEngine engine)
+{
+  switch (engine) {
+    case enParser:
+      return "parser";
+    case enStream:
+      return "stream";
+    case enStateFunc:
+      return "func";
+    case enStateClasses:
+      return "classes";
+    default:
+      return "";
+  }
+}
+
+// Parse document with engine, the number of start tags seen
+int parse_with(kEngine engine, const std::string &document)
+{
+  ParseEventTracker events;
+
+  switch (engine) {
+    case enParser: {
+      Parser parser(document, &events, pmDOMBuild);
+      break;
+    }
+    case enStream: {
+      Parser parser(document, &events, pmStream);
+      break;
+    }
+    case enStateFunc: {
+      ParseStateFunc parser(document, &events);
+      break;
+    }
+    case enStateClasses: {
+      ParseStateClasses parser(document, &events);
+      break;
+    }
+    default:
+      break;
+  }
+
+  return events.start_tags_;
+}
+
+//
+// Settings of the benchmark, 'key=value' words after the document sets
+//
+struct BenchOptions {
+  BenchOptions() : runs(3), time(1.0) {
+    for (int e = 0; e < enCount; ++e) engines[e] = true;
+  }
+
+  bool parse(const std::string &option, std::string *error);
+
+  bool engines[enCount];  // engines=<name,...> (parser, stream, func,
+                          // classes), all by default
+  size_t runs;            // runs=<n> passes over the set at least
+  double time;            // time=<s> of passes at least
+};
+
+bool BenchOptions::parse(const std::string &option, std::string *error)
+{
+  std::string::size_type eq = option.find('=');
+  std::string key = option.substr(0, eq);
+  std::string value = option.substr(eq + 1);
+
+  if (key == "engines") {
+    for (int e = 0; e < enCount; ++e) engines[e] = false;
+
+    std::stringstream names(value);
+    std::string name;
+    while (std::getline(names, name, ',')) {
+      int e = 0;
+      while ((e < enCount) && (name != engine_name(static_cast<kEngine>(e)))) {
+        ++e;
+      }
+      if (e == enCount) {
+        *error = "Unknown engine: " + name;
+        return false;
+      }
+      engines[e] = true;
+    }
+    return true;
+  }
+
+  char *end;
+  double number = strtod(value.c_str(), &end);
+  if ((*end != '\0') || value.empty() || (number < 0)) {
+    *error = "Bad value of " + key;
+    return false;
+  }
+
+  if (key == "runs") {
+    runs = static_cast<size_t>(number);
+  } else if (key == "time") {
+    time = number;
+  } else {
+    *error = "Unknown option: " + key;
+    return false;
+  }
+
+  return true;
+}
+
+// Hardware counters read
+enum kCounter {
+  pcCycles,
+  pcInstructions,
+  pcBranches,
+  pcBranchMisses,
+  pcL1Misses,    // L1 data cache read misses
+  pcLLCMisses,   // last level cache misses
+  pcCount,
+};
+
+//
+// Hardware counters of the calling thread (user space only) by
+// perf_event_open. Each counter is opened on its own, so the counters the
+// CPU or the kernel doesn't give (virtual machines, perf_event_paranoid,
+// other platforms) are just left out. Counters multiplexed by the kernel
+// are scaled by the time they were running.
+//
+class PerfCounters {
+ public:
+  PerfCounters();
+  ~PerfCounters();
+
+  bool has(kCounter counter) const { return fds_[counter] >= 0; }
+  // Some counter is open?
+  bool available() const;
+  // Why the counters aren't available
+  const std::string &error() const { return error_; }
+
+  void start();
+  void stop();
+  // Count between start and stop (has(counter) only)
+  double value(kCounter counter) const { return values_[counter]; }
+
+ private:
+  PerfCounters(const PerfCounters&);
+  PerfCounters &operator=(const PerfCounters&);
+
+  int         fds_[pcCount];
+  double      values_[pcCount];
+  std::string error_;
+};
+
+#ifdef __linux__
+PerfCounters::PerfCounters()
+{
+  static const uint32_t kTypes[pcCount] = {
+    PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+    PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE,
+  };
+  static const uint64_t kConfigs[pcCount] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_BRANCH_INSTRUCTIONS,
+    PERF_COUNT_HW_BRANCH_MISSES,
+    PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+    PERF_COUNT_HW_CACHE_MISSES,
+  };
+
+  for (int c = 0; c < pcCount; ++c) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = kTypes[c];
+    attr.config = kConfigs[c];
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    fds_[c] = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1,
+                                       -1, 0));
+    if ((fds_[c] < 0) && error_.empty()) {
+      error_ = std::string("perf_event_open: ") + strerror(errno);
+    }
+    values_[c] = 0;
+  }
+}
+
+PerfCounters::~PerfCounters()
+{
+  for (int c = 0; c < pcCount; ++c) {
+    if (fds_[c] >= 0) close(fds_[c]);
+  }
+}
+
+void PerfCounters::start()
+{
+  for (int c = 0; c < pcCount; ++c) {
+    if (fds_[c] < 0) continue;
+    ioctl(fds_[c], PERF_EVENT_IOC_RESET, 0);
+    ioctl(fds_[c], PERF_EVENT_IOC_ENABLE, 0);
+  }
+}
+
+void PerfCounters::stop()
+{
+  for (int c = 0; c < pcCount; ++c) {
+    if (fds_[c] >= 0) ioctl(fds_[c], PERF_EVENT_IOC_DISABLE, 0);
+  }
+
+  for (int c = 0; c < pcCount; ++c) {
+    if (fds_[c] < 0) continue;
+
+    // value, time enabled, time running
+    uint64_t data[3] = { 0, 0, 0 };
+    values_[c] = 0;
+    if (read(fds_[c], data, sizeof(data)) != sizeof(data)) continue;
+    if (data[2] > 0) {
+      values_[c] = static_cast<double>(data[0]) * data[1] / data[2];
+    }
+  }
+}
+#else
+PerfCounters::PerfCounters()
+    : error_("hardware counters are read on Linux only")
+{
+  for (int c = 0; c < pcCount; ++c) {
+    fds_[c] = -1;
+    values_[c] = 0;
+  }
+}
+
+PerfCounters::~PerfCounters()
+{
+}
+
+void PerfCounters::start()
+{
+}
+
+void PerfCounters::stop()
+{
+}
+#endif  // __linux__
+
+bool PerfCounters::available() const
+{
+  for (int c = 0; c < pcCount; ++c) {
+    if (has(static_cast<kCounter>(c))) return true;
+  }
+  return false;
+}
+
+// Set of documents measured together
+struct DocumentSet {
+  std::string name;
+  std::vector<std::string> documents;
+  size_t bytes;
+};
+
+// Read the documents of path (file, directory or @list)
+bool load_set(const std::string &path, DocumentSet *set)
+{
+  std::vector<std::string> files;
+  if (!is_file_set(path.c_str())) {
+    files.push_back(path);
+  } else if (!list_files(path.c_str(), &files)) {
+    std::cerr << "Error file list not found: " << path << "\n";
+    return false;
+  }
+
+  set->name = path;
+  set->bytes = 0;
+  for (size_t i = 0; i < files.size(); ++i) {
+    std::ifstream file(files[i].c_str(), std::ios::in | std::ios::binary);
+    if (!file) {
+      std::cerr << "Error file not found: " << files[i] << "\n";
+      return false;
+    }
+    std::stringstream text;
+    text << file.rdbuf();
+    set->documents.push_back(text.str());
+    set->bytes += set->documents.back().size();
+  }
+
+  if (set->bytes == 0) {
+    std::cerr << "Error! Empty document set: " << path << "\n";
+    return false;
+  }
+  return true;
+}
+
+// Column of the table, "-" for missing counters
+std::string column(bool has, double value, const char *format)
+{
+  if (!has) return "-";
+
+  char buff[32];
+  snprintf(buff, sizeof(buff), format, value);
+  return buff;
+}
+
+// Measure engine on set and print its row
+void bench(const DocumentSet &set, kEngine engine,
+           const BenchOptions &options, PerfCounters *counters)
+{
+  // Warming up the caches and the allocator
+  int tags = 0;
+  for (size_t i = 0; i < set.documents.size(); ++i) {
+    tags += parse_with(engine, set.documents[i]);
+  }
+
+  size_t passes = 0;
+  Clock::time_point start = Clock::now();
+  double elapsed = 0;
+
+  counters->start();
+  while ((passes < options.runs) || (elapsed < options.time)) {
+    for (size_t i = 0; i < set.documents.size(); ++i) {
+      parse_with(engine, set.documents[i]);
+    }
+    ++passes;
+    elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+  }
+  counters->stop();
+
+  // Allocations of one more pass, out of the timed ones
+  AllocationStats allocations;
+  for (size_t i = 0; i < set.documents.size(); ++i) {
+    AllocationScope scope;
+    parse_with(engine, set.documents[i]);
+
+    AllocationStats stats = scope.stats();
+    allocations.count += stats.count;
+    allocations.bytes += stats.bytes;
+    if (stats.peak > allocations.peak) allocations.peak = stats.peak;
+  }
+
+  double kbytes = static_cast<double>(set.bytes) * passes / 1024;
+  double mbytes_s = kbytes / 1024 / elapsed;
+
+  bool ipc = counters->has(pcCycles) && counters->has(pcInstructions) &&
+             (counters->value(pcCycles) > 0);
+  bool miss_rate = counters->has(pcBranches) &&
+                   counters->has(pcBranchMisses) &&
+                   (counters->value(pcBranches) > 0);
+
+  printf("%-24s %-8s %8d %9.2f %6s %8s %10s %10s %10s",
+         set.name.substr(0, 24).c_str(), engine_name(engine), tags, mbytes_s,
+         column(ipc, ipc ? counters->value(pcInstructions) /
+                           counters->value(pcCycles) : 0, "%.2f").c_str(),
+         column(miss_rate, miss_rate ? 100 * counters->value(pcBranchMisses) /
+                           counters->value(pcBranches) : 0, "%.2f%%").c_str(),
+         column(counters->has(pcBranchMisses),
+                counters->value(pcBranchMisses) / kbytes, "%.2f").c_str(),
+         column(counters->has(pcL1Misses),
+                counters->value(pcL1Misses) / kbytes, "%.2f").c_str(),
+         column(counters->has(pcLLCMisses),
+                counters->value(pcLLCMisses) / kbytes, "%.3f").c_str());
+
+  if (allocation_tracking()) {
+    double set_kbytes = static_cast<double>(set.bytes) / 1024;
+    printf(" %10.1f %10.0f %10.0f", allocations.count / set_kbytes,
+           allocations.bytes / set_kbytes, allocations.peak / 1024.0);
+  }
+  printf("\n");
+  fflush(stdout);
+}
+
+}  // namespace
+
+int main(int argc, char *argv[])
+{
+  BenchOptions options;
+  std::vector<std::string> paths;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg.find('=') == std::string::npos) {
+      paths.push_back(arg);
+      continue;
+    }
+
+    std::string error;
+    if (!options.parse(arg, &error)) {
+      std::cerr << "Error! " << error << "\n";
+      return 1;
+    }
+  }
+
+  if (paths.empty()) {
+    std::cerr << "Usage: parsebench <File | Directory | @list>... "
+                 "[engines=parser,stream,func,classes] [runs=<n>] "
+                 "[time=<s>]\n";
+    return 1;
+  }
+
+  // Each path is one document shape, kept in memory
+  std::vector<DocumentSet> sets(paths.size());
+  for (size_t i = 0; i < paths.size(); ++i) {
+    if (!load_set(paths[i], &sets[i])) return 1;
+  }
+
+  PerfCounters counters;
+  if (!counters.available()) {
+    std::cout << "No hardware counters (" << counters.error()
+              << "), measuring the time only\n";
+  }
+
+  printf("%-24s %-8s %8s %9s %6s %8s %10s %10s %10s", "documents", "engine",
+         "tags", "MB/s", "IPC", "br-miss", "br-miss/KB", "L1-miss/KB",
+         "LLC-miss/KB");
+  // Allocations per KB of input and the peak live KB of one document
+  if (allocation_tracking()) {
+    printf(" %10s %10s %10s", "allocs/KB", "bytes/KB", "peak KB");
+  }
+  printf("\n");
+
+  for (size_t i = 0; i < sets.size(); ++i) {
+    for (int e = 0; e < enCount; ++e) {
+      if (!options.engines[e]) continue;
+      bench(sets[i], static_cast<kEngine>(e), options, &counters);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,279 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+// Replay of a capture file (server option capture=<file>) against a
+// server: the documents are sent at the pace they arrived, speed times
+// faster, or as fast as the server answers. Verdicts differing from the
+// captured ones are counted, latency is from the scheduled time.
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../include/async_client.h"
+#include "../include/capture.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+//
+// Settings of the replay, 'key=value' words after the capture
+//
+struct ReplayOptions {
+  ReplayOptions()
+      : speed(1),
+        connections(4),
+        depth(8),
+        timeout(10000) {}
+
+  bool parse(const std::string &option, std::string *error);
+
+  double speed;        // speed=<x> of the original pace, 0 - at once
+  size_t connections;  // connections=<n>
+  size_t depth;        // depth=<n> documents in flight per connection
+  int timeout;         // timeout=<ms> of one request
+};
+
+bool ReplayOptions::parse(const std::string &option, std::string *error)
+{
+  std::string::size_type eq = option.find('=');
+  if ((eq == std::string::npos) || (eq == 0)) {
+    *error = "Expected key=value: " + option;
+    return false;
+  }
+
+  std::string key = option.substr(0, eq);
+  char *end;
+  double value = strtod(option.c_str() + eq + 1, &end);
+  if ((*end != '\0') || (end == option.c_str() + eq + 1) || (value < 0)) {
+    *error = "Bad value of " + key;
+    return false;
+  }
+
+  if (key == "speed") {
+    speed = value;
+  } else if (key == "connections") {
+    connections = static_cast<size_t>(value);
+  } else if (key == "depth") {
+    depth = static_cast<size_t>(value);
+  } else if (key == "timeout") {
+    timeout = static_cast<int>(value);
+  } else {
+    *error = "Unknown option: " + key;
+    return false;
+  }
+
+  return true;
+}
+
+//
+// Results of the replay
+//
+class ReplayStats {
+ public:
+  ReplayStats() : valid_(0), invalid_(0), mismatched_(0), errors_(0) {}
+
+  void add(const AsyncResult &result, bool captured_valid, double latency)
+  {
+    if (result.status != asOk) {
+      ++errors_;
+      return;
+    }
+
+    latencies_.push_back(latency);
+    if (result.verdict.valid) {
+      ++valid_;
+    } else {
+      ++invalid_;
+    }
+    if (result.verdict.valid != captured_valid) ++mismatched_;
+  }
+
+  void print(double seconds)
+  {
+    size_t done = latencies_.size();
+
+    std::cout << "Verdicts: " << done << " (valid " << valid_
+              << ", invalid " << invalid_ << "), " << mismatched_
+              << " differ from the capture\n";
+    std::cout << "Errors: " << errors_ << "\n";
+    std::cout << "Throughput: " << done / seconds << " verdicts/s\n";
+
+    if (done == 0) return;
+
+    std::sort(latencies_.begin(), latencies_.end());
+    std::cout << "Latency ms: p50 " << percentile(0.5) << ", p90 "
+              << percentile(0.9) << ", p99 " << percentile(0.99)
+              << ", max " << latencies_.back() << "\n";
+  }
+
+ private:
+  double percentile(double p) const
+  {
+    size_t index = static_cast<size_t>(p * latencies_.size());
+    return latencies_[std::min(index, latencies_.size() - 1)];
+  }
+
+  size_t               valid_;
+  size_t               invalid_;
+  size_t               mismatched_;
+  size_t               errors_;
+  std::vector<double>  latencies_;
+};
+
+// Request sent, waiting for the verdict
+struct Pending {
+  Clock::time_point scheduled;
+  bool captured_valid;
+  std::future<AsyncResult> result;
+};
+
+}  // namespace
+
+int main(int argc, char *argv[])
+{
+  if (argc < 4) {
+    std::cerr << "Usage: replay <host> <port> <capture> [speed=<x>] "
+                 "[connections=<n>] [depth=<n>] [timeout=<ms>]\n"
+                 "  speed=1 - the original pace (default), 10 - ten times "
+                 "faster, 0 - at once\n";
+    return 1;
+  }
+
+  ReplayOptions options;
+  for (int i = 4; i < argc; ++i) {
+    std::string error;
+    if (!options.parse(argv[i], &error)) {
+      std::cerr << "Error! " << error << "\n";
+      return 1;
+    }
+  }
+
+  std::string error;
+  CaptureReader reader;
+  if (!reader.open(argv[3], &error)) {
+    std::cerr << "Error! " << error << "\n";
+    return 1;
+  }
+
+  AsyncClientOptions client_options;
+  client_options.connections = options.connections;
+  client_options.depth = options.depth;
+  client_options.request_timeout = options.timeout;
+
+  std::vector<ServerAddress> servers;
+  servers.push_back(ServerAddress(argv[1], atoi(argv[2])));
+  AsyncClient client(servers, client_options);
+
+  // At full speed the records are read as the verdicts come, not all at once
+  size_t window = (options.speed > 0)
+                      ? 0
+                      : 2 * options.connections * options.depth;
+
+  std::mutex lock;
+  std::condition_variable changed;
+  std::deque<Pending> pending;
+  bool sending = true;
+  ReplayStats stats;
+
+  std::thread collector([&]() {
+    for ( ; ; ) {
+      Pending request;
+      {
+        std::unique_lock<std::mutex> guard(lock);
+        changed.wait(guard, [&]() { return !sending || !pending.empty(); });
+        if (pending.empty()) return;
+        request = std::move(pending.front());
+        pending.pop_front();
+      }
+      changed.notify_all();
+
+      AsyncResult result = request.result.get();
+      Clock::time_point done = Clock::now();
+      stats.add(result, request.captured_valid,
+                std::chrono::duration<double, std::milli>(
+                    done - request.scheduled).count());
+    }
+  });
+
+  Clock::time_point start = Clock::now();
+  uint64_t first_time = 0;
+  uint64_t last_time = 0;
+  size_t documents = 0;
+  size_t bytes = 0;
+  CaptureRecord record;
+
+  while (reader.next(&record)) {
+    if (documents == 0) first_time = record.time;
+    last_time = record.time;
+    ++documents;
+    bytes += record.document.size();
+
+    Clock::time_point scheduled = Clock::now();
+    if (options.speed > 0) {
+      // Earlier records of the appended captures are sent right away
+      double offset = (record.time > first_time)
+                          ? (record.time - first_time) / options.speed
+                          : 0;
+      scheduled = start + std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double, std::micro>(offset));
+      std::this_thread::sleep_until(scheduled);
+    }
+
+    Pending request;
+    request.scheduled = scheduled;
+    request.captured_valid = record.valid;
+    request.result = client.validate_async(record.document);
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      pending.push_back(std::move(request));
+      if (window > 0) {
+        changed.wait(guard, [&]() { return pending.size() < window; });
+      }
+    }
+    changed.notify_all();
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    sending = false;
+  }
+  changed.notify_all();
+  collector.join();
+
+  if (reader.bad()) std::cerr << "Error! The capture ends in a broken record\n";
+
+  double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  double captured = (last_time > first_time)
+                        ? (last_time - first_time) / 1e6
+                        : 0;
+  std::cout << "Documents: " << documents << ", " << bytes << " bytes\n";
+  std::cout << "Time: " << seconds << " s (captured over " << captured
+            << " s)\n";
+  stats.print(seconds);
+
+  return 0;
+}
@@ -0,0 +1,389 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+// Generator of specialized C++ validators
+// Usage: schemagen <schema.dtd> <name> > include/<name>_schema.h
+// The header defines namespace <name>_schema with struct Model for
+// StaticValidator and kFingerprint of the DTD text.
+
+#include <ctype.h>
+#include <stdio.h>
+
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../include/schema.h"
+
+namespace {
+
+// C string literal
+std::string literal(const std::string &s)
+{
+  std::string out = "\"";
+  for (size_t i = 0; i < s.size(); ++i) {
+    if (s[i] == '"' || s[i] == '\\') out += '\\';
+    out += s[i];
+  }
+  return out + "\"";
+}
+
+// Identifier of element constant: 'instrument' -> eInstrument
+std::string element_constant(const std::string &name)
+{
+  std::string out = "e";
+  bool upper = true;
+  for (size_t i = 0; i < name.size(); ++i) {
+    if (!isalnum(name[i])) {
+      upper = true;
+      continue;
+    }
+    out += static_cast<char>(upper ? toupper(name[i]) : name[i]);
+    upper = false;
+  }
+  return out;
+}
+
+const char *kind_constant(kContentKind kind)
+{
+  switch (kind) {
+    case ckEmpty: return "ckEmpty";
+    case ckAny: return "ckAny";
+    case ckMixed: return "ckMixed";
+    default: return "ckChildren";
+  }
+}
+
+// Names grouped by hash, case labels must be unique
+std::map<uint32_t, std::vector<std::pair<std::string, int> > >
+group_by_hash(const std::vector<std::string> &names)
+{
+  std::map<uint32_t, std::vector<std::pair<std::string, int> > > groups;
+  for (size_t i = 0; i < names.size(); ++i) {
+    groups[StringView(names[i]).hash()].push_back(
+        std::make_pair(names[i], static_cast<int>(i)));
+  }
+  return groups;
+}
+
+void emit_element_id(const Schema &schema,
+                     const std::vector<std::string> &constants)
+{
+  std::vector<std::string> names;
+  for (size_t i = 0; i < schema.element_count(); ++i) {
+    names.push_back(schema.element(i).name);
+  }
+
+  std::cout << "  static int element_id(const std::string &name)\n"
+            << "  {\n"
+            << "    switch (StringView(name).hash()) {\n";
+
+  std::map<uint32_t, std::vector<std::pair<std::string, int> > > groups =
+      group_by_hash(names);
+  std::map<uint32_t, std::vector<std::pair<std::string, int> > >::iterator it;
+  for (it = groups.begin(); it != groups.end(); ++it) {
+    std::cout << "      case static_name_hash("
+              << literal(it->second[0].first) << "):\n";
+    for (size_t i = 0; i < it->second.size(); ++i) {
+      std::cout << "        if (name == " << literal(it->second[i].first)
+                << ") return " << constants[it->second[i].second] << ";\n";
+    }
+    std::cout << "        break;\n";
+  }
+
+  std::cout << "    }\n"
+            << "    return -1;\n"
+            << "  }\n\n";
+}
+
+void emit_step(const Schema &schema,
+               const std::vector<std::string> &constants)
+{
+  std::cout << "  static int32_t step(int element, int32_t state, int child)\n"
+            << "  {\n"
+            << "    switch (element) {\n";
+
+  for (size_t e = 0; e < schema.element_count(); ++e) {
+    const ElementDecl &decl = schema.element(e);
+    if ((decl.kind != ckChildren) && (decl.kind != ckMixed)) continue;
+
+    const ContentAutomaton &dfa = decl.automaton;
+    std::cout << "      case " << constants[e] << ":\n"
+              << "        switch (state) {\n";
+
+    for (size_t state = 0; state < dfa.states(); ++state) {
+      std::cout << "          case " << state << ":\n"
+                << "            switch (child) {\n";
+      for (int symbol = 0; symbol < dfa.symbols; ++symbol) {
+        int32_t target = dfa.step(state, symbol);
+        if (target < 0) continue;
+        std::cout << "              case " << constants[symbol]
+                  << ": return " << target << ";\n";
+      }
+      std::cout << "              default: return -1;\n"
+                << "            }\n";
+    }
+
+    std::cout << "        }\n"
+              << "        return -1;\n";
+  }
+
+  std::cout << "    }\n"
+            << "    return -1;\n"
+            << "  }\n\n";
+
+  std::cout << "  static bool accepting(int element, int32_t state)\n"
+            << "  {\n"
+            << "    switch (element) {\n";
+
+  for (size_t e = 0; e < schema.element_count(); ++e) {
+    const ElementDecl &decl = schema.element(e);
+    if (decl.kind != ckChildren) continue;
+
+    std::cout << "      case " << constants[e] << ":\n"
+              << "        return false";
+    for (size_t state = 0; state < decl.automaton.states(); ++state) {
+      if (decl.automaton.accepting[state]) {
+        std::cout << " || state == " << state;
+      }
+    }
+    std::cout << ";\n";
+  }
+
+  std::cout << "    }\n"
+            << "    return true;\n"
+            << "  }\n\n";
+}
+
+void emit_attribute_check(const ElementDecl &decl, const std::string &constant)
+{
+  std::string element = literal(decl.name);
+  std::vector<std::string> names;
+  for (size_t a = 0; a < decl.attributes.size(); ++a) {
+    names.push_back(*decl.attributes[a].name);
+  }
+
+  std::cout << "  static bool check_" << constant
+            << "(const AttributeSet &attributes, std::string *error)\n"
+            << "  {\n";
+
+  if (names.empty()) {
+    std::cout << "    if (attributes.empty()) return true;\n"
+              << "    *error = \"Attribute '\" + attributes.name_at(0).str() +"
+              << "\n"
+              << "             \"' of '\" " << element
+              << " \"' is not declared\";\n"
+              << "    return false;\n"
+              << "  }\n\n";
+    return;
+  }
+
+  bool has_required = false;
+  for (size_t a = 0; a < decl.attributes.size(); ++a) {
+    if (decl.attributes[a].use == auRequired) has_required = true;
+  }
+
+  if (has_required) std::cout << "    uint64_t present = 0;\n\n";
+  std::cout << "    for (size_t i = 0; i < attributes.size(); ++i) {\n"
+            << "      StringView name = attributes.name_at(i);\n\n"
+            << "      switch (name.hash()) {\n";
+
+  std::map<uint32_t, std::vector<std::pair<std::string, int> > > groups =
+      group_by_hash(names);
+  std::map<uint32_t, std::vector<std::pair<std::string, int> > >::iterator it;
+  for (it = groups.begin(); it != groups.end(); ++it) {
+    std::cout << "        case static_name_hash("
+              << literal(it->second[0].first) << "):\n";
+
+    for (size_t g = 0; g < it->second.size(); ++g) {
+      const AttributeDecl &attr = decl.attributes[it->second[g].second];
+      std::cout << "          if (name == StringView("
+                << literal(*attr.name) << ")) {\n";
+
+      std::vector<std::string> allowed(attr.values);
+      if (attr.use == auFixed) allowed.assign(1, attr.fixed);
+      if (!allowed.empty()) {
+        std::cout << "            StringView value = attributes.value_at(i);"
+                  << "\n"
+                  << "            if (";
+        for (size_t v = 0; v < allowed.size(); ++v) {
+          std::cout << ((v == 0) ? "" : " &&\n                ")
+                    << "value != StringView(" << literal(allowed[v]) << ")";
+        }
+        std::cout << ") {\n"
+                  << "              *error = \"Attribute '\" "
+                  << literal(*attr.name) << " \"' of '\" " << element
+                  << "\n"
+                  << "                       \"' has invalid value '\" + "
+                  << "value.str() + \"'\";\n"
+                  << "              return false;\n"
+                  << "            }\n";
+      }
+      if (attr.use == auRequired) {
+        std::cout << "            present |= 1ULL << "
+                  << it->second[g].second << ";\n";
+      }
+      std::cout << "            continue;\n"
+                << "          }\n";
+    }
+    std::cout << "          break;\n";
+  }
+
+  std::cout << "      }\n\n"
+            << "      *error = \"Attribute '\" + name.str() + \"' of '\" "
+            << element << " \"' is not declared\";\n"
+            << "      return false;\n"
+            << "    }\n\n";
+
+  for (size_t a = 0; a < decl.attributes.size(); ++a) {
+    if (decl.attributes[a].use != auRequired) continue;
+    std::cout << "    if ((present & (1ULL << " << a << ")) == 0) {\n"
+              << "      *error = \"Attribute '\" "
+              << literal(*decl.attributes[a].name) << " \"' of '\" "
+              << element << " \"' is required\";\n"
+              << "      return false;\n"
+              << "    }\n";
+  }
+
+  std::cout << "    return true;\n"
+            << "  }\n\n";
+}
+
+}  // namespace
+
+int main(int argc, char *argv[])
+{
+  if (argc != 3) {
+    std::cerr << "Usage: schemagen <schema.dtd> <name>\n";
+    return 1;
+  }
+
+  std::ifstream file(argv[1], std::ios::in);
+  if (!file) {
+    std::cerr << "Error file not found!\n";
+    return 1;
+  }
+  std::stringstream text;
+  text << file.rdbuf();
+
+  Schema schema;
+  std::string error;
+  if (!schema.compile(text.str(), &error)) {
+    std::cerr << "Error schema! " << error << "\n";
+    return 1;
+  }
+
+  for (size_t e = 0; e < schema.element_count(); ++e) {
+    if (schema.element(e).attributes.size() > 64) {
+      std::cerr << "Error! More than 64 attributes of '"
+                << schema.element(e).name << "'\n";
+      return 1;
+    }
+  }
+
+  std::string name = argv[2];
+  std::string guard = "TRLWO_1286_INCLUDE_";
+  for (size_t i = 0; i < name.size(); ++i) {
+    guard += isalnum(name[i]) ? toupper(name[i]) : '_';
+  }
+  guard += "_SCHEMA_H_";
+
+  std::vector<std::string> constants;
+  std::map<std::string, int> used;
+  for (size_t e = 0; e < schema.element_count(); ++e) {
+    std::string constant = element_constant(schema.element(e).name);
+    // Names like 'a-b' and 'a_b' map to the same constant
+    if (used[constant]++ != 0) {
+      std::ostringstream unique;
+      unique << constant << "_" << e;
+      constant = unique.str();
+    }
+    constants.push_back(constant);
+  }
+
+  char fingerprint[32];
+  snprintf(fingerprint, sizeof(fingerprint), "0x%016llxULL",
+           static_cast<unsigned long long>(schema.fingerprint()));
+
+  std::cout << "// Generated by tools/schemagen from " << argv[1]
+            << ", don't edit.\n\n"
+            << "#ifndef " << guard << "\n"
+            << "#define " << guard << "\n\n"
+            << "#include <stdint.h>\n"
+            << "#include <string>\n\n"
+            << "#include \"static_validator.h\"\n\n"
+            << "namespace " << name << "_schema {\n\n"
+            << "// Fingerprint of the source DTD text\n"
+            << "const uint64_t kFingerprint = " << fingerprint << ";\n\n"
+            << "enum kElement {\n";
+  for (size_t e = 0; e < constants.size(); ++e) {
+    std::cout << "  " << constants[e] << " = " << e << ",\n";
+  }
+  std::cout << "};\n\n"
+            << "struct Model {\n"
+            << "  static int root() { return " << constants[schema.root()]
+            << "; }\n\n";
+
+  std::cout << "  static const char *name(int element)\n"
+            << "  {\n"
+            << "    static const char *const names[] = {\n";
+  for (size_t e = 0; e < schema.element_count(); ++e) {
+    std::cout << "      " << literal(schema.element(e).name) << ",\n";
+  }
+  std::cout << "    };\n"
+            << "    return names[element];\n"
+            << "  }\n\n";
+
+  std::cout << "  static kContentKind kind(int element)\n"
+            << "  {\n"
+            << "    static const kContentKind kinds[] = {\n";
+  for (size_t e = 0; e < schema.element_count(); ++e) {
+    std::cout << "      " << kind_constant(schema.element(e).kind) << ",\n";
+  }
+  std::cout << "    };\n"
+            << "    return kinds[element];\n"
+            << "  }\n\n";
+
+  emit_element_id(schema, constants);
+  emit_step(schema, constants);
+
+  for (size_t e = 0; e < schema.element_count(); ++e) {
+    emit_attribute_check(schema.element(e), constants[e]);
+  }
+
+  std::cout << "  static bool check_attributes(int element,\n"
+            << "                               const AttributeSet "
+            << "&attributes,\n"
+            << "                               std::string *error)\n"
+            << "  {\n"
+            << "    switch (element) {\n";
+  for (size_t e = 0; e < schema.element_count(); ++e) {
+    std::cout << "      case " << constants[e] << ": return check_"
+              << constants[e] << "(attributes, error);\n";
+  }
+  std::cout << "    }\n"
+            << "    return false;\n"
+            << "  }\n"
+            << "};\n\n"
+            << "typedef StaticValidator<Model> Validator;\n\n"
+            << "}  // namespace " << name << "_schema\n\n"
+            << "#endif  // " << guard << "\n";
+
+  return 0;
+}
@@ -0,0 +1,240 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#include "include/trace.h"
+
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace {
+
+//
+// Trace file shared by the threads
+//
+struct TraceFile {
+  TraceFile() : sample(1), requests(0), threads(0), start(0), events(0) {}
+
+  std::mutex            lock;
+  std::ofstream         out;
+  size_t                sample;
+  std::atomic<uint64_t> requests;
+  std::atomic<int>      threads;
+  uint64_t              start;      // monotonic_ns() of opening
+  uint64_t              events;     // written so far
+  int                   pid;
+};
+
+TraceFile trace_file;
+// The file is open (checked without the lock)
+std::atomic<bool> trace_enabled(false);
+
+// Events buffered by a thread before they are written
+// (connections may last for many documents)
+const size_t kFlushEvents = 256;
+
+// Spans of the request handled by the thread, written at its end or
+// every kFlushEvents
+struct ThreadTrace {
+  ThreadTrace() : active(false), tid(0) {}
+
+  bool                     active;
+  int                      tid;
+  std::vector<std::string> events;
+};
+
+thread_local ThreadTrace thread_trace;
+
+// Microseconds since opening the trace
+std::string timestamp(uint64_t ns)
+{
+  char buff[32];
+  double us = (ns > trace_file.start) ? (ns - trace_file.start) / 1e3 : 0;
+  snprintf(buff, sizeof(buff), "%.3f", us);
+  return buff;
+}
+
+// JSON string with quotes
+std::string quoted(const std::string &text)
+{
+  std::string result = "\"";
+  for (size_t i = 0; i < text.size(); ++i) {
+    unsigned char c = text[i];
+    if ((c == '"') || (c == '\\')) {
+      result += '\\';
+      result += c;
+    } else if (c < 0x20) {
+      char buff[8];
+      snprintf(buff, sizeof(buff), "\\u%04x", c);
+      result += buff;
+    } else {
+      result += c;
+    }
+  }
+  return result + "\"";
+}
+
+std::string ids()
+{
+  char buff[48];
+  snprintf(buff, sizeof(buff), "\"pid\":%d,\"tid\":%d",
+           trace_file.pid, thread_trace.tid);
+  return buff;
+}
+
+// Write the events of the thread to the file
+void flush_events(ThreadTrace *trace)
+{
+  std::lock_guard<std::mutex> guard(trace_file.lock);
+  if (trace_enabled.load() && trace_file.out.is_open()) {
+    for (size_t i = 0; i < trace->events.size(); ++i) {
+      if (trace_file.events++ > 0) trace_file.out << ",\n";
+      trace_file.out << trace->events[i];
+    }
+    trace_file.out.flush();
+  }
+  trace->events.clear();
+}
+
+}  // namespace
+
+bool trace_open(const std::string &file_name, size_t sample,
+                std::string *error)
+{
+  std::lock_guard<std::mutex> guard(trace_file.lock);
+
+  trace_file.out.open(file_name.c_str(), std::ios::out | std::ios::trunc);
+  if (!trace_file.out) {
+    *error = "Can't write trace file " + file_name;
+    return false;
+  }
+
+  trace_file.sample = (sample == 0) ? 1 : sample;
+  trace_file.start = monotonic_ns();
+  trace_file.events = 0;
+#ifdef _WIN32
+  trace_file.pid = static_cast<int>(GetCurrentProcessId());
+#else
+  trace_file.pid = static_cast<int>(getpid());
+#endif
+
+  // The JSON array format, readers accept it without the closing ']'
+  // if the process is killed
+  trace_file.out << "[\n";
+  trace_file.out.flush();
+  trace_enabled = true;
+  return true;
+}
+
+void trace_close()
+{
+  if (!trace_enabled.exchange(false)) return;
+
+  std::lock_guard<std::mutex> guard(trace_file.lock);
+  trace_file.out << "\n]\n";
+  trace_file.out.close();
+}
+
+bool trace_begin(const std::string &name)
+{
+  ThreadTrace &trace = thread_trace;
+  trace.active = false;
+  if (!trace_enabled.load(std::memory_order_relaxed)) return false;
+
+  uint64_t request = trace_file.requests++;
+  if (request % trace_file.sample != 0) return false;
+
+  if (trace.tid == 0) trace.tid = ++trace_file.threads;
+  trace.active = true;
+  trace.events.clear();
+
+  // Label of the thread in the viewer
+  trace.events.push_back("{\"name\":\"thread_name\",\"ph\":\"M\"," + ids() +
+                         ",\"args\":{\"name\":" + quoted(name) + "}}");
+  return true;
+}
+
+void trace_end()
+{
+  ThreadTrace &trace = thread_trace;
+  if (!trace.active) return;
+  trace.active = false;
+  flush_events(&trace);
+}
+
+bool trace_active()
+{
+  return thread_trace.active;
+}
+
+void trace_span(const char *name, uint64_t start, uint64_t end,
+                const std::string &args)
+{
+  ThreadTrace &trace = thread_trace;
+  if (!trace.active) return;
+
+  char duration[32];
+  snprintf(duration, sizeof(duration), "%.3f",
+           (end > start) ? (end - start) / 1e3 : 0.0);
+
+  std::string event = "{\"name\":" + quoted(name) +
+                      ",\"cat\":\"xv\",\"ph\":\"X\",\"ts\":" +
+                      timestamp(start) + ",\"dur\":" + duration + "," + ids();
+  if (!args.empty()) event += ",\"args\":{" + args + "}";
+  event += "}";
+
+  trace.events.push_back(event);
+  if (trace.events.size() >= kFlushEvents) flush_events(&trace);
+}
+
+// -- TraceBatches
+TraceBatches::TraceBatches(const char *name, size_t batch)
+    : name_(name),
+      active_(trace_active()),
+      batch_(batch),
+      state_(-1),
+      transitions_(0),
+      start_position_(0),
+      position_(0),
+      start_(active_ ? monotonic_ns() : 0)
+{
+}
+
+void TraceBatches::flush()
+{
+  if (!active_ || (transitions_ == 0)) return;
+
+  uint64_t now = monotonic_ns();
+  char args[96];
+  snprintf(args, sizeof(args), "\"transitions\":%lu,\"bytes\":%lu",
+           static_cast<unsigned long>(transitions_),
+           static_cast<unsigned long>(position_ - start_position_));
+  trace_span(name_, start_, now, args);
+
+  transitions_ = 0;
+  start_position_ = position_;
+  start_ = now;
+}
@@ -0,0 +1,92 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#include "include/validator.h"
+
+#include <string>
+
+Validator::Validator(std::shared_ptr<const Schema> schema,
+                     std::shared_ptr<const RuleSet> rules)
+    : schema_(schema),
+      rules_(rules),
+      generated_(NULL)
+{
+  if (schema_) generated_ = find_generated_validator(schema_->fingerprint());
+}
+
+uint64_t Validator::fingerprint() const
+{
+  uint64_t schema = schema_ ? schema_->fingerprint() : 0;
+  uint64_t rules = rules_ ? rules_->fingerprint() : 0;
+  return schema ^ (rules * 1099511628211ULL);
+}
+
+ValidationResult Validator::validate(StringView data,
+                                     const ParseEventsList &handlers) const
+{
+  ParseEventsList extra(handlers);
+  std::unique_ptr<RuleChecker> rules;
+
+  if (rules_) {
+    rules.reset(new RuleChecker(rules_.get()));
+    extra.push_back(rules.get());
+  }
+
+  ValidationResult result;
+  if (generated_ != NULL) {
+    result = generated_(data, extra);
+  } else {
+    SchemaValidator events(schema_.get());
+    result = validate_with(&events, data, extra);
+  }
+
+  // Structural errors come first
+  if (result.valid && rules && !rules->result()) {
+    result.valid = false;
+    result.message = rules->error();
+  }
+
+  return result;
+}
+
+ValidationResult Validator::validate_fragment(const std::string &data,
+                                              const std::string &element) const
+{
+  ParseEventsList extra;
+  std::unique_ptr<RuleChecker> rules;
+
+  if (rules_) {
+    rules.reset(new RuleChecker(rules_.get()));
+    extra.push_back(rules.get());
+  }
+
+  int root = schema_ ? schema_->element_id(element) : -1;
+  if (schema_ && (root < 0)) {
+    ValidationResult result;
+    result.message = "Element '" + element + "' is not declared";
+    return result;
+  }
+
+  SchemaValidator events(schema_.get(), root);
+  ValidationResult result = validate_with(&events, data, extra);
+
+  if (result.valid && rules && !rules->result()) {
+    result.valid = false;
+    result.message = rules->error();
+  }
+
+  return result;
+}
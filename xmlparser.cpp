@@ -15,21 +15,33 @@
  ********************************************************************/
 
 #include "include/xmlparser.h"
+#include "include/trace.h"
 
 #include <list>
+#include <mutex>
 #include <string>
+#include <unordered_set>
 
-Parser::Parser(std::string _data)
+namespace {
+
+// State transitions per span of traced parsing
+const size_t kTraceBatch = 1024;
+
+}  // namespace
+
+Parser::Parser(StringView _data)
 {
   initialize(_data, NULL);
 }
 
-Parser::Parser(std::string _data, IParseEvents *pEventHandler)
+Parser::Parser(StringView _data, IParseEvents *pEventHandler,
+               kParseMode mode)
 {
-  initialize(_data, pEventHandler);
+  initialize(_data, pEventHandler, mode);
 }
 
-void Parser::initialize(std::string _data, IParseEvents *pEventHandler)
+void Parser::initialize(StringView _data, IParseEvents *pEventHandler,
+                        kParseMode mode)
 {
 #ifndef STATIC_STRING_UTIL
   sUtil.reset(new StringUtil());
@@ -48,20 +60,22 @@ void Parser::initialize(std::string _data, IParseEvents *pEventHandler)
   pDocument->set_root(&(*root));
   idxCurrent = 0;
   state = oldState = psConsume;
-  parseMode = pmDOMBuild;
+  parseMode = mode;
   parse_data();
 }
 
 Parser::~Parser()
 {
-    root.~shared_ptr();
-    pDocument.~shared_ptr();
-#ifndef STATIC_STRING_UTIL
-    sUtil.~shared_ptr();
-#endif
+  // Tags left open by a broken document in the streamed mode
+  if (parseMode == pmStream) {
+    while (tagStack.size() > 1) {
+      delete tagStack.top();
+      tagStack.pop();
+    }
+  }
 }
 
-Document *Parser::loadXML(std::string _data, IParseEvents *pEventHandler)
+Document *Parser::loadXML(StringView _data, IParseEvents *pEventHandler)
 {
   Parser p(_data, pEventHandler);
 
@@ -75,16 +89,16 @@ void Parser::rewind()
 
 int Parser::next_char()
 {
-  if (idxCurrent >= data.length()) return EOF;
+  if (static_cast<size_t>(idxCurrent) >= data.size()) return EOF;
 
-  return data.at(idxCurrent++);
+  return data[idxCurrent++];
 }
 
 int Parser::peek_next_char()
 {
-  if (idxCurrent >= data.length()) return EOF;
+  if (static_cast<size_t>(idxCurrent) >= data.size()) return EOF;
 
-  return data.at(idxCurrent);
+  return data[idxCurrent];
 }
 
 void Parser::change_state(kParseState newState)
@@ -104,24 +118,17 @@ void Parser::end_tag(std::string tok)
 {
   Tag *popped = NULL;
 
-  if (!SUTIL_INVOKE(equals_ignore_case(tagStack.top()->get_name(), tok))) {
-    Tag *top = tagStack.top();
-    // can be an empty tag, like <br />
-    if (top->has_content() == false) {
-      popped = tagStack.top();
-      tagStack.pop();
-    } else {
+  // The root placeholder is never closed by the document
+  if ((tagStack.size() > 1) && (tagStack.top()->get_name() == tok)) {
+    popped = tagStack.top();
+    tagStack.pop();
+  } else {
 #ifdef _DEBUG
-      printf("WARN: Illegal XML, end-tag has no corrsponding start tag!\n");
+    printf("WARN: Illegal XML, end-tag has no corrsponding start tag!\n");
 #endif
-    }
-  } else {
-    if (!tagStack.empty()) {
-      popped = tagStack.top();
-      tagStack.pop();
-    }
   }
 
+  // NULL tells the handler about the mismatched end tag
   if (pEventHandler != NULL) {
     pEventHandler->end_tag(reinterpret_cast<ITag*> (popped));
   }
@@ -132,6 +139,26 @@ void Parser::end_tag(std::string tok)
   }
 }
 
+void Parser::add_content(std::string &tok)
+{
+  SUTIL_INVOKE(trim(tok));
+  if (tok.empty()) return;
+
+  Tag *top = tagStack.top();
+
+  if (parseMode == pmDOMBuild) {
+    if (top->has_content()) {
+      top->get_content() += " " + tok;
+    } else {
+      top->set_content(tok);
+    }
+  }
+
+  if (pEventHandler != NULL) {
+    pEventHandler->content_tag(reinterpret_cast<ITag*> (top), tok);
+  }
+}
+
 void Parser::commit_tag(Tag *pTag)
 {
   if (pEventHandler != NULL) {
@@ -161,11 +188,17 @@ void Parser::parse_data()
 
   tagStack.push(&(*root));
 
+  // Spans of the parsing when the request is traced
+  TraceBatches batches("parse", kTraceBatch);
+
   while ((c = next_char()) != EOF) {
+    batches.step(state, idxCurrent);
+
     switch (state)
     {
       case psConsume: {
         if (c == '<') {
+          add_content(token);
           int next = peek_next_char();
 
            if (next == '/') {  // ? '</' - distinguish between token <  and </
@@ -210,6 +243,7 @@ void Parser::parse_data()
       if ((c == '-') && (peek_next_char() == '>')) {
         if (token == "-") {
           next_char();
+          token = "";  // the '-' of '-->' isn't content
           change_state(psConsume);
         }
       } else if (c == '-') {
@@ -219,8 +253,8 @@ void Parser::parse_data()
     }
     case psTagHeader: {  // <?
       if (isspace(c)) {
-        // drop them
-        tagCurrent = create_tag(SUTIL_INVOKE(trim(token)));
+        // drop them, header tags are kept as '?name'
+        tagCurrent = create_tag("?" + SUTIL_INVOKE(trim(token)));
         token = "";
         change_state(psTagAttributeName);
       } else {
@@ -239,6 +273,7 @@ void Parser::parse_data()
         tagCurrent = create_tag(SUTIL_INVOKE(trim(token)));
         token = "";
         commit_tag(tagCurrent);
+        end_tag(tagCurrent->get_name());
         change_state(psConsume);
       } else if (c == '>') {
         tagCurrent = create_tag(SUTIL_INVOKE(trim(token)));
@@ -285,13 +320,13 @@ void Parser::parse_data()
       } else if ((c == '/') && (peek_next_char() == '>')) {
         next_char();
         commit_tag(tagCurrent);
-        end_tag(SUTIL_INVOKE(trim(token)));
+        end_tag(tagCurrent->get_name());
         token = "";
         change_state(psConsume);
       } else if ((c == '?') && (peek_next_char() == '>')) {
         next_char();
         commit_tag(tagCurrent);
-        end_tag(SUTIL_INVOKE(trim(token)));
+        end_tag(tagCurrent->get_name());
         token = "";
         change_state(psConsume);
       } else {
@@ -303,6 +338,7 @@ void Parser::parse_data()
       if (c == '"') {
         attr_value = token;
         tagCurrent->add_attribute(attr_name, attr_value);
+        token = "";
         change_state(psTagAttributeName);
       } else {
         token +=c;
@@ -312,7 +348,7 @@ void Parser::parse_data()
     case psTagContent: {
       // can't use 'peekNext' since we might have >< which is legal
       if (c == '<') {
-        tagCurrent->set_content(SUTIL_INVOKE(trim(token)));
+        add_content(token);
         token = "";
         change_state(psConsume);
         rewind();  // rewind so we will see tag start next time
@@ -332,12 +368,9 @@ Tag::Tag(std::string _name)
   content.clear();
 }
 
-void Tag::add_attribute(std::string _name, std::string _value)
+void Tag::add_attribute(StringView _name, StringView _value)
 {
-  Attribute *attr = new Attribute();
-  attr->set_name(_name);
-  attr->set_value(_value);
-  attributes.push_back(attr);
+  attributes.add(_name, _value);
 }
 
 void Tag::add_child(Tag *tag)
@@ -356,28 +389,110 @@ std::string Tag::to_string()
   return std::string(name + " ("+content+")");
 }
 
-bool Tag::has_attribute(std::string name)
+bool Tag::has_attribute(StringView name)
 {
-  std::list<IAttribute*>::iterator it = attributes.begin();
+  return attributes.has(name);
+}
 
-  for ( ; it != attributes.end(); ++it) {
-    IAttribute *pAttribute = *it;
-    if (pAttribute->get_name() == name) return true;
+StringView Tag::get_attribute_value(StringView name, StringView defValue)
+{
+  return attributes.get(name, defValue);
+}
+
+// -- Attributes
+const std::string *NameTable::intern(StringView name)
+{
+  static std::mutex lock;
+  static std::unordered_set<std::string> names;
+
+  std::lock_guard<std::mutex> guard(lock);
+  return &(*names.insert(name.str()).first);
+}
+
+void AttributeSet::add(StringView name, StringView value)
+{
+  Entry entry;
+  entry.name_offset = static_cast<uint32_t>(names_.size());
+  entry.name_length = static_cast<uint32_t>(name.size());
+  entry.name_hash = name.hash();
+  entry.value_offset = static_cast<uint32_t>(values_.size());
+  entry.value_length = static_cast<uint32_t>(value.size());
+
+  names_.append(name.data(), name.size());
+  names_ += '\0';
+  values_.append(value.data(), value.size());
+  entries_.push_back(entry);
+
+  if (entries_.size() == kIndexThreshold + 1) {
+    rebuild_index(4 * kIndexThreshold);
+  } else if (!index_.empty()) {
+    if (2 * entries_.size() > index_.size()) {
+      rebuild_index(2 * index_.size());
+    } else {
+      index_entry(entries_.size() - 1);
+    }
   }
+}
 
-  return false;
+StringView AttributeSet::get(StringView name, StringView defValue) const
+{
+  int idx = find(name);
+  return (idx < 0) ? defValue : value_at(idx);
 }
 
-std::string Tag::get_attribute_value(std::string name, std::string defValue)
+void AttributeSet::clear()
 {
-  std::list<IAttribute*>::iterator it = attributes.begin();
+  entries_.clear();
+  names_.clear();
+  values_.clear();
+  index_.clear();
+}
+
+int AttributeSet::find(StringView name) const
+{
+  uint32_t h = name.hash();
 
-  for ( ; it != attributes.end(); ++it) {
-    IAttribute *pAttribute = *it;
-    if (pAttribute->get_name() == name) return pAttribute->get_value();
+  if (index_.empty()) {
+    for (size_t i = 0; i < entries_.size(); ++i) {
+      if ((entries_[i].name_hash == h) && (name_at(i) == name)) {
+        return static_cast<int>(i);
+      }
+    }
+    return -1;
   }
 
-  return defValue;
+  size_t mask = index_.size() - 1;
+  for (size_t slot = h & mask; index_[slot] != 0; slot = (slot + 1) & mask) {
+    const Entry &entry = entries_[index_[slot] - 1];
+    if ((entry.name_hash == h) && (name_at(index_[slot] - 1) == name)) {
+      return index_[slot] - 1;
+    }
+  }
+
+  return -1;
+}
+
+void AttributeSet::index_entry(size_t idx)
+{
+  const Entry &entry = entries_[idx];
+  size_t mask = index_.size() - 1;
+  size_t slot = entry.name_hash & mask;
+
+  for ( ; index_[slot] != 0; slot = (slot + 1) & mask) {
+    // Keep the first of duplicated names
+    if (name_at(index_[slot] - 1) == name_at(idx)) return;
+  }
+
+  index_[slot] = static_cast<uint32_t>(idx + 1);
+}
+
+void AttributeSet::rebuild_index(size_t slots)
+{
+  index_.assign(slots, 0);
+
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    index_entry(i);
+  }
 }
 
 std::string Document::indent_string(int depth)
@@ -446,7 +561,7 @@ bool StringUtil::equals_ignore_case(std::string a, std::string b)
 
 std::string StringUtilStatic::white_spaces_(" \f\n\r\t\v");
 
-ParseStateFunc::ParseStateFunc(std::string _data, IParseEvents *pEventHandler)
+ParseStateFunc::ParseStateFunc(StringView _data, IParseEvents *pEventHandler)
 {
   initialize(_data, pEventHandler);
 }
@@ -454,6 +569,7 @@ ParseStateFunc::ParseStateFunc(std::string _data, IParseEvents *pEventHandler)
 void ParseStateFunc::state_consume(char c)
 {
   if (c == '<') {
+    add_content(token);
     int next = peek_next_char();
     if (next == '/') {  // ? '</' - distinguish between token <  and </
       next_char();  // consume '/'
@@ -506,6 +622,7 @@ void ParseStateFunc::state_tag_start(char c)
     tagCurrent = create_tag(SUTIL_INVOKE(trim(token)));
     token = "";
     commit_tag(tagCurrent);
+    end_tag(tagCurrent->get_name());
     change_state(psConsume);
   } else if (c == '>') {
     tagCurrent = create_tag(SUTIL_INVOKE(trim(token)));
@@ -533,8 +650,8 @@ void ParseStateFunc::state_end_tag_start(char c)
 void ParseStateFunc::state_tag_header(char c)
 {
   if (isspace(c)) {
-    // drop them
-    tagCurrent = create_tag(SUTIL_INVOKE(trim(token)));
+    // drop them, header tags are kept as '?name'
+    tagCurrent = create_tag("?" + SUTIL_INVOKE(trim(token)));
     token = "";
     change_state(psTagAttributeName);
   } else {
@@ -547,6 +664,7 @@ void ParseStateFunc::state_comment_consume(char c)
   if ((c == '-') && (peek_next_char() == '>')) {
     if (token == "-") {
       next_char();
+      token = "";  // the '-' of '-->' isn't content
       change_state(psConsume);
     }
   } else if (c == '-') {
@@ -576,13 +694,13 @@ void ParseStateFunc::state_attribute_name(char c)
   } else if ((c == '/') && (peek_next_char() == '>')) {
     next_char();
     commit_tag(tagCurrent);
-    end_tag(SUTIL_INVOKE(trim(token)));
+    end_tag(tagCurrent->get_name());
     token = "";
     change_state(psConsume);
   } else if ((c == '?') && (peek_next_char() == '>')) {
     next_char();
     commit_tag(tagCurrent);
-    end_tag(SUTIL_INVOKE(trim(token)));
+    end_tag(tagCurrent->get_name());
     token = "";
     change_state(psConsume);
   } else {
@@ -595,6 +713,7 @@ void ParseStateFunc::state_attribute_value(char c)
   if (c == '"') {
     attr_value = token;
     tagCurrent->add_attribute(attr_name, attr_value);
+    token = "";
     change_state(psTagAttributeName);
   } else {
     token += c;
@@ -605,7 +724,7 @@ void ParseStateFunc::state_tag_content(char c)
 {
   // can't use 'peekNext' since we might have >< which is legal
   if (c == '<') {
-    tagCurrent->set_content(SUTIL_INVOKE(trim(token)));
+    add_content(token);
     token = "";
     change_state(psConsume);
     rewind();  // rewind so we will see tag start next time
@@ -669,6 +788,11 @@ void ParseStateImpl::commit_tag(Tag *pTag)
   pContext->commit_tag(pTag);
 }
 
+void ParseStateImpl::add_content(std::string &tok)
+{
+  pContext->add_content(tok);
+}
+
 void ParseStateImpl::rewind()
 {
   pContext->rewind();
@@ -697,6 +821,7 @@ void StateConsume::enter()
 void StateConsume::consume(char c)
 {
   if (c == '<') {
+    add_content(token);
     int next = peek_next_char();
 
     if (next == '/') {  // ? '</' - distinguish between token <  and </
@@ -759,6 +884,7 @@ void StateTagStart::consume(char c) {
     pContext->tagCurrent = create_tag(SUTIL_INVOKE(trim(token)));
     token = "";
     commit_tag(pContext->tagCurrent);
+    end_tag(pContext->tagCurrent->get_name());
     change_state(psConsume);
   } else if (c == '>') {
     pContext->tagCurrent = create_tag(SUTIL_INVOKE(trim(token)));
@@ -796,8 +922,8 @@ void StateTagHeader::enter()
 void StateTagHeader::consume(char c)
 {
   if (isspace(c)) {
-    // drop them
-    pContext->tagCurrent = create_tag(SUTIL_INVOKE(trim(token)));
+    // drop them, header tags are kept as '?name'
+    pContext->tagCurrent = create_tag("?" + SUTIL_INVOKE(trim(token)));
     token = "";
     change_state(psTagAttributeName);
   } else {
@@ -848,13 +974,13 @@ void StateAttributeName::consume(char c)
   } else if ((c == '/') && (peek_next_char() == '>')) {
     next_char();
     commit_tag(pContext->tagCurrent);
-    end_tag(SUTIL_INVOKE(trim(token)));
+    end_tag(pContext->tagCurrent->get_name());
     token = "";
     change_state(psConsume);
   } else if ((c == '?') && (peek_next_char() == '>')) {
     next_char();
     commit_tag(pContext->tagCurrent);
-    end_tag(SUTIL_INVOKE(trim(token)));
+    end_tag(pContext->tagCurrent->get_name());
     token = "";
     change_state(psConsume);
   } else {
@@ -888,7 +1014,7 @@ void StateTagContent::consume(char c)
 {
   // can't use 'peekNext' since we might have >< which is legal
   if (c == '<') {
-    pContext->tagCurrent->set_content(SUTIL_INVOKE(trim(token)));
+    add_content(token);
     token = "";
     change_state(psConsume);
     rewind();  // rewind so we will see tag start next time
@@ -897,7 +1023,7 @@ void StateTagContent::consume(char c)
   }
 }
 
-ParseStateClasses::ParseStateClasses(std::string _data,
+ParseStateClasses::ParseStateClasses(StringView _data,
                                      IParseEvents *pEventHandler)
 {
   state_consume.pContext = this;
@@ -945,10 +1071,11 @@ void ParseStateClasses::change_state(kParseState newState) {
   if (pState != NULL) pState->enter();
 }
 
-void ParseStateClasses::initialize(std::string _data,
-                                   IParseEvents *pEventHandler)
+void ParseStateClasses::initialize(StringView _data,
+                                   IParseEvents *pEventHandler,
+                                   kParseMode mode)
 {
-  Parser::initialize(_data, pEventHandler);
+  Parser::initialize(_data, pEventHandler, mode);
 }
 
 void ParseStateClasses::parse_data()
@@ -0,0 +1,246 @@
+/********************************************************************
+ * Copyright 2014 Sasha Halchin.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ ********************************************************************/
+
+#include "include/xmlvalidator.h"
+
+#include <string.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "include/rules.h"
+#include "include/schema.h"
+#include "include/validator.h"
+
+struct xv_validator {
+  Validator validator;
+
+  explicit xv_validator(std::shared_ptr<const Schema> schema,
+                        std::shared_ptr<const RuleSet> rules)
+      : validator(schema, rules) {}
+};
+
+struct xv_context {
+  const Validator *validator;
+  std::string document;   // fed chunks, reused between documents
+  std::string error;
+};
+
+namespace {
+
+//
+// Class for passing the parse events to the C callbacks
+//
+class CallbackEvents : public IParseEvents {
+ public:
+  CallbackEvents(const xv_callbacks *callbacks, void *user)
+      : callbacks_(callbacks), user_(user) {}
+
+  virtual void start_tag(ITag *pTag)
+  {
+    if (callbacks_->start_tag == NULL) return;
+
+    const AttributeSet &set = pTag->get_attributes();
+    attributes_.resize(set.size());
+    for (size_t i = 0; i < set.size(); ++i) {
+      StringView value = set.value_at(i);
+      attributes_[i].name = set.name_at(i).data();
+      attributes_[i].value = value.data();
+      attributes_[i].value_size = value.size();
+    }
+
+    callbacks_->start_tag(user_, pTag->get_name().c_str(),
+                          attributes_.empty() ? NULL : &attributes_[0],
+                          attributes_.size());
+  }
+
+  virtual void end_tag(ITag *pTag)
+  {
+    if (callbacks_->end_tag == NULL) return;
+    callbacks_->end_tag(user_, pTag->get_name().c_str());
+  }
+
+  virtual void content_tag(ITag *pTag, const std::string &content)
+  {
+    if (callbacks_->content == NULL) return;
+    callbacks_->content(user_, pTag->get_name().c_str(), content.data(),
+                        content.size());
+  }
+
+ private:
+  const xv_callbacks         *callbacks_;
+  void                       *user_;
+  std::vector<xv_attribute>  attributes_;
+};
+
+void copy_error(const std::string &message, char *error, size_t error_size)
+{
+  if ((error == NULL) || (error_size == 0)) return;
+
+  size_t size = (message.size() < error_size) ? message.size()
+                                              : error_size - 1;
+  memcpy(error, message.data(), size);
+  error[size] = '\0';
+}
+
+// Validate document with extra handlers (the error goes to context)
+int validate_document(xv_context *context, StringView document,
+                      const ParseEventsList &extra)
+{
+  ValidationResult result = context->validator->validate(document, extra);
+  context->error = result.message;
+  return result.valid ? XV_VALID : XV_INVALID;
+}
+
+// Validator of compiled schema and rules (either may be NULL)
+xv_validator *make_validator(Schema *schema, RuleSet *rules)
+{
+  return new xv_validator(std::shared_ptr<const Schema>(schema),
+                          std::shared_ptr<const RuleSet>(rules));
+}
+
+}  // namespace
+
+int xv_api_version(void)
+{
+  return XV_API_VERSION;
+}
+
+xv_validator *xv_validator_new(const char *schema_file, const char *rules_file,
+                               char *error, size_t error_size)
+{
+  std::string message;
+  std::unique_ptr<Schema> schema;
+  std::unique_ptr<RuleSet> rules;
+
+  if (schema_file != NULL) {
+    schema.reset(new Schema());
+    if (!schema->load(schema_file, &message)) {
+      copy_error(message, error, error_size);
+      return NULL;
+    }
+  }
+
+  if (rules_file != NULL) {
+    rules.reset(new RuleSet());
+    if (!rules->load(rules_file, &message)) {
+      copy_error(message, error, error_size);
+      return NULL;
+    }
+  }
+
+  return make_validator(schema.release(), rules.release());
+}
+
+xv_validator *xv_validator_compile(const char *schema_text,
+                                   const char *rules_text,
+                                   char *error, size_t error_size)
+{
+  std::string message;
+  std::unique_ptr<Schema> schema;
+  std::unique_ptr<RuleSet> rules;
+
+  if (schema_text != NULL) {
+    schema.reset(new Schema());
+    if (!schema->compile(schema_text, &message)) {
+      copy_error(message, error, error_size);
+      return NULL;
+    }
+  }
+
+  if (rules_text != NULL) {
+    rules.reset(new RuleSet());
+    if (!rules->compile(rules_text, &message)) {
+      copy_error(message, error, error_size);
+      return NULL;
+    }
+  }
+
+  return make_validator(schema.release(), rules.release());
+}
+
+void xv_validator_free(xv_validator *validator)
+{
+  delete validator;
+}
+
+xv_context *xv_context_new(const xv_validator *validator)
+{
+  if (validator == NULL) return NULL;
+
+  xv_context *context = new xv_context();
+  context->validator = &validator->validator;
+  return context;
+}
+
+void xv_context_free(xv_context *context)
+{
+  delete context;
+}
+
+int xv_validate_buffer(xv_context *context, const char *data, size_t size)
+{
+  if ((context == NULL) || ((data == NULL) && (size > 0))) return XV_ERROR;
+
+  // Parsed in place, the buffer is not copied
+  return validate_document(context, StringView(data, size),
+                           ParseEventsList());
+}
+
+int xv_parse(xv_context *context, const char *data, size_t size,
+             const xv_callbacks *callbacks, void *user)
+{
+  if ((context == NULL) || ((data == NULL) && (size > 0))) return XV_ERROR;
+  if (callbacks == NULL) return xv_validate_buffer(context, data, size);
+
+  CallbackEvents events(callbacks, user);
+  ParseEventsList extra(1, &events);
+
+  return validate_document(context, StringView(data, size), extra);
+}
+
+int xv_feed(xv_context *context, const char *data, size_t size)
+{
+  if ((context == NULL) || ((data == NULL) && (size > 0))) return XV_ERROR;
+
+  // The parser takes whole documents, chunks are collected until xv_finish
+  context->document.append(data, size);
+  return XV_VALID;
+}
+
+int xv_finish(xv_context *context)
+{
+  if (context == NULL) return XV_ERROR;
+
+  int status = validate_document(context, context->document,
+                                 ParseEventsList());
+  context->document.clear();
+  return status;
+}
+
+void xv_reset(xv_context *context)
+{
+  if (context == NULL) return;
+
+  context->document.clear();
+  context->error.clear();
+}
+
+const char *xv_error(const xv_context *context)
+{
+  return (context == NULL) ? "" : context->error.c_str();
+}